@@ -0,0 +1,88 @@
+#include "histogram.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace bench {
+
+Histogram::Histogram(int64_t highest) : highest(highest), counts(index_of(highest) + 1) {}
+
+std::size_t Histogram::index_of(int64_t value) {
+  // Bucket b holds [2^(b+10), 2^(b+11)) in steps of 2^b; bucket 0 also
+  // covers everything below 2048 exactly.
+  const auto v = static_cast<uint64_t>(value);
+  const int bucket = 63 - __builtin_clzll(v | static_cast<uint64_t>(kSubBucketCount - 1)) - kSubBucketHalfMagnitude;
+  const auto sub = static_cast<int64_t>(v >> bucket);
+  return static_cast<std::size_t>((int64_t{bucket} << kSubBucketHalfMagnitude) + sub);
+}
+
+int64_t Histogram::highest_equivalent(std::size_t index) {
+  auto i = static_cast<int64_t>(index);
+  int bucket = static_cast<int>(i >> kSubBucketHalfMagnitude) - 1;
+  int64_t sub = (i & (kSubBucketHalf - 1)) + kSubBucketHalf;
+  if (bucket < 0) {
+    bucket = 0;
+    sub -= kSubBucketHalf;
+  }
+  return ((sub + 1) << bucket) - 1;
+}
+
+void Histogram::record(int64_t value) {
+  value = std::clamp<int64_t>(value, 0, highest);
+  ++counts[index_of(value)];
+  ++total;
+  min_ = std::min(min_, value);
+  max_ = std::max(max_, value);
+  sum += static_cast<double>(value);
+}
+
+void Histogram::merge(const Histogram& other) {
+  const std::size_t n = std::min(counts.size(), other.counts.size());
+  for (std::size_t i = 0; i < n; ++i) {
+    counts[i] += other.counts[i];
+  }
+  total += other.total;
+  min_ = std::min(min_, other.min_);
+  max_ = std::max(max_, other.max_);
+  sum += other.sum;
+}
+
+int64_t Histogram::percentile(double p) const {
+  if (total == 0) {
+    return 0;
+  }
+  const auto target = std::max<int64_t>(1, static_cast<int64_t>(std::ceil(p / 100.0 * static_cast<double>(total))));
+  int64_t seen = 0;
+  for (std::size_t i = 0; i < counts.size(); ++i) {
+    seen += counts[i];
+    if (seen >= target) {
+      return std::min(highest_equivalent(i), max_);
+    }
+  }
+  return max_;
+}
+
+void Histogram::write_percentiles(std::FILE* out, double scale) const {
+  std::fprintf(out, "%12s %14s %10s %14s\n\n", "Value", "Percentile", "TotalCount", "1/(1-Percentile)");
+  int64_t seen = 0;
+  for (std::size_t i = 0; i < counts.size(); ++i) {
+    if (counts[i] == 0) {
+      continue;
+    }
+    seen += counts[i];
+    const double fraction = static_cast<double>(seen) / static_cast<double>(total);
+    const double value = static_cast<double>(std::min(highest_equivalent(i), max_)) / scale;
+    if (seen == total) {
+      std::fprintf(out, "%12.3f %14.12f %10lld\n", value, fraction, static_cast<long long>(seen));
+    } else {
+      std::fprintf(out, "%12.3f %14.12f %10lld %14.2f\n", value, fraction, static_cast<long long>(seen),
+                   1.0 / (1.0 - fraction));
+    }
+  }
+  std::fprintf(out, "#[Mean    = %12.3f, Max            = %12.3f]\n", mean() / scale,
+               static_cast<double>(max_) / scale);
+  std::fprintf(out, "#[Total count    = %12lld, Buckets        = %12zu]\n", static_cast<long long>(total),
+               counts.size() / static_cast<std::size_t>(kSubBucketHalf));
+}
+
+}  // namespace bench
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+namespace bench {
+
+// HdrHistogram style latency histogram: 2048 linear sub-buckets per power of
+// two, so every recorded value keeps 3 significant digits, in fixed memory
+// and O(1) per record.
+class Histogram {
+ public:
+  // Values above highest are clamped to it.
+  explicit Histogram(int64_t highest = 60'000'000'000);
+
+  void record(int64_t value);
+  void merge(const Histogram& other);
+
+  // Smallest recorded-equivalent value at or above p percent of samples.
+  int64_t percentile(double p) const;
+  int64_t min() const { return total == 0 ? 0 : min_; }
+  int64_t max() const { return max_; }
+  int64_t count() const { return total; }
+  double mean() const { return total == 0 ? 0 : sum / static_cast<double>(total); }
+
+  // Percentile distribution in the .hgrm text format, values divided by scale.
+  void write_percentiles(std::FILE* out, double scale) const;
+
+ private:
+  static constexpr int kSubBucketHalfMagnitude = 10;
+  static constexpr int64_t kSubBucketHalf = int64_t{1} << kSubBucketHalfMagnitude;
+  static constexpr int64_t kSubBucketCount = kSubBucketHalf * 2;
+
+  static std::size_t index_of(int64_t value);
+  // Largest value that lands in the same bucket as counts[index].
+  static int64_t highest_equivalent(std::size_t index);
+
+  int64_t highest;
+  std::vector<int64_t> counts;
+  int64_t total{0};
+  int64_t min_{INT64_MAX};
+  int64_t max_{0};
+  double sum{0};
+};
+
+}  // namespace bench
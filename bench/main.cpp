@@ -0,0 +1,127 @@
+#include <barrier>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "histogram.hpp"
+#include "options.hpp"
+#include "worker.hpp"
+#include "workload.hpp"
+
+namespace {
+struct Summary {
+  uint64_t completed{0};
+  uint64_t errors{0};
+  uint64_t disconnects{0};
+  double elapsed_s{0};
+};
+
+// "set:40,get:40" for humans, "\"set\":40,\"get\":40" for json.
+std::string mix_string(const bench::Options& opts, bool json) {
+  std::string out;
+  for (std::size_t i = 0; i < bench::kCommandCount; ++i) {
+    if (opts.mix[i] == 0) {
+      continue;
+    }
+    if (!out.empty()) {
+      out.push_back(',');
+    }
+    if (json) {
+      out.push_back('"');
+    }
+    out += bench::command_name(static_cast<bench::Command>(i));
+    out += json ? "\":" : ":";
+    out += std::to_string(opts.mix[i]);
+  }
+  return out;
+}
+
+void print_human(const bench::Options& opts, const Summary& s, const bench::Histogram& h) {
+  auto us = [](int64_t ns) { return static_cast<double>(ns) / 1e3; };
+  std::printf("kvbench %s:%u threads=%u connections=%u pipeline=%u keyspace=%llu dist=%s value=%uB mix=%s\n",
+              opts.host.c_str(), opts.port, opts.threads, opts.connections, opts.pipeline,
+              static_cast<unsigned long long>(opts.keyspace), opts.dist == bench::KeyDist::Zipf ? "zipf" : "uniform",
+              opts.value_size, mix_string(opts, false).c_str());
+  std::printf("completed %llu requests in %.3f s: %.1f ops/s, %llu errors, %llu disconnects\n",
+              static_cast<unsigned long long>(s.completed), s.elapsed_s,
+              static_cast<double>(s.completed) / s.elapsed_s, static_cast<unsigned long long>(s.errors),
+              static_cast<unsigned long long>(s.disconnects));
+  std::printf("latency us: min %.1f  p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f  mean %.1f\n", us(h.min()),
+              us(h.percentile(50)), us(h.percentile(90)), us(h.percentile(99)), us(h.percentile(99.9)),
+              us(h.max()), h.mean() / 1e3);
+}
+
+void print_json(const bench::Options& opts, const Summary& s, const bench::Histogram& h) {
+  auto us = [](int64_t ns) { return static_cast<double>(ns) / 1e3; };
+  std::printf("{\"host\":\"%s\",\"port\":%u,\"threads\":%u,\"connections\":%u,\"pipeline\":%u,"
+              "\"keyspace\":%llu,\"dist\":\"%s\",\"zipf_theta\":%g,\"value_size\":%u,\"mix\":{%s},"
+              "\"completed\":%llu,\"errors\":%llu,\"disconnects\":%llu,\"elapsed_s\":%.6f,\"ops_per_sec\":%.1f,"
+              "\"latency_us\":{\"min\":%.3f,\"p50\":%.3f,\"p90\":%.3f,\"p99\":%.3f,\"p99_9\":%.3f,\"max\":%.3f,"
+              "\"mean\":%.3f}}\n",
+              opts.host.c_str(), opts.port, opts.threads, opts.connections, opts.pipeline,
+              static_cast<unsigned long long>(opts.keyspace), opts.dist == bench::KeyDist::Zipf ? "zipf" : "uniform",
+              opts.zipf_theta, opts.value_size, mix_string(opts, true).c_str(),
+              static_cast<unsigned long long>(s.completed), static_cast<unsigned long long>(s.errors),
+              static_cast<unsigned long long>(s.disconnects), s.elapsed_s,
+              static_cast<double>(s.completed) / s.elapsed_s, us(h.min()), us(h.percentile(50)),
+              us(h.percentile(90)), us(h.percentile(99)), us(h.percentile(99.9)), us(h.max()), h.mean() / 1e3);
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  const bench::Options opts = bench::parse_args(argc, argv);
+
+  std::unique_ptr<bench::Zipf> zipf;
+  if (opts.dist == bench::KeyDist::Zipf) {
+    zipf = std::make_unique<bench::Zipf>(opts.keyspace, opts.zipf_theta);
+  }
+
+  // Workers connect first; the clock starts once every connection is up.
+  std::barrier<> start(static_cast<std::ptrdiff_t>(opts.threads) + 1);
+  std::vector<bench::WorkerResult> results(opts.threads);
+  std::vector<std::thread> threads;
+  for (unsigned i = 0; i < opts.threads; ++i) {
+    const unsigned conns = opts.connections / opts.threads + (i < opts.connections % opts.threads ? 1 : 0);
+    const uint64_t quota = opts.requests / opts.threads + (i < opts.requests % opts.threads ? 1 : 0);
+    threads.emplace_back(bench::run_worker, std::cref(opts), zipf.get(), i, conns, quota, std::ref(start),
+                         std::ref(results[i]));
+  }
+  start.arrive_and_wait();
+  const auto t0 = std::chrono::steady_clock::now();
+  for (auto& t : threads) {
+    t.join();
+  }
+  const auto t1 = std::chrono::steady_clock::now();
+
+  Summary summary;
+  summary.elapsed_s = std::chrono::duration<double>(t1 - t0).count();
+  bench::Histogram latency;
+  for (const auto& r : results) {
+    latency.merge(r.latency);
+    summary.completed += r.completed;
+    summary.errors += r.errors;
+    summary.disconnects += r.disconnects;
+  }
+
+  if (opts.json) {
+    print_json(opts, summary, latency);
+  } else {
+    print_human(opts, summary, latency);
+  }
+
+  if (!opts.hist_path.empty()) {
+    std::FILE* f = std::fopen(opts.hist_path.c_str(), "w");
+    if (f == nullptr) {
+      std::perror(opts.hist_path.c_str());
+      return 1;
+    }
+    latency.write_percentiles(f, 1e3);  // microseconds
+    std::fclose(f);
+  }
+
+  // Lost connections make the numbers incomparable; fail the run.
+  return summary.disconnects == 0 ? 0 : 1;
+}
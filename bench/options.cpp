@@ -0,0 +1,158 @@
+#include "options.hpp"
+
+#include <charconv>
+#include <cstdio>
+#include <cstdlib>
+#include <string_view>
+
+namespace bench {
+
+namespace {
+[[noreturn]] void usage(const char* prog) {
+  std::fprintf(stderr,
+               "usage: %s [--host H] [--port N] [--threads N] [--connections N] [--pipeline N]\n"
+               "          [--requests N | --duration SECONDS] [--keyspace N] [--dist uniform|zipf]\n"
+               "          [--zipf-theta F] [--value-size N] [--mix set=40,get=40,del=10,exists=5,ping=5]\n"
+               "          [--seed N] [--json] [--hist PATH]\n"
+               "  --host H          server address (default 127.0.0.1)\n"
+               "  --port N          server port (default 9000)\n"
+               "  --threads N       client threads (default 1)\n"
+               "  --connections N   connections across all threads (default 50)\n"
+               "  --pipeline N      requests in flight per connection (default 16)\n"
+               "  --requests N      total requests to complete (default 1000000)\n"
+               "  --duration S      run for S seconds instead of a request count\n"
+               "  --keyspace N      distinct keys, named key:0 .. key:N-1 (default 1000)\n"
+               "  --dist D          key popularity, uniform (default) or zipf\n"
+               "  --zipf-theta F    zipf skew in (0, 1) (default 0.99)\n"
+               "  --value-size N    SET value bytes (default 16)\n"
+               "  --mix SPEC        command weights (default set=40,get=40,del=10,exists=5,ping=5)\n"
+               "  --seed N          random seed (default 42)\n"
+               "  --json            print one JSON object for regression tracking\n"
+               "  --hist PATH       write the latency percentile distribution (HdrHistogram .hgrm)\n",
+               prog);
+  std::exit(EXIT_FAILURE);
+}
+
+template <typename T>
+T parse_number(const char* prog, std::string_view s) {
+  T value{};
+  auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), value);
+  if (ec != std::errc() || ptr != s.data() + s.size()) {
+    usage(prog);
+  }
+  return value;
+}
+
+// "set=40,get=60": listed commands get their weight, the rest 0.
+std::array<unsigned, kCommandCount> parse_mix(const char* prog, std::string_view spec) {
+  std::array<unsigned, kCommandCount> mix{};
+  unsigned total = 0;
+  while (!spec.empty()) {
+    std::size_t comma = spec.find(',');
+    std::string_view item = spec.substr(0, comma);
+    spec = comma == std::string_view::npos ? std::string_view() : spec.substr(comma + 1);
+
+    std::size_t eq = item.find('=');
+    if (eq == std::string_view::npos) {
+      usage(prog);
+    }
+    std::string_view name = item.substr(0, eq);
+    std::size_t cmd = 0;
+    while (cmd < kCommandCount && name != command_name(static_cast<Command>(cmd))) {
+      ++cmd;
+    }
+    if (cmd == kCommandCount) {
+      usage(prog);
+    }
+    mix[cmd] = parse_number<unsigned>(prog, item.substr(eq + 1));
+    total += mix[cmd];
+  }
+  if (total == 0) {
+    usage(prog);
+  }
+  return mix;
+}
+}  // namespace
+
+const char* command_name(Command cmd) {
+  switch (cmd) {
+    case Command::Set:
+      return "set";
+    case Command::Get:
+      return "get";
+    case Command::Del:
+      return "del";
+    case Command::Exists:
+      return "exists";
+    case Command::Ping:
+      return "ping";
+  }
+  return "?";
+}
+
+Options parse_args(int argc, char** argv) {
+  Options opts;
+  const char* prog = argc > 0 ? argv[0] : "kvbench";
+
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    auto next = [&]() -> std::string_view {
+      if (i + 1 >= argc) {
+        usage(prog);
+      }
+      return argv[++i];
+    };
+
+    if (arg == "--host") {
+      opts.host = std::string(next());
+    } else if (arg == "--port") {
+      opts.port = parse_number<uint16_t>(prog, next());
+    } else if (arg == "--threads") {
+      opts.threads = parse_number<unsigned>(prog, next());
+    } else if (arg == "--connections") {
+      opts.connections = parse_number<unsigned>(prog, next());
+    } else if (arg == "--pipeline") {
+      opts.pipeline = parse_number<unsigned>(prog, next());
+    } else if (arg == "--requests") {
+      opts.requests = parse_number<uint64_t>(prog, next());
+    } else if (arg == "--duration") {
+      opts.duration_s = parse_number<double>(prog, next());
+    } else if (arg == "--keyspace") {
+      opts.keyspace = parse_number<uint64_t>(prog, next());
+    } else if (arg == "--dist") {
+      std::string_view dist = next();
+      if (dist == "uniform") {
+        opts.dist = KeyDist::Uniform;
+      } else if (dist == "zipf") {
+        opts.dist = KeyDist::Zipf;
+      } else {
+        usage(prog);
+      }
+    } else if (arg == "--zipf-theta") {
+      opts.zipf_theta = parse_number<double>(prog, next());
+      if (!(opts.zipf_theta > 0 && opts.zipf_theta < 1)) {
+        usage(prog);
+      }
+    } else if (arg == "--value-size") {
+      opts.value_size = parse_number<unsigned>(prog, next());
+    } else if (arg == "--mix") {
+      opts.mix = parse_mix(prog, next());
+    } else if (arg == "--seed") {
+      opts.seed = parse_number<uint64_t>(prog, next());
+    } else if (arg == "--json") {
+      opts.json = true;
+    } else if (arg == "--hist") {
+      opts.hist_path = std::string(next());
+    } else {
+      usage(prog);
+    }
+  }
+
+  if (opts.threads == 0 || opts.connections < opts.threads || opts.pipeline == 0 || opts.keyspace == 0 ||
+      opts.duration_s < 0) {
+    usage(prog);
+  }
+  return opts;
+}
+
+}  // namespace bench
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+namespace bench {
+
+// Commands the load generator can send; the mix gives each a weight.
+enum class Command { Set, Get, Del, Exists, Ping };
+inline constexpr std::size_t kCommandCount = 5;
+const char* command_name(Command cmd);
+
+enum class KeyDist { Uniform, Zipf };
+
+struct Options {
+  std::string host{"127.0.0.1"};
+  uint16_t port{9000};
+  // Client threads, each driving its share of the connections.
+  unsigned threads{1};
+  unsigned connections{50};
+  // Requests kept in flight per connection.
+  unsigned pipeline{16};
+  // Total requests, unless duration_s is set, which runs for that long.
+  uint64_t requests{1000000};
+  double duration_s{0};
+
+  uint64_t keyspace{1000};
+  KeyDist dist{KeyDist::Uniform};
+  double zipf_theta{0.99};
+  unsigned value_size{16};
+  // Weights indexed by Command.
+  std::array<unsigned, kCommandCount> mix{40, 40, 10, 5, 5};
+  uint64_t seed{42};
+
+  // One JSON object on stdout instead of the human readable summary.
+  bool json{false};
+  // HdrHistogram style percentile distribution of latencies (.hgrm).
+  std::string hist_path;
+};
+
+// Parses command line flags, dies with a usage message on bad input.
+Options parse_args(int argc, char** argv);
+
+}  // namespace bench
@@ -0,0 +1,261 @@
+#include "worker.hpp"
+
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <charconv>
+#include <chrono>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../src/net/buffer.hpp"
+#include "../src/net/epoll.hpp"
+#include "../src/net/socket.hpp"
+#include "../src/util/error.hpp"
+
+namespace bench {
+
+namespace {
+constexpr std::size_t kReadChunk = 64 * 1024;
+
+int64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+struct Conn {
+  int fd{-1};
+  std::string out;
+  std::size_t out_off{0};
+  bool want_out{false};
+  net::Buffer in;
+  std::deque<int64_t> sent_at;  // send time of each request awaiting a reply
+};
+
+int connect_to(const Options& opts) {
+  addrinfo hints{};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* res = nullptr;
+  const std::string port = std::to_string(opts.port);
+  if (::getaddrinfo(opts.host.c_str(), port.c_str(), &hints, &res) != 0 || res == nullptr) {
+    util::die("cannot resolve " + opts.host);
+  }
+  int fd = ::socket(res->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  util::syscall_or_die(fd, "socket");
+  if (::connect(fd, res->ai_addr, res->ai_addrlen) != 0) {
+    util::die_errno("connect " + opts.host + ":" + port);
+  }
+  ::freeaddrinfo(res);
+  net::set_nonblocking(fd);
+  net::set_tcp_nodelay(fd);
+  return fd;
+}
+
+// Bytes in the complete reply starting at pos, or 0 when more data is
+// needed. Sets bad on a reply this client does not understand.
+std::size_t reply_length(std::string_view buf, std::size_t pos, bool& bad) {
+  const std::size_t eol = buf.find("\r\n", pos);
+  if (eol == std::string_view::npos) {
+    return 0;
+  }
+  const char type = buf[pos];
+  if (type == '+' || type == '-' || type == ':') {
+    return eol + 2 - pos;
+  }
+  if (type != '$' && type != '*') {
+    bad = true;
+    return 0;
+  }
+
+  long long n = 0;
+  auto [ptr, ec] = std::from_chars(buf.data() + pos + 1, buf.data() + eol, n);
+  if (ec != std::errc() || ptr != buf.data() + eol) {
+    bad = true;
+    return 0;
+  }
+  std::size_t next = eol + 2;
+  if (n <= 0) {
+    return next - pos;  // null or empty
+  }
+  if (type == '$') {
+    next += static_cast<std::size_t>(n) + 2;
+    return next <= buf.size() ? next - pos : 0;
+  }
+  for (long long i = 0; i < n; ++i) {
+    if (next >= buf.size()) {
+      return 0;
+    }
+    const std::size_t len = reply_length(buf, next, bad);
+    if (len == 0) {
+      return 0;
+    }
+    next += len;
+  }
+  return next - pos;
+}
+}  // namespace
+
+void run_worker(const Options& opts, const Zipf* zipf, unsigned index, unsigned connections, uint64_t quota,
+                std::barrier<>& start, WorkerResult& result) {
+  Workload workload(opts, zipf, opts.seed + 0x9E3779B97F4A7C15ULL * (index + 1));
+  std::vector<Conn> conns(connections);
+  std::vector<Conn*> by_fd;
+  net::Epoll epoll(static_cast<int>(connections));
+  for (Conn& c : conns) {
+    c.fd = connect_to(opts);
+    if (static_cast<std::size_t>(c.fd) >= by_fd.size()) {
+      by_fd.resize(static_cast<std::size_t>(c.fd) + 1, nullptr);
+    }
+    by_fd[static_cast<std::size_t>(c.fd)] = &c;
+    if (!epoll.add(c.fd, EPOLLIN)) {
+      util::die_errno("epoll add");
+    }
+  }
+
+  start.arrive_and_wait();
+
+  const int64_t deadline = opts.duration_s > 0 ? now_ns() + static_cast<int64_t>(opts.duration_s * 1e9) : INT64_MAX;
+  uint64_t issued = 0;
+  uint64_t inflight = 0;
+  auto can_issue = [&](int64_t t) { return opts.duration_s > 0 ? t < deadline : issued < quota; };
+  auto issue = [&](Conn& c, int64_t t) {
+    workload.next_command(c.out);
+    c.sent_at.push_back(t);
+    ++issued;
+    ++inflight;
+  };
+
+  auto flush = [&](Conn& c) {
+    while (c.out_off < c.out.size()) {
+      ssize_t n = ::send(c.fd, c.out.data() + c.out_off, c.out.size() - c.out_off, MSG_NOSIGNAL);
+      if (n > 0) {
+        c.out_off += static_cast<std::size_t>(n);
+        continue;
+      }
+      if (n == -1 && errno == EINTR) {
+        continue;
+      }
+      if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        if (!c.want_out) {
+          c.want_out = true;
+          epoll.mod(c.fd, EPOLLIN | EPOLLOUT);
+        }
+        return true;
+      }
+      return false;
+    }
+    c.out.clear();
+    c.out_off = 0;
+    if (c.want_out) {
+      c.want_out = false;
+      epoll.mod(c.fd, EPOLLIN);
+    }
+    return true;
+  };
+
+  // Every reply is timed against the moment its batch was read and replaced
+  // by a new request, so each connection keeps pipeline requests in flight.
+  auto read_replies = [&](Conn& c) {
+    while (true) {
+      char* dst = c.in.prepare(kReadChunk);
+      ssize_t n = ::recv(c.fd, dst, c.in.writable(), 0);
+      if (n > 0) {
+        c.in.commit(static_cast<std::size_t>(n));
+        continue;
+      }
+      if (n == 0) {
+        return false;
+      }
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      return false;
+    }
+
+    const int64_t t = now_ns();
+    const std::string_view buf = c.in.readable();
+    std::size_t pos = 0;
+    bool bad = false;
+    while (pos < buf.size() && !c.sent_at.empty()) {
+      const std::size_t len = reply_length(buf, pos, bad);
+      if (bad) {
+        return false;
+      }
+      if (len == 0) {
+        break;
+      }
+      if (buf[pos] == '-') {
+        ++result.errors;
+      }
+      pos += len;
+      result.latency.record(t - c.sent_at.front());
+      c.sent_at.pop_front();
+      --inflight;
+      ++result.completed;
+      if (can_issue(t)) {
+        issue(c, t);
+      }
+    }
+    c.in.consume(pos);
+    return true;
+  };
+
+  auto drop = [&](Conn& c) {
+    epoll.del(c.fd);
+    ::close(c.fd);
+    c.fd = -1;
+    inflight -= c.sent_at.size();
+    c.sent_at.clear();
+    ++result.disconnects;
+  };
+
+  const int64_t t0 = now_ns();
+  for (Conn& c : conns) {
+    for (unsigned i = 0; i < opts.pipeline && can_issue(t0); ++i) {
+      issue(c, t0);
+    }
+    if (!flush(c)) {
+      drop(c);
+    }
+  }
+
+  while (inflight > 0) {
+    int n = epoll.wait(1000);
+    if (n < 0) {
+      util::die_errno("epoll_wait");
+    }
+    epoll_event* events = epoll.events_data();
+    for (int i = 0; i < n; ++i) {
+      Conn& c = *by_fd[static_cast<std::size_t>(events[i].data.fd)];
+      if (c.fd == -1) {
+        continue;
+      }
+      bool ok = (events[i].events & (EPOLLERR | EPOLLHUP)) == 0;
+      if (ok && (events[i].events & EPOLLIN)) {
+        ok = read_replies(c);
+      }
+      if (ok) {
+        ok = flush(c);
+      }
+      if (!ok) {
+        drop(c);
+      }
+    }
+  }
+
+  for (Conn& c : conns) {
+    if (c.fd != -1) {
+      ::close(c.fd);
+    }
+  }
+}
+
+}  // namespace bench
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <barrier>
+#include <cstdint>
+
+#include "histogram.hpp"
+#include "options.hpp"
+#include "workload.hpp"
+
+namespace bench {
+
+struct WorkerResult {
+  Histogram latency;  // nanoseconds, send to reply
+  uint64_t completed{0};
+  uint64_t errors{0};        // error replies
+  uint64_t disconnects{0};   // connections lost mid-run
+};
+
+// One client thread: connects its share of the connections, waits on start,
+// then keeps pipeline requests in flight on each until quota requests have
+// completed (or, with a duration, until the deadline) and drains them.
+void run_worker(const Options& opts, const Zipf* zipf, unsigned index, unsigned connections, uint64_t quota,
+                std::barrier<>& start, WorkerResult& result);
+
+}  // namespace bench
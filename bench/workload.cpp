@@ -0,0 +1,124 @@
+#include "workload.hpp"
+
+#include <charconv>
+#include <cmath>
+
+#include "../src/protocol/resp.hpp"
+
+namespace bench {
+
+namespace {
+uint64_t splitmix64(uint64_t& x) {
+  uint64_t z = (x += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+uint64_t rotl(uint64_t x, int k) {
+  return (x << k) | (x >> (64 - k));
+}
+
+double zeta(uint64_t n, double theta) {
+  double sum = 0;
+  for (uint64_t i = 1; i <= n; ++i) {
+    sum += 1.0 / std::pow(static_cast<double>(i), theta);
+  }
+  return sum;
+}
+}  // namespace
+
+Rng::Rng(uint64_t seed) {
+  for (auto& word : s) {
+    word = splitmix64(seed);
+  }
+}
+
+uint64_t Rng::next() {
+  const uint64_t result = rotl(s[1] * 5, 7) * 9;
+  const uint64_t t = s[1] << 17;
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = rotl(s[3], 45);
+  return result;
+}
+
+Zipf::Zipf(uint64_t n, double theta)
+    : n(n),
+      theta(theta),
+      alpha(1.0 / (1.0 - theta)),
+      zetan(zeta(n, theta)),
+      half_pow_theta(std::pow(0.5, theta)) {
+  const double zeta2 = 1.0 + half_pow_theta;
+  eta = (1.0 - std::pow(2.0 / static_cast<double>(n), 1.0 - theta)) / (1.0 - zeta2 / zetan);
+}
+
+uint64_t Zipf::next(Rng& rng) const {
+  const double u = rng.uniform();
+  const double uz = u * zetan;
+  if (uz < 1.0) {
+    return 0;
+  }
+  if (uz < 1.0 + half_pow_theta) {
+    return 1 % n;
+  }
+  const auto rank = static_cast<uint64_t>(static_cast<double>(n) * std::pow(eta * u - eta + 1.0, alpha));
+  return rank < n ? rank : n - 1;
+}
+
+Workload::Workload(const Options& opts, const Zipf* zipf, uint64_t seed)
+    : opts(opts), zipf(zipf), rng(seed), value(opts.value_size, 'x') {
+  unsigned running = 0;
+  for (std::size_t i = 0; i < kCommandCount; ++i) {
+    running += opts.mix[i];
+    cumulative[i] = running;
+  }
+  for (char& c : value) {
+    c = static_cast<char>('a' + rng.below(26));
+  }
+}
+
+uint64_t Workload::next_key() {
+  if (opts.dist == KeyDist::Zipf) {
+    return zipf->next(rng);
+  }
+  return rng.below(opts.keyspace);
+}
+
+void Workload::next_command(std::string& out) {
+  const auto pick = static_cast<unsigned>(rng.below(cumulative.back()));
+  std::size_t cmd = 0;
+  while (pick >= cumulative[cmd]) {
+    ++cmd;
+  }
+
+  char key[32] = "key:";
+  auto [end, ec] = std::to_chars(key + 4, key + sizeof(key), next_key());
+  (void)ec;
+  const std::string_view key_view(key, static_cast<std::size_t>(end - key));
+
+  args.clear();
+  switch (static_cast<Command>(cmd)) {
+    case Command::Set:
+      args = {"SET", key_view, value};
+      break;
+    case Command::Get:
+      args = {"GET", key_view};
+      break;
+    case Command::Del:
+      args = {"DEL", key_view};
+      break;
+    case Command::Exists:
+      args = {"EXISTS", key_view};
+      break;
+    case Command::Ping:
+      args = {"PING"};
+      break;
+  }
+  resp::append_command(out, args);
+}
+
+}  // namespace bench
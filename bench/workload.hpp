@@ -0,0 +1,65 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "options.hpp"
+
+namespace bench {
+
+// xoshiro256** seeded through splitmix64: fast and good enough for load.
+class Rng {
+ public:
+  explicit Rng(uint64_t seed);
+  uint64_t next();
+  // Uniform in [0, 1).
+  double uniform() { return static_cast<double>(next() >> 11) * 0x1.0p-53; }
+  // Uniform in [0, n).
+  uint64_t below(uint64_t n) { return static_cast<uint64_t>((static_cast<u128>(next()) * n) >> 64); }
+
+ private:
+  __extension__ using u128 = unsigned __int128;
+
+  std::array<uint64_t, 4> s;
+};
+
+// Zipfian ranks in [0, n) (Gray et al., as in YCSB): rank 0 is the hottest.
+// Construction sums n terms once; sampling is O(1). Shared read-only.
+class Zipf {
+ public:
+  Zipf(uint64_t n, double theta);
+  uint64_t next(Rng& rng) const;
+
+ private:
+  uint64_t n;
+  double theta;
+  double alpha;
+  double zetan;
+  double eta;
+  double half_pow_theta;
+};
+
+// Generates the configured command mix over the keyspace, one per call.
+class Workload {
+ public:
+  // zipf is only used with KeyDist::Zipf.
+  Workload(const Options& opts, const Zipf* zipf, uint64_t seed);
+
+  // Appends one RESP encoded command to out.
+  void next_command(std::string& out);
+
+ private:
+  uint64_t next_key();
+
+  const Options& opts;
+  const Zipf* zipf;
+  Rng rng;
+  std::array<unsigned, kCommandCount> cumulative{};
+  std::string value;
+  std::vector<std::string_view> args;
+};
+
+}  // namespace bench
@@ -1,85 +1,386 @@
 #include "dispatcher.hpp"
 
+#include <algorithm>
+#include <array>
 #include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <iterator>
 
 #include "../protocol/resp.hpp"
+#include "../server/cluster.hpp"
+#include "../server/replication.hpp"
+#include "../util/time.hpp"
+#include "../util/tsc.hpp"
 
 namespace commands {
 
 namespace {
-enum class Command {
-  Ping,
-  Echo,
-  Set,
-  Get,
-  Del,
-  Exists,
-  Expire,
-  Ttl,
-  Unknown
+// Command lookup is a perfect hash over the case-folded name: the seed of an
+// FNV-1a hash is searched at compile time until every command lands in its
+// own slot, so a lookup is one hash of the name, one slot load and one
+// compare, however many commands there are.
+constexpr int kSlotBits = 7;
+constexpr std::size_t kSlots = std::size_t{1} << kSlotBits;
+constexpr uint8_t kEmptySlot = 0xFF;
+
+constexpr char to_lower(char c) {
+  return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+constexpr std::size_t slot_of(std::string_view name, uint32_t seed) {
+  uint32_t h = seed;
+  for (char c : name) {
+    h = (h ^ static_cast<unsigned char>(to_lower(c))) * 16777619u;
+  }
+  return h >> (32 - kSlotBits);
+}
+
+// Case-insensitive match against a lower-case name.
+constexpr bool matches(std::string_view input, std::string_view name) {
+  if (input.size() != name.size()) {
+    return false;
+  }
+  for (std::size_t i = 0; i < name.size(); ++i) {
+    if (to_lower(input[i]) != name[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool iequals(std::string_view input, std::string_view upper) {
+  if (input.size() != upper.size()) {
+    return false;
+  }
+  for (std::size_t i = 0; i < upper.size(); ++i) {
+    const char c = input[i];
+    if ((c >= 'a' && c <= 'z' ? static_cast<char>(c - 'a' + 'A') : c) != upper[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+struct CommandIndex {
+  uint32_t seed;
+  std::array<uint8_t, kSlots> slots;
 };
 
-Command to_command(std::string_view cmd) {
-  if (cmd == "SET") return Command::Set;
-  if (cmd == "GET") return Command::Get;
-  if (cmd == "DEL") return Command::Del;
-  if (cmd == "EXISTS") return Command::Exists;
-  if (cmd == "EXPIRE") return Command::Expire;
-  if (cmd == "TTL") return Command::Ttl;
-  if (cmd == "PING") return Command::Ping;
-  if (cmd == "ECHO") return Command::Echo;
-  return Command::Unknown;
+template <typename Spec, std::size_t N>
+constexpr CommandIndex make_index(const Spec (&specs)[N]) {
+  static_assert(N < kEmptySlot && 2 * N <= kSlots, "grow kSlotBits");
+  for (uint32_t seed = 2166136261u;; ++seed) {
+    CommandIndex index{seed, {}};
+    index.slots.fill(kEmptySlot);
+    bool perfect = true;
+    for (std::size_t i = 0; i < N && perfect; ++i) {
+      uint8_t& slot = index.slots[slot_of(specs[i].name, seed)];
+      perfect = slot == kEmptySlot;
+      slot = static_cast<uint8_t>(i);
+    }
+    if (perfect) {
+      return index;
+    }
+  }
 }
 
+constexpr std::string_view kWrongType = "Operation against a key holding the wrong kind of value";
+
 bool parse_ll(std::string_view s, long long& out) {
   const char* begin = s.data();
   const char* end = begin + s.size();
   auto [ptr, ec] = std::from_chars(begin, end, out);
   return ec == std::errc() && ptr == end;
 }
+
+// Scores accept what Redis does: decimals, exponents and [+-]inf; no NaN.
+bool parse_score(std::string_view s, double& out) {
+  if (!s.empty() && s[0] == '+') {
+    s.remove_prefix(1);
+  }
+  const char* end = s.data() + s.size();
+  auto [ptr, ec] = std::from_chars(s.data(), end, out);
+  return ec == std::errc() && ptr == end && out == out;
+}
+
+// A ZRANGEBYSCORE bound; a leading '(' makes it exclusive.
+bool parse_bound(std::string_view s, double& out, bool& exclusive) {
+  exclusive = !s.empty() && s[0] == '(';
+  if (exclusive) {
+    s.remove_prefix(1);
+  }
+  return parse_score(s, out);
+}
+
+void append_score(std::string& out, double score) {
+  char buf[32];
+  auto [ptr, ec] = std::to_chars(buf, buf + sizeof(buf), score);
+  (void)ec;
+  resp::append_string(out, std::string_view(buf, static_cast<std::size_t>(ptr - buf)));
+}
+
+// SLOWLOG and STALLLOG share their subcommands: GET [count] (default 10,
+// negative for all), LEN and RESET. append_entry writes one entry.
+template <typename Entry, typename F>
+void event_log_command(resp::Args args, std::string& out, server::EventLog<Entry>& log,
+                       std::string_view name, F&& append_entry) {
+  if (iequals(args[1], "GET") && args.size() <= 3) {
+    long long count = 10;
+    if (args.size() == 3 && !parse_ll(args[2], count)) {
+      resp::append_error(out, "value is not an integer or out of range");
+      return;
+    }
+    const std::vector<Entry> entries =
+        log.latest(count < 0 ? log.size() : static_cast<std::size_t>(count));
+    resp::append_array_header(out, entries.size());
+    for (const Entry& e : entries) {
+      append_entry(e);
+    }
+  } else if (iequals(args[1], "LEN") && args.size() == 2) {
+    resp::append_integer(out, static_cast<long long>(log.size()));
+  } else if (iequals(args[1], "RESET") && args.size() == 2) {
+    log.reset();
+    resp::append_ok(out);
+  } else {
+    std::string msg = "unknown subcommand or wrong number of arguments for '";
+    msg.append(name).push_back('\'');
+    resp::append_error(out, msg);
+  }
+}
+
+bool parse_slot(std::string_view s, std::uint16_t& slot) {
+  long long n = 0;
+  if (!parse_ll(s, n) || n < 0 || n >= static_cast<long long>(db::kKeySlots)) {
+    return false;
+  }
+  slot = static_cast<std::uint16_t>(n);
+  return true;
+}
+
+// A RESTORE payload: a type byte, then the string or that type's listpack.
+bool valid_payload(std::string_view payload) {
+  if (payload.empty() || static_cast<unsigned char>(payload[0]) > static_cast<unsigned char>(db::ValueType::ZSet)) {
+    return false;
+  }
+  const auto type = static_cast<db::ValueType>(payload[0]);
+  return type == db::ValueType::String || db::Store::valid_collection(type, payload.substr(1));
+}
+
+std::string client_label(unsigned shard, std::uint64_t id) {
+  return "id=" + std::to_string(id) + " shard=" + std::to_string(shard);
+}
+
+void append_items(std::string& out, const std::vector<db::SortedSet::Item>& items, bool with_scores) {
+  resp::append_array_header(out, with_scores ? items.size() * 2 : items.size());
+  for (const auto& [member, score] : items) {
+    resp::append_string(out, member);
+    if (with_scores) {
+      append_score(out, score);
+    }
+  }
+}
 } // commands namespace
 
-void Dispatcher::dispatch(const std::vector<std::string_view>& args, std::string& out) {
+// name, arity, first key, last key, key step, write, handler
+constexpr Dispatcher::CommandSpec Dispatcher::kCommands[] = {
+    {"ping", -1, 0, 0, 0, false, &Dispatcher::handle_ping},
+    {"echo", 2, 0, 0, 0, false, &Dispatcher::handle_echo},
+    {"set", 3, 1, 1, 1, true, &Dispatcher::handle_set},
+    {"get", 2, 1, 1, 1, false, &Dispatcher::handle_get},
+    {"mget", -2, 1, -1, 1, false, &Dispatcher::handle_mget},
+    {"mset", -3, 1, -1, 2, true, &Dispatcher::handle_mset},
+    {"msetnx", -3, 1, -1, 2, true, &Dispatcher::handle_msetnx},
+    {"hset", -4, 1, 1, 1, true, &Dispatcher::handle_hset},
+    {"hget", 3, 1, 1, 1, false, &Dispatcher::handle_hget},
+    {"hgetall", 2, 1, 1, 1, false, &Dispatcher::handle_hgetall},
+    {"lpush", -3, 1, 1, 1, true, &Dispatcher::handle_lpush},
+    {"rpop", -2, 1, 1, 1, true, &Dispatcher::handle_rpop},
+    {"lrange", 4, 1, 1, 1, false, &Dispatcher::handle_lrange},
+    {"zadd", -4, 1, 1, 1, true, &Dispatcher::handle_zadd},
+    {"zrange", -4, 1, 1, 1, false, &Dispatcher::handle_zrange},
+    {"zrangebyscore", -4, 1, 1, 1, false, &Dispatcher::handle_zrangebyscore},
+    {"del", -2, 1, -1, 1, true, &Dispatcher::handle_del},
+    {"exists", -2, 1, -1, 1, false, &Dispatcher::handle_exists},
+    {"expire", 3, 1, 1, 1, true, &Dispatcher::handle_expire},
+    {"ttl", 2, 1, 1, 1, false, &Dispatcher::handle_ttl},
+    {"pexpireat", 3, 1, 1, 1, true, &Dispatcher::handle_pexpireat},
+    {"save", 1, 0, 0, 0, false, &Dispatcher::handle_save},
+    {"bgsave", 1, 0, 0, 0, false, &Dispatcher::handle_bgsave},
+    {"lastsave", 1, 0, 0, 0, false, &Dispatcher::handle_lastsave},
+    {"memory", 2, 0, 0, 0, false, &Dispatcher::handle_memory},
+    {"info", -1, 0, 0, 0, false, &Dispatcher::handle_info},
+    {"slowlog", -2, 0, 0, 0, false, &Dispatcher::handle_slowlog},
+    {"stalllog", -2, 0, 0, 0, false, &Dispatcher::handle_stalllog},
+    {"replicaof", 3, 0, 0, 0, false, &Dispatcher::handle_replicaof},
+    {"replconf", -3, 0, 0, 0, false, &Dispatcher::handle_replconf},
+    {"psync", 3, 0, 0, 0, false, &Dispatcher::handle_psync},
+    {"cluster", -2, 0, 0, 0, false, &Dispatcher::handle_cluster},
+    {"asking", 1, 0, 0, 0, false, &Dispatcher::handle_asking},
+    {"restore", -4, 1, 1, 1, true, &Dispatcher::handle_restore},
+};
+std::vector<std::string_view> Dispatcher::command_names() {
+  static_assert(std::size(kCommands) <= server::kMaxCommands);
+  std::vector<std::string_view> names;
+  for (const CommandSpec& spec : kCommands) {
+    names.push_back(spec.name);
+  }
+  return names;
+}
+
+const Dispatcher::CommandSpec* Dispatcher::lookup(std::string_view name) {
+  static constexpr CommandIndex kIndex = make_index(kCommands);
+
+  const uint8_t i = kIndex.slots[slot_of(name, kIndex.seed)];
+  if (i == kEmptySlot || !matches(name, kCommands[i].name)) {
+    return nullptr;
+  }
+  return &kCommands[i];
+}
+
+bool Dispatcher::CommandSpec::arity_ok(std::size_t argc) const {
+  return arity >= 0 ? argc == static_cast<std::size_t>(arity) : argc >= static_cast<std::size_t>(-arity);
+}
+
+void Dispatcher::dispatch(resp::Args args, std::string& out, resp::Splices* splices) {
+  reply_splices = splices;
   if (args.empty()) {
     resp::append_error(out, "empty command");
     return;
   }
+  const CommandSpec* spec = lookup(args[0]);
+  if (spec == nullptr) {
+    resp::append_error(out, "unknown command");
+    return;
+  }
+  if (!spec->arity_ok(args.size())) {
+    std::string msg = "wrong number of arguments for '";
+    msg.append(spec->name);
+    msg.push_back('\'');
+    resp::append_error(out, msg);
+    return;
+  }
+  if (spec->write && link != nullptr && link->following() && !applying) {
+    resp::append_error_code(out, "READONLY", "You can't write against a read only replica.");
+    return;
+  }
+  if (stats == nullptr) {
+    (this->*spec->handler)(args, out);
+    store.publish();
+    return;
+  }
+  const std::uint64_t start = util::tsc();
+  (this->*spec->handler)(args, out);
+  store.publish();
+  record(spec, args, util::tsc() - start);
+}
 
-  switch (to_command(args[0])) {
-    case Command::Set:
-      handle_set(args, out);
-      break;
-    case Command::Get:
-      handle_get(args, out);
-      break;
-    case Command::Del:
-      handle_del(args, out);
-      break;
-    case Command::Exists:
-      handle_exists(args, out);
-      break;
-    case Command::Expire:
-      handle_expire(args, out);
-      break;
-    case Command::Ttl:
-      handle_ttl(args, out);
-      break;
-    case Command::Ping:
-      handle_ping(args, out);
-      break;
-    case Command::Echo:
-      handle_echo(args, out);
-      break;
-    case Command::Unknown:
-    default:
-      resp::append_error(out, "unknown command");
-      break;
+void Dispatcher::record(const CommandSpec* spec, resp::Args args, std::uint64_t ticks) {
+  stats->commands[static_cast<std::size_t>(spec - kCommands)].record(ticks);
+  if (ticks > slowest.ticks) {
+    slowest = {spec->name, ticks};
+  }
+  if (ticks > slow_ticks) {
+    log_slow(args, ticks);
+  }
+}
+
+bool Dispatcher::peek(const db::Store& owner, unsigned reader, resp::Args args, std::string& out) {
+  const CommandSpec* spec = args.empty() ? nullptr : lookup(args[0]);
+  if (spec == nullptr || !spec->arity_ok(args.size())) {
+    return false;
+  }
+  const std::uint64_t start = stats != nullptr ? util::tsc() : 0;
+  db::Store::Peek found;
+  if (spec->handler == &Dispatcher::handle_get) {
+    if (!owner.peek(reader, args[1], found, &peeked)) {
+      return false;
+    }
+    if (found.found && found.type != db::ValueType::String) {
+      resp::append_error_code(out, "WRONGTYPE", kWrongType);
+    } else {
+      reply_splices = nullptr;
+      append_value(out, found.found ? std::optional<std::string_view>(peeked) : std::nullopt);
+    }
+  } else if (spec->handler == &Dispatcher::handle_exists) {
+    long long count = 0;
+    for (std::size_t i = 1; i < args.size(); ++i) {
+      if (!owner.peek(reader, args[i], found, nullptr)) {
+        return false;
+      }
+      count += found.found;
+    }
+    resp::append_integer(out, count);
+  } else if (spec->handler == &Dispatcher::handle_ttl) {
+    if (!owner.peek(reader, args[1], found, nullptr)) {
+      return false;
+    }
+    long long remaining = found.found ? -1 : -2;
+    if (found.found && found.expire_at != db::kNoExpiry) {
+      remaining = std::max<long long>(
+          0, std::chrono::duration_cast<std::chrono::milliseconds>(found.expire_at - util::now()).count());
+    }
+    resp::append_integer(out, remaining);
+  } else {
+    return false;
+  }
+  if (stats != nullptr) {
+    record(spec, args, util::tsc() - start);
+  }
+  return true;
+}
+
+void Dispatcher::apply(resp::Args args) {
+  applying = true;
+  client_shard = 0;
+  client_id = 0;
+  applied_reply.clear();
+  dispatch(args, applied_reply);
+  applying = false;
+}
+
+void Dispatcher::log_slow(resp::Args args, std::uint64_t ticks) {
+  server::SlowEntry e;
+  e.unix_secs = util::unix_millis() / 1000;
+  e.usec = util::tsc_to_us(ticks);
+  e.args = server::SlowEntry::truncate(args);
+  e.client_shard = client_shard;
+  e.client_id = client_id;
+  metrics->slowlog().add(std::move(e));
+}
+
+bool Dispatcher::key_range(resp::Args args, std::size_t& first, std::size_t& last,
+                           std::size_t& step) {
+  const CommandSpec* spec = args.empty() ? nullptr : lookup(args[0]);
+  // A command with the wrong arity is answered locally with the error.
+  if (spec == nullptr || spec->first_key == 0 || !spec->arity_ok(args.size())) {
+    return false;
+  }
+  first = static_cast<std::size_t>(spec->first_key);
+  last = spec->last_key >= 0 ? static_cast<std::size_t>(spec->last_key) + 1
+                             : args.size() + 1 - static_cast<std::size_t>(-spec->last_key);
+  step = static_cast<std::size_t>(spec->key_step);
+  return true;
+}
+
+void Dispatcher::propagate(resp::Args args) {
+  if (log_buf != nullptr) {
+    resp::append_command(*log_buf, args);
   }
 }
 
-void Dispatcher::handle_ping(const std::vector<std::string_view>& args, std::string& out) {
+bool Dispatcher::make_room(std::string& out) {
+  const bool ok = store.make_room([this](std::string_view key) { propagate({"DEL", key}); });
+  if (!ok) {
+    resp::append_error_code(out, "OOM", "command not allowed when used memory > 'maxmemory'");
+  }
+  return ok;
+}
+
+void Dispatcher::handle_ping(resp::Args args, std::string& out) {
   if (args.size() > 2) {
-    resp::append_error(out, "ERR wrong number of arguments for 'ping'");
+    resp::append_error(out, "wrong number of arguments for 'ping'");
     return;
   }
   if (args.size() == 1) {
@@ -90,51 +391,284 @@ void Dispatcher::handle_ping(const std::vector<std::string_view>& args, std::str
   }
 }
 
-void Dispatcher::handle_echo(const std::vector<std::string_view>& args, std::string& out) {
-  if (args.size() != 2) {
-    resp::append_error(out, "ERR wrong number of arguments for 'echo'");
-    return;
-  }
+void Dispatcher::handle_echo(resp::Args args, std::string& out) {
   resp::append_string(out, args[1]);
 }
 
-void Dispatcher::handle_set(const std::vector<std::string_view>& args, std::string& out) {
-  if (args.size() != 3) {
-    resp::append_error(out, "ERR wrong number of arguments for 'set'");
+void Dispatcher::handle_set(resp::Args args, std::string& out) {
+  if (!make_room(out)) {
     return;
   }
-  store.set(std::string(args[1]), std::string(args[2]));
+  store.set(args[1], args[2]);
+  propagate(args);
   resp::append_ok(out);
 }
 
-void Dispatcher::handle_get(const std::vector<std::string_view>& args, std::string& out) {
-  if (args.size() != 2) {
-    resp::append_error(out, "ERR wrong number of arguments for 'get'");
+void Dispatcher::append_value(std::string& out, std::optional<std::string_view> value) {
+  if (!value.has_value()) {
+    resp::append_null_string(out);
     return;
   }
-  auto val = store.get(args[1]);
-  resp::append_string(out, val);
+  if (reply_splices == nullptr || !db::SlabAllocator::refcounted(value->size())) {
+    resp::append_string(out, *value);
+    return;
+  }
+  // Sent from the stored block, which stays alive until the reply is out.
+  db::SlabAllocator::ref(value->data());
+  resp::append_spliced(out, *reply_splices, *value, resp::Pin(value->data(), &db::SlabAllocator::unref));
 }
 
-void Dispatcher::handle_del(const std::vector<std::string_view>& args, std::string& out) {
-  if (args.size() < 2) {
-    resp::append_error(out, "ERR wrong number of arguments for 'del'");
+void Dispatcher::handle_get(resp::Args args, std::string& out) {
+  std::optional<std::string_view> val;
+  if (!store.get(args[1], val)) {
+    resp::append_error_code(out, "WRONGTYPE", kWrongType);
     return;
   }
+  append_value(out, val);
+}
+
+void Dispatcher::handle_mget(resp::Args args, std::string& out) {
+  const std::size_t n = args.size() - 1;
+  store.get_many(args.data() + 1, n, values);
+
+  // Size the reply once: "$<len>\r\n<value>\r\n" per hit, "$-1\r\n" per miss,
+  // leaving out values that will be spliced.
+  std::size_t bytes = 16;
+  for (const auto& v : values) {
+    const bool spliced = reply_splices != nullptr && v && db::SlabAllocator::refcounted(v->size());
+    bytes += v ? (spliced ? 0 : v->size()) + 24 : 5;
+  }
+  out.reserve(out.size() + bytes);
+  resp::append_array_header(out, n);
+  for (const auto& v : values) {
+    append_value(out, v);
+  }
+}
+
+void Dispatcher::handle_mset(resp::Args args, std::string& out) {
+  set_many(args, out, false);
+}
+
+void Dispatcher::handle_msetnx(resp::Args args, std::string& out) {
+  set_many(args, out, true);
+}
+
+void Dispatcher::set_many(resp::Args args, std::string& out, bool only_if_absent) {
+  if (args.size() % 2 == 0) {
+    resp::append_error(out, only_if_absent ? "wrong number of arguments for 'msetnx'"
+                                           : "wrong number of arguments for 'mset'");
+    return;
+  }
+  if (!make_room(out)) {
+    return;
+  }
+  const bool written = store.set_many(args.data() + 1, (args.size() - 1) / 2, only_if_absent);
+  if (written) {
+    propagate(args);
+  }
+  if (only_if_absent) {
+    resp::append_integer(out, written ? 1 : 0);
+  } else {
+    resp::append_ok(out);
+  }
+}
+
+void Dispatcher::handle_hset(resp::Args args, std::string& out) {
+  if (args.size() % 2 != 0) {
+    resp::append_error(out, "wrong number of arguments for 'hset'");
+    return;
+  }
+  if (!make_room(out)) {
+    return;
+  }
+  std::size_t added = 0;
+  if (!store.hset(args[1], args.data() + 2, (args.size() - 2) / 2, added)) {
+    resp::append_error_code(out, "WRONGTYPE", kWrongType);
+    return;
+  }
+  propagate(args);
+  resp::append_integer(out, static_cast<long long>(added));
+}
+
+void Dispatcher::handle_hget(resp::Args args, std::string& out) {
+  std::optional<std::string_view> val;
+  if (!store.hget(args[1], args[2], val)) {
+    resp::append_error_code(out, "WRONGTYPE", kWrongType);
+    return;
+  }
+  append_value(out, val);
+}
+
+void Dispatcher::handle_hgetall(resp::Args args, std::string& out) {
+  if (!store.hgetall(args[1], elements)) {
+    resp::append_error_code(out, "WRONGTYPE", kWrongType);
+    return;
+  }
+  resp::append_array_header(out, elements.size());
+  for (std::string_view e : elements) {
+    resp::append_string(out, e);
+  }
+}
+
+void Dispatcher::handle_lpush(resp::Args args, std::string& out) {
+  if (!make_room(out)) {
+    return;
+  }
+  std::size_t length = 0;
+  if (!store.lpush(args[1], args.data() + 2, args.size() - 2, length)) {
+    resp::append_error_code(out, "WRONGTYPE", kWrongType);
+    return;
+  }
+  propagate(args);
+  resp::append_integer(out, static_cast<long long>(length));
+}
+
+void Dispatcher::handle_rpop(resp::Args args, std::string& out) {
+  if (args.size() > 3) {
+    resp::append_error(out, "wrong number of arguments for 'rpop'");
+    return;
+  }
+  long long count = 1;
+  if (args.size() == 3 && (!parse_ll(args[2], count) || count < 0)) {
+    resp::append_error(out, "value is out of range, must be positive");
+    return;
+  }
+  if (!store.rpop(args[1], static_cast<std::size_t>(count), popped)) {
+    resp::append_error_code(out, "WRONGTYPE", kWrongType);
+    return;
+  }
+  if (!popped.empty()) {
+    propagate(args);
+  }
+  if (args.size() == 2) {
+    if (popped.empty()) {
+      resp::append_null_string(out);
+    } else {
+      resp::append_string(out, std::string_view(popped[0]));
+    }
+    return;
+  }
+  // An existing list is never empty, so only a count of 0 pops nothing
+  // from one; that gets an empty array, a missing key the null array.
+  if (popped.empty() && !(count == 0 && store.exists(args[1]))) {
+    resp::append_null_array(out);
+    return;
+  }
+  resp::append_array_header(out, popped.size());
+  for (const std::string& item : popped) {
+    resp::append_string(out, std::string_view(item));
+  }
+}
+
+void Dispatcher::handle_lrange(resp::Args args, std::string& out) {
+  long long start = 0;
+  long long stop = 0;
+  if (!parse_ll(args[2], start) || !parse_ll(args[3], stop)) {
+    resp::append_error(out, "value is not an integer or out of range");
+    return;
+  }
+  if (!store.lrange(args[1], start, stop, elements)) {
+    resp::append_error_code(out, "WRONGTYPE", kWrongType);
+    return;
+  }
+  resp::append_array_header(out, elements.size());
+  for (std::string_view e : elements) {
+    resp::append_string(out, e);
+  }
+}
+
+void Dispatcher::handle_zadd(resp::Args args, std::string& out) {
+  if (args.size() % 2 != 0) {
+    resp::append_error(out, "wrong number of arguments for 'zadd'");
+    return;
+  }
+  scored.clear();
+  for (std::size_t i = 2; i < args.size(); i += 2) {
+    double score = 0;
+    if (!parse_score(args[i], score)) {
+      resp::append_error(out, "value is not a valid float");
+      return;
+    }
+    scored.emplace_back(score, args[i + 1]);
+  }
+  if (!make_room(out)) {
+    return;
+  }
+  std::size_t added = 0;
+  if (!store.zadd(args[1], scored.data(), scored.size(), added)) {
+    resp::append_error_code(out, "WRONGTYPE", kWrongType);
+    return;
+  }
+  propagate(args);
+  resp::append_integer(out, static_cast<long long>(added));
+}
+
+void Dispatcher::handle_zrange(resp::Args args, std::string& out) {
+  const bool with_scores = args.size() == 5 && iequals(args[4], "WITHSCORES");
+  if (args.size() > 4 && !with_scores) {
+    resp::append_error(out, "syntax error");
+    return;
+  }
+  long long start = 0;
+  long long stop = 0;
+  if (!parse_ll(args[2], start) || !parse_ll(args[3], stop)) {
+    resp::append_error(out, "value is not an integer or out of range");
+    return;
+  }
+  if (!store.zrange(args[1], start, stop, items)) {
+    resp::append_error_code(out, "WRONGTYPE", kWrongType);
+    return;
+  }
+  append_items(out, items, with_scores);
+}
+
+void Dispatcher::handle_zrangebyscore(resp::Args args, std::string& out) {
+  db::ScoreRange range{};
+  if (!parse_bound(args[2], range.min, range.min_exclusive) || !parse_bound(args[3], range.max, range.max_exclusive)) {
+    resp::append_error(out, "min or max is not a float");
+    return;
+  }
+  // Options: WITHSCORES, LIMIT offset count (a negative count means all).
+  bool with_scores = false;
+  long long offset = 0;
+  long long count = -1;
+  for (std::size_t i = 4; i < args.size(); ++i) {
+    if (iequals(args[i], "WITHSCORES")) {
+      with_scores = true;
+    } else if (iequals(args[i], "LIMIT") && i + 2 < args.size() && parse_ll(args[i + 1], offset) &&
+               parse_ll(args[i + 2], count)) {
+      i += 2;
+    } else {
+      resp::append_error(out, "syntax error");
+      return;
+    }
+  }
+  if (offset < 0) {
+    resp::append_array_header(out, 0);
+    return;
+  }
+  const std::size_t limit = count < 0 ? SIZE_MAX : static_cast<std::size_t>(count);
+  if (!store.zrange_by_score(args[1], range, static_cast<std::size_t>(offset), limit, items)) {
+    resp::append_error_code(out, "WRONGTYPE", kWrongType);
+    return;
+  }
+  append_items(out, items, with_scores);
+}
+
+void Dispatcher::handle_del(resp::Args args, std::string& out) {
   long long removed = 0;
   for (std::size_t i = 1; i < args.size(); ++i) {
     if (store.del(args[i])) {
       ++removed;
     }
   }
+  if (removed > 0) {
+    propagate(args);
+  }
   resp::append_integer(out, removed);
 }
 
-void Dispatcher::handle_exists(const std::vector<std::string_view>& args, std::string& out) {
-  if (args.size() < 2) {
-    resp::append_error(out, "ERR wrong number of arguments for 'exists'");
-    return;
-  }
+void Dispatcher::handle_exists(resp::Args args, std::string& out) {
   long long count = 0;
   for (std::size_t i = 1; i < args.size(); ++i) {
     if (store.exists(args[i])) {
@@ -144,27 +678,385 @@ void Dispatcher::handle_exists(const std::vector<std::string_view>& args, std::s
   resp::append_integer(out, count);
 }
 
-void Dispatcher::handle_expire(const std::vector<std::string_view>& args, std::string& out) {
-  if (args.size() != 3) {
-    resp::append_error(out, "ERR wrong number of arguments for 'expire'");
-    return;
-  }
+void Dispatcher::handle_expire(resp::Args args, std::string& out) {
   long long ttl_ms = 0;
   if (!parse_ll(args[2], ttl_ms) || ttl_ms < 0) {
-    resp::append_error(out, "ERR invalid expire time");
+    resp::append_error(out, "invalid expire time");
     return;
   }
   bool ok = store.expire(args[1], ttl_ms);
+  if (ok && log_buf != nullptr) {
+    char when[24];
+    auto [ptr, ec] = std::to_chars(when, when + sizeof(when), util::unix_millis() + ttl_ms);
+    (void)ec;
+    propagate({"PEXPIREAT", args[1], std::string_view(when, static_cast<std::size_t>(ptr - when))});
+  }
   resp::append_integer(out, ok ? 1 : 0);
 }
 
-void Dispatcher::handle_ttl(const std::vector<std::string_view>& args, std::string& out) {
-  if (args.size() != 2) {
-    resp::append_error(out, "ERR wrong number of arguments for 'ttl'");
+void Dispatcher::handle_pexpireat(resp::Args args, std::string& out) {
+  long long unix_ms = 0;
+  if (!parse_ll(args[2], unix_ms)) {
+    resp::append_error(out, "invalid expire time");
     return;
   }
+  bool ok = store.expire_at(args[1], util::from_unix_millis(unix_ms));
+  if (ok) {
+    propagate(args);
+  }
+  resp::append_integer(out, ok ? 1 : 0);
+}
+
+void Dispatcher::handle_ttl(resp::Args args, std::string& out) {
   long long remaining = store.ttl(args[1]);
   resp::append_integer(out, remaining);
 }
 
+void Dispatcher::handle_save(resp::Args, std::string& out) {
+  save(out, false);
+}
+
+void Dispatcher::handle_bgsave(resp::Args, std::string& out) {
+  save(out, true);
+}
+
+void Dispatcher::save(std::string& out, bool background) {
+  if (snapshots == nullptr) {
+    resp::append_error(out, "snapshots are disabled");
+    return;
+  }
+  switch (background ? snapshots->background_save() : snapshots->save()) {
+    case persist::Snapshotter::Status::Ok:
+      if (background) {
+        resp::append_status_string(out, "Background saving started");
+      } else {
+        resp::append_ok(out);
+      }
+      break;
+    case persist::Snapshotter::Status::Busy:
+      resp::append_error(out, "Background save already in progress");
+      break;
+    case persist::Snapshotter::Status::NotReady:
+      resp::append_error(out, "server is still loading");
+      break;
+    case persist::Snapshotter::Status::Failed:
+      resp::append_error(out, "snapshot failed");
+      break;
+  }
+}
+
+void Dispatcher::handle_lastsave(resp::Args, std::string& out) {
+  resp::append_integer(out, snapshots != nullptr ? snapshots->last_save_unix() : 0);
+}
+
+void Dispatcher::handle_memory(resp::Args args, std::string& out) {
+  const bool stats = iequals(args[1], "STATS");
+  if (!stats && !iequals(args[1], "MALLOC-STATS")) {
+    resp::append_error(out, "unknown subcommand or wrong number of arguments for 'memory'");
+    return;
+  }
+  char line[128];
+  if (stats) {
+    const int n = std::snprintf(line, sizeof(line), "used_memory %zu\nmaxmemory %zu\nkeys %zu\nevicted_keys %zu\n",
+                                store.used_memory(), store.maxmemory(), store.size(), store.evicted_keys());
+    resp::append_string(out, std::string_view(line, static_cast<std::size_t>(n)));
+    return;
+  }
+  // One line per size class in use: requested vs used chunk bytes shows
+  // internal fragmentation, free chunks show what deletes left behind.
+  const db::SlabAllocator& slab = store.allocator();
+  std::string report = "chunk slabs used free requested wasted\n";
+  for (const auto& c : slab.class_stats()) {
+    if (c.slabs == 0) {
+      continue;
+    }
+    const std::size_t used_bytes = c.used_chunks * c.chunk_size;
+    const int n = std::snprintf(line, sizeof(line), "%u %zu %zu %zu %zu %zu\n", c.chunk_size, c.slabs,
+                                c.used_chunks, c.free_chunks, c.requested_bytes, used_bytes - c.requested_bytes);
+    report.append(line, static_cast<std::size_t>(n));
+  }
+  const int n = std::snprintf(line, sizeof(line), "large_blocks %zu\nlarge_bytes %zu\nresident_bytes %zu\n",
+                              slab.large_blocks(), slab.large_bytes(), slab.resident_bytes());
+  report.append(line, static_cast<std::size_t>(n));
+  resp::append_string(out, std::string_view(report));
+}
+
+void Dispatcher::handle_info(resp::Args args, std::string& out) {
+  if (args.size() > 2) {
+    resp::append_error(out, "syntax error");
+    return;
+  }
+  if (metrics == nullptr) {
+    resp::append_error(out, "INFO is not available");
+    return;
+  }
+  std::string section(args.size() == 2 ? args[1] : std::string_view());
+  for (char& c : section) {
+    c = to_lower(c);
+  }
+  // This shard's store numbers are current; the others publish theirs on
+  // every cron tick.
+  stats->publish(store);
+  std::string report;  // empty for an unknown section, as in Redis
+  metrics->info(section, report);
+  resp::append_string(out, std::string_view(report));
+}
+
+void Dispatcher::handle_slowlog(resp::Args args, std::string& out) {
+  if (metrics == nullptr) {
+    resp::append_error(out, "SLOWLOG is not available");
+    return;
+  }
+  // Entries as Redis reports them: id, unix time, microseconds, arguments,
+  // client and client name (always empty here).
+  event_log_command(args, out, metrics->slowlog(), "slowlog", [&](const server::SlowEntry& e) {
+    resp::append_array_header(out, 6);
+    resp::append_integer(out, static_cast<long long>(e.id));
+    resp::append_integer(out, e.unix_secs);
+    resp::append_integer(out, static_cast<long long>(e.usec));
+    resp::append_array_header(out, e.args.size());
+    for (const std::string& arg : e.args) {
+      resp::append_string(out, std::string_view(arg));
+    }
+    resp::append_string(out, std::string_view(client_label(e.client_shard, e.client_id)));
+    resp::append_string(out, std::string_view());
+  });
+}
+
+void Dispatcher::handle_stalllog(resp::Args args, std::string& out) {
+  if (metrics == nullptr) {
+    resp::append_error(out, "STALLLOG is not available");
+    return;
+  }
+  // Entries are flat field/value arrays, so they read without a legend.
+  event_log_command(args, out, metrics->stalls(), "stalllog", [&](const server::StallEntry& e) {
+    auto field = [&](std::string_view name, long long value) {
+      resp::append_string(out, name);
+      resp::append_integer(out, value);
+    };
+    resp::append_array_header(out, 22);
+    field("id", static_cast<long long>(e.id));
+    field("time", e.unix_secs);
+    field("duration_us", static_cast<long long>(e.usec));
+    field("shard", e.shard);
+    field("events", static_cast<long long>(e.events));
+    field("commands", static_cast<long long>(e.commands));
+    resp::append_string(out, std::string_view("top_client"));
+    resp::append_string(out, std::string_view(client_label(e.shard, e.client_id)));
+    field("top_client_commands", static_cast<long long>(e.client_commands));
+    resp::append_string(out, std::string_view("slowest_command"));
+    resp::append_string(out, e.slowest);
+    field("slowest_command_us", static_cast<long long>(e.slowest_usec));
+    field("maintenance_us", static_cast<long long>(e.maintenance_usec));
+  });
+}
+
+void Dispatcher::handle_replicaof(resp::Args args, std::string& out) {
+  if (link == nullptr) {
+    resp::append_error(out, "REPLICAOF needs --threads 1 and no appendonly file");
+    return;
+  }
+  if (iequals(args[1], "NO") && iequals(args[2], "ONE")) {
+    link->stop();
+    resp::append_ok(out);
+    return;
+  }
+  long long port = 0;
+  if (!parse_ll(args[2], port) || port <= 0 || port > 65535) {
+    resp::append_error(out, "Invalid master port");
+    return;
+  }
+  link->follow(args[1], static_cast<std::uint16_t>(port));
+  resp::append_ok(out);
+}
+
+void Dispatcher::handle_replconf(resp::Args args, std::string& out) {
+  if (args.size() % 2 == 0) {
+    resp::append_error(out, "syntax error");
+    return;
+  }
+  long long value = 0;
+  if (iequals(args[1], "ACK")) {
+    // Acknowledgements get no reply, so they never interleave with the stream.
+    if (parse_ll(args[2], value) && value >= 0) {
+      repl = {ReplRequest::Kind::Ack, {}, value};
+    }
+    return;
+  }
+  if (iequals(args[1], "LISTENING-PORT")) {
+    if (!parse_ll(args[2], value) || value <= 0 || value > 65535) {
+      resp::append_error(out, "value is not a valid port");
+      return;
+    }
+    repl = {ReplRequest::Kind::ListeningPort, {}, value};
+  }
+  resp::append_ok(out);  // other options (capa, ...) are accepted and ignored
+}
+
+void Dispatcher::handle_psync(resp::Args args, std::string& out) {
+  if (link != nullptr && link->following()) {
+    resp::append_error(out, "a replica cannot serve PSYNC");
+    return;
+  }
+  long long offset = -1;
+  if (!parse_ll(args[2], offset)) {
+    resp::append_error(out, "value is not an integer or out of range");
+    return;
+  }
+  repl = {ReplRequest::Kind::Psync, args[1], offset};
+}
+
+void Dispatcher::handle_cluster(resp::Args args, std::string& out) {
+  if (cluster == nullptr) {
+    resp::append_error(out, "This instance has cluster support disabled");
+    return;
+  }
+  const std::string_view sub = args[1];
+  std::string err;
+  std::uint16_t slot = 0;
+  if (iequals(sub, "KEYSLOT") && args.size() == 3) {
+    resp::append_integer(out, db::key_slot(args[2]));
+  } else if (iequals(sub, "MYID") && args.size() == 2) {
+    resp::append_string(out, std::string_view(cluster->myid()));
+  } else if (iequals(sub, "INFO") && args.size() == 2) {
+    std::string report;
+    cluster->info(report);
+    resp::append_string(out, std::string_view(report));
+  } else if (iequals(sub, "SLOTS") && args.size() == 2) {
+    cluster->slots_reply(out);
+  } else if (iequals(sub, "COUNTKEYSINSLOT") && args.size() == 3) {
+    if (!parse_slot(args[2], slot)) {
+      resp::append_error(out, "Invalid or out of range slot");
+      return;
+    }
+    resp::append_integer(out, static_cast<long long>(cluster->keys_in_slot(slot)));
+  } else if ((iequals(sub, "ADDSLOTS") || iequals(sub, "DELSLOTS")) && args.size() >= 3) {
+    std::vector<std::uint16_t> slots;
+    for (std::size_t i = 2; i < args.size(); ++i) {
+      if (!parse_slot(args[i], slot)) {
+        resp::append_error(out, "Invalid or out of range slot");
+        return;
+      }
+      slots.push_back(slot);
+    }
+    const bool ok = iequals(sub, "ADDSLOTS") ? cluster->add_slots(slots, err) : cluster->del_slots(slots, err);
+    if (ok) {
+      resp::append_ok(out);
+    } else {
+      resp::append_error(out, err);
+    }
+  } else if (iequals(sub, "ADDSLOTSRANGE") && args.size() >= 4 && args.size() % 2 == 0) {
+    std::vector<std::uint16_t> slots;
+    std::uint16_t last = 0;
+    for (std::size_t i = 2; i < args.size(); i += 2) {
+      if (!parse_slot(args[i], slot) || !parse_slot(args[i + 1], last)) {
+        resp::append_error(out, "Invalid or out of range slot");
+        return;
+      }
+      if (slot > last) {
+        resp::append_error(out, "start slot number " + std::to_string(slot) +
+                                    " is greater than end slot number " + std::to_string(last));
+        return;
+      }
+      for (unsigned s = slot; s <= last; ++s) {
+        slots.push_back(static_cast<std::uint16_t>(s));
+      }
+    }
+    if (cluster->add_slots(slots, err)) {
+      resp::append_ok(out);
+    } else {
+      resp::append_error(out, err);
+    }
+  } else if (iequals(sub, "SETSLOT") && (args.size() == 4 || args.size() == 6)) {
+    if (!parse_slot(args[2], slot)) {
+      resp::append_error(out, "Invalid or out of range slot");
+      return;
+    }
+    server::Cluster::SlotState state;
+    if (args.size() == 4 && iequals(args[3], "STABLE")) {
+      state = server::Cluster::SlotState::Stable;
+    } else if (args.size() == 6 && iequals(args[3], "NODE")) {
+      state = server::Cluster::SlotState::Node;
+    } else if (args.size() == 6 && iequals(args[3], "MIGRATING")) {
+      state = server::Cluster::SlotState::Migrating;
+    } else if (args.size() == 6 && iequals(args[3], "IMPORTING")) {
+      state = server::Cluster::SlotState::Importing;
+    } else {
+      resp::append_error(out, "Invalid CLUSTER SETSLOT action or number of arguments");
+      return;
+    }
+    long long port = 0;
+    if (args.size() == 6 && (!parse_ll(args[5], port) || port <= 0 || port > 65535)) {
+      resp::append_error(out, "Invalid node port");
+      return;
+    }
+    const std::string_view host = args.size() == 6 ? args[4] : std::string_view();
+    if (cluster->set_slot(slot, state, host, static_cast<std::uint16_t>(port), err)) {
+      resp::append_ok(out);
+    } else {
+      resp::append_error(out, err);
+    }
+  } else {
+    resp::append_error(out, "unknown subcommand or wrong number of arguments for 'cluster'");
+  }
+}
+
+void Dispatcher::handle_asking(resp::Args, std::string& out) {
+  asking_requested = true;
+  resp::append_ok(out);
+}
+
+void Dispatcher::handle_restore(resp::Args args, std::string& out) {
+  long long ttl = 0;
+  if (!parse_ll(args[2], ttl) || ttl < 0) {
+    resp::append_error(out, "Invalid TTL value, must be >= 0");
+    return;
+  }
+  bool replace = false;
+  bool absttl = false;
+  for (std::size_t i = 4; i < args.size(); ++i) {
+    if (iequals(args[i], "REPLACE")) {
+      replace = true;
+    } else if (iequals(args[i], "ABSTTL")) {
+      absttl = true;
+    } else {
+      resp::append_error(out, "syntax error");
+      return;
+    }
+  }
+  const std::string_view payload = args[3];
+  if (!valid_payload(payload)) {
+    resp::append_error(out, "Bad data format");
+    return;
+  }
+  if (!replace && store.exists(args[1])) {
+    resp::append_error_code(out, "BUSYKEY", "Target key name already exists.");
+    return;
+  }
+  if (!make_room(out)) {
+    return;
+  }
+  util::TimePoint deadline = db::kNoExpiry;
+  long long unix_ms = 0;
+  if (ttl != 0) {
+    unix_ms = absttl ? ttl : util::unix_millis() + ttl;
+    deadline = util::from_unix_millis(unix_ms);
+    if (unix_ms <= util::unix_millis()) {
+      // Already expired: nothing to keep, but what was there is replaced.
+      if (store.del(args[1])) {
+        propagate({"DEL", args[1]});
+      }
+      resp::append_ok(out);
+      return;
+    }
+  }
+  store.restore(args[1], payload.substr(1), deadline, static_cast<db::ValueType>(payload[0]));
+  char when[24];
+  auto [ptr, ec] = std::to_chars(when, when + sizeof(when), unix_ms);
+  (void)ec;
+  propagate({"RESTORE", args[1], std::string_view(when, static_cast<std::size_t>(ptr - when)), payload, "REPLACE",
+             "ABSTTL"});
+  resp::append_ok(out);
+}
+
 }
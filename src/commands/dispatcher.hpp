@@ -1,10 +1,22 @@
 #pragma once
 
+#include <cstdint>
+#include <initializer_list>
+#include <optional>
 #include <string>
 #include <string_view>
+#include <utility>
 #include <vector>
 
 #include "../db/store.hpp"
+#include "../persist/snapshot.hpp"
+#include "../protocol/resp.hpp"
+#include "../server/metrics.hpp"
+
+namespace server {
+class Cluster;
+class ReplicaLink;
+}
 
 namespace commands {
 
@@ -12,19 +24,186 @@ class Dispatcher {
  public:
   explicit Dispatcher(db::Store& store) : store(store) {}
 
-  void dispatch(const std::vector<std::string_view>& args, std::string& out);
+  // Large values may be spliced into out through splices rather than copied
+  // into it (see resp::Splice); null keeps every reply inline.
+  void dispatch(resp::Args args, std::string& out, resp::Splices* splices = nullptr);
+
+  // Answers GET, EXISTS or TTL on keys of another shard by reading its
+  // store without locks (db::Store::peek), counted in this thread's stats
+  // like dispatch(). reader is this thread's slot in the stores' epoch
+  // domain. Returns false with out untouched for any other command, or when
+  // the owner has to answer after all.
+  bool peek(const db::Store& owner, unsigned reader, resp::Args args, std::string& out);
+
+  // Runs a command from the primary's replication stream: writes are
+  // allowed although this node is a read-only replica, and the reply is
+  // dropped.
+  void apply(resp::Args args);
+
+  // Successful mutations are appended to buf as RESP commands, with relative
+  // deadlines rewritten as absolute ones so the log replays correctly later;
+  // the batch goes to the aof and to replicas. Null (the default) disables
+  // logging, e.g. while replaying the log itself.
+  void set_log_buffer(std::string* buf) { log_buf = buf; }
+  // This node's link to a primary: while it follows one, write commands
+  // from clients are refused. Enables REPLICAOF.
+  void set_replica_link(server::ReplicaLink* l) { link = l; }
+  // Enables the CLUSTER command; slot checks and redirects are the reactor's.
+  void set_cluster(server::Cluster* c) { cluster = c; }
+  // Enables SAVE/BGSAVE/LASTSAVE.
+  void set_snapshotter(persist::Snapshotter* s) { snapshots = s; }
+  // Enables INFO, and per-command calls and latency recorded into mine
+  // (this thread's block of metrics).
+  void set_metrics(server::Metrics* all, server::ThreadMetrics* mine) {
+    metrics = all;
+    stats = mine;
+  }
+
+  // Commands taking more TSC ticks than this are logged to SLOWLOG.
+  void set_slowlog_threshold(std::uint64_t ticks) { slow_ticks = ticks; }
+  // The client whose commands are dispatched next: the shard owning its
+  // connection and the connection's id there. Reported by SLOWLOG.
+  void set_client(unsigned shard, std::uint64_t id) {
+    client_shard = shard;
+    client_id = id;
+  }
+  // Longest command since the last call, for the event-loop watchdog.
+  struct Slowest {
+    std::string_view name;
+    std::uint64_t ticks{0};
+  };
+  Slowest take_slowest() { return std::exchange(slowest, Slowest{}); }
+
+  // PSYNC and REPLCONF act on the connection that sent them, which only the
+  // reactor knows: their handlers leave the request here and the reactor
+  // takes it right after dispatch. replid views the command's arguments.
+  struct ReplRequest {
+    enum class Kind { None, ListeningPort, Ack, Psync };
+    Kind kind{Kind::None};
+    std::string_view replid;
+    long long value{0};
+  };
+  bool repl_requested() const { return repl.kind != ReplRequest::Kind::None; }
+  ReplRequest take_repl_request() { return std::exchange(repl, ReplRequest{}); }
+  // ASKING flags the connection's next command, which the reactor tracks.
+  bool take_asking() { return std::exchange(asking_requested, false); }
+
+  // Command names in table order, which is the order of
+  // server::ThreadMetrics::commands.
+  static std::vector<std::string_view> command_names();
+
+  // Key arguments of a command are every step-th of args[first, last)
+  // (step 2 skips MSET's values). Returns false for commands that touch no
+  // keys (PING, ECHO, unknown) or have the wrong number of arguments.
+  static bool key_range(resp::Args args, std::size_t& first, std::size_t& last,
+                        std::size_t& step);
 
  private:
-  void handle_ping(const std::vector<std::string_view>& args, std::string& out);
-  void handle_echo(const std::vector<std::string_view>& args, std::string& out);
-  void handle_set(const std::vector<std::string_view>& args, std::string& out);
-  void handle_get(const std::vector<std::string_view>& args, std::string& out);
-  void handle_del(const std::vector<std::string_view>& args, std::string& out);
-  void handle_exists(const std::vector<std::string_view>& args, std::string& out);
-  void handle_expire(const std::vector<std::string_view>& args, std::string& out);
-  void handle_ttl(const std::vector<std::string_view>& args, std::string& out);
+  using Handler = void (Dispatcher::*)(resp::Args args, std::string& out);
+
+  // A row of the command table, with Redis' conventions: arity counts the
+  // name and is a minimum when negative; keys are every key_step-th argument
+  // from first_key to last_key, negative counting from the end, and
+  // first_key 0 means none. Write commands are refused on a replica.
+  struct CommandSpec {
+    std::string_view name;  // lower case; matched case-insensitively
+    int arity;
+    int first_key;
+    int last_key;
+    int key_step;
+    bool write;
+    Handler handler;
+
+    bool arity_ok(std::size_t argc) const;
+  };
+  static const CommandSpec kCommands[];
+  static const CommandSpec* lookup(std::string_view name);
+
+  void handle_ping(resp::Args args, std::string& out);
+  void handle_echo(resp::Args args, std::string& out);
+  void handle_set(resp::Args args, std::string& out);
+  void handle_get(resp::Args args, std::string& out);
+  void handle_mget(resp::Args args, std::string& out);
+  void handle_mset(resp::Args args, std::string& out);
+  void handle_msetnx(resp::Args args, std::string& out);
+  void handle_hset(resp::Args args, std::string& out);
+  void handle_hget(resp::Args args, std::string& out);
+  void handle_hgetall(resp::Args args, std::string& out);
+  void handle_lpush(resp::Args args, std::string& out);
+  void handle_rpop(resp::Args args, std::string& out);
+  void handle_lrange(resp::Args args, std::string& out);
+  void handle_zadd(resp::Args args, std::string& out);
+  void handle_zrange(resp::Args args, std::string& out);
+  void handle_zrangebyscore(resp::Args args, std::string& out);
+  void handle_del(resp::Args args, std::string& out);
+  void handle_exists(resp::Args args, std::string& out);
+  void handle_expire(resp::Args args, std::string& out);
+  void handle_ttl(resp::Args args, std::string& out);
+  void handle_pexpireat(resp::Args args, std::string& out);
+  void handle_save(resp::Args args, std::string& out);
+  void handle_bgsave(resp::Args args, std::string& out);
+  void handle_lastsave(resp::Args args, std::string& out);
+  // MEMORY STATS | MALLOC-STATS: accounting and slab allocator usage of the
+  // shard serving the client.
+  void handle_memory(resp::Args args, std::string& out);
+  // INFO [section]: server-wide counters summed over every shard.
+  void handle_info(resp::Args args, std::string& out);
+  // SLOWLOG GET [count] | LEN | RESET, over the commands of every shard.
+  void handle_slowlog(resp::Args args, std::string& out);
+  // STALLLOG GET [count] | LEN | RESET: event-loop iterations over budget.
+  void handle_stalllog(resp::Args args, std::string& out);
+  // REPLICAOF host port | NO ONE.
+  void handle_replicaof(resp::Args args, std::string& out);
+  // REPLCONF listening-port <port> | ACK <offset> | <option> <value>, sent
+  // by replicas.
+  void handle_replconf(resp::Args args, std::string& out);
+  // PSYNC <replid> <offset>: answered by the reactor.
+  void handle_psync(resp::Args args, std::string& out);
+  // CLUSTER KEYSLOT | MYID | INFO | SLOTS | COUNTKEYSINSLOT | ADDSLOTS |
+  // ADDSLOTSRANGE | DELSLOTS | SETSLOT.
+  void handle_cluster(resp::Args args, std::string& out);
+  void handle_asking(resp::Args args, std::string& out);
+  // RESTORE key ttl payload [REPLACE] [ABSTTL], payload as SlotMigrator
+  // sends it: the type byte, then the value in its compact form.
+  void handle_restore(resp::Args args, std::string& out);
+
+  // Per-command latency, the watchdog's slowest command and SLOWLOG.
+  void record(const CommandSpec* spec, resp::Args args, std::uint64_t ticks);
+  void log_slow(resp::Args args, std::uint64_t ticks);
+  void set_many(resp::Args args, std::string& out, bool only_if_absent);
+  void save(std::string& out, bool background);
+  // Bulk reply for a stored value (or null), spliced when large.
+  void append_value(std::string& out, std::optional<std::string_view> value);
+  void propagate(resp::Args args);
+  void propagate(std::initializer_list<std::string_view> args) { propagate(resp::Args(args.begin(), args.size())); }
+  // Evicts down to maxmemory before a write that may grow the store, logging
+  // a DEL per evicted key. Appends an OOM error and returns false if the
+  // policy cannot free enough.
+  bool make_room(std::string& out);
 
   db::Store& store;
+  std::string* log_buf{nullptr};
+  resp::Splices* reply_splices{nullptr};  // of the command being dispatched
+  persist::Snapshotter* snapshots{nullptr};
+  server::Metrics* metrics{nullptr};
+  server::ThreadMetrics* stats{nullptr};
+  std::uint64_t slow_ticks{UINT64_MAX};
+  unsigned client_shard{0};
+  std::uint64_t client_id{0};
+  Slowest slowest;
+  server::ReplicaLink* link{nullptr};
+  server::Cluster* cluster{nullptr};
+  bool asking_requested{false};
+  bool applying{false};
+  std::string applied_reply;
+  ReplRequest repl;
+  // Command results, kept to reuse their allocations.
+  std::vector<std::optional<std::string_view>> values;
+  std::vector<std::string_view> elements;
+  std::vector<std::string> popped;
+  std::vector<std::pair<double, std::string_view>> scored;
+  std::vector<db::SortedSet::Item> items;
+  std::string peeked;
 };
 
 }  // namespace commands
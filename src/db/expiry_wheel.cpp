@@ -0,0 +1,88 @@
+#include "expiry_wheel.hpp"
+
+#include <utility>
+
+namespace db {
+
+void ExpiryWheel::schedule(std::string_view key, int64_t deadline_ms, uint8_t gen) {
+  Timer timer{SmallString(key, *alloc), deadline_ms, gen};
+  key_bytes += timer.key.heap_bytes();
+  place(std::move(timer));
+}
+
+bool ExpiryWheel::take_due(Timer& out) {
+  if (due.empty()) {
+    return false;
+  }
+  out = std::move(due.back());
+  due.pop_back();
+  key_bytes -= out.key.heap_bytes();
+  return true;
+}
+
+void ExpiryWheel::place(Timer&& timer) {
+  if (timer.deadline_ms <= current) {
+    due.push_back(std::move(timer));
+    return;
+  }
+  // Lowest level whose slot is still ahead of current in this rotation:
+  // deadline and current agree on every bit above that level.
+  const auto d = static_cast<uint64_t>(timer.deadline_ms);
+  const auto c = static_cast<uint64_t>(current);
+  for (int level = 0; level < kLevels; ++level) {
+    const int shift = kBits * (level + 1);
+    if ((d >> shift) == (c >> shift)) {
+      wheels[static_cast<std::size_t>(level)][(d >> (kBits * level)) & (kSlots - 1)].push_back(std::move(timer));
+      ++scheduled;
+      return;
+    }
+  }
+  overflow.push_back(std::move(timer));
+  ++scheduled;
+}
+
+void ExpiryWheel::cascade(int level) {
+  const auto c = static_cast<uint64_t>(current);
+  auto& bucket = wheels[static_cast<std::size_t>(level)][(c >> (kBits * level)) & (kSlots - 1)];
+  std::vector<Timer> timers = std::move(bucket);
+  bucket.clear();
+  scheduled -= timers.size();
+  for (Timer& t : timers) {
+    place(std::move(t));
+  }
+}
+
+void ExpiryWheel::advance(int64_t now_ms) {
+  while (current < now_ms) {
+    if (scheduled == 0) {
+      current = now_ms;
+      return;
+    }
+    ++current;
+    const auto c = static_cast<uint64_t>(current);
+
+    // Entering a new block at some level: refill finer levels, coarsest first.
+    if ((c & ((uint64_t{1} << (kBits * kLevels)) - 1)) == 0) {
+      std::vector<Timer> far = std::move(overflow);
+      overflow.clear();
+      scheduled -= far.size();
+      for (Timer& t : far) {
+        place(std::move(t));
+      }
+    }
+    for (int level = kLevels - 1; level > 0; --level) {
+      if ((c & ((uint64_t{1} << (kBits * level)) - 1)) == 0) {
+        cascade(level);
+      }
+    }
+
+    auto& bucket = wheels[0][c & (kSlots - 1)];
+    scheduled -= bucket.size();
+    for (Timer& t : bucket) {
+      due.push_back(std::move(t));
+    }
+    bucket.clear();
+  }
+}
+
+}  // namespace db
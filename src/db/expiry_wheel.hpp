@@ -0,0 +1,61 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "small_string.hpp"
+
+namespace db {
+
+// Hierarchical timing wheel of key deadlines with 1ms ticks: four levels of
+// 256 slots cover ~49 days, later deadlines wait in an overflow list. Timers
+// are cascaded to finer levels as time reaches their block, so scheduling is
+// O(1) and advancing costs O(ticks + timers that fire).
+//
+// Timers carry the key and a generation the store stamped them with. The
+// store checks each fired timer against the key's current entry, so stale
+// timers (key deleted, persisted or given a later deadline) are harmless.
+class ExpiryWheel {
+ public:
+  struct Timer {
+    SmallString key;
+    int64_t deadline_ms;
+    uint8_t gen;
+  };
+
+  // Long keys are copied into alloc, which must outlive the wheel.
+  ExpiryWheel(int64_t now_ms, SlabAllocator& alloc) : alloc(&alloc), current(now_ms) {}
+
+  void schedule(std::string_view key, int64_t deadline_ms, uint8_t gen);
+  // Moves every timer due at or before now_ms onto the due list.
+  void advance(int64_t now_ms);
+
+  // Pops a due timer into out; false once none are left.
+  bool take_due(Timer& out);
+  bool has_due() const { return !due.empty(); }
+  std::size_t pending() const { return scheduled + due.size(); }
+  // Queued timers and their out-of-line key copies; spare vector capacity
+  // is not counted.
+  std::size_t memory_bytes() const { return pending() * sizeof(Timer) + key_bytes; }
+
+ private:
+  static constexpr int kLevels = 4;
+  static constexpr int kBits = 8;
+  static constexpr std::size_t kSlots = std::size_t{1} << kBits;
+
+  void place(Timer&& timer);
+  void cascade(int level);
+
+  std::array<std::array<std::vector<Timer>, kSlots>, kLevels> wheels;
+  std::vector<Timer> overflow;
+  std::vector<Timer> due;
+  SlabAllocator* alloc;
+  int64_t current;  // last tick processed
+  std::size_t scheduled{0};  // timers in wheels and overflow
+  std::size_t key_bytes{0};  // heap bytes of every queued timer's key
+};
+
+}  // namespace db
@@ -0,0 +1,62 @@
+#include "field_table.hpp"
+
+#include <utility>
+
+#include "listpack.hpp"
+
+namespace db {
+
+FieldTable::FieldTable(std::string_view lp, SlabAllocator& alloc)
+    : table(listpack::size(lp) / 2), alloc(&alloc) {
+  for (std::size_t pos = listpack::kBegin; pos < lp.size();) {
+    const std::string_view field = listpack::next(lp, pos);
+    set(field, listpack::next(lp, pos));
+  }
+}
+
+bool FieldTable::set(std::string_view field, std::string_view value) {
+  const std::size_t h = HashTable::hash(field);
+  Entry* e = table.find(field, h);
+  const bool added = e == nullptr;
+  if (added) {
+    if (!table.has_room()) {
+      grow();
+    }
+    e = table.insert(field, h, *alloc);
+    heap += e->key.heap_bytes();
+  }
+  heap -= e->value.heap_bytes();
+  e->value.assign(value, *alloc);
+  heap += e->value.heap_bytes();
+  return added;
+}
+
+std::optional<std::string_view> FieldTable::get(std::string_view field) {
+  Entry* e = table.find(field, HashTable::hash(field));
+  if (e == nullptr) {
+    return std::nullopt;
+  }
+  return e->value.view();
+}
+
+void FieldTable::flatten(std::string& lp) const {
+  listpack::init(lp);
+  for_each([&](std::string_view field, std::string_view value) {
+    listpack::push_back(lp, field);
+    listpack::push_back(lp, value);
+  });
+}
+
+void FieldTable::grow() {
+  HashTable next(table.next_capacity());
+  for (std::size_t i = 0; i < table.capacity(); ++i) {
+    if (table.slot_full(i)) {
+      Entry& e = table.slot(i);
+      next.insert(std::move(e), HashTable::hash(e.key.view()));
+    }
+  }
+  // Everything was moved out; the old table only frees its arrays.
+  table = std::move(next);
+}
+
+}  // namespace db
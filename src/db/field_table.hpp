@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "hash_table.hpp"
+#include "slab_allocator.hpp"
+
+namespace db {
+
+// Encoding of hashes past the listpack limits: the store's own Swiss table,
+// with the field in each entry's key and its value in the value. It grows
+// by rehashing in one step; a single hash is small next to the keyspace, so
+// this does not need the store's incremental migration.
+class FieldTable {
+ public:
+  // Takes over the field/value pairs of a listpack. Strings are copied into
+  // alloc, which must outlive the table.
+  FieldTable(std::string_view lp, SlabAllocator& alloc);
+
+  std::size_t size() const { return table.size(); }
+  // Slots and control bytes plus out-of-line field and value chunks.
+  std::size_t bytes() const { return table.capacity() * (sizeof(Entry) + 1) + heap; }
+
+  // Returns true if field was not present.
+  bool set(std::string_view field, std::string_view value);
+  std::optional<std::string_view> get(std::string_view field);
+
+  template <typename F>
+  void for_each(F&& f) const {
+    for (std::size_t i = 0; i < table.capacity(); ++i) {
+      if (table.slot_full(i)) {
+        f(table.slot(i).key.view(), table.slot(i).value.view());
+      }
+    }
+  }
+  // All pairs as one listpack, for snapshots.
+  void flatten(std::string& lp) const;
+
+ private:
+  void grow();
+
+  HashTable table;
+  SlabAllocator* alloc;
+  std::size_t heap{0};
+};
+
+}  // namespace db
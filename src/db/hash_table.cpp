@@ -0,0 +1,449 @@
+#include "hash_table.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <new>
+
+#include "../util/error.hpp"
+#include "field_table.hpp"
+#include "quicklist.hpp"
+#include "sorted_set.hpp"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace db {
+
+namespace {
+constexpr std::size_t kGroupWidth = 16;
+constexpr std::size_t kMinCapacity = kGroupWidth;
+
+int8_t h2_of(std::size_t hash) { return static_cast<int8_t>(hash & 0x7F); }
+std::size_t h1_of(std::size_t hash) { return hash >> 7; }
+
+std::size_t max_load(std::size_t cap) { return cap - cap / 8; }
+
+// Bitmask queries over 16 control bytes, bit i set when byte i matches.
+class Group {
+ public:
+  explicit Group(const int8_t* pos) {
+#if defined(__SSE2__)
+    ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pos));
+#else
+    std::memcpy(ctrl, pos, kGroupWidth);
+#endif
+  }
+
+  uint32_t match(int8_t h2) const {
+#if defined(__SSE2__)
+    return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2), ctrl)));
+#else
+    return match_if([h2](int8_t c) { return c == h2; });
+#endif
+  }
+
+  uint32_t match_empty() const {
+#if defined(__SSE2__)
+    return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(-128), ctrl)));
+#else
+    return match_if([](int8_t c) { return c == -128; });
+#endif
+  }
+
+  // Empty and deleted are the only control values with the sign bit set.
+  uint32_t match_empty_or_deleted() const {
+#if defined(__SSE2__)
+    return static_cast<uint32_t>(_mm_movemask_epi8(ctrl));
+#else
+    return match_if([](int8_t c) { return c < 0; });
+#endif
+  }
+
+ private:
+#if defined(__SSE2__)
+  __m128i ctrl;
+#else
+  template <typename F>
+  uint32_t match_if(F&& f) const {
+    uint32_t mask = 0;
+    for (std::size_t i = 0; i < kGroupWidth; ++i) {
+      if (f(ctrl[i])) {
+        mask |= 1u << i;
+      }
+    }
+    return mask;
+  }
+  int8_t ctrl[kGroupWidth];
+#endif
+};
+
+// Triangular probing over groups; visits every group when the count is a power of two.
+class ProbeSeq {
+ public:
+  ProbeSeq(std::size_t hash, std::size_t group_mask) : mask(group_mask), group(h1_of(hash) & group_mask) {}
+  std::size_t offset() const { return group * kGroupWidth; }
+  void next() {
+    ++step;
+    group = (group + step) & mask;
+  }
+
+ private:
+  std::size_t mask;
+  std::size_t group;
+  std::size_t step{0};
+};
+
+unsigned lowest_bit(uint32_t mask) { return static_cast<unsigned>(__builtin_ctz(mask)); }
+}  // namespace
+
+void Entry::release_object() {
+  if (encoding != Encoding::Object) {
+    return;
+  }
+  switch (type) {
+    case ValueType::Hash:
+      delete object<FieldTable>();
+      break;
+    case ValueType::List:
+      delete object<Quicklist>();
+      break;
+    case ValueType::ZSet:
+      delete object<SortedSet>();
+      break;
+    case ValueType::String:
+      break;
+  }
+  value = SmallString();
+  encoding = Encoding::Compact;
+}
+
+std::size_t Entry::heap_bytes() const {
+  std::size_t bytes = key.heap_bytes() + value.heap_bytes();
+  if (encoding == Encoding::Object) {
+    switch (type) {
+      case ValueType::Hash:
+        bytes += sizeof(FieldTable) + object<FieldTable>()->bytes();
+        break;
+      case ValueType::List:
+        bytes += sizeof(Quicklist) + object<Quicklist>()->bytes();
+        break;
+      case ValueType::ZSet:
+        bytes += sizeof(SortedSet) + object<SortedSet>()->bytes();
+        break;
+      case ValueType::String:
+        break;
+    }
+  }
+  return bytes;
+}
+
+std::string_view Entry::compact_value(std::string& scratch) const {
+  if (encoding == Encoding::Compact) {
+    return value.view();
+  }
+  switch (type) {
+    case ValueType::Hash:
+      object<FieldTable>()->flatten(scratch);
+      break;
+    case ValueType::List:
+      object<Quicklist>()->flatten(scratch);
+      break;
+    case ValueType::ZSet:
+      object<SortedSet>()->flatten(scratch);
+      break;
+    case ValueType::String:
+      break;
+  }
+  return scratch;
+}
+
+HashTable::HashTable(std::size_t min_capacity, bool versioned) {
+  if (min_capacity == 0) {
+    return;
+  }
+  std::size_t new_cap = kMinCapacity;
+  while (new_cap < min_capacity) {
+    new_cap *= 2;
+  }
+  ctrl = new int8_t[new_cap];
+  std::memset(ctrl, kEmpty, new_cap);
+  slots = static_cast<Entry*>(::operator new(new_cap * sizeof(Entry)));
+  cap = new_cap;
+  growth_left = max_load(new_cap);
+  if (versioned) {
+    versions = new std::atomic<uint32_t>[new_cap / kGroupWidth]();
+  }
+}
+
+HashTable::~HashTable() {
+  destroy_all();
+}
+
+HashTable::HashTable(HashTable&& other) noexcept
+    : ctrl(other.ctrl),
+      slots(other.slots),
+      cap(other.cap),
+      count(other.count),
+      growth_left(other.growth_left),
+      versions(other.versions),
+      locked(std::move(other.locked)) {
+  other.ctrl = nullptr;
+  other.slots = nullptr;
+  other.versions = nullptr;
+  other.cap = other.count = other.growth_left = 0;
+}
+
+HashTable& HashTable::operator=(HashTable&& other) noexcept {
+  if (this != &other) {
+    destroy_all();
+    std::swap(ctrl, other.ctrl);
+    std::swap(slots, other.slots);
+    std::swap(cap, other.cap);
+    std::swap(count, other.count);
+    std::swap(growth_left, other.growth_left);
+    std::swap(versions, other.versions);
+    std::swap(locked, other.locked);
+  }
+  return *this;
+}
+
+std::size_t HashTable::hash(std::string_view key) {
+  return std::hash<std::string_view>{}(key);
+}
+
+Entry* HashTable::find(std::string_view key, std::size_t hash) {
+  if (cap == 0) {
+    return nullptr;
+  }
+  const int8_t h2 = h2_of(hash);
+  ProbeSeq seq(hash, cap / kGroupWidth - 1);
+  while (true) {
+    Group g(ctrl + seq.offset());
+    for (uint32_t m = g.match(h2); m != 0; m &= m - 1) {
+      Entry& e = slots[seq.offset() + lowest_bit(m)];
+      if (e.key.view() == key) {
+        return &e;
+      }
+    }
+    if (g.match_empty() != 0) {
+      return nullptr;
+    }
+    seq.next();
+  }
+}
+
+void HashTable::prefetch_group(std::size_t hash) const {
+  if (cap != 0) {
+    __builtin_prefetch(ctrl + ProbeSeq(hash, cap / kGroupWidth - 1).offset());
+  }
+}
+
+void HashTable::prefetch_slot(std::size_t hash) const {
+  if (cap == 0) {
+    return;
+  }
+  const std::size_t offset = ProbeSeq(hash, cap / kGroupWidth - 1).offset();
+  const uint32_t m = Group(ctrl + offset).match(h2_of(hash));
+  if (m != 0) {
+    __builtin_prefetch(slots + offset + lowest_bit(m));
+  }
+}
+
+std::size_t HashTable::find_insert_slot(std::size_t hash) const {
+  ProbeSeq seq(hash, cap / kGroupWidth - 1);
+  while (true) {
+    uint32_t m = Group(ctrl + seq.offset()).match_empty_or_deleted();
+    if (m != 0) {
+      return seq.offset() + lowest_bit(m);
+    }
+    seq.next();
+  }
+}
+
+std::size_t HashTable::claim_slot(std::size_t hash) {
+  // Past the max load a probe may never meet an empty slot again, so an
+  // insert without room is a caller bug that would hang lookups later.
+  if (growth_left == 0) {
+    util::die("hash table insert without room");
+  }
+  const std::size_t idx = find_insert_slot(hash);
+  lock(&slots[idx]);
+  if (ctrl[idx] == kEmpty) {
+    --growth_left;
+  }
+  ctrl[idx] = h2_of(hash);
+  ++count;
+  return idx;
+}
+
+Entry* HashTable::insert(std::string_view key, std::size_t hash, SlabAllocator& alloc) {
+  Entry* e = new (&slots[claim_slot(hash)]) Entry{};
+  e->key.assign(key, alloc);
+  return e;
+}
+
+void HashTable::insert(Entry&& entry, std::size_t hash) {
+  new (&slots[claim_slot(hash)]) Entry(std::move(entry));
+}
+
+void HashTable::erase(Entry* entry) {
+  const std::size_t idx = static_cast<std::size_t>(entry - slots);
+  lock(entry);
+  entry->~Entry();
+  --count;
+  // Groups are probed whole, so a slot in a group that still has an empty byte
+  // never sits in the middle of another key's probe chain and can be freed.
+  const std::size_t group_start = idx & ~(kGroupWidth - 1);
+  if (Group(ctrl + group_start).match_empty() != 0) {
+    ctrl[idx] = kEmpty;
+    ++growth_left;
+  } else {
+    ctrl[idx] = kDeleted;
+  }
+}
+
+Entry* HashTable::sample(std::size_t pos) {
+  constexpr std::size_t kMaxGroups = 8;
+  if (count == 0) {
+    return nullptr;
+  }
+  const std::size_t group_mask = cap / kGroupWidth - 1;
+  std::size_t group = (pos / kGroupWidth) & group_mask;
+  // Rotating by pos picks a varying slot within the group rather than always the first.
+  const unsigned shift = static_cast<unsigned>(pos % kGroupWidth);
+  for (std::size_t n = 0; n <= std::min(kMaxGroups, group_mask); ++n) {
+    const uint32_t full = ~Group(ctrl + group * kGroupWidth).match_empty_or_deleted() & 0xFFFF;
+    if (full != 0) {
+      const uint32_t after = full >> shift;
+      const unsigned bit = after != 0 ? lowest_bit(after) + shift : lowest_bit(full);
+      return &slots[group * kGroupWidth + bit];
+    }
+    group = (group + 1) & group_mask;
+  }
+  return nullptr;
+}
+
+std::size_t HashTable::next_capacity() const {
+  if (cap == 0) {
+    return kMinCapacity;
+  }
+  return count <= max_load(cap) / 2 ? cap : cap * 2;
+}
+
+std::size_t HashTable::memory_bytes() const {
+  const std::size_t version_bytes = versions != nullptr ? cap / kGroupWidth * sizeof(*versions) : 0;
+  return cap * (sizeof(Entry) + 1) + version_bytes;
+}
+
+void HashTable::lock_slot(std::size_t idx) {
+  const std::size_t group = idx / kGroupWidth;
+  const uint32_t v = versions[group].load(std::memory_order_relaxed);
+  if (v % 2 != 0) {
+    return;
+  }
+  versions[group].store(v + 1, std::memory_order_relaxed);
+  // Orders the odd version before the writes to the group that follow.
+  std::atomic_thread_fence(std::memory_order_release);
+  locked.push_back(group);
+}
+
+void HashTable::unlock_all() {
+  for (std::size_t group : locked) {
+    versions[group].store(versions[group].load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+  locked.clear();
+}
+
+void HashTable::seal() {
+  if (versions == nullptr) {
+    return;
+  }
+  locked.clear();
+  for (std::size_t group = 0; group < cap / kGroupWidth; ++group) {
+    lock_slot(group * kGroupWidth);
+  }
+  locked.clear();
+}
+
+HashTable::PeekStatus HashTable::peek(const View& v, std::string_view key, std::size_t hash, Peeked& out) {
+  if (v.cap == 0) {
+    return PeekStatus::Missing;
+  }
+  const int8_t h2 = h2_of(hash);
+  ProbeSeq seq(hash, v.cap / kGroupWidth - 1);
+  while (true) {
+    const std::size_t group = seq.offset() / kGroupWidth;
+    const uint32_t version = v.versions[group].load(std::memory_order_acquire);
+    if (version % 2 != 0) {
+      return PeekStatus::Busy;
+    }
+    const Group g(v.ctrl + seq.offset());
+    for (uint32_t m = g.match(h2); m != 0; m &= m - 1) {
+      const Entry& e = v.slots[seq.offset() + lowest_bit(m)];
+      const SmallString::Copy candidate = e.key.copy();
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (v.versions[group].load(std::memory_order_relaxed) != version) {
+        return PeekStatus::Busy;
+      }
+      if (candidate.size() != key.size()) {
+        continue;
+      }
+      if (!candidate.readable()) {
+        return PeekStatus::Busy;
+      }
+      // The copy was whole, so a chunk pointer in it is a slab chunk; if it
+      // was reused since, the version check after comparing catches it.
+      const bool match = candidate.view() == key;
+      out.value = e.value.copy();
+      std::memcpy(&out.expire_at, &e.expire_at, sizeof(out.expire_at));
+      if (e.timer_only) {
+        out.expire_at = kNoExpiry;
+      }
+      out.type = e.type;
+      out.encoding = e.encoding;
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (v.versions[group].load(std::memory_order_relaxed) != version) {
+        return PeekStatus::Busy;
+      }
+      if (match) {
+        out.group = group;
+        out.version = version;
+        return PeekStatus::Found;
+      }
+    }
+    const bool ends = g.match_empty() != 0;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (v.versions[group].load(std::memory_order_relaxed) != version) {
+      return PeekStatus::Busy;
+    }
+    if (ends) {
+      return PeekStatus::Missing;
+    }
+    seq.next();
+  }
+}
+
+bool HashTable::unchanged(const View& v, const Peeked& p) {
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return v.versions[p.group].load(std::memory_order_relaxed) == p.version;
+}
+
+void HashTable::destroy_all() {
+  for (std::size_t i = 0; i < cap; ++i) {
+    if (is_full(ctrl[i])) {
+      slots[i].~Entry();
+    }
+  }
+  delete[] ctrl;
+  ::operator delete(slots);
+  delete[] versions;
+  ctrl = nullptr;
+  slots = nullptr;
+  versions = nullptr;
+  locked.clear();
+  cap = count = growth_left = 0;
+}
+
+}  // namespace db
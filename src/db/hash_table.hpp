@@ -0,0 +1,199 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "../util/time.hpp"
+#include "small_string.hpp"
+
+namespace db {
+
+inline constexpr util::TimePoint kNoExpiry = util::TimePoint::max();
+
+enum class ValueType : uint8_t { String, Hash, List, ZSet };
+
+// Where a value lives. Compact: in value itself, as the string or (for
+// collections) a listpack. Object: value holds a pointer to the FieldTable,
+// Quicklist or SortedSet a collection converted to past its size limits.
+enum class Encoding : uint8_t { Compact, Object };
+
+// Everything a key needs lives in its slot, so a hit costs one control-byte
+// probe plus one slot access.
+struct Entry {
+  SmallString key;
+  SmallString value;
+  // Deadline, or kNoExpiry. A key that has one also has an expiry-wheel
+  // timer due at or before it. Clearing the deadline leaves that timer
+  // queued, so expire_at is kept as its bound with timer_only set, and a
+  // later deadline no earlier than the bound needs no new timer.
+  util::TimePoint expire_at{kNoExpiry};
+  // Eviction metadata, read according to the store's policy: last access in
+  // clock milliseconds (LRU), or minutes of the last decay << 8 | a log
+  // access counter (LFU).
+  uint32_t access{0};
+  ValueType type{ValueType::String};
+  Encoding encoding{Encoding::Compact};
+  bool timer_only{false};
+  // Generation of the queued timer that belongs to this entry. Timers left
+  // behind by a deleted key of the same name carry another one and are
+  // dropped when they fire instead of being rescheduled.
+  uint8_t timer_gen{0};
+
+  Entry() = default;
+  ~Entry() { release_object(); }
+  Entry(Entry&& other) noexcept
+      : key(std::move(other.key)),
+        value(std::move(other.value)),
+        expire_at(other.expire_at),
+        access(other.access),
+        type(other.type),
+        encoding(other.encoding),
+        timer_only(other.timer_only),
+        timer_gen(other.timer_gen) {
+    other.encoding = Encoding::Compact;
+  }
+  Entry& operator=(Entry&&) = delete;
+
+  bool has_expiry() const { return expire_at != kNoExpiry && !timer_only; }
+  bool timer_armed() const { return expire_at != kNoExpiry; }
+
+  template <typename T>
+  T* object() const {
+    T* obj = nullptr;
+    std::memcpy(&obj, value.view().data(), sizeof(obj));
+    return obj;
+  }
+  // Frees an Object encoding's collection; the value is left empty.
+  void release_object();
+  // Bytes beyond the slot: out-of-line key and value, and any collection.
+  std::size_t heap_bytes() const;
+  // The value in its compact form: the string or listpack itself, or an
+  // Object collection flattened into scratch.
+  std::string_view compact_value(std::string& scratch) const;
+};
+
+static_assert(sizeof(Entry) == 64);
+
+// Open-addressing table in the Swiss-table style: one control byte per slot
+// (empty, deleted, or 7 bits of the hash) scanned 16 at a time with SSE2, and
+// entries stored inline in a flat slot array. Max load factor is 7/8.
+//
+// The table never resizes itself: callers check has_room() before inserting
+// and grow by migrating into a new table (see Store), so no single insert
+// pays for a full rehash.
+//
+// A versioned table can also be read by other threads without locks. Each
+// group of 16 slots has a version that is odd while its owner is changing
+// one of the group's slots: insert and erase mark their group, the owner
+// marks an entry's group with lock() before changing the entry in place,
+// and unlock_all() releases every marked group once the change is whole.
+// Readers probe through a View and discard what they read from a group
+// whose version was odd or moved meanwhile (a seqlock per group).
+class HashTable {
+ public:
+  explicit HashTable(std::size_t min_capacity = 0, bool versioned = false);
+  ~HashTable();
+
+  HashTable(HashTable&& other) noexcept;
+  HashTable& operator=(HashTable&& other) noexcept;
+  HashTable(const HashTable&) = delete;
+  HashTable& operator=(const HashTable&) = delete;
+
+  static std::size_t hash(std::string_view key);
+
+  Entry* find(std::string_view key, std::size_t hash);
+  // Batched lookups issue these ahead of find(): first the control bytes of
+  // the hash's first probe group, then (once those have arrived) the slot
+  // whose control byte matches, if any.
+  void prefetch_group(std::size_t hash) const;
+  void prefetch_slot(std::size_t hash) const;
+  // Inserts a key that is not present (empty value, no expiry), copying a
+  // long key into alloc. Requires has_room().
+  Entry* insert(std::string_view key, std::size_t hash, SlabAllocator& alloc);
+  // Moves in an entry whose key is not present. Requires has_room().
+  void insert(Entry&& entry, std::size_t hash);
+  void erase(Entry* entry);
+
+  bool has_room() const { return growth_left > 0; }
+  bool owns(const Entry* e) const { return e >= slots && e < slots + cap; }
+  // Capacity a replacement table should have: double when genuinely full,
+  // the same size when the load is mostly tombstones.
+  std::size_t next_capacity() const;
+
+  // Some full slot at or after pos (wrapping), for sampled eviction. Gives
+  // up after a few groups and returns null if they are all empty.
+  Entry* sample(std::size_t pos);
+
+  // Slot-level access for incremental migration.
+  bool slot_full(std::size_t i) const { return is_full(ctrl[i]); }
+  Entry& slot(std::size_t i) { return slots[i]; }
+  const Entry& slot(std::size_t i) const { return slots[i]; }
+
+  std::size_t size() const { return count; }
+  std::size_t capacity() const { return cap; }
+  // Slot, control byte and version arrays, full or empty.
+  std::size_t memory_bytes() const;
+
+  // Owner side of a versioned table; no-ops otherwise.
+  void lock(const Entry* e) {
+    if (versions != nullptr) {
+      lock_slot(static_cast<std::size_t>(e - slots));
+    }
+  }
+  void unlock_all();
+  // Leaves every group locked for good, before the table is retired, so
+  // readers still holding its View retry rather than find stale entries.
+  void seal();
+
+  // Reader side. The arrays a View points at stay put for the table's
+  // lifetime; keeping the table alive while they are read is the caller's
+  // business (see Store::peek).
+  struct View {
+    const int8_t* ctrl{nullptr};
+    const Entry* slots{nullptr};
+    const std::atomic<uint32_t>* versions{nullptr};
+    std::size_t cap{0};
+  };
+  View view() const { return View{ctrl, slots, versions, cap}; }
+  // An entry as a reader copied it. Its value's out-of-line bytes may be
+  // read until unchanged() says otherwise.
+  struct Peeked {
+    SmallString::Copy value;
+    util::TimePoint expire_at;
+    ValueType type;
+    Encoding encoding;
+    std::size_t group;
+    uint32_t version;
+  };
+  enum class PeekStatus { Found, Missing, Busy };
+  // Busy when a group on key's probe path was being written, or holds a
+  // candidate key in a large block that cannot be compared safely.
+  static PeekStatus peek(const View& v, std::string_view key, std::size_t hash, Peeked& out);
+  static bool unchanged(const View& v, const Peeked& p);
+
+ private:
+  static constexpr int8_t kEmpty = -128;
+  static constexpr int8_t kDeleted = -2;
+  static bool is_full(int8_t c) { return c >= 0; }
+
+  std::size_t find_insert_slot(std::size_t hash) const;
+  std::size_t claim_slot(std::size_t hash);
+  void lock_slot(std::size_t idx);
+  void destroy_all();
+
+  int8_t* ctrl{nullptr};
+  Entry* slots{nullptr};
+  std::size_t cap{0};
+  std::size_t count{0};
+  std::size_t growth_left{0};
+  std::atomic<uint32_t>* versions{nullptr};  // per group, when versioned
+  std::vector<std::size_t> locked;           // groups marked since unlock_all()
+};
+
+}  // namespace db
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "../util/crc16.hpp"
+
+namespace db {
+
+// Keys map onto 16384 hash slots as in Redis Cluster. Slots are the unit
+// that moves between nodes, and reactors within a node own slot % threads.
+inline constexpr std::size_t kKeySlots = 16384;
+
+// CRC16 of the key mod 16384. A hash tag, the part between the first '{'
+// and the next '}' when not empty, is hashed instead of the whole key, so
+// keys like {user:1}:name and {user:1}:email share a slot.
+constexpr std::uint16_t key_slot(std::string_view key) {
+  const std::size_t open = key.find('{');
+  if (open != std::string_view::npos) {
+    const std::size_t close = key.find('}', open + 1);
+    if (close != std::string_view::npos && close != open + 1) {
+      key = key.substr(open + 1, close - open - 1);
+    }
+  }
+  return static_cast<std::uint16_t>(util::crc16(key) & (kKeySlots - 1));
+}
+
+}  // namespace db
@@ -0,0 +1,119 @@
+#include "listpack.hpp"
+
+#include <cstring>
+
+namespace db::listpack {
+
+namespace {
+std::size_t read_varint(std::string_view lp, std::size_t& pos) {
+  std::size_t v = 0;
+  unsigned shift = 0;
+  while (true) {
+    const auto byte = static_cast<unsigned char>(lp[pos++]);
+    v |= static_cast<std::size_t>(byte & 0x7F) << shift;
+    if (byte < 0x80) {
+      return v;
+    }
+    shift += 7;
+  }
+}
+
+char* write_varint(char* p, std::size_t v) {
+  while (v >= 0x80) {
+    *p++ = static_cast<char>((v & 0x7F) | 0x80);
+    v >>= 7;
+  }
+  *p++ = static_cast<char>(v);
+  return p;
+}
+
+void set_size(std::string& lp, std::size_t n) {
+  const auto count = static_cast<uint32_t>(n);
+  std::memcpy(lp.data(), &count, sizeof(count));
+}
+}  // namespace
+
+void init(std::string& lp) {
+  lp.assign(kBegin, '\0');
+}
+
+std::size_t size(std::string_view lp) {
+  uint32_t count = 0;
+  std::memcpy(&count, lp.data(), sizeof(count));
+  return count;
+}
+
+bool valid(std::string_view lp) {
+  if (lp.size() < kBegin) {
+    return false;
+  }
+  std::size_t pos = kBegin;
+  std::size_t n = 0;
+  while (pos < lp.size()) {
+    std::size_t len = 0;
+    for (unsigned shift = 0;; shift += 7) {
+      if (pos == lp.size() || shift > 56) {
+        return false;
+      }
+      const auto byte = static_cast<unsigned char>(lp[pos++]);
+      len |= static_cast<std::size_t>(byte & 0x7F) << shift;
+      if (byte < 0x80) {
+        break;
+      }
+    }
+    if (len > lp.size() - pos) {
+      return false;
+    }
+    pos += len;
+    ++n;
+  }
+  return n == size(lp);
+}
+
+std::string_view next(std::string_view lp, std::size_t& pos) {
+  const std::size_t len = read_varint(lp, pos);
+  const std::string_view item = lp.substr(pos, len);
+  pos += len;
+  return item;
+}
+
+std::size_t seek(std::string_view lp, std::size_t index) {
+  std::size_t pos = kBegin;
+  for (std::size_t i = 0; i < index; ++i) {
+    const std::size_t len = read_varint(lp, pos);
+    pos += len;
+  }
+  return pos;
+}
+
+void insert(std::string& lp, std::size_t pos, std::string_view item) {
+  char header[10];
+  const std::size_t header_len = static_cast<std::size_t>(write_varint(header, item.size()) - header);
+  lp.insert(pos, header_len + item.size(), '\0');
+  std::memcpy(lp.data() + pos, header, header_len);
+  std::memcpy(lp.data() + pos + header_len, item.data(), item.size());
+  set_size(lp, listpack::size(lp) + 1);
+}
+
+void erase(std::string& lp, std::size_t pos, std::size_t count) {
+  std::size_t end = pos;
+  for (std::size_t i = 0; i < count; ++i) {
+    const std::size_t len = read_varint(lp, end);
+    end += len;
+  }
+  lp.erase(pos, end - pos);
+  set_size(lp, listpack::size(lp) - count);
+}
+
+void replace(std::string& lp, std::size_t pos, std::string_view item) {
+  std::size_t end = pos;
+  const std::size_t old_len = read_varint(lp, end);
+  end += old_len;
+  char header[10];
+  const std::size_t header_len = static_cast<std::size_t>(write_varint(header, item.size()) - header);
+  lp.replace(pos, end - pos, header_len + item.size(), '\0');
+  std::memcpy(lp.data() + pos, header, header_len);
+  std::memcpy(lp.data() + pos + header_len, item.data(), item.size());
+}
+
+}  // namespace db::listpack
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace db::listpack {
+
+// Small collections are stored as one contiguous buffer instead of a node
+// per element, in the spirit of Redis' listpack:
+//   u32 element count, then per element a LEB128 length and its bytes.
+// The buffer is a plain string, so it lives in an entry's SmallString value
+// (slab chunk, or inline when tiny). Readers take a string_view of it;
+// writers edit a std::string copy that the store assigns back, which reuses
+// the chunk in place when it still fits.
+//
+// Positions are byte offsets of an element's length prefix; kBegin is the
+// first element and lp.size() is the end.
+
+inline constexpr std::size_t kBegin = 4;
+
+// An empty listpack.
+void init(std::string& lp);
+std::size_t size(std::string_view lp);
+// Whether lp is well formed: every length prefix stays within the buffer and
+// the count matches. For listpacks from outside the process (RESTORE).
+bool valid(std::string_view lp);
+
+// Element at pos; advances pos to the next one.
+std::string_view next(std::string_view lp, std::size_t& pos);
+// Position of element index (index <= size), walking from the front.
+std::size_t seek(std::string_view lp, std::size_t index);
+
+// Inserts item before the element at pos (lp.size() appends).
+void insert(std::string& lp, std::size_t pos, std::string_view item);
+// Removes count elements starting at pos.
+void erase(std::string& lp, std::size_t pos, std::size_t count = 1);
+// Replaces the element at pos.
+void replace(std::string& lp, std::size_t pos, std::string_view item);
+
+inline void push_back(std::string& lp, std::string_view item) {
+  insert(lp, lp.size(), item);
+}
+
+}  // namespace db::listpack
@@ -0,0 +1,85 @@
+#include "quicklist.hpp"
+
+#include <algorithm>
+
+#include "listpack.hpp"
+
+namespace db {
+
+Quicklist::Quicklist(std::string_view lp) {
+  for (std::size_t pos = listpack::kBegin; pos < lp.size();) {
+    push_back(listpack::next(lp, pos));
+  }
+}
+
+void Quicklist::push_front(std::string_view item) {
+  if (nodes.empty() || nodes.front().size() + item.size() > kNodeBytes) {
+    nodes.emplace_front();
+    listpack::init(nodes.front());
+    payload += nodes.front().capacity();
+  }
+  std::string& node = nodes.front();
+  payload -= node.capacity();
+  listpack::insert(node, listpack::kBegin, item);
+  payload += node.capacity();
+  ++count;
+}
+
+void Quicklist::push_back(std::string_view item) {
+  if (nodes.empty() || nodes.back().size() + item.size() > kNodeBytes) {
+    nodes.emplace_back();
+    listpack::init(nodes.back());
+    payload += nodes.back().capacity();
+  }
+  std::string& node = nodes.back();
+  payload -= node.capacity();
+  listpack::push_back(node, item);
+  payload += node.capacity();
+  ++count;
+}
+
+void Quicklist::pop_back(std::string& out) {
+  std::string& node = nodes.back();
+  const std::size_t last = listpack::seek(node, listpack::size(node) - 1);
+  std::size_t pos = last;
+  out.append(listpack::next(node, pos));
+  payload -= node.capacity();
+  listpack::erase(node, last);
+  --count;
+  if (listpack::size(node) == 0) {
+    nodes.pop_back();
+  } else {
+    payload += node.capacity();
+  }
+}
+
+void Quicklist::range(std::size_t start, std::size_t stop, std::vector<std::string_view>& out) const {
+  if (start >= count || start > stop) {
+    return;
+  }
+  std::size_t remaining = std::min(stop, count - 1) - start + 1;
+  // Skip whole nodes by their counts, then walk elements.
+  auto it = nodes.begin();
+  while (start >= listpack::size(*it)) {
+    start -= listpack::size(*it);
+    ++it;
+  }
+  for (; remaining > 0; ++it) {
+    std::size_t pos = listpack::seek(*it, start);
+    for (; pos < it->size() && remaining > 0; --remaining) {
+      out.push_back(listpack::next(*it, pos));
+    }
+    start = 0;
+  }
+}
+
+void Quicklist::flatten(std::string& lp) const {
+  listpack::init(lp);
+  for (const std::string& node : nodes) {
+    for (std::size_t pos = listpack::kBegin; pos < node.size();) {
+      listpack::push_back(lp, listpack::next(node, pos));
+    }
+  }
+}
+
+}  // namespace db
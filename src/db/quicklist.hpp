@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace db {
+
+// Encoding of lists past the single-listpack limit: a deque of listpack
+// nodes of at most kNodeBytes each, so pushes and pops at either end touch
+// one small node and elements still cost a few bytes of overhead each.
+class Quicklist {
+ public:
+  static constexpr std::size_t kNodeBytes = 8 * 1024;
+
+  // Takes over the elements of a listpack.
+  explicit Quicklist(std::string_view lp);
+
+  std::size_t size() const { return count; }
+  // Bytes held by the nodes and the deque's bookkeeping for them.
+  std::size_t bytes() const { return payload + nodes.size() * kNodeOverhead; }
+
+  void push_front(std::string_view item);
+  void push_back(std::string_view item);
+  // Removes the last element, appending it to out. Requires size() > 0.
+  void pop_back(std::string& out);
+
+  // Elements [start, stop], clamped to the list. Views stay valid until the
+  // next change.
+  void range(std::size_t start, std::size_t stop, std::vector<std::string_view>& out) const;
+  // All elements as one listpack, for snapshots.
+  void flatten(std::string& lp) const;
+
+ private:
+  static constexpr std::size_t kNodeOverhead = sizeof(std::string) + 16;
+
+  std::deque<std::string> nodes;
+  std::size_t count{0};
+  std::size_t payload{0};  // sum of node capacities
+};
+
+}  // namespace db
@@ -0,0 +1,140 @@
+#include "slab_allocator.hpp"
+
+#include <cstdlib>
+#include <new>
+
+namespace db {
+
+namespace {
+constexpr std::array<std::uint32_t, 27> kClassSizes = {
+    32,   48,   64,   80,   96,   112,  128,                          // 16 byte steps
+    160,  192,  224,  256,  320,  384,  448,  512,  640,  768, 896,  // 4 per doubling
+    1024, 1280, 1536, 1792, 2048, 2560, 3072, 3584, 4096,
+};
+
+// Size class for every size up to kMaxClassSize in 16 byte steps.
+constexpr auto kClassLookup = [] {
+  std::array<std::uint8_t, 4096 / 16 + 1> table{};
+  std::size_t cls = 0;
+  for (std::size_t i = 0; i < table.size(); ++i) {
+    while (kClassSizes[cls] < i * 16) {
+      ++cls;
+    }
+    table[i] = static_cast<std::uint8_t>(cls);
+  }
+  return table;
+}();
+
+static_assert(kClassSizes.back() == SlabAllocator::kMaxClassSize);
+}  // namespace
+
+SlabAllocator::SlabAllocator() {
+  for (std::size_t i = 0; i < kNumClasses; ++i) {
+    classes[i].owner = this;
+    classes[i].chunk_size = kClassSizes[i];
+  }
+}
+
+SlabAllocator::~SlabAllocator() {
+  for (void* slab : slabs) {
+    std::free(slab);
+  }
+}
+
+std::size_t SlabAllocator::class_index(std::size_t size) {
+  return kClassLookup[(size + 15) / 16];
+}
+
+SlabAllocator::SizeClass& SlabAllocator::class_of(char* ptr) {
+  auto slab = reinterpret_cast<std::uintptr_t>(ptr) & ~(std::uintptr_t{kSlabBytes} - 1);
+  return *reinterpret_cast<SlabHeader*>(slab)->cls;
+}
+
+char* SlabAllocator::carve_slab(SizeClass& cls) {
+  void* slab = std::aligned_alloc(kSlabBytes, kSlabBytes);
+  if (slab == nullptr) {
+    throw std::bad_alloc();
+  }
+  slabs.push_back(slab);
+  static_cast<SlabHeader*>(slab)->cls = &cls;
+  ++cls.slabs;
+
+  char* base = static_cast<char*>(slab);
+  cls.carve = base + kSlabHeaderBytes;
+  cls.carve_end = cls.carve + (kSlabBytes - kSlabHeaderBytes) / cls.chunk_size * cls.chunk_size;
+  return cls.carve;
+}
+
+SlabAllocator::Block SlabAllocator::allocate(std::size_t size) {
+  if (size > kMaxClassSize) {
+    auto* header = static_cast<LargeHeader*>(::operator new(kLargeHeaderBytes + size));
+    header->owner = this;
+    header->size = static_cast<std::uint32_t>(size);
+    header->refs = 1;
+    ++large_count;
+    large_total += size;
+    return {reinterpret_cast<char*>(header) + kLargeHeaderBytes, static_cast<std::uint32_t>(size)};
+  }
+
+  SizeClass& cls = classes[class_index(size)];
+  char* chunk;
+  if (cls.free_list != nullptr) {
+    chunk = reinterpret_cast<char*>(cls.free_list);
+    cls.free_list = cls.free_list->next;
+  } else {
+    if (cls.carve == cls.carve_end) {
+      carve_slab(cls);
+    }
+    chunk = cls.carve;
+    cls.carve += cls.chunk_size;
+  }
+  ++cls.used;
+  cls.requested += size;
+  return {chunk, cls.chunk_size};
+}
+
+void SlabAllocator::deallocate(char* ptr, std::uint32_t cap, std::size_t size) {
+  if (cap > kMaxClassSize) {
+    unref(ptr);
+    return;
+  }
+  SizeClass& cls = class_of(ptr);
+  auto* chunk = reinterpret_cast<FreeChunk*>(ptr);
+  chunk->next = cls.free_list;
+  cls.free_list = chunk;
+  --cls.used;
+  cls.requested -= size;
+}
+
+void SlabAllocator::unref(const char* ptr) {
+  LargeHeader* header = large_header(ptr);
+  if (--header->refs > 0) {
+    return;
+  }
+  --header->owner->large_count;
+  header->owner->large_total -= header->size;
+  ::operator delete(header);
+}
+
+void SlabAllocator::resized(char* ptr, std::uint32_t cap, std::size_t old_size, std::size_t new_size) {
+  if (cap <= kMaxClassSize) {
+    SizeClass& cls = class_of(ptr);
+    cls.requested = cls.requested - old_size + new_size;
+  }
+}
+
+std::vector<SlabAllocator::ClassStats> SlabAllocator::class_stats() const {
+  std::vector<ClassStats> out;
+  out.reserve(kNumClasses);
+  for (const SizeClass& cls : classes) {
+    const std::size_t per_slab = (kSlabBytes - kSlabHeaderBytes) / cls.chunk_size;
+    out.push_back(ClassStats{cls.chunk_size, cls.slabs, cls.used, cls.slabs * per_slab - cls.used, cls.requested});
+  }
+  return out;
+}
+
+std::size_t SlabAllocator::resident_bytes() const {
+  return slabs.size() * kSlabBytes + large_total + large_count * kLargeHeaderBytes;
+}
+
+}  // namespace db
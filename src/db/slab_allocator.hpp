@@ -0,0 +1,119 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace db {
+
+// Size-class allocator for key and value bytes that do not fit inline in a
+// SmallString. Blocks up to kMaxClassSize come from 64KB slabs split into
+// equal chunks, one set of slabs per size class (16 byte steps up to 128,
+// then four classes per power of two, as in jemalloc); freed chunks go on
+// their class's free list and are reused before new slabs are carved.
+// Larger blocks come from the system heap.
+//
+// Slabs are 64KB aligned and start with a header naming their class, so a
+// block is freed from its pointer and capacity alone. Not thread safe: each
+// store owns one, and everything allocated from it is freed on its thread.
+//
+// Large blocks are refcounted, so a reply can send a value straight from its
+// block: ref() keeps the block alive past a delete or overwrite of the value
+// (and makes SmallString stop reusing it in place) until the matching
+// unref(). The owner's deallocate() counts as one unref.
+class SlabAllocator {
+ public:
+  static constexpr std::size_t kSlabBytes = 64 * 1024;
+  static constexpr std::size_t kMaxClassSize = 4096;
+
+  struct Block {
+    char* ptr;
+    std::uint32_t cap;
+  };
+
+  // What one size class holds, for spotting fragmentation: chunks handed out
+  // vs carved slab space, and bytes asked for vs chunk bytes in use.
+  struct ClassStats {
+    std::uint32_t chunk_size;
+    std::size_t slabs;
+    std::size_t used_chunks;
+    std::size_t free_chunks;
+    std::size_t requested_bytes;
+  };
+
+  SlabAllocator();
+  ~SlabAllocator();
+
+  SlabAllocator(const SlabAllocator&) = delete;
+  SlabAllocator& operator=(const SlabAllocator&) = delete;
+
+  // A block of at least size bytes; cap is the usable size.
+  Block allocate(std::size_t size);
+  // Returns a block; size is the length last stored in it.
+  static void deallocate(char* ptr, std::uint32_t cap, std::size_t size);
+  // Accounting for a block reused in place for a value of another length.
+  static void resized(char* ptr, std::uint32_t cap, std::size_t old_size, std::size_t new_size);
+
+  // Whether a string of size bytes held in a SmallString sits alone at the
+  // start of a large (refcounted) block.
+  static bool refcounted(std::size_t size) { return size > kMaxClassSize; }
+  static void ref(const char* ptr) { ++large_header(ptr)->refs; }
+  static void unref(const char* ptr);
+  // A large block someone besides its owner still references.
+  static bool shared(const char* ptr, std::uint32_t cap) {
+    return cap > kMaxClassSize && large_header(ptr)->refs > 1;
+  }
+
+  std::vector<ClassStats> class_stats() const;
+  // Blocks above kMaxClassSize.
+  std::size_t large_blocks() const { return large_count; }
+  std::size_t large_bytes() const { return large_total; }
+  // Everything taken from the system: slabs plus large blocks.
+  std::size_t resident_bytes() const;
+
+ private:
+  struct FreeChunk {
+    FreeChunk* next;
+  };
+
+  struct SizeClass {
+    SlabAllocator* owner;
+    std::uint32_t chunk_size;
+    FreeChunk* free_list{nullptr};
+    char* carve{nullptr};  // unused tail of the newest slab
+    char* carve_end{nullptr};
+    std::size_t slabs{0};
+    std::size_t used{0};
+    std::size_t requested{0};
+  };
+
+  struct SlabHeader {
+    SizeClass* cls;
+  };
+
+  // Large blocks carry a header too, so they can be found without a slab.
+  struct LargeHeader {
+    SlabAllocator* owner;
+    std::uint32_t size;
+    std::uint32_t refs;
+  };
+
+  static constexpr std::size_t kSlabHeaderBytes = 64;
+  static constexpr std::size_t kLargeHeaderBytes = 16;
+  static constexpr std::size_t kNumClasses = 27;
+
+  static std::size_t class_index(std::size_t size);
+  static SizeClass& class_of(char* ptr);
+  static LargeHeader* large_header(const char* ptr) {
+    return reinterpret_cast<LargeHeader*>(const_cast<char*>(ptr) - kLargeHeaderBytes);
+  }
+  char* carve_slab(SizeClass& cls);
+
+  std::array<SizeClass, kNumClasses> classes;
+  std::vector<void*> slabs;
+  std::size_t large_count{0};
+  std::size_t large_total{0};
+};
+
+}  // namespace db
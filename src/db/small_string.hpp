@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#include "slab_allocator.hpp"
+
+namespace db {
+
+// 24-byte string that keeps up to 23 bytes inline and larger strings in a
+// SlabAllocator block. The last byte is the inline length, or kHeapTag.
+// Reassigning a heap string whose block is large enough (and not referenced
+// by a pending reply) overwrites it in place. Blocks know their allocator, so
+// destruction needs no reference.
+class SmallString {
+ public:
+  static constexpr std::size_t kInlineCapacity = 23;
+
+  SmallString() noexcept { raw.buf[kTagIndex] = 0; }
+  SmallString(std::string_view s, SlabAllocator& alloc) {
+    raw.buf[kTagIndex] = 0;
+    assign(s, alloc);
+  }
+  ~SmallString() { release(); }
+
+  SmallString(SmallString&& other) noexcept {
+    std::memcpy(&raw, &other.raw, sizeof(raw));
+    other.raw.buf[kTagIndex] = 0;
+  }
+  SmallString& operator=(SmallString&& other) noexcept {
+    if (this != &other) {
+      release();
+      std::memcpy(&raw, &other.raw, sizeof(raw));
+      other.raw.buf[kTagIndex] = 0;
+    }
+    return *this;
+  }
+  SmallString(const SmallString&) = delete;
+  SmallString& operator=(const SmallString&) = delete;
+
+  void assign(std::string_view s, SlabAllocator& alloc) {
+    if (s.size() <= kInlineCapacity) {
+      release();
+      std::memcpy(raw.buf, s.data(), s.size());
+      raw.buf[kTagIndex] = static_cast<char>(s.size());
+      return;
+    }
+    if (!on_heap() || raw.heap.cap < s.size() || SlabAllocator::shared(raw.heap.ptr, raw.heap.cap)) {
+      release();
+      const SlabAllocator::Block block = alloc.allocate(s.size());
+      raw.heap.ptr = block.ptr;
+      raw.heap.cap = block.cap;
+      raw.buf[kTagIndex] = static_cast<char>(kHeapTag);
+    } else {
+      SlabAllocator::resized(raw.heap.ptr, raw.heap.cap, raw.heap.size, s.size());
+    }
+    std::memcpy(raw.heap.ptr, s.data(), s.size());
+    raw.heap.size = static_cast<std::uint32_t>(s.size());
+  }
+
+  bool on_heap() const { return static_cast<unsigned char>(raw.buf[kTagIndex]) == kHeapTag; }
+  std::size_t size() const { return on_heap() ? raw.heap.size : static_cast<unsigned char>(raw.buf[kTagIndex]); }
+  std::string_view view() const {
+    return on_heap() ? std::string_view(raw.heap.ptr, raw.heap.size)
+                     : std::string_view(raw.buf, static_cast<unsigned char>(raw.buf[kTagIndex]));
+  }
+  // Bytes allocated outside the object.
+  std::size_t heap_bytes() const { return on_heap() ? raw.heap.cap : 0; }
+
+  // For lock-free readers on other threads: the 24 bytes copied while the
+  // owner may be rewriting them, to be validated against the owner's version
+  // before being trusted.
+  class Copy;
+  Copy copy() const;
+
+ private:
+  static constexpr std::size_t kTagIndex = 23;
+  static constexpr unsigned char kHeapTag = 0xFF;
+
+  void release() {
+    if (on_heap()) {
+      SlabAllocator::deallocate(raw.heap.ptr, raw.heap.cap, raw.heap.size);
+      raw.buf[kTagIndex] = 0;
+    }
+  }
+
+  union Raw {
+    struct {
+      char* ptr;
+      std::uint32_t size;
+      std::uint32_t cap;
+    } heap;
+    char buf[24];
+  } raw;
+};
+
+static_assert(sizeof(SmallString) == 24);
+
+class SmallString::Copy {
+ public:
+  std::size_t size() const { return heap() ? raw.heap.size : static_cast<unsigned char>(raw.buf[kTagIndex]); }
+  // Out-of-line bytes may only be read from a slab chunk: slabs live as long
+  // as their allocator, while a large block can be freed under the reader.
+  bool readable() const { return !heap() || raw.heap.cap <= SlabAllocator::kMaxClassSize; }
+  // Views this copy for inline bytes, the chunk otherwise. Requires readable().
+  std::string_view view() const {
+    return heap() ? std::string_view(raw.heap.ptr, raw.heap.size)
+                  : std::string_view(raw.buf, static_cast<unsigned char>(raw.buf[kTagIndex]));
+  }
+
+ private:
+  friend class SmallString;
+  bool heap() const { return static_cast<unsigned char>(raw.buf[kTagIndex]) == kHeapTag; }
+
+  Raw raw;
+};
+
+inline SmallString::Copy SmallString::copy() const {
+  Copy c;
+  std::memcpy(&c.raw, &raw, sizeof(raw));
+  return c;
+}
+
+}  // namespace db
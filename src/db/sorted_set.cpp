@@ -0,0 +1,215 @@
+#include "sorted_set.hpp"
+
+#include <algorithm>
+#include <new>
+
+#include "listpack.hpp"
+
+namespace db {
+
+SortedSet::SortedSet(std::string_view lp) : head(make_node(kMaxLevel, 0, {})) {
+  for (std::size_t pos = listpack::kBegin; pos < lp.size();) {
+    const std::string_view member = listpack::next(lp, pos);
+    insert(read_score(listpack::next(lp, pos)), member);
+  }
+}
+
+SortedSet::~SortedSet() {
+  Node* x = head->level()[0].forward;
+  while (x != nullptr) {
+    Node* next = x->level()[0].forward;
+    free_node(x);
+    x = next;
+  }
+  free_node(head);
+}
+
+int SortedSet::random_level() {
+  // Each level is kept with probability 1/4, as in Redis.
+  thread_local uint64_t state = 0x2545F4914F6CDD1DULL;
+  int levels = 1;
+  while (levels < kMaxLevel) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    if ((state & 3) != 0) {
+      break;
+    }
+    ++levels;
+  }
+  return levels;
+}
+
+std::size_t SortedSet::node_cost(int levels, std::size_t member_size) {
+  constexpr std::size_t kIndexEntry = 32;
+  constexpr std::size_t kInlineMember = 15;
+  return sizeof(Node) + static_cast<std::size_t>(levels) * sizeof(Level) +
+         (member_size > kInlineMember ? member_size + 1 : 0) + kIndexEntry;
+}
+
+SortedSet::Node* SortedSet::make_node(int levels, double score, std::string_view member) {
+  const auto n = static_cast<std::size_t>(levels);
+  void* mem = ::operator new(sizeof(Node) + n * sizeof(Level));
+  Node* node = new (mem) Node{std::string(member), score, nullptr, levels};
+  for (std::size_t i = 0; i < n; ++i) {
+    node->level()[i] = Level{nullptr, 0};
+  }
+  node_bytes += node_cost(levels, member.size());
+  return node;
+}
+
+void SortedSet::free_node(Node* n) {
+  node_bytes -= node_cost(n->levels, n->member.size());
+  n->~Node();
+  ::operator delete(n);
+}
+
+bool SortedSet::add(double score, std::string_view member) {
+  auto it = index.find(member);
+  if (it == index.end()) {
+    insert(score, member);
+    return true;
+  }
+  if (it->second->score != score) {
+    remove(it->second->score, member);
+    insert(score, member);
+  }
+  return false;
+}
+
+void SortedSet::insert(double score, std::string_view member) {
+  Node* update[kMaxLevel];
+  std::size_t rank[kMaxLevel];
+  Node* x = head;
+  for (int i = level - 1; i >= 0; --i) {
+    rank[i] = i == level - 1 ? 0 : rank[i + 1];
+    while (x->level()[i].forward != nullptr && before(x->level()[i].forward, score, member)) {
+      rank[i] += x->level()[i].span;
+      x = x->level()[i].forward;
+    }
+    update[i] = x;
+  }
+
+  const int levels = random_level();
+  if (levels > level) {
+    for (int i = level; i < levels; ++i) {
+      rank[i] = 0;
+      update[i] = head;
+      head->level()[i].span = length;
+    }
+    level = levels;
+  }
+
+  x = make_node(levels, score, member);
+  for (int i = 0; i < levels; ++i) {
+    Level& prev = update[i]->level()[i];
+    x->level()[i].forward = prev.forward;
+    prev.forward = x;
+    // rank[0] - rank[i] elements lie between update[i] and the new node.
+    x->level()[i].span = prev.span - (rank[0] - rank[i]);
+    prev.span = rank[0] - rank[i] + 1;
+  }
+  for (int i = levels; i < level; ++i) {
+    ++update[i]->level()[i].span;
+  }
+
+  x->backward = update[0] == head ? nullptr : update[0];
+  if (x->level()[0].forward != nullptr) {
+    x->level()[0].forward->backward = x;
+  } else {
+    tail = x;
+  }
+  ++length;
+  index.emplace(x->member, x);
+}
+
+void SortedSet::remove(double score, std::string_view member) {
+  Node* update[kMaxLevel];
+  Node* x = head;
+  for (int i = level - 1; i >= 0; --i) {
+    while (x->level()[i].forward != nullptr && before(x->level()[i].forward, score, member)) {
+      x = x->level()[i].forward;
+    }
+    update[i] = x;
+  }
+  x = x->level()[0].forward;
+
+  for (int i = 0; i < level; ++i) {
+    Level& prev = update[i]->level()[i];
+    if (prev.forward == x) {
+      prev.span += x->level()[i].span - 1;
+      prev.forward = x->level()[i].forward;
+    } else {
+      --prev.span;
+    }
+  }
+  if (x->level()[0].forward != nullptr) {
+    x->level()[0].forward->backward = x->backward;
+  } else {
+    tail = x->backward;
+  }
+  while (level > 1 && head->level()[level - 1].forward == nullptr) {
+    --level;
+  }
+  --length;
+  index.erase(x->member);
+  free_node(x);
+}
+
+const SortedSet::Node* SortedSet::at_rank(std::size_t rank) const {
+  // Spans count from 1: the head is rank 0.
+  const std::size_t target = rank + 1;
+  std::size_t traversed = 0;
+  const Node* x = head;
+  for (int i = level - 1; i >= 0; --i) {
+    while (x->level()[i].forward != nullptr && traversed + x->level()[i].span <= target) {
+      traversed += x->level()[i].span;
+      x = x->level()[i].forward;
+    }
+    if (traversed == target) {
+      return x;
+    }
+  }
+  return nullptr;
+}
+
+void SortedSet::range(std::size_t start, std::size_t stop, std::vector<Item>& out) const {
+  if (start >= length || start > stop) {
+    return;
+  }
+  stop = std::min(stop, length - 1);
+  const Node* x = at_rank(start);
+  for (std::size_t n = stop - start + 1; n > 0 && x != nullptr; --n) {
+    out.emplace_back(x->member, x->score);
+    x = x->level()[0].forward;
+  }
+}
+
+void SortedSet::range_by_score(const ScoreRange& r, std::size_t offset, std::size_t limit,
+                               std::vector<Item>& out) const {
+  // Last node below the range, then walk forward.
+  const Node* x = head;
+  for (int i = level - 1; i >= 0; --i) {
+    while (x->level()[i].forward != nullptr && !r.above_min(x->level()[i].forward->score)) {
+      x = x->level()[i].forward;
+    }
+  }
+  x = x->level()[0].forward;
+  for (; x != nullptr && offset > 0 && r.below_max(x->score); --offset) {
+    x = x->level()[0].forward;
+  }
+  for (std::size_t n = 0; x != nullptr && n < limit && r.below_max(x->score); ++n) {
+    out.emplace_back(x->member, x->score);
+    x = x->level()[0].forward;
+  }
+}
+
+void SortedSet::flatten(std::string& lp) const {
+  listpack::init(lp);
+  for (const Node* x = head->level()[0].forward; x != nullptr; x = x->level()[0].forward) {
+    listpack::push_back(lp, x->member);
+    listpack::push_back(lp, score_bytes(x->score));
+  }
+}
+
+}  // namespace db
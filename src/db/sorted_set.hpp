@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace db {
+
+// In a sorted set's listpack, each member is followed by the raw 8 bytes of
+// its score.
+inline std::string_view score_bytes(const double& score) {
+  return {reinterpret_cast<const char*>(&score), sizeof(score)};
+}
+inline double read_score(std::string_view bytes) {
+  double score = 0;
+  std::memcpy(&score, bytes.data(), sizeof(score));
+  return score;
+}
+
+// Score interval for ZRANGEBYSCORE; either end may be exclusive.
+struct ScoreRange {
+  double min;
+  double max;
+  bool min_exclusive{false};
+  bool max_exclusive{false};
+
+  bool above_min(double score) const { return min_exclusive ? score > min : score >= min; }
+  bool below_max(double score) const { return max_exclusive ? score < max : score <= max; }
+};
+
+// Encoding of sorted sets past the listpack limits: a skiplist ordered by
+// (score, member) whose links record their span, so rank lookups are
+// O(log n), plus a member index for O(1) score lookups (as Redis' zset).
+class SortedSet {
+ public:
+  using Item = std::pair<std::string_view, double>;
+
+  // Takes over the member/score pairs of a listpack, already in order.
+  explicit SortedSet(std::string_view lp);
+  ~SortedSet();
+
+  SortedSet(const SortedSet&) = delete;
+  SortedSet& operator=(const SortedSet&) = delete;
+
+  std::size_t size() const { return length; }
+  // Nodes, member strings and index buckets.
+  std::size_t bytes() const { return node_bytes + index.bucket_count() * sizeof(void*); }
+
+  // Adds member or moves it to a new score; true if it was not present.
+  bool add(double score, std::string_view member);
+
+  // Elements with ranks [start, stop], clamped, in order.
+  void range(std::size_t start, std::size_t stop, std::vector<Item>& out) const;
+  // Elements with scores in r, in order, skipping offset and returning at
+  // most limit.
+  void range_by_score(const ScoreRange& r, std::size_t offset, std::size_t limit, std::vector<Item>& out) const;
+  // All pairs as one listpack in order, for snapshots.
+  void flatten(std::string& lp) const;
+
+ private:
+  static constexpr int kMaxLevel = 32;
+
+  struct Node;
+  struct Level {
+    Node* forward;
+    std::size_t span;  // elements this link skips over, for ranks
+  };
+  struct Node {
+    std::string member;
+    double score;
+    Node* backward;
+    int levels;
+    Level* level() { return reinterpret_cast<Level*>(this + 1); }
+    const Level* level() const { return reinterpret_cast<const Level*>(this + 1); }
+  };
+
+  static bool before(const Node* n, double score, std::string_view member) {
+    return n->score < score || (n->score == score && n->member < member);
+  }
+  static int random_level();
+  // Bytes a node accounts for: the node and its links, a member too long for
+  // the string's inline buffer, and its index entry.
+  static std::size_t node_cost(int levels, std::size_t member_size);
+
+  Node* make_node(int levels, double score, std::string_view member);
+  void free_node(Node* n);
+  void insert(double score, std::string_view member);
+  void remove(double score, std::string_view member);
+  // Element at 0-based rank, or null.
+  const Node* at_rank(std::size_t rank) const;
+
+  Node* head;
+  Node* tail{nullptr};
+  int level{1};
+  std::size_t length{0};
+  std::size_t node_bytes{0};
+  std::unordered_map<std::string_view, Node*> index;
+};
+
+}  // namespace db
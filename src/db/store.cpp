@@ -1,115 +1,562 @@
 #include "store.hpp"
 
+#include <algorithm>
 #include <utility>
 
 namespace db {
 
-std::optional<std::string_view> Store::get(std::string_view key) {
-  auto it = kv.find(key);
-  if (it == kv.end()) {
-    return std::nullopt;
+namespace {
+// Slots migrated per command while resizing, and again per insert. A new
+// table is at least as big as the old one, so this outpaces inserts and the
+// migration always finishes before the new table fills.
+constexpr std::size_t kMigrateSlotsPerOp = 32;
+constexpr std::size_t kMigrateSlotsPerStep = 1024;
+
+// How many keys ahead batched lookups prefetch. Far enough to cover a DRAM
+// miss per key, near enough that the lines are still cached when used.
+constexpr std::size_t kPrefetchDistance = 16;
+
+
+// LFU counters start above zero so new keys survive their first sample, and
+// grow with probability 1 / ((counter - kLfuInit) * kLfuLogFactor + 1), so
+// 255 takes about a million hits. They lose one per idle minute.
+constexpr uint32_t kLfuInit = 5;
+constexpr uint32_t kLfuLogFactor = 10;
+constexpr int64_t kLfuDecayMs = 60 * 1000;
+
+// Slot probes per requested sample before volatile-ttl gives up on finding
+// keys with a deadline.
+constexpr unsigned kSampleAttempts = 4;
+
+// Consistent views a peek tries for before leaving the key to its owner.
+constexpr int kPeekAttempts = 4;
+
+uint32_t lfu_minutes(int64_t clock_ms) {
+  return static_cast<uint32_t>(clock_ms / kLfuDecayMs) & 0xFFFFFF;
+}
+
+// Counter after decaying it for the minutes since it was last touched.
+uint32_t lfu_counter(uint32_t access, int64_t clock_ms) {
+  const uint32_t idle = (lfu_minutes(clock_ms) - (access >> 8)) & 0xFFFFFF;
+  const uint32_t counter = access & 0xFF;
+  return counter > idle ? counter - idle : 0;
+}
+}  // namespace
+
+std::size_t Store::footprint(const Entry& e) {
+  // Slot and control byte, plus what lives outside the slot.
+  return sizeof(Entry) + 1 + e.heap_bytes();
+}
+
+Entry* Store::lookup(std::string_view key, std::size_t hash) {
+  if (rehashing()) {
+    if (Entry* e = draining.find(key, hash)) {
+      return e;
+    }
   }
-  auto exp_it = expires.find(key);
-  if (exp_it == expires.end()) {
-    return it->second;
+  return table.find(key, hash);
+}
+
+Entry* Store::find(std::string_view key, std::size_t hash) {
+  if (rehashing()) {
+    migrate(kMigrateSlotsPerOp);
+  }
+  return lookup(key, hash);
+}
+
+Entry* Store::live(Entry* e) {
+  if (e == nullptr || !e->has_expiry()) {
+    return e;
   }
-  auto now = util::now();
-  if (exp_it->second <= now) {
-    kv.erase(it);
-    expires.erase(exp_it);
-    return std::nullopt;
+  if (e->expire_at <= util::now()) {
+    erase(e);
+    return nullptr;
   }
-  return it->second;
+  return e;
 }
 
-void Store::set(std::string key, std::string value) {
-  remove_expiration(key);
-  kv.insert_or_assign(std::move(key), std::move(value));
+void Store::erase(Entry* e) {
+  count_key(e->key.view(), -1);
+  used -= footprint(*e);
+  if (e->has_expiry()) {
+    --volatile_keys;
+  }
+  if (draining.owns(e)) {
+    draining.erase(e);
+  } else {
+    table.erase(e);
+  }
 }
 
-bool Store::del(std::string_view key) {
-  auto it = kv.find(key);
-  if (it == kv.end()) {
+bool Store::get(std::string_view key, std::optional<std::string_view>& value) {
+  Entry* e = find_live(key);
+  if (e == nullptr) {
+    value.reset();
+    return true;
+  }
+  if (e->type != ValueType::String) {
     return false;
   }
-  kv.erase(it);
-  auto exp_it = expires.find(key);
-  if (exp_it != expires.end()) {
-    expires.erase(exp_it);
+  touch(e);
+  value = e->value.view();
+  return true;
+}
+
+Entry* Store::find_or_insert(std::string_view key, std::size_t hash) {
+  Entry* e = find(key, hash);
+  if (e == nullptr) {
+    // Inserts pay a migration step of their own on top of the lookup's, so a
+    // resize drains at least twice as fast as the new table fills.
+    if (rehashing()) {
+      migrate(kMigrateSlotsPerOp);
+    }
+    if (!table.has_room()) {
+      start_resize();
+    }
+    e = table.insert(key, hash, slab);
+    count_key(key, 1);
+    used += footprint(*e);
+    e->access = policy == EvictionPolicy::AllKeysLfu ? lfu_minutes(clock_ms) << 8 | kLfuInit
+                                                     : static_cast<uint32_t>(clock_ms);
+  } else {
+    touch(e);
+  }
+  return e;
+}
+
+void Store::assign_value(Entry* e, std::string_view value) {
+  lock(e);
+  used -= e->value.heap_bytes();
+  e->value.assign(value, slab);
+  used += e->value.heap_bytes();
+}
+
+void Store::set_deadline(Entry* e, util::TimePoint deadline) {
+  if (deadline == kNoExpiry && !e->has_expiry()) {
+    return;
+  }
+  lock(e);
+  volatile_keys += deadline != kNoExpiry;
+  volatile_keys -= e->has_expiry();
+  if (deadline == kNoExpiry) {
+    e->timer_only = true;
+    return;
   }
+  // A queued timer that fires early is rescheduled to the deadline then, so
+  // refreshing a TTL does not pile up timers.
+  if (!e->timer_armed() || deadline < e->expire_at) {
+    arm_timer(e, deadline);
+  }
+  e->expire_at = deadline;
+  e->timer_only = false;
+}
+
+void Store::arm_timer(Entry* e, util::TimePoint deadline) {
+  // A fresh generation per timer, so an older one that happens to match
+  // after the counter wraps owns the entry for one firing at most.
+  e->timer_gen = ++timer_gens;
+  wheel.schedule(e->key.view(), util::to_millis_ceil(deadline), e->timer_gen);
+}
+
+void Store::make_string(Entry* e) {
+  if (e->type != ValueType::String) {
+    lock(e);
+    used -= footprint(*e);
+    e->release_object();
+    e->type = ValueType::String;
+    used += footprint(*e);
+  }
+}
+
+void Store::set(std::string_view key, std::string_view value) {
+  Entry* e = find_or_insert(key);
+  make_string(e);
+  assign_value(e, value);
+  set_deadline(e, kNoExpiry);
+}
+
+void Store::reserve(std::size_t keys) {
+  if (size() == 0 && !rehashing()) {
+    // Leave headroom under the 7/8 max load.
+    replace_table(table, HashTable(keys + keys / 4, epochs != nullptr));
+  }
+}
+
+void Store::clear() {
+  replace_table(table, HashTable());
+  replace_table(draining, HashTable());
+  migrate_cursor = 0;
+  used = 0;
+  volatile_keys = 0;
+  if (slot_keys) {
+    for (std::size_t i = 0; i < kKeySlots; ++i) {
+      slot_keys[i].store(0, std::memory_order_relaxed);
+    }
+  }
+}
+
+void Store::count_slots() {
+  slot_keys = std::make_unique<std::atomic<std::uint32_t>[]>(kKeySlots);
+}
+
+void Store::restore(std::string_view key, std::string_view value, util::TimePoint deadline, ValueType type) {
+  Entry* e = find_or_insert(key);
+  lock(e);
+  make_string(e);
+  if (type == ValueType::String) {
+    assign_value(e, value);
+  } else {
+    e->type = type;
+    scratch.assign(value);
+    store_listpack(e, scratch);
+  }
+  set_deadline(e, deadline);
+}
+
+bool Store::del(std::string_view key) {
+  Entry* e = find(key);
+  if (e == nullptr) {
+    return false;
+  }
+  erase(e);
   return true;
 }
 
 bool Store::exists(std::string_view key) {
-  auto it = kv.find(key);
-  if (it == kv.end()) {
+  Entry* e = find_live(key);
+  if (e == nullptr) {
     return false;
   }
-  auto exp_it = expires.find(key);
-  if (exp_it == expires.end()) {
-    return true;
+  touch(e);
+  return true;
+}
+
+void Store::hash_batch(const std::string_view* keys, std::size_t n, std::size_t stride) {
+  batch_hashes.resize(n);
+  for (std::size_t i = 0; i < n; ++i) {
+    batch_hashes[i] = HashTable::hash(keys[i * stride]);
   }
-  auto now = util::now();
-  if (exp_it->second <= now) {
-    kv.erase(it);
-    expires.erase(exp_it);
-    return false;
+  for (std::size_t i = 0; i < std::min(n, kPrefetchDistance); ++i) {
+    table.prefetch_group(batch_hashes[i]);
+    draining.prefetch_group(batch_hashes[i]);
+  }
+}
+
+void Store::prefetch_batch(std::size_t i) const {
+  // Control bytes requested kPrefetchDistance keys ago should have arrived by
+  // the time their slot is wanted, halfway there.
+  if (i + kPrefetchDistance < batch_hashes.size()) {
+    table.prefetch_group(batch_hashes[i + kPrefetchDistance]);
+    draining.prefetch_group(batch_hashes[i + kPrefetchDistance]);
+  }
+  if (i + kPrefetchDistance / 2 < batch_hashes.size()) {
+    table.prefetch_slot(batch_hashes[i + kPrefetchDistance / 2]);
+    draining.prefetch_slot(batch_hashes[i + kPrefetchDistance / 2]);
+  }
+}
+
+void Store::get_many(const std::string_view* keys, std::size_t n,
+                     std::vector<std::optional<std::string_view>>& values) {
+  // Migrate for the whole batch up front: nothing may move once views are handed out.
+  if (rehashing()) {
+    migrate(kMigrateSlotsPerOp * n);
+  }
+  hash_batch(keys, n, 1);
+  values.clear();
+  for (std::size_t i = 0; i < n; ++i) {
+    prefetch_batch(i);
+    Entry* e = live(lookup(keys[i], batch_hashes[i]));
+    if (e == nullptr || e->type != ValueType::String) {
+      values.emplace_back();
+      continue;
+    }
+    touch(e);
+    values.emplace_back(e->value.view());
+  }
+}
+
+bool Store::set_many(const std::string_view* kv, std::size_t pairs, bool only_if_absent) {
+  hash_batch(kv, pairs, 2);
+  if (only_if_absent) {
+    for (std::size_t i = 0; i < pairs; ++i) {
+      prefetch_batch(i);
+      if (live(find(kv[2 * i], batch_hashes[i])) != nullptr) {
+        return false;
+      }
+    }
+  }
+  for (std::size_t i = 0; i < pairs; ++i) {
+    prefetch_batch(i);
+    Entry* e = find_or_insert(kv[2 * i], batch_hashes[i]);
+    make_string(e);
+    assign_value(e, kv[2 * i + 1]);
+    set_deadline(e, kNoExpiry);
   }
   return true;
 }
 
 bool Store::expire(std::string_view key, long long ttl_ms) {
-  auto it = kv.find(key);
-  if (it == kv.end()) {
+  return expire_at(key, util::now() + std::chrono::milliseconds(ttl_ms));
+}
+
+bool Store::expire_at(std::string_view key, util::TimePoint deadline) {
+  Entry* e = find_live(key);
+  if (e == nullptr) {
     return false;
   }
-  auto deadline = util::now() + std::chrono::milliseconds(ttl_ms);
-  auto exp_it = expires.find(key);
-  if (exp_it != expires.end()) {
-    exp_it->second = deadline;
-  } else {
-    expires.emplace(std::string(key), deadline);
-  }
+  set_deadline(e, deadline);
   return true;
 }
 
 long long Store::ttl(std::string_view key) {
-  auto it = kv.find(key);
-  if (it == kv.end()) {
+  Entry* e = find_live(key);
+  if (e == nullptr) {
     return -2;
   }
-  auto exp_it = expires.find(key);
-  if (exp_it == expires.end()) {
+  if (!e->has_expiry()) {
     return -1;
   }
-  auto now = util::now();
-  if (exp_it->second <= now) {
-    kv.erase(it);
-    expires.erase(exp_it);
-    return -2;
-  }
-  auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(exp_it->second - now).count();
+  auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(e->expire_at - util::now()).count();
   return remaining < 0 ? 0 : remaining;
 }
 
-void Store::sweep_expired() {
-  auto now = util::now();
-  for (auto it = expires.begin(); it != expires.end();) {
-    if (it->second <= now) {
-      kv.erase(it->first);
-      it = expires.erase(it);
-    } 
-    else {
-      ++it;
+bool Store::expire_cycle(std::size_t max_keys, std::chrono::microseconds budget) {
+  const util::TimePoint start = util::now();
+  wheel.advance(util::to_millis(start));
+
+  ExpiryWheel::Timer timer{};
+  std::size_t handled = 0;
+  util::TimePoint now = start;
+  while (handled < max_keys && wheel.take_due(timer)) {
+    ++handled;
+
+    // A timer of another generation was left behind by a deleted key of the
+    // same name, or replaced by an earlier one; it just goes.
+    Entry* e = find(timer.key.view());
+    if (e != nullptr && e->timer_armed() && e->timer_gen == timer.gen) {
+      if (e->timer_only) {
+        // The key lost its deadline; nothing is queued for it any more.
+        lock(e);
+        e->expire_at = kNoExpiry;
+        e->timer_only = false;
+      } else if (e->expire_at <= now) {
+        erase(e);
+      } else {
+        arm_timer(e, e->expire_at);
+      }
+    }
+
+    // Reading the clock per key would cost more than most deletions.
+    if (handled % 16 == 0) {
+      now = util::now();
+      if (now - start >= budget) {
+        break;
+      }
+    }
+  }
+  publish();
+  return wheel.has_due();
+}
+
+bool Store::rehash_step(std::chrono::microseconds budget) {
+  if (!rehashing()) {
+    return false;
+  }
+  const auto deadline = util::now() + budget;
+  do {
+    migrate(kMigrateSlotsPerStep);
+  } while (rehashing() && util::now() < deadline);
+  publish();
+  return rehashing();
+}
+
+void Store::start_resize() {
+  // Sized for the keys in both tables: with any resize still in flight (the
+  // new table filled before the old one drained) the rest of the old table
+  // moves straight into next rather than into the full one.
+  HashTable next(std::max(table.next_capacity(), 2 * size()), epochs != nullptr);
+  if (rehashing()) {
+    for (; migrate_cursor < draining.capacity(); ++migrate_cursor) {
+      migrate_slot(next);
     }
+    retire_table(draining, HashTable());
+    migrate_cursor = 0;
+  }
+  if (table.size() == 0) {
+    replace_table(table, std::move(next));
+    return;
   }
+  draining = std::exchange(table, std::move(next));
+  migrate_cursor = 0;
+  publish_layout();
 }
 
-void Store::remove_expiration(std::string_view key) {
-  auto exp_it = expires.find(key);
-  if (exp_it != expires.end()) {
-    expires.erase(exp_it);
+void Store::migrate(std::size_t slots) {
+  const std::size_t end = std::min(migrate_cursor + slots, draining.capacity());
+  for (; migrate_cursor < end; ++migrate_cursor) {
+    migrate_slot(table);
+  }
+  if (migrate_cursor == draining.capacity()) {
+    replace_table(draining, HashTable());
+    migrate_cursor = 0;
   }
 }
 
+void Store::migrate_slot(HashTable& into) {
+  if (!draining.slot_full(migrate_cursor)) {
+    return;
+  }
+  Entry& e = draining.slot(migrate_cursor);
+  draining.lock(&e);
+  const std::size_t h = HashTable::hash(e.key.view());
+  into.insert(std::move(e), h);
+  draining.erase(&e);
+}
+
+void Store::share_reads(util::EpochDomain& domain, unsigned thread) {
+  epochs = &domain;
+  epoch_thread = thread;
+  publish_layout();
+}
+
+void Store::replace_table(HashTable& t, HashTable next) {
+  retire_table(t, std::move(next));
+  publish_layout();
+}
+
+void Store::retire_table(HashTable& t, HashTable next) {
+  if (epochs == nullptr || t.capacity() == 0) {
+    t = std::move(next);
+  } else {
+    t.seal();
+    epochs->retire(epoch_thread, new HashTable(std::exchange(t, std::move(next))),
+                   [](void* p) { delete static_cast<HashTable*>(p); });
+  }
+}
+
+void Store::publish_layout() {
+  if (epochs == nullptr) {
+    return;
+  }
+  const Layout* old = layout.exchange(new Layout{draining.view(), table.view()}, std::memory_order_seq_cst);
+  if (old != nullptr) {
+    epochs->retire(epoch_thread, const_cast<Layout*>(old), [](void* p) { delete static_cast<Layout*>(p); });
+  }
+}
+
+bool Store::peek(unsigned reader, std::string_view key, Peek& out, std::string* value) const {
+  if (epochs == nullptr || policy == EvictionPolicy::AllKeysLru || policy == EvictionPolicy::AllKeysLfu) {
+    return false;
+  }
+  const std::size_t hash = HashTable::hash(key);
+  for (int attempt = 0; attempt < kPeekAttempts; ++attempt) {
+    const util::EpochDomain::Guard pin = epochs->pin(reader);
+    const Layout* l = layout.load(std::memory_order_seq_cst);
+    // Draining first, as lookup() does: a migrating entry reaches the new
+    // table before it leaves the old one.
+    HashTable::Peeked p;
+    const HashTable::View* where = &l->draining;
+    HashTable::PeekStatus status = HashTable::peek(l->draining, key, hash, p);
+    if (status == HashTable::PeekStatus::Missing) {
+      where = &l->table;
+      status = HashTable::peek(l->table, key, hash, p);
+    }
+    if (status == HashTable::PeekStatus::Busy) {
+      continue;
+    }
+    // A resize since l was loaded may have moved the key out of l's tables
+    // into one l does not have, so a miss only counts under the same layout.
+    if (status == HashTable::PeekStatus::Missing && layout.load(std::memory_order_seq_cst) != l) {
+      continue;
+    }
+    if (status == HashTable::PeekStatus::Missing || (p.expire_at != kNoExpiry && p.expire_at <= util::now())) {
+      out = Peek{};
+      return true;
+    }
+    if (value != nullptr && p.type == ValueType::String) {
+      if (!p.value.readable()) {
+        return false;
+      }
+      value->assign(p.value.view());
+      if (!HashTable::unchanged(*where, p)) {
+        continue;
+      }
+    }
+    out = Peek{true, p.type, p.expire_at};
+    return true;
+  }
+  return false;
+}
+
+void Store::set_maxmemory(std::size_t bytes, EvictionPolicy p, unsigned n) {
+  max_bytes = bytes;
+  policy = p;
+  samples = n;
+}
+
+void Store::touch(Entry* e) {
+  if (policy == EvictionPolicy::AllKeysLru) {
+    e->access = static_cast<uint32_t>(clock_ms);
+  } else if (policy == EvictionPolicy::AllKeysLfu) {
+    uint32_t counter = lfu_counter(e->access, clock_ms);
+    if (counter < 255) {
+      const uint32_t base = counter > kLfuInit ? counter - kLfuInit : 0;
+      if (next_random() % (base * kLfuLogFactor + 1) == 0) {
+        ++counter;
+      }
+    }
+    e->access = lfu_minutes(clock_ms) << 8 | counter;
+  }
+}
+
+Entry* Store::pick_victim() {
+  if (policy == EvictionPolicy::NoEviction || size() == 0) {
+    return nullptr;
+  }
+  Entry* victim = nullptr;
+  uint64_t best = 0;
+  unsigned sampled = 0;
+  for (unsigned attempt = 0; sampled < samples && attempt < samples * kSampleAttempts; ++attempt) {
+    // Sample each table in proportion to the keys it holds.
+    const uint64_t r = next_random();
+    HashTable& t = (r >> 32) % size() < draining.size() ? draining : table;
+    Entry* e = t.sample(static_cast<std::size_t>(r));
+    if (e == nullptr) {
+      continue;
+    }
+    // Higher score means a better victim.
+    uint64_t score = 0;
+    switch (policy) {
+      case EvictionPolicy::AllKeysLru:
+        score = static_cast<uint32_t>(clock_ms) - e->access;
+        break;
+      case EvictionPolicy::AllKeysLfu:
+        score = 255 - lfu_counter(e->access, clock_ms);
+        break;
+      case EvictionPolicy::VolatileTtl:
+        if (!e->has_expiry()) {
+          continue;
+        }
+        score = static_cast<uint64_t>((kNoExpiry - e->expire_at).count());
+        break;
+      case EvictionPolicy::NoEviction:
+        break;
+    }
+    ++sampled;
+    if (victim == nullptr || score > best) {
+      victim = e;
+      best = score;
+    }
+  }
+  return victim;
+}
+
+uint64_t Store::next_random() {
+  // xorshift64*: only has to spread samples and LFU coin flips.
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
 }  // namespace db
@@ -1,50 +1,337 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <optional>
 #include <string>
 #include <string_view>
-#include <unordered_map>
+#include <utility>
+#include <vector>
 
+#include "../util/epoch.hpp"
 #include "../util/time.hpp"
+#include "expiry_wheel.hpp"
+#include "hash_table.hpp"
+#include "key_slot.hpp"
+#include "slab_allocator.hpp"
+#include "sorted_set.hpp"
 
 namespace db {
 
-struct TransparentStringHash {
-  using is_transparent = void;
-  std::size_t operator()(std::string_view value) const noexcept {
-    return std::hash<std::string_view>{}(value);
-  }
-};
-
-struct TransparentStringEq {
-  using is_transparent = void;
-  bool operator()(std::string_view lhs, std::string_view rhs) const noexcept {
-    return lhs == rhs;
-  }
+// What a store over its memory limit deletes to make room for a write.
+enum class EvictionPolicy {
+  NoEviction,   // nothing; writes fail until keys are deleted or expire
+  AllKeysLru,   // least recently used key
+  AllKeysLfu,   // least frequently used key (log counter decaying each minute)
+  VolatileTtl,  // key with a deadline that expires soonest
 };
 
 class Store {
  public:
-  std::optional<std::string_view> get(std::string_view key);
-  void set(std::string key, std::string value);
+  Store() = default;
+  ~Store() { delete layout.load(std::memory_order_relaxed); }
+  Store(const Store&) = delete;
+  Store& operator=(const Store&) = delete;
+
+  // Returns false if key holds a collection rather than a string. Values
+  // for which SlabAllocator::refcounted(size) holds are viewed from the start
+  // of their block, so callers may pin them with SlabAllocator::ref; the
+  // same goes for get_many and hget.
+  bool get(std::string_view key, std::optional<std::string_view>& value);
+  // Replaces whatever key held.
+  void set(std::string_view key, std::string_view value);
   bool del(std::string_view key);
   bool exists(std::string_view key);
 
+  // Batched forms of get and set. All keys are hashed first, and each lookup
+  // prefetches the buckets of the keys a few positions ahead, so cache misses
+  // overlap across the batch instead of being paid one key at a time.
+  //
+  // get_many fills values[i] for keys[i] (nullopt for collections); the
+  // views stay valid until the next write to the store.
+  void get_many(const std::string_view* keys, std::size_t n, std::vector<std::optional<std::string_view>>& values);
+  // kv holds pairs key, value. With only_if_absent nothing is written if any
+  // key exists (MSETNX), and false is returned.
+  bool set_many(const std::string_view* kv, std::size_t pairs, bool only_if_absent);
+
+  // Collections. Small ones are a listpack in the entry's value; past the
+  // limits in store_collections.cpp they convert to a FieldTable, Quicklist
+  // or SortedSet. Each returns false, doing nothing, if key holds another
+  // type. Views handed out stay valid until the next write to the store.
+  //
+  // hset sets pairs field, value; added counts new fields. hgetall returns
+  // field, value, field, value, ...
+  bool hset(std::string_view key, const std::string_view* fv, std::size_t pairs, std::size_t& added);
+  bool hget(std::string_view key, std::string_view field, std::optional<std::string_view>& value);
+  bool hgetall(std::string_view key, std::vector<std::string_view>& out);
+  // Pushes each item to the head in turn; length is the new list length.
+  bool lpush(std::string_view key, const std::string_view* items, std::size_t n, std::size_t& length);
+  // Pops up to count items from the tail; a list left empty is deleted.
+  bool rpop(std::string_view key, std::size_t count, std::vector<std::string>& out);
+  // Ranges are inclusive; negative indexes count from the end.
+  bool lrange(std::string_view key, long long start, long long stop, std::vector<std::string_view>& out);
+  bool zadd(std::string_view key, const std::pair<double, std::string_view>* items, std::size_t n, std::size_t& added);
+  bool zrange(std::string_view key, long long start, long long stop, std::vector<SortedSet::Item>& out);
+  bool zrange_by_score(std::string_view key, const ScoreRange& range, std::size_t offset, std::size_t limit,
+                       std::vector<SortedSet::Item>& out);
+
   // Expire in milliseconds, returns true if expiration set, false if key missing.
   bool expire(std::string_view key, long long ttl_ms);
+  // Same with an absolute deadline; a deadline in the past expires the key.
+  bool expire_at(std::string_view key, util::TimePoint deadline);
   // Time left to live in milliseconds, -1 if no expiration, -2 if key missing/expired.
   long long ttl(std::string_view key);
 
-  // Optional periodic sweep to remove expired entries.
- void sweep_expired();
+  // Active expiry: deletes keys whose deadline has passed, stopping after
+  // max_keys timers or once budget is spent. Returns true if expired timers
+  // are still queued, so the event loop knows to call again soon.
+  bool expire_cycle(std::size_t max_keys, std::chrono::microseconds budget);
+  std::size_t expiring() const { return wheel.pending(); }
+
+  // Migrates entries from the old table for up to budget. Returns true while
+  // a resize is still in progress, so the event loop knows to call again.
+  bool rehash_step(std::chrono::microseconds budget);
+  bool rehashing() const { return draining.capacity() != 0; }
+
+  std::size_t size() const { return table.size() + draining.size(); }
+  // Keys with a deadline (Redis' "expires").
+  std::size_t volatile_size() const { return volatile_keys; }
+
+  // Memory ceiling for this store (0 = none). Policies compare a sample of
+  // `samples` keys and evict the best candidate, so eviction is O(samples)
+  // per key without any per-key list.
+  void set_maxmemory(std::size_t max_bytes, EvictionPolicy policy, unsigned samples);
+  // Bytes held by the key space: both tables' slot arrays (a draining one
+  // included, empty slots too), the entries' out-of-line key and value
+  // chunks, and the expiry wheel's queued timers.
+  std::size_t used_memory() const {
+    const std::size_t slot_bytes = size() * (sizeof(Entry) + 1);
+    return used - slot_bytes + table.memory_bytes() + draining.memory_bytes() + wheel.memory_bytes();
+  }
+  std::size_t maxmemory() const { return max_bytes; }
+  std::size_t evicted_keys() const { return evicted; }
+  // Refreshes the clock access times are stamped with; called once per
+  // event-loop wakeup rather than per command.
+  void update_clock() { clock_ms = util::to_millis(util::now()); }
+
+  // Evicts until the entries' own bytes (used) are within the limit, calling
+  // on_evict(key) before each key goes. Returns false if the policy found
+  // nothing to evict (noeviction, or no keys with a deadline under
+  // volatile-ttl). Idle slots and queued timers are left out of the
+  // comparison: evicting a key frees neither, so counting them could evict
+  // every key and still be over.
+  template <typename F>
+  bool make_room(F&& on_evict) {
+    while (max_bytes != 0 && used > max_bytes) {
+      Entry* victim = pick_victim();
+      if (victim == nullptr) {
+        return false;
+      }
+      on_evict(victim->key.view());
+      erase(victim);
+      ++evicted;
+    }
+    return true;
+  }
+  // Where key and value bytes too long to store inline live.
+  const SlabAllocator& allocator() const { return slab; }
+
+  // Bulk loading: size an empty store for keys entries up front, then insert
+  // or overwrite keys with their value and deadline (kNoExpiry for none).
+  // Collections come as their listpack (Entry::compact_value).
+  void reserve(std::size_t keys);
+  // Drops every key, e.g. before a replica loads its primary's snapshot.
+  // Queued expiry timers go stale and are discarded when they fire.
+  void clear();
+  void restore(std::string_view key, std::string_view value, util::TimePoint deadline,
+               ValueType type = ValueType::String);
+  // Whether lp, from outside the process (RESTORE, a snapshot file), is a
+  // well-formed listpack of a non-empty collection of type: pairs for
+  // hashes and sorted sets, with 8-byte scores.
+  static bool valid_collection(ValueType type, std::string_view lp);
+
+  // Cluster mode: counts keys per hash slot from here on, for slot
+  // migration and CLUSTER COUNTKEYSINSLOT. Enabled on an empty store; the
+  // counts may be read from any thread.
+  void count_slots();
+  std::size_t keys_in_slot(std::uint16_t slot) const {
+    return slot_keys ? slot_keys[slot].load(std::memory_order_relaxed) : 0;
+  }
+
+  // Shared reads: other threads may look keys up with peek() while the
+  // owning thread keeps writing, without either side taking a lock. The
+  // tables become versioned (see HashTable): a write marks the groups it
+  // touches and publish() releases them once the command is done, so a
+  // reader never sees half a command. Tables the owner replaces are retired
+  // through domain and freed by reclaim() once no reader can hold them.
+  // Enabled on an empty store; thread is the owner's slot in domain.
+  void share_reads(util::EpochDomain& domain, unsigned thread);
+  void publish() {
+    if (epochs != nullptr) {
+      table.unlock_all();
+      draining.unlock_all();
+    }
+  }
+  void reclaim() {
+    if (epochs != nullptr) {
+      epochs->collect(epoch_thread);
+    }
+  }
+
+  // A key as peek() found it. Expired keys are reported missing (their
+  // deletion is left to the owner), and peeks stamp no access for eviction.
+  struct Peek {
+    bool found{false};
+    ValueType type{ValueType::String};
+    util::TimePoint expire_at{kNoExpiry};
+  };
+  // Called from another thread, reader being its slot in the epoch domain.
+  // With value non-null a string's value is copied into it. Returns false
+  // when no consistent view was had in a few tries (a writer kept the key's
+  // groups busy), the value is in a large block, or the eviction policy
+  // needs the owner to see every access; the caller then asks the owner.
+  bool peek(unsigned reader, std::string_view key, Peek& out, std::string* value) const;
+
+  // Visits the entries (expired ones included) in up to budget table slots
+  // from position cursor on, stopping early once f returns false, and
+  // returns the position to resume from, 0 once every slot has been
+  // visited. f must not modify the store. Entries migrated by a resize
+  // between calls may be missed or seen twice, so a caller that must see
+  // every entry walks again until it finds none.
+  template <typename F>
+  std::size_t scan(std::size_t cursor, std::size_t budget, F&& f) const {
+    const std::size_t old = draining.capacity();
+    const std::size_t total = old + table.capacity();
+    const std::size_t stop = std::min(total, cursor + budget);
+    while (cursor < stop) {
+      const HashTable& t = cursor < old ? draining : table;
+      const std::size_t i = cursor < old ? cursor : cursor - old;
+      ++cursor;
+      if (t.slot_full(i) && !f(t.slot(i))) {
+        break;
+      }
+    }
+    return cursor >= total ? 0 : cursor;
+  }
+
+  // Visits every entry that has not expired yet.
+  template <typename F>
+  void for_each(F&& f) const {
+    const util::TimePoint now = util::now();
+    for (const HashTable* t : {&draining, &table}) {
+      for (std::size_t i = 0; i < t->capacity(); ++i) {
+        if (t->slot_full(i) && (!t->slot(i).has_expiry() || t->slot(i).expire_at > now)) {
+          f(t->slot(i));
+        }
+      }
+    }
+  }
 
  private:
-  void remove_expiration(std::string_view key);
+  // Looks up key in both tables during a resize, without migrating.
+  Entry* lookup(std::string_view key, std::size_t hash);
+  // Migrates a step of any resize in progress, then looks up key.
+  Entry* find(std::string_view key, std::size_t hash);
+  Entry* find(std::string_view key) { return find(key, HashTable::hash(key)); }
+  // Null if e's deadline has passed, deleting it.
+  Entry* live(Entry* e);
+  // Looks up key, lazily deleting it if its deadline has passed.
+  Entry* find_live(std::string_view key) { return live(find(key)); }
+  // Existing entry for key, or a new one with an empty value and no expiry.
+  Entry* find_or_insert(std::string_view key, std::size_t hash);
+  Entry* find_or_insert(std::string_view key) { return find_or_insert(key, HashTable::hash(key)); }
+  void assign_value(Entry* e, std::string_view value);
+  // Frees any collection e holds and makes it a string.
+  void make_string(Entry* e);
+  // Sets or clears (kNoExpiry) e's deadline, keeping volatile_keys in step
+  // and scheduling a timer unless one already queued fires no later.
+  void set_deadline(Entry* e, util::TimePoint deadline);
+  // Queues a timer for deadline that e owns.
+  void arm_timer(Entry* e, util::TimePoint deadline);
+  // Bytes accounted for e in used.
+  static std::size_t footprint(const Entry& e);
+
+  // Live entry for key if it holds type, else null; wrong_type tells a key
+  // of another type from a missing one.
+  Entry* find_typed(std::string_view key, ValueType type, bool& wrong_type);
+  // Same, but a missing key becomes an empty collection of type.
+  Entry* find_or_create(std::string_view key, ValueType type, bool& wrong_type);
+  // Stores lp as e's value, converting to the Object encoding if it is past
+  // the limits for e's type.
+  void store_listpack(Entry* e, const std::string& lp);
+  void install_object(Entry* e, const void* obj);
+  void erase(Entry* e);
+
+  // Stamps an access on e for the LRU/LFU policies.
+  void touch(Entry* e);
+  Entry* pick_victim();
+
+  // Hashes every stride-th key into batch_hashes and prefetches the first few.
+  void hash_batch(const std::string_view* keys, std::size_t n, std::size_t stride);
+  // Prefetches ahead of batch position i.
+  void prefetch_batch(std::size_t i) const;
+  uint64_t next_random();
+
+  // Growth happens by swapping in a bigger table and moving a few slots per
+  // command (and per loop tick) from the old one, instead of one O(n) rehash.
+  void start_resize();
+  void migrate(std::size_t slots);
+  // Moves the entry at migrate_cursor in draining, if any, into into.
+  void migrate_slot(HashTable& into);
+  // Marks e's group in a versioned table before e is changed in place.
+  void lock(Entry* e) {
+    if (epochs != nullptr) {
+      (draining.owns(e) ? draining : table).lock(e);
+    }
+  }
+  // Replaces a table, retiring the old one when readers may still be in it,
+  // and publishes the new layout.
+  void replace_table(HashTable& t, HashTable next);
+  // The same without publishing, for a caller that publishes once done.
+  void retire_table(HashTable& t, HashTable next);
+  void publish_layout();
+  // Adjusts key's slot count by delta when counting.
+  void count_key(std::string_view key, int delta) {
+    if (slot_keys) {
+      std::atomic<std::uint32_t>& n = slot_keys[key_slot(key)];
+      n.store(static_cast<std::uint32_t>(static_cast<int>(n.load(std::memory_order_relaxed)) + delta),
+              std::memory_order_relaxed);
+    }
+  }
+
+  SlabAllocator slab;  // declared first: every string below frees into it
+  HashTable table;     // receives all inserts
+  HashTable draining;  // previous table while it is migrated into table
+  std::size_t migrate_cursor{0};
+
+  ExpiryWheel wheel{util::to_millis(util::now()), slab};
+  uint8_t timer_gens{0};  // last generation handed to a timer
+
+  std::vector<std::size_t> batch_hashes;
+  std::string scratch;  // listpack being edited
+
+  std::size_t used{0};
+  std::size_t max_bytes{0};
+  std::size_t evicted{0};
+  std::size_t volatile_keys{0};
+  std::unique_ptr<std::atomic<std::uint32_t>[]> slot_keys;  // written by the owning thread only
 
-  using KvMap = std::unordered_map<std::string, std::string, TransparentStringHash, TransparentStringEq>;
-  using ExpMap = std::unordered_map<std::string, util::TimePoint, TransparentStringHash, TransparentStringEq>;
-  KvMap kv;
-  ExpMap expires;
+  // Shared reads: what peek() probes, swapped whole when a table changes.
+  struct Layout {
+    HashTable::View draining;
+    HashTable::View table;
+  };
+  util::EpochDomain* epochs{nullptr};
+  unsigned epoch_thread{0};
+  std::atomic<const Layout*> layout{nullptr};
+  EvictionPolicy policy{EvictionPolicy::NoEviction};
+  unsigned samples{5};
+  int64_t clock_ms{util::to_millis(util::now())};
+  uint64_t rng_state{0x9E3779B97F4A7C15};
 };
 
 }  // namespace db
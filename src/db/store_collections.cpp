@@ -0,0 +1,421 @@
+#include <algorithm>
+
+#include "field_table.hpp"
+#include "listpack.hpp"
+#include "quicklist.hpp"
+#include "store.hpp"
+
+// Hash, list and sorted-set commands. While small, a collection is a
+// listpack edited as a copy in scratch and assigned back (in place when its
+// slab chunk still fits); past these limits it converts, once, to a
+// FieldTable, Quicklist or SortedSet. The limits match Redis' defaults.
+
+namespace db {
+
+namespace {
+constexpr std::size_t kHashMaxListpackEntries = 128;
+constexpr std::size_t kHashMaxListpackValue = 64;
+constexpr std::size_t kListMaxListpackBytes = 8 * 1024;
+constexpr std::size_t kZSetMaxListpackEntries = 128;
+constexpr std::size_t kZSetMaxListpackValue = 64;
+
+// Position of the pair whose first element is name, or lp.size().
+std::size_t find_pair(std::string_view lp, std::string_view name) {
+  for (std::size_t pos = listpack::kBegin; pos < lp.size();) {
+    const std::size_t at = pos;
+    const std::string_view first = listpack::next(lp, pos);
+    listpack::next(lp, pos);
+    if (first == name) {
+      return at;
+    }
+  }
+  return lp.size();
+}
+
+// Pairs past the limits, or with an element longer than max_value.
+bool pairs_too_big(std::string_view lp, std::size_t max_entries, std::size_t max_value, bool check_second) {
+  if (listpack::size(lp) / 2 > max_entries) {
+    return true;
+  }
+  for (std::size_t pos = listpack::kBegin; pos < lp.size();) {
+    const std::string_view first = listpack::next(lp, pos);
+    const std::string_view second = listpack::next(lp, pos);
+    if (first.size() > max_value || (check_second && second.size() > max_value)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Resolves negative indexes against n and clamps; false if the range is empty.
+bool normalize_range(long long start, long long stop, std::size_t n, std::size_t& first, std::size_t& last) {
+  const auto len = static_cast<long long>(n);
+  if (start < 0) {
+    start = std::max(start + len, 0LL);
+  }
+  if (stop < 0) {
+    stop += len;
+  }
+  if (start > stop || start >= len) {
+    return false;
+  }
+  first = static_cast<std::size_t>(start);
+  last = static_cast<std::size_t>(std::min(stop, len - 1));
+  return true;
+}
+}  // namespace
+
+bool Store::valid_collection(ValueType type, std::string_view lp) {
+  if (!listpack::valid(lp) || listpack::size(lp) == 0) {
+    return false;
+  }
+  if (type == ValueType::List) {
+    return true;
+  }
+  if (listpack::size(lp) % 2 != 0) {
+    return false;
+  }
+  if (type == ValueType::ZSet) {
+    for (std::size_t pos = listpack::kBegin; pos < lp.size();) {
+      listpack::next(lp, pos);
+      if (listpack::next(lp, pos).size() != sizeof(double)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+Entry* Store::find_typed(std::string_view key, ValueType type, bool& wrong_type) {
+  Entry* e = find_live(key);
+  wrong_type = e != nullptr && e->type != type;
+  if (e == nullptr || wrong_type) {
+    return nullptr;
+  }
+  touch(e);
+  return e;
+}
+
+Entry* Store::find_or_create(std::string_view key, ValueType type, bool& wrong_type) {
+  if (Entry* e = find_typed(key, type, wrong_type); e != nullptr || wrong_type) {
+    return e;
+  }
+  Entry* e = find_or_insert(key);
+  lock(e);
+  listpack::init(scratch);
+  e->type = type;
+  assign_value(e, scratch);
+  return e;
+}
+
+void Store::install_object(Entry* e, const void* obj) {
+  e->value.assign(std::string_view(reinterpret_cast<const char*>(&obj), sizeof(obj)), slab);
+  e->encoding = Encoding::Object;
+}
+
+void Store::store_listpack(Entry* e, const std::string& lp) {
+  lock(e);
+  used -= footprint(*e);
+  switch (e->type) {
+    case ValueType::Hash:
+      if (pairs_too_big(lp, kHashMaxListpackEntries, kHashMaxListpackValue, true)) {
+        install_object(e, new FieldTable(lp, slab));
+      } else {
+        e->value.assign(lp, slab);
+      }
+      break;
+    case ValueType::List:
+      if (lp.size() > kListMaxListpackBytes) {
+        install_object(e, new Quicklist(lp));
+      } else {
+        e->value.assign(lp, slab);
+      }
+      break;
+    case ValueType::ZSet:
+      if (pairs_too_big(lp, kZSetMaxListpackEntries, kZSetMaxListpackValue, false)) {
+        install_object(e, new SortedSet(lp));
+      } else {
+        e->value.assign(lp, slab);
+      }
+      break;
+    case ValueType::String:
+      e->value.assign(lp, slab);
+      break;
+  }
+  used += footprint(*e);
+}
+
+bool Store::hset(std::string_view key, const std::string_view* fv, std::size_t pairs, std::size_t& added) {
+  bool wrong_type = false;
+  Entry* e = find_or_create(key, ValueType::Hash, wrong_type);
+  if (e == nullptr) {
+    return false;
+  }
+  added = 0;
+  if (e->encoding == Encoding::Object) {
+    used -= footprint(*e);
+    auto* fields = e->object<FieldTable>();
+    for (std::size_t i = 0; i < pairs; ++i) {
+      if (fields->set(fv[2 * i], fv[2 * i + 1])) {
+        ++added;
+      }
+    }
+    used += footprint(*e);
+    return true;
+  }
+
+  scratch.assign(e->value.view());
+  for (std::size_t i = 0; i < pairs; ++i) {
+    const std::size_t pos = find_pair(scratch, fv[2 * i]);
+    if (pos == scratch.size()) {
+      listpack::push_back(scratch, fv[2 * i]);
+      listpack::push_back(scratch, fv[2 * i + 1]);
+      ++added;
+    } else {
+      std::size_t value_pos = pos;
+      listpack::next(scratch, value_pos);
+      listpack::replace(scratch, value_pos, fv[2 * i + 1]);
+    }
+  }
+  store_listpack(e, scratch);
+  return true;
+}
+
+bool Store::hget(std::string_view key, std::string_view field, std::optional<std::string_view>& value) {
+  bool wrong_type = false;
+  Entry* e = find_typed(key, ValueType::Hash, wrong_type);
+  value.reset();
+  if (e == nullptr) {
+    return !wrong_type;
+  }
+  if (e->encoding == Encoding::Object) {
+    value = e->object<FieldTable>()->get(field);
+    return true;
+  }
+  const std::string_view lp = e->value.view();
+  std::size_t pos = find_pair(lp, field);
+  if (pos != lp.size()) {
+    listpack::next(lp, pos);
+    value = listpack::next(lp, pos);
+  }
+  return true;
+}
+
+bool Store::hgetall(std::string_view key, std::vector<std::string_view>& out) {
+  bool wrong_type = false;
+  Entry* e = find_typed(key, ValueType::Hash, wrong_type);
+  out.clear();
+  if (e == nullptr) {
+    return !wrong_type;
+  }
+  if (e->encoding == Encoding::Object) {
+    e->object<FieldTable>()->for_each([&](std::string_view field, std::string_view value) {
+      out.push_back(field);
+      out.push_back(value);
+    });
+    return true;
+  }
+  const std::string_view lp = e->value.view();
+  for (std::size_t pos = listpack::kBegin; pos < lp.size();) {
+    out.push_back(listpack::next(lp, pos));
+  }
+  return true;
+}
+
+bool Store::lpush(std::string_view key, const std::string_view* items, std::size_t n, std::size_t& length) {
+  bool wrong_type = false;
+  Entry* e = find_or_create(key, ValueType::List, wrong_type);
+  if (e == nullptr) {
+    return false;
+  }
+  if (e->encoding == Encoding::Object) {
+    used -= footprint(*e);
+    auto* list = e->object<Quicklist>();
+    for (std::size_t i = 0; i < n; ++i) {
+      list->push_front(items[i]);
+    }
+    used += footprint(*e);
+    length = list->size();
+    return true;
+  }
+
+  scratch.assign(e->value.view());
+  for (std::size_t i = 0; i < n; ++i) {
+    listpack::insert(scratch, listpack::kBegin, items[i]);
+  }
+  length = listpack::size(scratch);
+  store_listpack(e, scratch);
+  return true;
+}
+
+bool Store::rpop(std::string_view key, std::size_t count, std::vector<std::string>& out) {
+  bool wrong_type = false;
+  Entry* e = find_typed(key, ValueType::List, wrong_type);
+  out.clear();
+  if (e == nullptr) {
+    return !wrong_type;
+  }
+  std::size_t remaining = 0;
+  if (e->encoding == Encoding::Object) {
+    used -= footprint(*e);
+    auto* list = e->object<Quicklist>();
+    for (; count > 0 && list->size() > 0; --count) {
+      list->pop_back(out.emplace_back());
+    }
+    used += footprint(*e);
+    remaining = list->size();
+  } else {
+    scratch.assign(e->value.view());
+    for (; count > 0 && listpack::size(scratch) > 0; --count) {
+      const std::size_t last = listpack::seek(scratch, listpack::size(scratch) - 1);
+      std::size_t pos = last;
+      out.emplace_back(listpack::next(scratch, pos));
+      listpack::erase(scratch, last);
+    }
+    remaining = listpack::size(scratch);
+    if (remaining > 0) {
+      store_listpack(e, scratch);
+    }
+  }
+  if (remaining == 0) {
+    erase(e);
+  }
+  return true;
+}
+
+bool Store::lrange(std::string_view key, long long start, long long stop, std::vector<std::string_view>& out) {
+  bool wrong_type = false;
+  Entry* e = find_typed(key, ValueType::List, wrong_type);
+  out.clear();
+  if (e == nullptr) {
+    return !wrong_type;
+  }
+  std::size_t first = 0;
+  std::size_t last = 0;
+  if (e->encoding == Encoding::Object) {
+    auto* list = e->object<Quicklist>();
+    if (normalize_range(start, stop, list->size(), first, last)) {
+      list->range(first, last, out);
+    }
+    return true;
+  }
+  const std::string_view lp = e->value.view();
+  if (normalize_range(start, stop, listpack::size(lp), first, last)) {
+    std::size_t pos = listpack::seek(lp, first);
+    for (std::size_t i = first; i <= last; ++i) {
+      out.push_back(listpack::next(lp, pos));
+    }
+  }
+  return true;
+}
+
+bool Store::zadd(std::string_view key, const std::pair<double, std::string_view>* items, std::size_t n,
+                 std::size_t& added) {
+  bool wrong_type = false;
+  Entry* e = find_or_create(key, ValueType::ZSet, wrong_type);
+  if (e == nullptr) {
+    return false;
+  }
+  added = 0;
+  if (e->encoding == Encoding::Object) {
+    used -= footprint(*e);
+    auto* zset = e->object<SortedSet>();
+    for (std::size_t i = 0; i < n; ++i) {
+      if (zset->add(items[i].first, items[i].second)) {
+        ++added;
+      }
+    }
+    used += footprint(*e);
+    return true;
+  }
+
+  scratch.assign(e->value.view());
+  for (std::size_t i = 0; i < n; ++i) {
+    const auto [score, member] = items[i];
+    std::size_t pos = find_pair(scratch, member);
+    if (pos == scratch.size()) {
+      ++added;
+    } else {
+      std::size_t score_pos = pos;
+      listpack::next(scratch, score_pos);
+      if (read_score(listpack::next(scratch, score_pos)) == score) {
+        continue;
+      }
+      listpack::erase(scratch, pos, 2);
+    }
+    // Pairs stay ordered by (score, member).
+    for (pos = listpack::kBegin; pos < scratch.size();) {
+      std::size_t next = pos;
+      const std::string_view m = listpack::next(scratch, next);
+      const double s = read_score(listpack::next(scratch, next));
+      if (s > score || (s == score && m > member)) {
+        break;
+      }
+      pos = next;
+    }
+    // Insert the score first so both land in front of the element at pos.
+    listpack::insert(scratch, pos, score_bytes(score));
+    listpack::insert(scratch, pos, member);
+  }
+  store_listpack(e, scratch);
+  return true;
+}
+
+bool Store::zrange(std::string_view key, long long start, long long stop, std::vector<SortedSet::Item>& out) {
+  bool wrong_type = false;
+  Entry* e = find_typed(key, ValueType::ZSet, wrong_type);
+  out.clear();
+  if (e == nullptr) {
+    return !wrong_type;
+  }
+  std::size_t first = 0;
+  std::size_t last = 0;
+  if (e->encoding == Encoding::Object) {
+    auto* zset = e->object<SortedSet>();
+    if (normalize_range(start, stop, zset->size(), first, last)) {
+      zset->range(first, last, out);
+    }
+    return true;
+  }
+  const std::string_view lp = e->value.view();
+  if (normalize_range(start, stop, listpack::size(lp) / 2, first, last)) {
+    std::size_t pos = listpack::seek(lp, 2 * first);
+    for (std::size_t i = first; i <= last; ++i) {
+      const std::string_view member = listpack::next(lp, pos);
+      out.emplace_back(member, read_score(listpack::next(lp, pos)));
+    }
+  }
+  return true;
+}
+
+bool Store::zrange_by_score(std::string_view key, const ScoreRange& range, std::size_t offset, std::size_t limit,
+                            std::vector<SortedSet::Item>& out) {
+  bool wrong_type = false;
+  Entry* e = find_typed(key, ValueType::ZSet, wrong_type);
+  out.clear();
+  if (e == nullptr) {
+    return !wrong_type;
+  }
+  if (e->encoding == Encoding::Object) {
+    e->object<SortedSet>()->range_by_score(range, offset, limit, out);
+    return true;
+  }
+  const std::string_view lp = e->value.view();
+  for (std::size_t pos = listpack::kBegin; pos < lp.size() && out.size() < limit;) {
+    const std::string_view member = listpack::next(lp, pos);
+    const double score = read_score(listpack::next(lp, pos));
+    if (!range.below_max(score)) {
+      break;
+    }
+    if (range.above_min(score)) {
+      if (offset > 0) {
+        --offset;
+      } else {
+        out.emplace_back(member, score);
+      }
+    }
+  }
+  return true;
+}
+
+}  // namespace db
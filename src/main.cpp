@@ -1,123 +1,89 @@
-#include <errno.h>
-#include <sys/epoll.h>
-#include <sys/socket.h>
-#include <unistd.h>
-
+#include <atomic>
 #include <iostream>
 #include <memory>
-#include <unordered_map>
+#include <thread>
+#include <vector>
 
 #include "commands/dispatcher.hpp"
-#include "db/store.hpp"
-#include "net/connection.hpp"
-#include "net/epoll.hpp"
-#include "net/socket.hpp"
-#include "util/error.hpp"
-
-#if defined(__linux__)
-#include <sched.h>
-#endif
+#include "persist/aof.hpp"
+#include "persist/snapshot.hpp"
+#include "server/cluster.hpp"
+#include "server/config.hpp"
+#include "server/mailbox.hpp"
+#include "server/metrics.hpp"
+#include "server/reactor.hpp"
+#include "server/replication.hpp"
+#include "util/affinity.hpp"
+#include "util/epoch.hpp"
 
 namespace {
-void pin_cpu_or_die() {
-#if defined(__linux__)
-  cpu_set_t set;
-  CPU_ZERO(&set);
-  CPU_SET(4, &set);
-  if (::sched_setaffinity(0, sizeof(set), &set) != 0) {
-    util::die_errno("sched_setaffinity");
-  }
-#else
-  util::die("CPU pinning is only supported on Linux");
-#endif
-}
+constexpr std::size_t kMailboxCapacity = 4096;
 }  // namespace
 
-int main() {
+int main(int argc, char** argv) {
   std::cout << "Redis Started \n";
-  uint16_t port = 9000;
+  server::Config cfg = server::parse_args(argc, argv);
 
-  pin_cpu_or_die();
-
-  int listen_fd = net::create_listen_socket(port);
-  net::Epoll epoll;
-  if (!epoll.add(listen_fd, EPOLLIN)) {
-    util::die_errno("epoll add listen_fd");
+  // Shards only talk to each other when there is more than one.
+  std::unique_ptr<server::Mailbox> mailbox;
+  if (cfg.threads > 1) {
+    mailbox = std::make_unique<server::Mailbox>(cfg.threads, kMailboxCapacity);
   }
 
-  db::Store store;
-  commands::Dispatcher dispatcher(store);
-  std::unordered_map<int, std::unique_ptr<net::Connection>> conns;
-
-  auto dispatch_cb = [&](const std::vector<std::string_view>& args, std::string& out) {
-    dispatcher.dispatch(args, out);
-  };
+  // Opened before any reactor starts so a torn tail is trimmed exactly once.
+  std::unique_ptr<persist::Aof> aof;
+  if (!cfg.aof_path.empty()) {
+    aof = std::make_unique<persist::Aof>(cfg.aof_path, cfg.aof_fsync);
+  }
 
-  while (true) {
-    int n = epoll.wait(-1);
-    if (n < 0) {
-      if (errno == EINTR) {
-        continue;
-      }
-      util::die_errno("epoll_wait");
+  auto wake = [&](unsigned shard) {
+    if (mailbox != nullptr) {
+      mailbox->notify(shard);
     }
+  };
+  persist::Snapshotter snapshots(cfg.snapshot_path, cfg.threads, wake);
+  server::Replication replication(cfg.repl_backlog_size, cfg.threads, wake);
 
-    epoll_event* events = epoll.events_data();
-    for (int i = 0; i < n; ++i) {
-      int fd = events[i].data.fd;
-      uint32_t ev = events[i].events;
-
-      if (fd == listen_fd) {
-        // Accept as many clients as are queued.
-        while (true) {
-          int client_fd = ::accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
-          if (client_fd < 0) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-              break;
-            }
-            if (errno == EINTR) {
-              continue;
-            }
-            break;
-          }
-
-          net::set_tcp_nodelay(client_fd);
-          conns.emplace(client_fd, std::make_unique<net::Connection>(client_fd));
-          epoll.add(client_fd, EPOLLIN);
-        }
-        continue;
-      }
-
-      auto it = conns.find(fd);
-      if (it == conns.end()) {
-        continue;
-      }
-      net::Connection& conn = *it->second;
+  server::Metrics metrics(cfg, commands::Dispatcher::command_names());
+  metrics.set_replication(&replication);
 
-      bool alive = true;
-      if (ev & (EPOLLERR | EPOLLHUP)) {
-        alive = false;
-      }
-      if (alive && (ev & EPOLLIN)) {
-        alive = conn.on_read(dispatch_cb);
-      }
-      if (alive && (ev & EPOLLOUT)) {
-        alive = conn.on_write();
-      }
+  std::unique_ptr<server::Cluster> cluster;
+  if (cfg.cluster_enabled) {
+    cluster = std::make_unique<server::Cluster>(cfg.cluster_announce_ip, cfg.port, cfg.threads, wake);
+  }
 
-      if (!alive) {
-        epoll.del(fd);
-        conns.erase(it);
-        continue;
-      }
+  server::Shared shared;
+  shared.mailbox = mailbox.get();
+  shared.aof = aof.get();
+  shared.snapshots = &snapshots;
+  shared.metrics = &metrics;
+  shared.replication = &replication;
+  shared.cluster = cluster.get();
+
+  // Each shard publishes its store here once loaded.
+  std::unique_ptr<util::EpochDomain> epochs;
+  std::unique_ptr<std::atomic<const db::Store*>[]> stores;
+  if (cfg.lockfree_reads && cfg.threads > 1) {
+    epochs = std::make_unique<util::EpochDomain>(cfg.threads);
+    stores = std::make_unique<std::atomic<const db::Store*>[]>(cfg.threads);
+    shared.epochs = epochs.get();
+    shared.stores = stores.get();
+  }
 
-      uint32_t new_events = EPOLLIN;
-      if (conn.wants_write()) {
-        new_events |= EPOLLOUT;
-      }
-      epoll.mod(fd, new_events);
+  // Pin before building the reactor so its memory is first touched on its core.
+  auto run_shard = [&](unsigned shard) {
+    if (cfg.pin) {
+      util::pin_cpu_or_die(cfg.cpu_base + static_cast<int>(shard));
     }
+    server::Reactor reactor(cfg, shard, shared);
+    reactor.run();
+  };
+
+  std::vector<std::thread> threads;
+  for (unsigned shard = 1; shard < cfg.threads; ++shard) {
+    threads.emplace_back(run_shard, shard);
   }
+  run_shard(0);
 
   return 0;
 }
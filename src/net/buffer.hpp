@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <string_view>
+
+namespace net {
+
+// Linear byte buffer with a read cursor. Consuming only advances the cursor;
+// unread bytes are moved to the front at most once per fill, when the tail
+// runs out of room, so parsing a pipelined batch never memmoves per command.
+class Buffer {
+ public:
+  std::string_view readable() const { return {data.get() + begin, end - begin}; }
+  std::size_t size() const { return end - begin; }
+  bool empty() const { return begin == end; }
+
+  void consume(std::size_t n) {
+    begin += n;
+    if (begin == end) {
+      begin = end = 0;
+    }
+  }
+
+  // Drops unread bytes past the first n.
+  void truncate(std::size_t n) {
+    if (n < size()) {
+      end = begin + n;
+    }
+  }
+
+  // Returns space for at least min_bytes past the unread data. Compacts or
+  // grows as needed; writable() reports how much room there is.
+  char* prepare(std::size_t min_bytes) {
+    if (cap - end < min_bytes) {
+      if (begin > 0 && cap - size() >= min_bytes) {
+        std::memmove(data.get(), data.get() + begin, size());
+      } else {
+        std::size_t new_cap = cap == 0 ? kInitialCapacity : cap * 2;
+        while (new_cap - size() < min_bytes) {
+          new_cap *= 2;
+        }
+        auto grown = std::make_unique_for_overwrite<char[]>(new_cap);
+        if (size() > 0) {
+          std::memcpy(grown.get(), data.get() + begin, size());
+        }
+        data = std::move(grown);
+        cap = new_cap;
+      }
+      end -= begin;
+      begin = 0;
+    }
+    return data.get() + end;
+  }
+  std::size_t writable() const { return cap - end; }
+  std::size_t capacity() const { return cap; }
+  void commit(std::size_t n) { end += n; }
+
+ private:
+  static constexpr std::size_t kInitialCapacity = 16 * 1024;
+
+  std::unique_ptr<char[]> data;
+  std::size_t cap{0};
+  std::size_t begin{0};
+  std::size_t end{0};
+};
+
+}  // namespace net
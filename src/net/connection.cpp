@@ -1,14 +1,16 @@
 #include "connection.hpp"
 
 #include <errno.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
-#include "../protocol/resp.hpp"
+#include <algorithm>
+#include <span>
 
 namespace net {
 
-Connection::Connection(int fd) : fd_(fd) {}
+Connection::Connection(int fd, std::uint64_t id) : fd_(fd), id_(id), interest_(EPOLLIN) {}
 
 Connection::~Connection() {
   close();
@@ -21,42 +23,106 @@ void Connection::close() {
   }
 }
 
-bool Connection::read_from_socket() {
-  char buf[4096];
+Connection::ReadStatus Connection::read_from_socket() {
+  // recv straight into the buffer tail (or the parser's pending big bulk);
+  // leftovers from a partial frame are compacted at most once here, not per
+  // parsed command.
   while (true) {
-    ssize_t n = ::recv(fd_, buf, sizeof(buf), 0);
+    const bool big = parser.big_arg_pending();
+    char* dst = nullptr;
+    std::size_t room = 0;
+    if (big) {
+      const std::span<char> space = parser.big_arg_space();
+      dst = space.data();
+      room = space.size();
+    } else {
+      dst = read_buf.prepare(kReadChunk);
+      room = std::min(read_buf.writable(), kMaxReadBuffer - read_buf.size());
+      if (room == 0) {
+        return ReadStatus::Full;
+      }
+    }
+    ssize_t n = ::recv(fd_, dst, room, 0);
     if (n > 0) {
-      if (read_buf.size() + static_cast<std::size_t>(n) > kMaxReadBuffer) {
-        return false;  // too large
+      if (!big) {
+        read_buf.commit(static_cast<std::size_t>(n));
+        continue;
+      }
+      parser.big_arg_commit(static_cast<std::size_t>(n));
+      if (!parser.big_arg_pending()) {
+        return ReadStatus::BigArgDone;
       }
-      read_buf.append(buf, static_cast<std::size_t>(n));
       continue;
     }
     if (n == 0) {
-      return false;  // peer closed
+      return ReadStatus::Closed;  // peer closed
     }
     if (errno == EAGAIN || errno == EWOULDBLOCK) {
-      break;
+      return ReadStatus::Drained;
     }
     if (errno == EINTR) {
       continue;
     }
+    return ReadStatus::Closed;
+  }
+}
+
+bool Connection::read_commands() {
+  parsed.clear();
+  // Receives until the socket would block, the buffer is full or a big bulk
+  // completes; a socket left readable is reported again by the next wait.
+  const ReadStatus status = read_from_socket();
+  if (status == ReadStatus::Closed) {
+    parsed_partly = false;
     return false;
   }
-  return true;
+  const std::size_t used = parser.parse_batch(read_buf.readable(), parsed);
+  // Parsing past a frame with big bulks would free them.
+  parsed_partly = used > 0 && parser.holds_big_args();
+  // Consuming only moves the cursor, so the views stay valid.
+  read_buf.consume(used);
+  if (parser.big_arg_pending()) {
+    read_buf.truncate(parser.frame_bytes());  // the rest is in the bulk
+  }
+  parsed_error = parser.error();
+  // A frame of small arguments that does not fit.
+  return parsed_partly || status != ReadStatus::Full || read_buf.size() < kMaxReadBuffer;
+}
+
+const msghdr* Connection::pending_output() {
+  std::size_t count = 0;
+  std::size_t pos = write_offset;
+  std::size_t skip = splice_offset;
+  for (const resp::Splice& s : splices) {
+    if (s.at > pos) {
+      out_iov[count++] = {write_buf.data() + pos, s.at - pos};
+      pos = s.at;
+    }
+    if (count == kMaxIov) {
+      break;
+    }
+    out_iov[count++] = {const_cast<char*>(s.data.data()) + skip, s.data.size() - skip};
+    skip = 0;
+    if (count == kMaxIov) {
+      break;
+    }
+  }
+  if (count < kMaxIov && pos < write_buf.size()) {
+    out_iov[count++] = {write_buf.data() + pos, write_buf.size() - pos};
+  }
+  out_msg.msg_iov = out_iov.data();
+  out_msg.msg_iovlen = count;
+  return &out_msg;
 }
 
 bool Connection::flush_write() { // send replies
-  while (pending_write_bytes() > 0) {
-    const char* data = write_buf.data() + write_offset;
-    const std::size_t len = pending_write_bytes();
-    ssize_t n = ::send(fd_, data, len, 0);
+  while (wants_write()) {
+    // Reply bytes and spliced values go out together; values are sent from
+    // the store without a copy into write_buf.
+    // MSG_NOSIGNAL: a peer that reset the connection must not SIGPIPE us.
+    ssize_t n = ::sendmsg(fd_, pending_output(), MSG_NOSIGNAL);
     if (n > 0) {
-      write_offset += static_cast<std::size_t>(n);
-      if (write_offset == write_buf.size()) {
-        write_buf.clear();
-        write_offset = 0;
-      }
+      advance_output(static_cast<std::size_t>(n));
       continue;
     }
     if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
@@ -70,30 +136,75 @@ bool Connection::flush_write() { // send replies
   return true;
 }
 
-bool Connection::on_read(const std::function<void(const std::vector<std::string_view>&, std::string&)>& dispatch) {
-  if (!read_from_socket()) {
-    return false;
-  }
+bool Connection::on_write() {
+  return flush_write();
+}
 
-  while (parser.parse(read_buf)) {
-    maybe_compact_write_buf();
-    dispatch(parser.argv(), write_buf);
-    parser.consume(read_buf);
-    if (pending_write_bytes() > kMaxWriteBuffer) {
-      return false;  // backpressure failure
+bool Connection::write_keeping_pins() {
+  keep_pins = true;
+  const bool ok = flush_write();
+  keep_pins = false;
+  return ok;
+}
+
+void Connection::advance_output(std::size_t n) {
+  while (n > 0) {
+    if (!splices.empty() && splices.front().at == write_offset) {
+      const std::size_t size = splices.front().data.size();
+      const std::size_t step = std::min(n, size - splice_offset);
+      splice_offset += step;
+      n -= step;
+      if (splice_offset == size) {
+        if (keep_pins) {
+          sent_pins.push_back(std::move(splices.front().pin));
+        }
+        splices.pop_front();
+        splice_offset = 0;
+        spliced_bytes -= size;
+        --splices_counted;
+      }
+      continue;
     }
+    const std::size_t end = splices.empty() ? write_buf.size() : splices.front().at;
+    const std::size_t step = std::min(n, end - write_offset);
+    write_offset += step;
+    n -= step;
+  }
+  if (write_offset == write_buf.size() && splices.empty()) {
+    write_buf.clear();
+    write_offset = 0;
   }
+}
 
-  if (parser.error()) {
-    resp::append_error(write_buf, "protocol error");
-    return false;
+std::string& Connection::reply_buffer() {
+  if (held.empty()) {
+    return write_buf;
+  }
+  if (!held.back().ready) {
+    held.push_back(HeldReply{{}, true});
   }
+  return held.back().data;
+}
 
-  return true;
+std::uint64_t Connection::defer_reply() {
+  held.push_back(HeldReply{{}, false});
+  return held_base + held.size() - 1;
 }
 
-bool Connection::on_write() {
-  return flush_write();
+void Connection::complete_reply(std::uint64_t seq, std::string_view reply) {
+  if (seq < held_base || seq - held_base >= held.size()) {
+    return;
+  }
+  HeldReply& slot = held[seq - held_base];
+  slot.data.assign(reply);
+  slot.ready = true;
+
+  maybe_compact_write_buf();
+  while (!held.empty() && held.front().ready) {
+    write_buf.append(held.front().data);
+    held.pop_front();
+    ++held_base;
+  }
 }
 
 void Connection::maybe_compact_write_buf() {
@@ -102,10 +213,27 @@ void Connection::maybe_compact_write_buf() {
   }
   if (write_offset >= 4096 && write_offset * 2 >= write_buf.size()) {
     write_buf.erase(0, write_offset);
+    for (resp::Splice& s : splices) {
+      s.at -= write_offset;
+    }
     write_offset = 0;
   }
 }
 
+std::size_t Connection::buffer_bytes() const {
+  std::size_t bytes = read_buf.capacity() + write_buf.capacity();
+  for (const HeldReply& h : held) {
+    bytes += h.data.capacity();
+  }
+  return bytes;
+}
+
+void Connection::count_splices() {
+  for (; splices_counted < splices.size(); ++splices_counted) {
+    spliced_bytes += splices[splices_counted].data.size();
+  }
+}
+
 std::size_t Connection::pending_write_bytes() const {
   return write_buf.size() - write_offset;
 }
@@ -1,46 +1,272 @@
 #pragma once
 
-#include <functional>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <deque>
 #include <string>
 #include <string_view>
+#include <utility>
 #include <vector>
 
+#include "../protocol/resp.hpp"
 #include "../protocol/resp_parser.hpp"
+#include "buffer.hpp"
 
 namespace net {
 
 class Connection {
  public:
-  explicit Connection(int fd);
+  explicit Connection(int fd, std::uint64_t id = 0);
   ~Connection();
 
   Connection(const Connection&) = delete;
   Connection& operator=(const Connection&) = delete;
 
   int fd() const { return fd_; }
+  std::uint64_t id() const { return id_; }
   bool closed() const { return fd_ == -1; }
-  bool wants_write() const { return pending_write_bytes() > 0; }
+  bool wants_write() const { return pending_write_bytes() > 0 || !splices.empty(); }
+
+  // Epoll interest currently registered for fd, so callers only issue
+  // EPOLL_CTL_MOD when it actually changes.
+  uint32_t interest() const { return interest_; }
+  void set_interest(uint32_t events) { interest_ = events; }
+  // Set while the connection sits on its reactor's end-of-iteration flush list.
+  bool flush_queued() const { return flush_queued_; }
+  void set_flush_queued(bool queued) { flush_queued_ = queued; }
+  // Cluster mode: set by ASKING, for the next command only.
+  bool take_asking() { return std::exchange(asking_, false); }
+  void set_asking() { asking_ = true; }
 
-  // Returns false to indicate the connection should be closed.
-  bool on_read(const std::function<void(const std::vector<std::string_view>&, std::string&)>& dispatch);
+  // Unsent reply bytes and spliced values as one sendmsg message, for
+  // callers that submit the send themselves (io_uring). Stays valid until
+  // the next reply is added or output advances.
+  const msghdr* pending_output();
+  void advance_output(std::size_t n);
+  // Set while an io_uring send (or the wait for writability) is outstanding.
+  bool send_inflight() const { return send_inflight_; }
+  void set_send_inflight(bool inflight) { send_inflight_ = inflight; }
+
+  // Reads what the socket has and calls dispatch(resp::Args, std::string&
+  // reply, resp::Splices* splices) for each whole command; splices is null
+  // when the reply cannot take them. A template so the per-command call is
+  // direct (and usually inlined). Returns false to indicate the connection
+  // should be closed.
+  template <typename Dispatch>
+  bool on_read(Dispatch&& dispatch);
+  // Same as on_read for bytes already received by the caller; whole commands
+  // are parsed in place and only a trailing partial one is copied.
+  template <typename Dispatch>
+  bool on_data(std::string_view data, Dispatch&& dispatch);
   bool on_write();
 
+  // Threaded I/O splits on_read in two. read_commands(), on an I/O thread,
+  // receives what the socket has and parses the whole commands in it,
+  // keeping their arguments; run_commands(), on the reactor, then calls
+  // dispatch for each as on_read does. Both return false to close.
+  bool read_commands();
+  template <typename Dispatch>
+  bool run_commands(Dispatch&& dispatch);
+  // on_write() for an I/O thread. Store blocks may only be unreferenced on
+  // their reactor's thread, so the pins of values sent are kept until the
+  // reactor drops them with release_sent().
+  bool write_keeping_pins();
+  void release_sent() { sent_pins.clear(); }
+
+  // Buffer the current command's reply goes into. Once a reply has been
+  // deferred, later replies are held back so the client sees them in order.
+  std::string& reply_buffer();
+  // Reserves an ordered slot for a reply produced elsewhere (another shard).
+  std::uint64_t defer_reply();
+  // Fills a deferred slot and releases every reply that is now in order.
+  void complete_reply(std::uint64_t seq, std::string_view reply);
+  // Whether a deferred reply is still unfilled; the front of held always is.
+  bool awaiting_replies() const { return !held.empty(); }
+
   void close();
 
+  // Heap held by the connection's buffers, for INFO.
+  std::size_t buffer_bytes() const;
+
  private:
-  bool read_from_socket();
+  enum class ReadStatus { Drained, Full, BigArgDone, Closed };
+  ReadStatus read_from_socket();
+  template <typename Dispatch>
+  bool parse_buffered(Dispatch& dispatch);
+  template <typename Dispatch>
+  bool parse_commands(std::string_view in, std::size_t& used, Dispatch& dispatch);
+  // Dispatches the commands in parsed.
+  template <typename Dispatch>
+  bool dispatch_parsed(Dispatch& dispatch);
+  // Splices only go with replies written straight to write_buf.
+  resp::Splices* reply_splices() { return held.empty() ? &splices : nullptr; }
   bool flush_write();
   void maybe_compact_write_buf();
   std::size_t pending_write_bytes() const;
+  // Unsent output including spliced values, which count_splices() adds up
+  // as replies splice them in.
+  std::size_t output_bytes() const { return pending_write_bytes() + spliced_bytes - splice_offset; }
+  void count_splices();
 
   static constexpr std::size_t kMaxReadBuffer = 1 << 20;   // 1MB
   static constexpr std::size_t kMaxWriteBuffer = 1 << 20;  // 1MB
+  // Unsent output with spliced values counted, which pin store blocks. A
+  // single reply may exceed it, so any value can still be read.
+  static constexpr std::size_t kMaxOutputBytes = 64 << 20;  // 64MB
+  static constexpr std::size_t kReadChunk = 4096;
+  static constexpr std::size_t kMaxIov = 256;
+
+  struct HeldReply {
+    std::string data;
+    bool ready;
+  };
 
   int fd_;
-  std::string read_buf;
+  std::uint64_t id_;
+  uint32_t interest_;
+  bool flush_queued_{false};
+  bool asking_{false};
+  bool send_inflight_{false};
+  Buffer read_buf;
   std::string write_buf;
   std::size_t write_offset{0};
+  // Large values spliced into write_buf, in order of position; the front
+  // one has had splice_offset bytes sent. Counted by kMaxOutputBytes rather
+  // than kMaxWriteBuffer: the first splices_counted of them, spliced_bytes.
+  resp::Splices splices;
+  std::size_t splice_offset{0};
+  std::size_t splices_counted{0};
+  std::size_t spliced_bytes{0};
+  bool keep_pins{false};
+  std::vector<resp::Pin> sent_pins;  // see write_keeping_pins()
+  std::array<iovec, kMaxIov> out_iov;
+  msghdr out_msg{};
   resp::RespParser parser;
+  // The last batch of commands parsed, as views into read_buf (or the
+  // parser's big bulks) until the next receive.
+  resp::Batch parsed;
+  bool parsed_error{false};
+  bool parsed_partly{false};  // whole commands left in read_buf
+  std::deque<HeldReply> held;
+  std::uint64_t held_base{0};  // sequence number of held.front()
 };
 
+template <typename Dispatch>
+bool Connection::on_read(Dispatch&& dispatch) {
+  // Reading and parsing alternate only when a big bulk completes or the
+  // buffer fills; otherwise the socket is drained first.
+  while (true) {
+    const ReadStatus status = read_from_socket();
+    if (status == ReadStatus::Closed) {
+      return false;
+    }
+    if (!parse_buffered(dispatch)) {
+      return false;
+    }
+    if (status == ReadStatus::Drained) {
+      return true;
+    }
+    if (status == ReadStatus::Full && read_buf.size() >= kMaxReadBuffer) {
+      return false;  // a frame of small arguments that does not fit
+    }
+  }
+}
+
+template <typename Dispatch>
+bool Connection::on_data(std::string_view data, Dispatch&& dispatch) {
+  if (parser.big_arg_pending()) {
+    data.remove_prefix(parser.feed_big_arg(data));
+    if (parser.big_arg_pending()) {
+      return true;
+    }
+    // The bulk is complete; its frame resumes from read_buf below.
+  } else if (read_buf.size() == 0) {
+    std::size_t used = 0;
+    if (!parse_commands(data, used, dispatch)) {
+      return false;
+    }
+    data.remove_prefix(used);
+    if (parser.big_arg_pending()) {
+      data = data.substr(0, parser.frame_bytes());  // the rest is in the bulk
+    }
+    if (data.empty()) {
+      return true;
+    }
+  }
+
+  if (data.size() > kMaxReadBuffer - read_buf.size()) {
+    return false;  // too large
+  }
+  std::memcpy(read_buf.prepare(data.size()), data.data(), data.size());
+  read_buf.commit(data.size());
+  return parse_buffered(dispatch);
+}
+
+template <typename Dispatch>
+bool Connection::run_commands(Dispatch&& dispatch) {
+  if (!dispatch_parsed(dispatch)) {
+    return false;
+  }
+  if (parsed_error) {
+    resp::append_error(write_buf, "protocol error");
+    return false;
+  }
+  // The rest is parsed here, now that the big bulks it would drop are used.
+  return !parsed_partly || parse_buffered(dispatch);
+}
+
+template <typename Dispatch>
+bool Connection::parse_buffered(Dispatch& dispatch) {
+  std::size_t used = 0;
+  const bool ok = parse_commands(read_buf.readable(), used, dispatch);
+  read_buf.consume(used);
+  if (parser.big_arg_pending()) {
+    read_buf.truncate(parser.frame_bytes());  // the rest is in the bulk
+  }
+  return ok;
+}
+
+template <typename Dispatch>
+bool Connection::parse_commands(std::string_view in, std::size_t& used, Dispatch& dispatch) {
+  // Whole pipelines are parsed in one sweep, then dispatched; a batch that
+  // stops at big bulks is used before the rest is parsed.
+  std::size_t n = 0;
+  do {
+    parsed.clear();
+    n = parser.parse_batch(in.substr(used), parsed);
+    if (!dispatch_parsed(dispatch)) {
+      return false;
+    }
+    used += n;
+  } while (n > 0 && parser.holds_big_args());
+
+  if (parser.error()) {
+    resp::append_error(write_buf, "protocol error");
+    return false;
+  }
+
+  return true;
+}
+
+template <typename Dispatch>
+bool Connection::dispatch_parsed(Dispatch& dispatch) {
+  std::size_t first = 0;
+  for (const std::uint32_t argc : parsed.argc) {
+    maybe_compact_write_buf();
+    std::string& out = reply_buffer();
+    const bool had_output = wants_write();
+    dispatch(resp::Args(parsed.args.data() + first, argc), out, reply_splices());
+    first += argc;
+    count_splices();
+    if (pending_write_bytes() > kMaxWriteBuffer || (had_output && output_bytes() > kMaxOutputBytes)) {
+      return false;  // backpressure failure
+    }
+  }
+  return true;
+}
+
 }  // namespace net
@@ -1,13 +1,17 @@
 #include "socket.hpp"
 
 #include <arpa/inet.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <netdb.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <poll.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
 #include <cstring>
+#include <string>
 
 #include "../util/error.hpp"
 
@@ -29,11 +33,19 @@ void set_reuseaddr(int fd) {
   util::syscall_or_die(setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag)), "setsockopt(SO_REUSEADDR)");
 }
 
-int create_listen_socket(uint16_t port, int backlog) {
+void set_reuseport(int fd) {
+  int flag = 1;
+  util::syscall_or_die(setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &flag, sizeof(flag)), "setsockopt(SO_REUSEPORT)");
+}
+
+int create_listen_socket(uint16_t port, int backlog, bool reuseport) {
   int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
   util::syscall_or_die(fd, "socket");
 
   set_reuseaddr(fd);
+  if (reuseport) {
+    set_reuseport(fd);
+  }
 
   sockaddr_in addr{};
   addr.sin_family = AF_INET;
@@ -46,4 +58,50 @@ int create_listen_socket(uint16_t port, int backlog) {
   return fd;
 }
 
+int connect_nonblocking(const std::string& host, uint16_t port) {
+  // Resolved on every attempt; hosts are normally literal addresses, for
+  // which this does not block.
+  addrinfo hints{};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* res = nullptr;
+  const std::string service = std::to_string(port);
+  if (::getaddrinfo(host.c_str(), service.c_str(), &hints, &res) != 0 || res == nullptr) {
+    errno = EHOSTUNREACH;
+    return -1;
+  }
+  const int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    ::freeaddrinfo(res);
+    return -1;
+  }
+  set_tcp_nodelay(fd);
+  const int rc = ::connect(fd, res->ai_addr, res->ai_addrlen);
+  ::freeaddrinfo(res);
+  if (rc != 0 && errno != EINPROGRESS) {
+    const int err = errno;
+    ::close(fd);
+    errno = err;
+    return -1;
+  }
+  return fd;
+}
+
+int connect_result(int fd) {
+  pollfd p{fd, POLLOUT, 0};
+  if (::poll(&p, 1, 0) <= 0) {
+    return 0;
+  }
+  int err = 0;
+  socklen_t len = sizeof(err);
+  if (::getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0) {
+    return -1;
+  }
+  if (err != 0) {
+    errno = err;
+    return -1;
+  }
+  return 1;
+}
+
 }  // namespace net
@@ -1,12 +1,23 @@
 #pragma once
 
 #include <cstdint>
+#include <string>
 
 namespace net {
 
-int create_listen_socket(uint16_t port, int backlog = 128);
+// With reuseport, several sockets may bind the same port and the kernel
+// spreads incoming connections across them.
+int create_listen_socket(uint16_t port, int backlog = 128, bool reuseport = false);
 void set_tcp_nodelay(int fd);
 void set_reuseaddr(int fd);
+void set_reuseport(int fd);
 void set_nonblocking(int fd);
 
+// Outgoing connections for links between servers: starts a nonblocking
+// connect to host:port (resolved over IPv4) and returns the socket, or -1
+// with errno set. connect_result then gives 1 once connected, 0 while still
+// connecting and -1 with errno set if the attempt failed.
+int connect_nonblocking(const std::string& host, uint16_t port);
+int connect_result(int fd);
+
 }
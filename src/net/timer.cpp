@@ -0,0 +1,34 @@
+#include "timer.hpp"
+
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <cstdint>
+
+#include "../util/error.hpp"
+
+namespace net {
+
+Timer::Timer(std::chrono::microseconds interval) {
+  fd_ = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  util::syscall_or_die(fd_, "timerfd_create");
+
+  itimerspec spec{};
+  spec.it_interval.tv_sec = static_cast<time_t>(interval.count() / 1000000);
+  spec.it_interval.tv_nsec = static_cast<long>((interval.count() % 1000000) * 1000);
+  spec.it_value = spec.it_interval;
+  util::syscall_or_die(::timerfd_settime(fd_, 0, &spec, nullptr), "timerfd_settime");
+}
+
+Timer::~Timer() {
+  if (fd_ != -1) {
+    ::close(fd_);
+  }
+}
+
+void Timer::drain() {
+  std::uint64_t expirations = 0;
+  (void)!::read(fd_, &expirations, sizeof(expirations));
+}
+
+}  // namespace net
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <chrono>
+
+namespace net {
+
+// Periodic timerfd on the monotonic clock, meant to be registered with epoll.
+class Timer {
+ public:
+  explicit Timer(std::chrono::microseconds interval);
+  ~Timer();
+
+  Timer(const Timer&) = delete;
+  Timer& operator=(const Timer&) = delete;
+
+  int fd() const { return fd_; }
+  // Acknowledges expirations so the fd stops polling readable.
+  void drain();
+
+ private:
+  int fd_;
+};
+
+}  // namespace net
@@ -0,0 +1,191 @@
+#include "uring.hpp"
+
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "../util/error.hpp"
+
+namespace net {
+
+namespace {
+int sys_setup(unsigned entries, io_uring_params* p) {
+  return static_cast<int>(::syscall(__NR_io_uring_setup, entries, p));
+}
+
+int sys_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, const void* arg = nullptr,
+              std::size_t argsz = 0) {
+  return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz));
+}
+
+int sys_register(int fd, unsigned opcode, const void* arg, unsigned nr_args) {
+  return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+template <typename T>
+T* at(void* base, unsigned offset) {
+  return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+}
+}  // namespace
+
+Uring::Uring(unsigned entries) {
+  io_uring_params p{};
+  ring_fd = sys_setup(entries, &p);
+  util::syscall_or_die(ring_fd, "io_uring_setup");
+  feats = p.features;
+
+  sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+  const bool single_mmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single_mmap) {
+    sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+  }
+
+  sq_ring = ::mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                   IORING_OFF_SQ_RING);
+  if (sq_ring == MAP_FAILED) {
+    util::die_errno("mmap sq ring");
+  }
+  if (single_mmap) {
+    cq_ring = sq_ring;
+  } else {
+    cq_ring = ::mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                     IORING_OFF_CQ_RING);
+    if (cq_ring == MAP_FAILED) {
+      util::die_errno("mmap cq ring");
+    }
+  }
+  sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+  void* s = ::mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+  if (s == MAP_FAILED) {
+    util::die_errno("mmap sqes");
+  }
+  sqes = static_cast<io_uring_sqe*>(s);
+
+  sq_head = at<unsigned>(sq_ring, p.sq_off.head);
+  sq_tail = at<unsigned>(sq_ring, p.sq_off.tail);
+  sq_mask = at<unsigned>(sq_ring, p.sq_off.ring_mask);
+  sq_entries = p.sq_entries;
+  sqe_tail = *sq_tail;
+  // Entries are always used in ring order, so the index array is the identity.
+  unsigned* array = at<unsigned>(sq_ring, p.sq_off.array);
+  for (unsigned i = 0; i < sq_entries; ++i) {
+    array[i] = i;
+  }
+
+  cq_head = at<unsigned>(cq_ring, p.cq_off.head);
+  cq_tail = at<unsigned>(cq_ring, p.cq_off.tail);
+  cq_mask = at<unsigned>(cq_ring, p.cq_off.ring_mask);
+  cqes = at<io_uring_cqe>(cq_ring, p.cq_off.cqes);
+}
+
+Uring::~Uring() {
+  if (sqes != nullptr) {
+    ::munmap(sqes, sqes_size);
+  }
+  if (cq_ring != nullptr && cq_ring != sq_ring) {
+    ::munmap(cq_ring, cq_ring_size);
+  }
+  if (sq_ring != nullptr) {
+    ::munmap(sq_ring, sq_ring_size);
+  }
+  if (ring_fd != -1) {
+    ::close(ring_fd);
+  }
+}
+
+io_uring_sqe* Uring::get_sqe() {
+  const unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+  if (sqe_tail - head >= sq_entries) {
+    return nullptr;
+  }
+  io_uring_sqe* sqe = &sqes[sqe_tail & *sq_mask];
+  ++sqe_tail;
+  std::memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+int Uring::submit(unsigned wait_nr, int timeout_ms) {
+  const unsigned to_submit = sqe_tail - *sq_tail;
+  __atomic_store_n(sq_tail, sqe_tail, __ATOMIC_RELEASE);
+  if (to_submit == 0 && wait_nr == 0) {
+    return 0;
+  }
+  unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+  __kernel_timespec ts{};
+  io_uring_getevents_arg arg{};
+  const void* argp = nullptr;
+  std::size_t argsz = 0;
+  if (wait_nr > 0 && timeout_ms >= 0) {
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = static_cast<long long>(timeout_ms % 1000) * 1000000;
+    arg.ts = reinterpret_cast<std::uint64_t>(&ts);
+    flags |= IORING_ENTER_EXT_ARG;
+    argp = &arg;
+    argsz = sizeof(arg);
+  }
+  while (true) {
+    int ret = sys_enter(ring_fd, to_submit, wait_nr, flags, argp, argsz);
+    if (ret < 0 && errno == EINTR) {
+      continue;
+    }
+    return ret < 0 ? -errno : ret;
+  }
+}
+
+BufferRing::BufferRing(Uring& ring, std::uint16_t group, unsigned count, unsigned size)
+    : group_(group), count(count), size(size) {
+  br_size = count * sizeof(io_uring_buf);
+  void* r = ::mmap(nullptr, br_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (r == MAP_FAILED) {
+    util::die_errno("mmap buffer ring");
+  }
+  br = static_cast<io_uring_buf_ring*>(r);
+
+  void* b = ::mmap(nullptr, static_cast<std::size_t>(count) * size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (b == MAP_FAILED) {
+    util::die_errno("mmap receive buffers");
+  }
+  base = static_cast<char*>(b);
+
+  io_uring_buf_reg reg{};
+  reg.ring_addr = reinterpret_cast<std::uint64_t>(br);
+  reg.ring_entries = count;
+  reg.bgid = group;
+  util::syscall_or_die(sys_register(ring.fd(), IORING_REGISTER_PBUF_RING, &reg, 1), "io_uring register buffer ring");
+
+  for (unsigned i = 0; i < count; ++i) {
+    io_uring_buf& buf = entries()[i];
+    buf.addr = reinterpret_cast<std::uint64_t>(data(static_cast<std::uint16_t>(i)));
+    buf.len = size;
+    buf.bid = static_cast<std::uint16_t>(i);
+  }
+  __atomic_store_n(&br->tail, static_cast<std::uint16_t>(count), __ATOMIC_RELEASE);
+}
+
+BufferRing::~BufferRing() {
+  if (base != nullptr) {
+    ::munmap(base, static_cast<std::size_t>(count) * size);
+  }
+  if (br != nullptr) {
+    ::munmap(br, br_size);
+  }
+}
+
+void BufferRing::recycle(std::uint16_t bid) {
+  // The tail shares the first entry's reserved field, so write the entry
+  // before publishing it.
+  const std::uint16_t tail = br->tail;
+  io_uring_buf& buf = entries()[tail & (count - 1)];
+  buf.addr = reinterpret_cast<std::uint64_t>(data(bid));
+  buf.len = size;
+  buf.bid = bid;
+  __atomic_store_n(&br->tail, static_cast<std::uint16_t>(tail + 1), __ATOMIC_RELEASE);
+}
+
+}  // namespace net
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <linux/io_uring.h>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace net {
+
+// Minimal io_uring wrapper over the raw syscalls: one submission and one
+// completion ring mapped into our address space. Single-threaded use only.
+class Uring {
+ public:
+  explicit Uring(unsigned entries);
+  ~Uring();
+
+  Uring(const Uring&) = delete;
+  Uring& operator=(const Uring&) = delete;
+
+  // Next free submission entry, zeroed, or nullptr when the ring is full.
+  io_uring_sqe* get_sqe();
+  // Submits queued entries and waits for at least wait_nr completions, or
+  // until timeout_ms passes when it is not negative. Returns the number
+  // submitted or -errno (-ETIME when the wait timed out).
+  int submit(unsigned wait_nr = 0, int timeout_ms = -1);
+
+  // Calls f(const io_uring_cqe&) for every available completion.
+  template <typename F>
+  unsigned drain(F&& f) {
+    unsigned head = *cq_head;
+    const unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    unsigned seen = 0;
+    for (; head != tail; ++head, ++seen) {
+      f(cqes[head & *cq_mask]);
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    return seen;
+  }
+
+  int fd() const { return ring_fd; }
+  unsigned features() const { return feats; }
+
+ private:
+  int ring_fd{-1};
+  unsigned feats{0};
+
+  void* sq_ring{nullptr};
+  std::size_t sq_ring_size{0};
+  void* cq_ring{nullptr};
+  std::size_t cq_ring_size{0};
+  io_uring_sqe* sqes{nullptr};
+  std::size_t sqes_size{0};
+
+  unsigned* sq_head{nullptr};
+  unsigned* sq_tail{nullptr};
+  unsigned* sq_mask{nullptr};
+  unsigned sq_entries{0};
+  unsigned sqe_tail{0};  // entries handed out, published to sq_tail on submit
+
+  unsigned* cq_head{nullptr};
+  unsigned* cq_tail{nullptr};
+  unsigned* cq_mask{nullptr};
+  io_uring_cqe* cqes{nullptr};
+};
+
+// A ring of equally sized receive buffers registered with a Uring under a
+// group id; IOSQE_BUFFER_SELECT reads pick one and report it in the cqe.
+class BufferRing {
+ public:
+  // count must be a power of two.
+  BufferRing(Uring& ring, std::uint16_t group, unsigned count, unsigned size);
+  ~BufferRing();
+
+  BufferRing(const BufferRing&) = delete;
+  BufferRing& operator=(const BufferRing&) = delete;
+
+  std::uint16_t group() const { return group_; }
+  const char* data(std::uint16_t bid) const { return base + static_cast<std::size_t>(bid) * size; }
+  // Hands a consumed buffer back to the kernel.
+  void recycle(std::uint16_t bid);
+
+ private:
+  // The ring is an array of io_uring_buf starting at br; the header's flex
+  // array member is not at offset 0 once compiled as C++.
+  io_uring_buf* entries() { return reinterpret_cast<io_uring_buf*>(br); }
+
+  std::uint16_t group_;
+  unsigned count;
+  unsigned size;
+  io_uring_buf_ring* br{nullptr};
+  std::size_t br_size{0};
+  char* base{nullptr};
+};
+
+}  // namespace net
@@ -0,0 +1,147 @@
+#include "aof.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include "../protocol/resp_parser.hpp"
+#include "../util/error.hpp"
+
+namespace persist {
+
+namespace {
+// Read-only mapping of the first len bytes of a file.
+class Mapping {
+ public:
+  Mapping(int fd, std::size_t len) : len(len) {
+    if (len == 0) {
+      return;
+    }
+    void* p = ::mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+      util::die_errno("mmap aof");
+    }
+    ::madvise(p, len, MADV_SEQUENTIAL);
+    addr = static_cast<const char*>(p);
+  }
+  ~Mapping() {
+    if (addr != nullptr) {
+      ::munmap(const_cast<char*>(addr), len);
+    }
+  }
+  Mapping(const Mapping&) = delete;
+  Mapping& operator=(const Mapping&) = delete;
+
+  std::string_view bytes() const { return {addr, len}; }
+
+ private:
+  const char* addr{nullptr};
+  std::size_t len;
+};
+
+// Walks complete commands in data; returns the offset just past the last one.
+// corrupt is set when parsing stopped on garbage rather than a short tail.
+template <typename F>
+std::size_t for_each_command(std::string_view data, bool& corrupt, F&& f) {
+  resp::RespParser parser;
+  std::size_t offset = 0;
+  while (parser.parse(data.substr(offset))) {
+    f(parser.argv());
+    offset += parser.consumed_bytes();
+  }
+  corrupt = parser.error();
+  return offset;
+}
+}  // namespace
+
+Aof::Aof(std::string path, FsyncPolicy policy) : path(std::move(path)), policy(policy) {
+  fd = ::open(this->path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  util::syscall_or_die(fd, "open aof");
+
+  struct stat st {};
+  util::syscall_or_die(::fstat(fd, &st), "fstat aof");
+  const auto size = static_cast<std::size_t>(st.st_size);
+
+  bool corrupt = false;
+  {
+    Mapping map(fd, size);
+    loaded_bytes = for_each_command(map.bytes(), corrupt, [](resp::Args) {});
+  }
+  if (corrupt) {
+    std::fprintf(stderr, "aof: %s is corrupt at offset %zu\n", this->path.c_str(), loaded_bytes);
+    std::exit(EXIT_FAILURE);
+  }
+  if (loaded_bytes != size) {
+    std::fprintf(stderr, "aof: dropping %zu bytes of incomplete or corrupt tail\n", size - loaded_bytes);
+    util::syscall_or_die(::ftruncate(fd, static_cast<off_t>(loaded_bytes)), "ftruncate aof");
+  }
+
+  if (policy == FsyncPolicy::EverySec) {
+    sync_thread = std::thread([this] { fsync_loop(); });
+  }
+}
+
+Aof::~Aof() {
+  if (sync_thread.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(sync_mu);
+      stopping = true;
+    }
+    sync_cv.notify_one();
+    sync_thread.join();
+  }
+  if (fd != -1) {
+    ::fdatasync(fd);
+    ::close(fd);
+  }
+}
+
+void Aof::write(std::string_view batch) {
+  std::lock_guard<std::mutex> lock(write_mu);
+  while (!batch.empty()) {
+    ssize_t n = ::write(fd, batch.data(), batch.size());
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      // Acknowledging writes we could not log would silently lose data.
+      util::die_errno("aof write");
+    }
+    batch.remove_prefix(static_cast<std::size_t>(n));
+  }
+
+  if (policy == FsyncPolicy::Always) {
+    util::syscall_or_die(::fdatasync(fd), "aof fdatasync");
+  } else {
+    dirty.store(true, std::memory_order_relaxed);
+  }
+}
+
+void Aof::fsync_loop() {
+  std::unique_lock<std::mutex> lock(sync_mu);
+  while (!stopping) {
+    sync_cv.wait_for(lock, std::chrono::seconds(1));
+    if (dirty.exchange(false, std::memory_order_relaxed)) {
+      ::fdatasync(fd);
+    }
+  }
+}
+
+std::size_t Aof::replay(const std::function<void(resp::Args)>& apply) const {
+  Mapping map(fd, loaded_bytes);
+  std::size_t commands = 0;
+  bool corrupt = false;
+  for_each_command(map.bytes(), corrupt, [&](resp::Args args) {
+    apply(args);
+    ++commands;
+  });
+  return commands;
+}
+
+}  // namespace persist
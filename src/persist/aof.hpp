@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "../protocol/resp.hpp"
+
+namespace persist {
+
+enum class FsyncPolicy { Always, EverySec, No };
+
+// Append-only log of mutating commands, shared by every reactor. Each reactor
+// buffers the commands of one loop iteration and hands the whole batch to
+// write() (group commit). A key is owned by one reactor, so interleaving
+// batches from different reactors keeps every key's history in order.
+//
+//   always    write and fdatasync the batch before the loop sends any reply
+//   everysec  write per batch, a background thread fdatasyncs once a second
+//   no        write per batch, the kernel decides when to flush
+class Aof {
+ public:
+  // Opens (creating if needed) the log and cuts off a torn final command left
+  // by a crash, so replay() and new appends start from a clean boundary.
+  Aof(std::string path, FsyncPolicy policy);
+  ~Aof();
+
+  Aof(const Aof&) = delete;
+  Aof& operator=(const Aof&) = delete;
+
+  void write(std::string_view batch);
+
+  // Feeds every command that was in the log at open time to apply, straight
+  // from a read-only mapping without touching the network layer. Safe to call
+  // from several threads at once.
+  std::size_t replay(const std::function<void(resp::Args)>& apply) const;
+
+ private:
+  void fsync_loop();
+
+  std::string path;
+  FsyncPolicy policy;
+  int fd{-1};
+  std::size_t loaded_bytes{0};
+
+  std::mutex write_mu;
+  std::atomic<bool> dirty{false};
+
+  std::mutex sync_mu;
+  std::condition_variable sync_cv;
+  bool stopping{false};
+  std::thread sync_thread;
+};
+
+}  // namespace persist
@@ -0,0 +1,434 @@
+#include "snapshot.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#include "../util/error.hpp"
+#include "../util/time.hpp"
+
+namespace persist {
+
+namespace {
+constexpr std::string_view kMagic = "KVSNAP01";
+constexpr uint8_t kRecordString = 1;
+constexpr uint8_t kRecordHash = 2;
+constexpr uint8_t kRecordList = 3;
+constexpr uint8_t kRecordZSet = 4;
+constexpr uint8_t kRecordEnd = 0xFF;
+constexpr std::size_t kWriteChunk = 1 << 20;
+constexpr std::size_t kHeaderSize = 8 + 8 + 8;
+constexpr std::size_t kRecordHeaderSize = 1 + 4 + 4 + 8;
+
+template <typename T>
+void put(std::string& out, T value) {
+  char raw[sizeof(T)];
+  std::memcpy(raw, &value, sizeof(T));
+  out.append(raw, sizeof(T));
+}
+
+template <typename T>
+T get(const char* p) {
+  T value;
+  std::memcpy(&value, p, sizeof(T));
+  return value;
+}
+
+uint8_t record_type(db::ValueType type) {
+  switch (type) {
+    case db::ValueType::Hash:
+      return kRecordHash;
+    case db::ValueType::List:
+      return kRecordList;
+    case db::ValueType::ZSet:
+      return kRecordZSet;
+    case db::ValueType::String:
+      break;
+  }
+  return kRecordString;
+}
+
+bool value_type(uint8_t op, db::ValueType& type) {
+  switch (op) {
+    case kRecordString:
+      type = db::ValueType::String;
+      return true;
+    case kRecordHash:
+      type = db::ValueType::Hash;
+      return true;
+    case kRecordList:
+      type = db::ValueType::List;
+      return true;
+    case kRecordZSet:
+      type = db::ValueType::ZSet;
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool write_all(int fd, std::string_view data) {
+  while (!data.empty()) {
+    ssize_t n = ::write(fd, data.data(), data.size());
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data.remove_prefix(static_cast<std::size_t>(n));
+  }
+  return true;
+}
+
+// The parent's sockets are nonblocking, and the child shares their flags, so
+// it waits for room with poll instead of clearing O_NONBLOCK under the parent.
+bool wait_writable(int sock) {
+  pollfd p{sock, POLLOUT, 0};
+  while (true) {
+    const int n = ::poll(&p, 1, -1);
+    if (n > 0) {
+      return (p.revents & (POLLERR | POLLHUP)) == 0;
+    }
+    if (n < 0 && errno != EINTR) {
+      return false;
+    }
+  }
+}
+
+bool send_all(int sock, std::string_view data) {
+  while (!data.empty()) {
+    ssize_t n = ::send(sock, data.data(), data.size(), MSG_NOSIGNAL);
+    if (n >= 0) {
+      data.remove_prefix(static_cast<std::size_t>(n));
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      if (!wait_writable(sock)) {
+        return false;
+      }
+    } else if (errno != EINTR) {
+      return false;
+    }
+  }
+  return true;
+}
+
+Snapshotter::LoadResult corrupt(const std::string& path, std::size_t offset) {
+  std::fprintf(stderr, "snapshot: %s is corrupt at offset %zu\n", path.c_str(), offset);
+  return Snapshotter::LoadResult::Corrupt;
+}
+}  // namespace
+
+Snapshotter::Snapshotter(std::string path, unsigned shards, std::function<void(unsigned)> wake)
+    : path(std::move(path)), shards(shards), wake(std::move(wake)), stores(shards, nullptr) {}
+
+void Snapshotter::attach(unsigned shard, const db::Store* store) {
+  stores[shard] = store;
+  attached.fetch_add(1, std::memory_order_release);
+}
+
+bool Snapshotter::begin() {
+  bool expected = false;
+  return busy.compare_exchange_strong(expected, true, std::memory_order_acq_rel);
+}
+
+void Snapshotter::pause_others() {
+  if (shards == 1) {
+    return;
+  }
+  pause_requested.store(true, std::memory_order_release);
+  for (unsigned i = 0; i < shards; ++i) {
+    wake(i);
+  }
+  // Only the caller is not parking.
+  while (parked.load(std::memory_order_acquire) < shards - 1) {
+    std::this_thread::yield();
+  }
+}
+
+void Snapshotter::resume_others() {
+  pause_requested.store(false, std::memory_order_release);
+}
+
+void Snapshotter::park() {
+  parked.fetch_add(1, std::memory_order_acq_rel);
+  while (pause_requested.load(std::memory_order_acquire)) {
+    std::this_thread::yield();
+  }
+  parked.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+Snapshotter::Status Snapshotter::background_save() {
+  if (attached.load(std::memory_order_acquire) < shards) {
+    return Status::NotReady;
+  }
+  if (!begin()) {
+    return Status::Busy;
+  }
+  out.reserve(kWriteChunk + kRecordHeaderSize);
+
+  pause_others();
+  pid_t pid = ::fork();
+  resume_others();
+
+  if (pid == 0) {
+    // Child: every store is frozen in our copy of memory.
+    ::_exit(write_file() ? 0 : 1);
+  }
+  if (pid < 0) {
+    busy.store(false, std::memory_order_release);
+    return Status::Failed;
+  }
+  child.store(pid, std::memory_order_release);
+  return Status::Ok;
+}
+
+Snapshotter::Status Snapshotter::save() {
+  if (attached.load(std::memory_order_acquire) < shards) {
+    return Status::NotReady;
+  }
+  if (!begin()) {
+    return Status::Busy;
+  }
+  pause_others();
+  const bool ok = write_file();
+  resume_others();
+  if (ok) {
+    last_save.store(util::unix_millis() / 1000, std::memory_order_relaxed);
+  }
+  busy.store(false, std::memory_order_release);
+  return ok ? Status::Ok : Status::Failed;
+}
+
+void Snapshotter::poll() {
+  pid_t pid = child.load(std::memory_order_acquire);
+  if (pid <= 0) {
+    return;
+  }
+  int status = 0;
+  if (::waitpid(pid, &status, WNOHANG) != pid) {
+    return;
+  }
+  const bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  child.store(0, std::memory_order_release);
+  if (sending.load(std::memory_order_acquire) == Transfer::Running) {
+    // Stays busy until the reactor serving the replica has seen the outcome.
+    sending.store(ok ? Transfer::Done : Transfer::Failed, std::memory_order_release);
+    return;
+  }
+  if (ok) {
+    last_save.store(util::unix_millis() / 1000, std::memory_order_relaxed);
+  } else {
+    std::fprintf(stderr, "snapshot: background save failed\n");
+  }
+  busy.store(false, std::memory_order_release);
+}
+
+Snapshotter::Status Snapshotter::background_send(int fd, const std::function<std::string()>& preamble) {
+  if (attached.load(std::memory_order_acquire) < shards) {
+    return Status::NotReady;
+  }
+  if (!begin()) {
+    return Status::Busy;
+  }
+  out.reserve(kWriteChunk + kRecordHeaderSize);
+
+  pause_others();
+  const std::string head = preamble();
+  sending.store(Transfer::Running, std::memory_order_release);
+  pid_t pid = ::fork();
+  resume_others();
+
+  if (pid == 0) {
+    ::_exit(send_snapshot(fd, head) ? 0 : 1);
+  }
+  if (pid < 0) {
+    sending.store(Transfer::None, std::memory_order_release);
+    busy.store(false, std::memory_order_release);
+    return Status::Failed;
+  }
+  child.store(pid, std::memory_order_release);
+  return Status::Ok;
+}
+
+void Snapshotter::end_transfer() {
+  sending.store(Transfer::None, std::memory_order_release);
+  busy.store(false, std::memory_order_release);
+}
+
+bool Snapshotter::send_snapshot(int sock, std::string_view preamble) {
+  // Written to an unlinked file first, since the bulk header needs the size.
+  const std::string tmp = path + ".sync." + std::to_string(::getpid());
+  int fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    return false;
+  }
+  ::unlink(tmp.c_str());
+  const off_t size = write_to(fd) ? ::lseek(fd, 0, SEEK_END) : -1;
+  if (size < 0) {
+    ::close(fd);
+    return false;
+  }
+
+  std::string head(preamble);
+  head.push_back('$');
+  head.append(std::to_string(size)).append("\r\n");
+  bool ok = send_all(sock, head);
+  off_t sent = 0;
+  while (ok && sent < size) {
+    const ssize_t n = ::sendfile(sock, fd, &sent, static_cast<std::size_t>(size - sent));
+    if (n == 0) {
+      ok = false;
+    } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      ok = wait_writable(sock);
+    } else if (n < 0 && errno != EINTR) {
+      ok = false;
+    }
+  }
+  ::close(fd);
+  return ok;
+}
+
+bool Snapshotter::write_file() {
+  const std::string tmp = path + ".tmp." + std::to_string(::getpid());
+  int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  const bool ok = write_to(fd) && ::fsync(fd) == 0;
+  ::close(fd);
+
+  if (!ok || ::rename(tmp.c_str(), path.c_str()) != 0) {
+    ::unlink(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool Snapshotter::write_to(int fd) {
+  std::size_t hint = 0;
+  for (const db::Store* store : stores) {
+    hint += store->size();
+  }
+  out.clear();
+  out.append(kMagic);
+  put<uint64_t>(out, hint);
+  put<int64_t>(out, util::unix_millis());
+
+  bool ok = true;
+  uint64_t records = 0;
+  std::string scratch;  // collections in big encodings, flattened
+  for (const db::Store* store : stores) {
+    store->for_each([&](const db::Entry& e) {
+      if (!ok) {
+        return;
+      }
+      const std::string_view key = e.key.view();
+      const std::string_view value = e.compact_value(scratch);
+      out.push_back(static_cast<char>(record_type(e.type)));
+      put<uint32_t>(out, static_cast<uint32_t>(key.size()));
+      put<uint32_t>(out, static_cast<uint32_t>(value.size()));
+      put<int64_t>(out, e.has_expiry() ? util::to_unix_millis(e.expire_at) : -1);
+      out.append(key);
+      out.append(value);
+      ++records;
+      if (out.size() >= kWriteChunk) {
+        ok = write_all(fd, out);
+        out.clear();
+      }
+    });
+  }
+  out.push_back(static_cast<char>(kRecordEnd));
+  put<uint64_t>(out, records);
+  return ok && write_all(fd, out);
+}
+
+Snapshotter::LoadResult Snapshotter::load(const std::string& path, db::Store& store, unsigned shards,
+                                          const std::function<bool(std::string_view)>& keep) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return LoadResult::Missing;
+  }
+  struct stat st {};
+  util::syscall_or_die(::fstat(fd, &st), "fstat snapshot");
+  const auto size = static_cast<std::size_t>(st.st_size);
+  if (size < kHeaderSize + 9) {
+    ::close(fd);
+    return corrupt(path, 0);
+  }
+  void* map = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+  ::close(fd);
+  if (map == MAP_FAILED) {
+    util::die_errno("mmap snapshot");
+  }
+  ::madvise(map, size, MADV_SEQUENTIAL);
+  const char* data = static_cast<const char*>(map);
+  auto fail = [&](std::size_t offset) {
+    ::munmap(map, size);
+    return corrupt(path, offset);
+  };
+
+  if (std::string_view(data, kMagic.size()) != kMagic) {
+    return fail(0);
+  }
+  store.reserve(static_cast<std::size_t>(get<uint64_t>(data + 8)) / shards);
+
+  const util::TimePoint now = util::now();
+  const int64_t now_unix = util::unix_millis();
+  std::size_t pos = kHeaderSize;
+  uint64_t records = 0;
+  while (true) {
+    if (pos >= size) {
+      return fail(pos);
+    }
+    const auto op = static_cast<uint8_t>(data[pos]);
+    if (op == kRecordEnd) {
+      if (pos + 9 != size || get<uint64_t>(data + pos + 1) != records) {
+        return fail(pos);
+      }
+      break;
+    }
+    db::ValueType type{};
+    if (!value_type(op, type) || size - pos < kRecordHeaderSize) {
+      return fail(pos);
+    }
+    const auto key_len = get<uint32_t>(data + pos + 1);
+    const auto value_len = get<uint32_t>(data + pos + 5);
+    const auto deadline = get<int64_t>(data + pos + 9);
+    pos += kRecordHeaderSize;
+    if (size - pos < static_cast<std::size_t>(key_len) + value_len) {
+      return fail(pos);
+    }
+    const std::string_view key(data + pos, key_len);
+    const std::string_view value(data + pos + key_len, value_len);
+    if (type != db::ValueType::String && !db::Store::valid_collection(type, value)) {
+      return fail(pos);
+    }
+    pos += static_cast<std::size_t>(key_len) + value_len;
+    ++records;
+
+    if (deadline != -1 && deadline <= now_unix) {
+      continue;  // expired while on disk
+    }
+    if (!keep(key)) {
+      continue;
+    }
+    store.restore(key, value, deadline == -1 ? db::kNoExpiry : now + std::chrono::milliseconds(deadline - now_unix),
+                  type);
+  }
+
+  ::munmap(map, size);
+  return LoadResult::Loaded;
+}
+
+}  // namespace persist
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../db/store.hpp"
+
+namespace persist {
+
+// Binary snapshot of every shard's store, native (little-endian) byte order:
+//   header   "KVSNAP01", u64 key count hint, i64 unix ms when taken
+//   record   u8 record type, u32 key len, u32 value len,
+//            i64 unix ms deadline or -1, key bytes, value bytes
+// A string's value is its bytes; a hash, list or sorted set is stored as its
+// listpack whatever its encoding in memory, and re-encoded on load.
+//   trailer  u8 kRecordEnd, u64 record count
+// Deadlines are wall-clock so they survive a restart.
+//
+// Takes snapshots without stalling the event loops: the shard that receives
+// SAVE/BGSAVE briefly parks every other reactor at a barrier so all stores
+// are between commands, forks, and lets them go; the child writes the file
+// from its copy-on-write image.
+class Snapshotter {
+ public:
+  // wake interrupts another shard's epoll_wait so it reaches the barrier.
+  Snapshotter(std::string path, unsigned shards, std::function<void(unsigned)> wake);
+
+  Snapshotter(const Snapshotter&) = delete;
+  Snapshotter& operator=(const Snapshotter&) = delete;
+
+  // Registers a shard's store once it has finished loading; saves are refused
+  // until every shard has done so.
+  void attach(unsigned shard, const db::Store* store);
+
+  // Called by every reactor once per loop iteration; blocks while another
+  // shard is forking or saving in the foreground.
+  void maybe_park() {
+    if (pause_requested.load(std::memory_order_acquire)) {
+      park();
+    }
+  }
+
+  enum class Status { Ok, Busy, NotReady, Failed };
+  Status background_save();
+  Status save();
+  // Reaps a finished background save or send; called periodically by one
+  // reactor.
+  void poll();
+
+  // Full resync of a replica: like background_save, but the child sends the
+  // snapshot over the socket fd as a RESP bulk string, after the bytes
+  // preamble() returns. preamble runs while every store is parked, so it can
+  // read the replication offset the snapshot matches. The parent must not
+  // write to fd until the send is over. Once poll() has reaped the child,
+  // transfer() reports the outcome, and the snapshotter stays busy until
+  // end_transfer().
+  enum class Transfer { None, Running, Done, Failed };
+  Status background_send(int fd, const std::function<std::string()>& preamble);
+  Transfer transfer() const { return sending.load(std::memory_order_acquire); }
+  void end_transfer();
+
+  int64_t last_save_unix() const { return last_save.load(std::memory_order_relaxed); }
+
+  // Bulk-loads the snapshot at path from a read-only mapping into store,
+  // pre-sized for its share of the keys, keeping only records keep accepts.
+  // Reports Missing if there is no file and Corrupt on a malformed one, in
+  // which case store keeps whatever was restored before the bad record.
+  enum class LoadResult { Loaded, Missing, Corrupt };
+  static LoadResult load(const std::string& path, db::Store& store, unsigned shards,
+                         const std::function<bool(std::string_view)>& keep);
+
+ private:
+  bool begin();
+  void pause_others();
+  void resume_others();
+  void park();
+  bool write_file();
+  // Serializes every store to fd.
+  bool write_to(int fd);
+  // Child side of background_send.
+  bool send_snapshot(int sock, std::string_view preamble);
+
+  std::string path;
+  unsigned shards;
+  std::function<void(unsigned)> wake;
+  std::vector<const db::Store*> stores;
+  std::atomic<unsigned> attached{0};
+
+  std::atomic<bool> busy{false};
+  std::atomic<bool> pause_requested{false};
+  std::atomic<unsigned> parked{0};
+  std::atomic<pid_t> child{0};
+  std::atomic<Transfer> sending{Transfer::None};
+  std::atomic<int64_t> last_save{0};
+  std::string out;  // write buffer, allocated before fork
+};
+
+}  // namespace persist
@@ -1,17 +1,59 @@
 #pragma once
 #include <charconv>
 #include <cstddef>
+#include <deque>
 #include <optional>
+#include <span>
 #include <string>
 #include <string_view>
+#include <utility>
+#include <vector>
 
 namespace resp {
 
+// A command's arguments, as views into the buffer they were parsed from.
+using Args = std::span<const std::string_view>;
+
 inline constexpr std::string_view line_terminator = "\r\n";
 inline constexpr std::string_view success = "+OK\r\n";
 inline constexpr std::string_view null_string = "$-1\r\n";
 inline constexpr std::string_view null_array = "*-1\r\n";
 
+// Keeps the bytes of a spliced payload alive until they are sent: a
+// reference on a refcounted block (of the store), dropped through unref.
+class Pin {
+ public:
+  using Unref = void (*)(const char* block);
+
+  Pin(const char* block, Unref unref) : block(block), unref(unref) {}
+  Pin(Pin&& other) noexcept : block(std::exchange(other.block, nullptr)), unref(other.unref) {}
+  Pin& operator=(Pin&& other) noexcept {
+    std::swap(block, other.block);
+    std::swap(unref, other.unref);
+    return *this;
+  }
+  ~Pin() {
+    if (block != nullptr) {
+      unref(block);
+    }
+  }
+
+ private:
+  const char* block;
+  Unref unref;
+};
+
+// A bulk payload that goes on the wire after the first `at` bytes of a reply
+// buffer without being copied into it, so stored values are sent from where
+// they live and large ones do not grow that buffer. Connections send both
+// with sendmsg.
+struct Splice {
+  std::size_t at;
+  std::string_view data;
+  Pin pin;
+};
+using Splices = std::deque<Splice>;
+
 // simple for ok, queued, etc
 inline void append_status_string(std::string& out, std::string_view msg) {
   out.push_back('+');
@@ -19,18 +61,29 @@ inline void append_status_string(std::string& out, std::string_view msg) {
   out.append(line_terminator);
 }
 
-// for actual string data
-inline void append_string(std::string& out, std::string_view value) {
+inline void append_bulk_header(std::string& out, std::size_t len) {
   char len_buf[32];
-  auto [ptr, ec] = std::to_chars(len_buf, len_buf + sizeof(len_buf), value.size());
+  auto [ptr, ec] = std::to_chars(len_buf, len_buf + sizeof(len_buf), len);
   (void)ec;
   out.push_back('$');
   out.append(len_buf, static_cast<std::size_t>(ptr - len_buf));
   out.append(line_terminator);
+}
+
+// for actual string data
+inline void append_string(std::string& out, std::string_view value) {
+  append_bulk_header(out, value.size());
   out.append(value);
   out.append(line_terminator);
 }
 
+// Bulk string whose payload is spliced in rather than copied.
+inline void append_spliced(std::string& out, Splices& splices, std::string_view value, Pin pin) {
+  append_bulk_header(out, value.size());
+  splices.push_back(Splice{out.size(), value, std::move(pin)});
+  out.append(line_terminator);
+}
+
 inline void append_string(std::string& out, std::optional<std::string_view> value) {
   if (value.has_value()) {
     append_string(out, *value);
@@ -50,6 +103,15 @@ inline void append_error(std::string& out, std::string_view msg) {
   out.append(line_terminator);
 }
 
+// Error with its own code in place of ERR, e.g. WRONGTYPE or OOM.
+inline void append_error_code(std::string& out, std::string_view code, std::string_view msg) {
+  out.push_back('-');
+  out.append(code);
+  out.push_back(' ');
+  out.append(msg);
+  out.append(line_terminator);
+}
+
 inline void append_integer(std::string& out, long long value) {
   out.push_back(':');
   out.append(std::to_string(value));
@@ -70,4 +132,12 @@ inline void append_null_array(std::string& out) {
   out.append(null_array);
 }
 
+// Encodes a command the way clients send it, for logs and replication.
+inline void append_command(std::string& out, Args args) {
+  append_array_header(out, args.size());
+  for (std::string_view arg : args) {
+    append_string(out, arg);
+  }
+}
+
 }
@@ -1,131 +1,423 @@
 #include "resp_parser.hpp"
 
+#include <algorithm>
+#include <bit>
 #include <cstddef>
-#include <limits>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 namespace resp {
 
 namespace {
 enum class ParseStatus { Ok, Incomplete, Error };
 
-ParseStatus parse_length(const std::string& buffer, std::size_t& cursor, std::size_t& out) {
-  std::size_t i = cursor;
-  if (i >= buffer.size()) {
-    return ParseStatus::Incomplete;
+// Same bounds real Redis enforces, so a hostile header cannot make us reserve
+// or wait for an absurd amount of memory.
+constexpr std::size_t kMaxArrayLen = 1024 * 1024;
+constexpr std::size_t kMaxBulkLen = 512 * 1024 * 1024;
+// Big bulks one frame may hold, as Redis' client-query-buffer-limit.
+constexpr std::size_t kMaxBigArgBytes = 1024 * 1024 * 1024;
+// A big bulk starts this large (or as large as what has arrived) and
+// doubles as more comes, so memory follows the bytes received rather than
+// the length a header claims.
+constexpr std::size_t kBigArgStart = 4 * kBigArg;
+// Digits of a length that cannot overflow 64 bits; longer ones exceed the
+// bounds above anyway.
+constexpr std::size_t kMaxDigits = 19;
+
+constexpr std::size_t kBlock = 64;
+constexpr std::size_t kNoBlock = SIZE_MAX;
+
+// Value of the n ASCII digits at p; wide when 8 bytes may be read from p.
+std::size_t parse_digits(const char* p, std::size_t n, bool wide) {
+  // The usual one to four digits are quicker one by one than through the
+  // chain of multiplies below.
+  if (std::endian::native == std::endian::little && wide && n > 4 && n <= 8) {
+    // Up to eight digits at once. The shift drops the bytes past them and
+    // pads with zero bytes, which read as leading zeros; each step then
+    // combines neighbouring lanes: digits into pairs, pairs into fours,
+    // fours into eight.
+    std::uint64_t v = 0;
+    std::memcpy(&v, p, sizeof(v));
+    v <<= 8 * (8 - n);
+    v = ((v & 0x0F0F0F0F0F0F0F0F) * 2561) >> 8;
+    v = ((v & 0x00FF00FF00FF00FF) * 6553601) >> 16;
+    return static_cast<std::size_t>(((v & 0x0000FFFF0000FFFF) * 42949672960001) >> 32);
   }
-  if (buffer[i] < '0' || buffer[i] > '9') {
-    return ParseStatus::Error;
+  std::size_t value = 0;
+  for (std::size_t i = 0; i < n; ++i) {
+    value = value * 10 + static_cast<std::size_t>(p[i] - '0');
   }
+  return value;
+}
+}  // namespace
 
-  std::size_t value = 0;
-  while (i < buffer.size() && buffer[i] >= '0' && buffer[i] <= '9') {
-    std::size_t digit = static_cast<std::size_t>(buffer[i] - '0');
-    if (value > (std::numeric_limits<std::size_t>::max() - digit) / 10) {
+// Classifies the input 64 bytes at a time, on demand, into bitmaps with bit
+// i for byte i of the block: the \r of each \r\n, the '*' and '$' markers,
+// and bytes that are not ASCII digits. Headers are then parsed with a few
+// bit operations instead of a branch per byte, and a bulk's trailing \r\n is
+// one bit test. Blocks inside bulk data are never classified. Parsing only
+// moves forward, so only the latest block is kept.
+class Scanner {
+ public:
+  explicit Scanner(std::string_view in) : in(in) {}
+
+  const char* data() const { return in.data(); }
+  std::size_t size() const { return in.size(); }
+
+  // Whether a \r\n starts at pos; false for the last byte of the input.
+  bool crlf_at(std::size_t pos) { return bit(block(pos).crlf, pos); }
+
+  // Parses the "<marker><digits>\r\n" line at pos, which is in the input,
+  // and moves pos past it. Usually the line ends in the block it starts in,
+  // and its masks check the whole line at once.
+  ParseStatus header(std::size_t& pos, char marker, std::size_t& value) {
+    const Masks& m = block(pos);
+    if (!bit(marker == '*' ? m.star : m.dollar, pos)) {
+      return ParseStatus::Error;
+    }
+    const std::size_t off = pos % kBlock;
+    const std::uint64_t ends = m.crlf >> off;
+    if (ends == 0) {
+      return header_tail(pos, value);
+    }
+    // The line is the marker and its digits, and the \r\n is in this block.
+    const auto digits = static_cast<std::size_t>(std::countr_zero(ends)) - 1;
+    if (digits == 0 || digits > kMaxDigits || ((m.nondigit >> (off + 1)) & ((std::uint64_t{1} << digits) - 1)) != 0) {
+      return ParseStatus::Error;
+    }
+    value = parse_digits(in.data() + pos + 1, digits, pos + 9 <= in.size());
+    pos += digits + 3;
+    return ParseStatus::Ok;
+  }
+
+ private:
+  struct Masks {
+    std::uint64_t crlf;
+    std::uint64_t star;
+    std::uint64_t dollar;
+    std::uint64_t nondigit;
+  };
+
+  // The same for a line that runs into the next block or is not all here.
+  ParseStatus header_tail(std::size_t& pos, std::size_t& value) {
+    const std::size_t start = pos + 1;
+    if (start >= in.size()) {
+      return ParseStatus::Incomplete;
+    }
+    const std::size_t end = skip_digits(start);
+    const std::size_t digits = end - start;
+    if (digits == 0 || digits > kMaxDigits) {
       return ParseStatus::Error;
     }
-    value = value * 10 + digit;
-    ++i;
+    if (end + 1 >= in.size()) {
+      return ParseStatus::Incomplete;
+    }
+    if (!crlf_at(end)) {
+      return ParseStatus::Error;
+    }
+    value = parse_digits(in.data() + start, digits, start + 8 <= in.size());
+    pos = end + 2;
+    return ParseStatus::Ok;
   }
 
-  if (i + 1 >= buffer.size()) {
-    return ParseStatus::Incomplete;
+  // End of the digits starting at from, looking at most one past the
+  // longest length (so a run that long is seen) and not past the input.
+  std::size_t skip_digits(std::size_t from) {
+    const std::size_t to = std::min(in.size(), from + kMaxDigits + 1);
+    // Shifted in zeros read as digits, so a run reaching the end of the
+    // block continues into the next, which is as far as kMaxDigits goes.
+    const std::uint64_t other = block(from).nondigit >> (from % kBlock);
+    if (other != 0) {
+      return std::min(to, from + static_cast<std::size_t>(std::countr_zero(other)));
+    }
+    const std::size_t next = (from / kBlock + 1) * kBlock;
+    if (next >= to) {
+      return to;
+    }
+    const std::uint64_t rest = block(next).nondigit;
+    return rest == 0 ? to : std::min(to, next + static_cast<std::size_t>(std::countr_zero(rest)));
   }
-  if (buffer[i] != '\r' || buffer[i + 1] != '\n') {
-    return ParseStatus::Error;
+
+  static bool bit(std::uint64_t mask, std::size_t pos) { return ((mask >> (pos % kBlock)) & 1) != 0; }
+
+  const Masks& block(std::size_t pos) {
+    const std::size_t index = pos / kBlock;
+    if (index != current) {
+      masks = classify(index * kBlock);
+      current = index;
+    }
+    return masks;
   }
 
-  cursor = i + 2;
-  out = value;
-  return ParseStatus::Ok;
+  Masks classify(std::size_t start) const {
+    // The byte after the block tells whether a \r at its end starts a \r\n.
+    // Past the end of the input reads as zeros, which match nothing.
+    alignas(32) char tail[kBlock + 1];
+    const char* p = in.data() + start;
+    if (in.size() - start < kBlock + 1) {
+      std::memset(tail, 0, sizeof(tail));
+      std::memcpy(tail, p, in.size() - start);
+      p = tail;
+    }
+
+    std::uint64_t cr = 0;
+    std::uint64_t lf = 0;
+    Masks m{};
+    std::uint64_t digit = 0;
+#if defined(__AVX2__)
+    for (std::size_t i = 0; i < kBlock; i += 32) {
+      const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+      auto mask = [&](__m256i eq) {
+        return static_cast<std::uint64_t>(static_cast<std::uint32_t>(_mm256_movemask_epi8(eq))) << i;
+      };
+      cr |= mask(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')));
+      lf |= mask(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+      m.star |= mask(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('*')));
+      m.dollar |= mask(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('$')));
+      // Signed compares: bytes >= 0x80 are negative, so never digits.
+      digit |= mask(_mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('0' - 1)),
+                                     _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), v)));
+    }
+#elif defined(__SSE2__)
+    for (std::size_t i = 0; i < kBlock; i += 16) {
+      const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+      auto mask = [&](__m128i eq) {
+        return static_cast<std::uint64_t>(static_cast<std::uint32_t>(_mm_movemask_epi8(eq))) << i;
+      };
+      cr |= mask(_mm_cmpeq_epi8(v, _mm_set1_epi8('\r')));
+      lf |= mask(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+      m.star |= mask(_mm_cmpeq_epi8(v, _mm_set1_epi8('*')));
+      m.dollar |= mask(_mm_cmpeq_epi8(v, _mm_set1_epi8('$')));
+      // Signed compares: bytes >= 0x80 are negative, so never digits.
+      digit |= mask(_mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), v)));
+    }
+#else
+    for (std::size_t i = 0; i < kBlock; ++i) {
+      const std::uint64_t b = std::uint64_t{1} << i;
+      cr |= p[i] == '\r' ? b : 0;
+      lf |= p[i] == '\n' ? b : 0;
+      m.star |= p[i] == '*' ? b : 0;
+      m.dollar |= p[i] == '$' ? b : 0;
+      digit |= p[i] >= '0' && p[i] <= '9' ? b : 0;
+    }
+#endif
+    m.crlf = cr & ((lf >> 1) | (static_cast<std::uint64_t>(p[kBlock] == '\n') << (kBlock - 1)));
+    m.nondigit = ~digit;
+    return m;
+  }
+
+  std::string_view in;
+  std::size_t current{kNoBlock};
+  Masks masks{};
+};
+
+bool RespParser::fail() {
+  has_error = true;
+  args.clear();
+  return false;
 }
-}  // namespace
 
-bool RespParser::parse(std::string& buffer) {
+bool RespParser::parse(std::string_view buffer) {
   args.clear();
   consumed = 0;
 
-  if (has_error || buffer.empty()) { return false; }
-
-  std::size_t cursor = 0;
+  if (has_error || big_pending || buffer.empty()) { return false; }
 
-  // Expect arr header => *<count>\r\n
-  if (buffer[cursor] != '*') {
-    has_error = true;
+  Scanner in(buffer);
+  if (!parse_frame(in, 0)) {
     return false;
   }
-  ++cursor;
+  for (const auto& [offset, len, big] : spans) {
+    args.emplace_back(big ? big_args[offset].data() : buffer.data() + offset, len);
+  }
+  return true;
+}
 
-  std::size_t array_len = 0;
-  ParseStatus status = parse_length(buffer, cursor, array_len);
-  if (status == ParseStatus::Incomplete) {
-    return false;
+std::size_t RespParser::parse_batch(std::string_view buffer, Batch& out) {
+  args.clear();
+  consumed = 0;
+  if (has_error || big_pending) {
+    return 0;
   }
-  if (status == ParseStatus::Error) {
-    has_error = true;
-    return false;
+  // The previous batch has been used by now, so its big bulks can go, unless
+  // they belong to the frame being resumed.
+  if (!have_header) {
+    spans.clear();
+    big_args.clear();
   }
 
-  args.reserve(array_len);
-
-  for (std::size_t i = 0; i < array_len; ++i) {
-    if (cursor >= buffer.size()) {
-      args.clear();
-      return false;  // incomplete
+  // One scanner for the whole sweep, so each block is classified once.
+  Scanner in(buffer);
+  std::size_t used = 0;
+  while (used < buffer.size()) {
+    // Whole frames go straight to out; the last, partial one (or a bad one)
+    // is parsed again by parse_frame, which remembers where it stopped.
+    if (!have_header && parse_whole(in, used, out)) {
+      used += consumed;
+      continue;
     }
+    if (!parse_frame(in, used)) {
+      break;
+    }
+    for (const auto& [offset, len, big] : spans) {
+      out.args.emplace_back(big ? big_args[offset].data() : buffer.data() + used + offset, len);
+    }
+    out.argc.push_back(static_cast<std::uint32_t>(spans.size()));
+    used += consumed;
+    if (!big_args.empty()) {
+      break;
+    }
+  }
+  return used;
+}
 
-    if (buffer[cursor] != '$') {
-      has_error = true;
-      args.clear();
+bool RespParser::parse_whole(Scanner& in, std::size_t base, Batch& out) {
+  const std::size_t mark = out.args.size();
+  std::size_t pos = base;
+  std::size_t argc = 0;
+  if (in.header(pos, '*', argc) != ParseStatus::Ok || argc > kMaxArrayLen) {
+    return false;
+  }
+  for (std::size_t i = 0; i < argc; ++i) {
+    std::size_t len = 0;
+    if (pos >= in.size() || in.header(pos, '$', len) != ParseStatus::Ok || len > kMaxBulkLen ||
+        pos + len + 2 > in.size() || !in.crlf_at(pos + len)) {
+      out.args.resize(mark);
       return false;
     }
-    ++cursor;
+    out.args.emplace_back(in.data() + pos, len);
+    pos += len + 2;
+  }
+  out.argc.push_back(static_cast<std::uint32_t>(argc));
+  consumed = pos - base;
+  return true;
+}
 
-    std::size_t bulk_len = 0;
-    status = parse_length(buffer, cursor, bulk_len);
+bool RespParser::parse_frame(Scanner& in, std::size_t base) {
+  // Expect arr header => *<count>\r\n
+  if (!have_header) {
+    std::size_t pos = base;
+    ParseStatus status = in.header(pos, '*', array_len);
     if (status == ParseStatus::Incomplete) {
-      args.clear();
       return false;
     }
-    if (status == ParseStatus::Error) {
-      has_error = true;
-      args.clear();
-      return false;
+    if (status == ParseStatus::Error || array_len > kMaxArrayLen) {
+      return fail();
+    }
+    have_header = true;
+    cursor = pos - base;
+    spans.clear();
+    big_args.clear();
+  }
+
+  while (spans.size() < array_len) {
+    std::size_t pos = base + cursor;
+    if (!have_bulk_len) {
+      if (pos >= in.size()) {
+        return false;  // incomplete
+      }
+      ParseStatus status = in.header(pos, '$', bulk_len);
+      if (status == ParseStatus::Incomplete) {
+        return false;
+      }
+      if (status == ParseStatus::Error || bulk_len > kMaxBulkLen) {
+        return fail();
+      }
+      have_bulk_len = true;
+      cursor = pos - base;
     }
 
     const std::size_t need = bulk_len + 2;  // data + \r\n
-    if (cursor + need > buffer.size()) {
-      args.clear();
+    if (pos + need > in.size()) {
+      if (bulk_len >= kBigArg) {
+        std::size_t held = need;
+        for (const std::string& big : big_args) {
+          held += big.size();
+        }
+        if (held > kMaxBigArgBytes) {
+          return fail();
+        }
+        big_filled = in.size() - pos;
+        std::string& big = big_args.emplace_back(std::min(need, std::max(big_filled, kBigArgStart)), '\0');
+        std::memcpy(big.data(), in.data() + pos, big_filled);
+        big_pending = true;
+      }
       return false;  // incomplete
     }
 
-    args.emplace_back(buffer.data() + cursor, bulk_len);
-    cursor += bulk_len;
-
     // Expect trailing \r\n
-    if (buffer[cursor] != '\r' || buffer[cursor + 1] != '\n') {
-      has_error = true;
-      args.clear();
-      return false;
+    if (!in.crlf_at(pos + bulk_len)) {
+      return fail();
     }
-    cursor += 2;
+    spans.emplace_back(cursor, bulk_len, false);
+    cursor += need;
+    have_bulk_len = false;
   }
 
   consumed = cursor;
+
+  // Next call starts a fresh frame.
+  have_header = false;
+  cursor = 0;
   return true;
 }
 
-void RespParser::consume(std::string& buffer) {
-  if (consumed == 0 || consumed > buffer.size()) {
+std::span<char> RespParser::big_arg_space() {
+  std::string& big = big_args.back();
+  if (big_filled == big.size()) {
+    big.resize(std::min(bulk_len + 2, 2 * big.size()));
+  }
+  return {big.data() + big_filled, big.size() - big_filled};
+}
+
+void RespParser::big_arg_commit(std::size_t n) {
+  big_filled += n;
+  if (big_filled == bulk_len + 2) {
+    finish_big_arg();
+  }
+}
+
+std::size_t RespParser::feed_big_arg(std::string_view data) {
+  std::size_t fed = 0;
+  while (big_pending && fed < data.size()) {
+    const std::span<char> space = big_arg_space();
+    const std::size_t n = std::min(data.size() - fed, space.size());
+    std::memcpy(space.data(), data.data() + fed, n);
+    big_arg_commit(n);
+    fed += n;
+  }
+  return fed;
+}
+
+void RespParser::finish_big_arg() {
+  big_pending = false;
+  std::string& big = big_args.back();
+  if (big[bulk_len] != '\r' || big[bulk_len + 1] != '\n') {
+    fail();
     return;
   }
-  buffer.erase(0, consumed);
-  consumed = 0;
+  big.resize(bulk_len);
+  spans.emplace_back(big_args.size() - 1, bulk_len, true);
+  have_bulk_len = false;
 }
 
 void RespParser::reset() {
   args.clear();
+  spans.clear();
+  big_args.clear();
+  big_pending = false;
   consumed = 0;
   has_error = false;
+  have_header = false;
+  have_bulk_len = false;
+  cursor = 0;
 }
 
 }  // namespace resp
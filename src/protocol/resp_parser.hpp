@@ -1,35 +1,124 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <span>
 #include <string>
 #include <string_view>
 #include <vector>
 
+#include "../util/small_vector.hpp"
+
 namespace resp {
 
 // Streaming parser for RESP arrays of bulk strings.
 // Typical use:
-//   while (parser.parse(buf)) {
+//   while (parser.parse(buf.readable())) {
 //     const auto& args = parser.argv();
 //     ... process args ...
-//     parser.consume(buf);
+//     buf.consume(parser.consumed_bytes());
 //   }
+// parse() is given the unconsumed bytes starting at the current frame. When a
+// frame is incomplete the parser remembers how far it got (as offsets into the
+// frame), so the caller may compact or grow its buffer before the next call
+// and parsing resumes without rescanning the finished bulks.
 // If error() is true, the buffer contained a protocol violation.
+//
+// A bulk of at least kBigArg bytes that is not all buffered yet is received
+// into a string of its own instead (as Redis does past PROTO_MBULK_BIG_ARG):
+// parse() moves the bytes it was given for it there, returns false and sets
+// big_arg_pending(). From then on the caller keeps only the first
+// frame_bytes() of the frame and hands the rest of the bulk to big_arg_space()
+// / big_arg_commit() or feed_big_arg(), then resumes parse() once it clears.
+// Values are thus neither bounded by nor copied through the read buffer. The
+// string grows as the bulk arrives, and a frame's big bulks are capped at
+// 1GB in all, so a header alone cannot reserve much memory.
+//
+// parse_batch() parses every whole command at the front of a buffer in one
+// sweep, for a pipeline's worth of commands at a time. Input is classified
+// 64 bytes at a time with SIMD compares (AVX2, SSE2 or a scalar loop), so
+// headers and each bulk's trailing \r\n are found with bit operations.
 
-class RespParser {
+// Commands with up to this many arguments (every single-key command) are
+// parsed without touching the heap.
+inline constexpr std::size_t kInlineArgs = 8;
+using Argv = util::SmallVector<std::string_view, kInlineArgs>;
+
+inline constexpr std::size_t kBigArg = 32 * 1024;
+
+// Commands from one parse_batch(): every command's arguments back to back,
+// and how many each has.
+struct Batch {
   std::vector<std::string_view> args;
+  std::vector<std::uint32_t> argc;
+
+  void clear() {
+    args.clear();
+    argc.clear();
+  }
+};
+
+class Scanner;
+
+class RespParser {
+  struct Span {
+    std::size_t offset;  // within the frame, or index into big_args
+    std::size_t len;
+    bool big;
+  };
+
+  Argv args;
+  util::SmallVector<Span, kInlineArgs> spans;
   std::size_t consumed{};
   bool has_error{false};
+
+  // Resume state for a partially received frame.
+  bool have_header{false};
+  std::size_t array_len{};
+  std::size_t bulk_len{};
+  bool have_bulk_len{false};
+  std::size_t cursor{};
+  // Big bulks of the current frame; the last one is being received while
+  // big_pending is set.
+  std::vector<std::string> big_args;
+  std::size_t big_filled{};
+  bool big_pending{false};
+
+  bool fail();
+  void finish_big_arg();
+  // Parses the frame starting at base, leaving its arguments in spans.
+  bool parse_frame(Scanner& in, std::size_t base);
+  // Appends the frame starting at base to out if it is whole and valid,
+  // without touching the resume state.
+  bool parse_whole(Scanner& in, std::size_t base, Batch& out);
 public:
 
   // Attempts to parse one command returns true if valid
-  bool parse(std::string& buffer);
+  bool parse(std::string_view buffer);
+  // Appends every whole command at the front of buffer to out and returns
+  // the bytes they take. Stops early after a command with big bulks, whose
+  // storage the next call frees (holds_big_args()); call again for the rest
+  // once its arguments are used.
+  std::size_t parse_batch(std::string_view buffer, Batch& out);
 
-  const std::vector<std::string_view>& argv() const { return args; }
+  const Argv& argv() const { return args; }
+  // Length of the frame returned by the last successful parse().
   std::size_t consumed_bytes() const { return consumed; }
   bool error() const { return has_error; }
 
-  // Drop parsed bytes from buffer (invalidates argv string_views).
-  void consume(std::string& buffer);
+  bool big_arg_pending() const { return big_pending; }
+  // Whether argv() points into big bulks, which the next parse() frees.
+  bool holds_big_args() const { return !big_args.empty(); }
+  // Bytes of the current frame the caller must keep buffered while a big
+  // bulk is pending: everything before that bulk's data.
+  std::size_t frame_bytes() const { return cursor; }
+  // Room left in the pending bulk (data and trailing \r\n); receive into it
+  // and report the count with big_arg_commit().
+  std::span<char> big_arg_space();
+  void big_arg_commit(std::size_t n);
+  // Copies what belongs to the pending bulk from the front of data and
+  // returns how many bytes that was.
+  std::size_t feed_big_arg(std::string_view data);
 
   void reset();
 
@@ -0,0 +1,485 @@
+#include "cluster.hpp"
+
+#include <errno.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstring>
+
+#include "../commands/dispatcher.hpp"
+#include "../net/socket.hpp"
+#include "../protocol/resp.hpp"
+#include "../util/random_id.hpp"
+
+namespace server {
+
+namespace {
+constexpr std::chrono::seconds kRetryInterval{1};
+// Table slots scanned per step, and how much a batch carries at most.
+constexpr std::size_t kScanBudget = 4096;
+constexpr std::size_t kBatchKeys = 128;
+constexpr std::size_t kBatchBytes = 1 << 20;
+constexpr std::size_t kReadChunk = 16 * 1024;
+constexpr std::size_t kMaxLine = 1024;
+
+void append_field(std::string& out, std::string_view name, std::size_t value) {
+  out.append(name);
+  out.push_back(':');
+  out.append(std::to_string(value));
+  out.append("\r\n");
+}
+}  // namespace
+
+Cluster::Cluster(std::string host, std::uint16_t port, unsigned shards, std::function<void(unsigned)> wake)
+    : id(util::random_hex_id()),
+      shards(shards),
+      wake(std::move(wake)),
+      owners(std::make_unique<std::atomic<std::uint16_t>[]>(db::kKeySlots)),
+      migrating_to(std::make_unique<std::atomic<std::uint16_t>[]>(db::kKeySlots)),
+      importing_from(std::make_unique<std::atomic<std::uint16_t>[]>(db::kKeySlots)),
+      nodes{Node{{}, 0}, Node{std::move(host), port}},
+      stores(shards, nullptr) {}
+
+std::string Cluster::address(std::uint16_t node) const {
+  std::lock_guard<std::mutex> lock(mu);
+  return nodes[node].host + ":" + std::to_string(nodes[node].port);
+}
+
+void Cluster::address(std::uint16_t node, std::string& host, std::uint16_t& port) const {
+  std::lock_guard<std::mutex> lock(mu);
+  host = nodes[node].host;
+  port = nodes[node].port;
+}
+
+void Cluster::attach_store(unsigned shard, const db::Store* store) {
+  std::lock_guard<std::mutex> lock(mu);
+  stores[shard] = store;
+}
+
+std::size_t Cluster::keys_in_slot(std::uint16_t slot) const {
+  std::lock_guard<std::mutex> lock(mu);
+  const db::Store* store = stores[slot % shards];
+  return store != nullptr ? store->keys_in_slot(slot) : 0;
+}
+
+std::uint16_t Cluster::node_index(std::string_view host, std::uint16_t port) {
+  for (std::size_t i = kSelf; i < nodes.size(); ++i) {
+    if (nodes[i].host == host && nodes[i].port == port) {
+      return static_cast<std::uint16_t>(i);
+    }
+  }
+  nodes.push_back(Node{std::string(host), port});
+  return static_cast<std::uint16_t>(nodes.size() - 1);
+}
+
+void Cluster::changed(std::uint16_t slot) {
+  changes.fetch_add(1, std::memory_order_acq_rel);
+  wake(slot % shards);
+}
+
+bool Cluster::add_slots(const std::vector<std::uint16_t>& slots, std::string& err) {
+  std::lock_guard<std::mutex> lock(mu);
+  for (std::uint16_t slot : slots) {
+    if (owner(slot) != kNone) {
+      err = "Slot " + std::to_string(slot) + " is already busy";
+      return false;
+    }
+  }
+  for (std::uint16_t slot : slots) {
+    owners[slot].store(kSelf, std::memory_order_release);
+    changed(slot);
+  }
+  return true;
+}
+
+bool Cluster::del_slots(const std::vector<std::uint16_t>& slots, std::string& err) {
+  std::lock_guard<std::mutex> lock(mu);
+  for (std::uint16_t slot : slots) {
+    if (owner(slot) == kNone) {
+      err = "Slot " + std::to_string(slot) + " is already unassigned";
+      return false;
+    }
+  }
+  for (std::uint16_t slot : slots) {
+    owners[slot].store(kNone, std::memory_order_release);
+    migrating_to[slot].store(kNone, std::memory_order_release);
+    importing_from[slot].store(kNone, std::memory_order_release);
+    changed(slot);
+  }
+  return true;
+}
+
+bool Cluster::set_slot(std::uint16_t slot, SlotState state, std::string_view host, std::uint16_t port,
+                       std::string& err) {
+  std::lock_guard<std::mutex> lock(mu);
+  const std::uint16_t current = owner(slot);
+  const std::string name = std::to_string(slot);
+  switch (state) {
+    case SlotState::Stable:
+      migrating_to[slot].store(kNone, std::memory_order_release);
+      importing_from[slot].store(kNone, std::memory_order_release);
+      break;
+    case SlotState::Migrating: {
+      if (current != kSelf) {
+        err = "I'm not the owner of hash slot " + name;
+        return false;
+      }
+      const std::uint16_t node = node_index(host, port);
+      if (node == kSelf) {
+        err = "I'm the owner of hash slot " + name;
+        return false;
+      }
+      migrating_to[slot].store(node, std::memory_order_release);
+      break;
+    }
+    case SlotState::Importing: {
+      if (current == kSelf) {
+        err = "I'm already the owner of hash slot " + name;
+        return false;
+      }
+      const std::uint16_t node = node_index(host, port);
+      if (node == kSelf) {
+        err = "I can't import a slot from myself";
+        return false;
+      }
+      importing_from[slot].store(node, std::memory_order_release);
+      break;
+    }
+    case SlotState::Node: {
+      const std::uint16_t node = node_index(host, port);
+      const db::Store* store = stores[slot % shards];
+      if (node != kSelf && current == kSelf && store != nullptr && store->keys_in_slot(slot) != 0) {
+        err = "I still hold keys, can't assign hash slot " + name + " to another node";
+        return false;
+      }
+      owners[slot].store(node, std::memory_order_release);
+      migrating_to[slot].store(kNone, std::memory_order_release);
+      importing_from[slot].store(kNone, std::memory_order_release);
+      break;
+    }
+  }
+  changed(slot);
+  return true;
+}
+
+void Cluster::slots_reply(std::string& out) const {
+  struct Range {
+    std::size_t first;
+    std::size_t last;
+    std::uint16_t node;
+  };
+  std::vector<Range> ranges;
+  for (std::size_t slot = 0; slot < db::kKeySlots;) {
+    const std::uint16_t node = owner(static_cast<std::uint16_t>(slot));
+    std::size_t last = slot;
+    while (last + 1 < db::kKeySlots && owner(static_cast<std::uint16_t>(last + 1)) == node) {
+      ++last;
+    }
+    if (node != kNone) {
+      ranges.push_back({slot, last, node});
+    }
+    slot = last + 1;
+  }
+  // Ranges as Redis gives them: first slot, last slot, then the serving
+  // node as host, port and id, where the id is only known for this node.
+  std::lock_guard<std::mutex> lock(mu);
+  resp::append_array_header(out, ranges.size());
+  for (const Range& r : ranges) {
+    const Node& n = nodes[r.node];
+    resp::append_array_header(out, 3);
+    resp::append_integer(out, static_cast<long long>(r.first));
+    resp::append_integer(out, static_cast<long long>(r.last));
+    resp::append_array_header(out, r.node == kSelf ? 3 : 2);
+    resp::append_string(out, std::string_view(n.host));
+    resp::append_integer(out, n.port);
+    if (r.node == kSelf) {
+      resp::append_string(out, std::string_view(id));
+    }
+  }
+}
+
+void Cluster::info(std::string& out) const {
+  std::size_t assigned = 0;
+  std::size_t migrating_slots = 0;
+  std::size_t importing_slots = 0;
+  std::vector<bool> serving;
+  {
+    std::lock_guard<std::mutex> lock(mu);
+    serving.resize(nodes.size());
+  }
+  for (std::size_t i = 0; i < db::kKeySlots; ++i) {
+    const auto slot = static_cast<std::uint16_t>(i);
+    const std::uint16_t node = owner(slot);
+    if (node != kNone) {
+      ++assigned;
+      if (node < serving.size()) {
+        serving[node] = true;
+      }
+    }
+    migrating_slots += migrating(slot) != kNone;
+    importing_slots += importing(slot) != kNone;
+  }
+  std::size_t known = 0;
+  {
+    std::lock_guard<std::mutex> lock(mu);
+    known = nodes.size() - 1;
+  }
+  out.append(assigned == db::kKeySlots ? "cluster_state:ok\r\n" : "cluster_state:fail\r\n");
+  append_field(out, "cluster_slots_assigned", assigned);
+  append_field(out, "cluster_slots_ok", assigned);
+  append_field(out, "cluster_slots_migrating", migrating_slots);
+  append_field(out, "cluster_slots_importing", importing_slots);
+  append_field(out, "cluster_known_nodes", known);
+  append_field(out, "cluster_size", static_cast<std::size_t>(std::count(serving.begin(), serving.end(), true)));
+}
+
+SlotMigrator::SlotMigrator(Cluster& cluster, db::Store& store, commands::Dispatcher& dispatcher, unsigned shard)
+    : cluster(cluster), store(store), dispatcher(dispatcher), shard(shard), moving(db::kKeySlots, false) {}
+
+SlotMigrator::~SlotMigrator() {
+  close_socket();
+}
+
+bool SlotMigrator::busy() const {
+  return state == State::Scan || out_sent < out.size();
+}
+
+bool SlotMigrator::pick_slots() {
+  const std::uint64_t v = cluster.version();
+  if (v == seen_version) {
+    return false;  // nothing was migrating at this version
+  }
+  seen_version = v;
+  target = Cluster::kNone;
+  for (std::size_t i = shard; i < db::kKeySlots; i += cluster.shard_count()) {
+    const std::uint16_t node = cluster.migrating(static_cast<std::uint16_t>(i));
+    if (node != Cluster::kNone) {
+      target = node;
+      break;
+    }
+  }
+  if (target == Cluster::kNone) {
+    return false;
+  }
+  cluster.address(target, host, port);
+  slots.clear();
+  refresh_slots();
+  return true;
+}
+
+void SlotMigrator::refresh_slots() {
+  seen_version = cluster.version();
+  slots.clear();
+  for (std::size_t i = shard; i < db::kKeySlots; i += cluster.shard_count()) {
+    const auto slot = static_cast<std::uint16_t>(i);
+    moving[i] = cluster.migrating(slot) == target;
+    if (moving[i]) {
+      slots.push_back(slot);
+    }
+  }
+}
+
+bool SlotMigrator::step() {
+  bool new_socket = false;
+  if (state == State::Idle) {
+    if (util::now() < retry_at || !pick_slots()) {
+      return false;
+    }
+    sock = net::connect_nonblocking(host, port);
+    if (sock < 0) {
+      fail(std::strerror(errno));
+      return false;
+    }
+    ++gen;
+    state = State::Connecting;
+    new_socket = true;
+  }
+  if (state == State::Connecting) {
+    const int rc = net::connect_result(sock);
+    if (rc < 0) {
+      fail(std::strerror(errno));
+      return false;
+    }
+    if (rc == 0) {
+      return new_socket;
+    }
+    std::fprintf(stderr, "cluster: shard %u moving %zu slots to %s:%u\n", shard, slots.size(), host.c_str(),
+                 static_cast<unsigned>(port));
+    state = State::Scan;
+    cursor = 0;
+  }
+  if (state == State::Scan) {
+    if (cluster.version() != seen_version) {
+      refresh_slots();
+    }
+    if (slots.empty()) {
+      // Handed over, or the operator called it off.
+      close_socket();
+      state = State::Idle;
+      seen_version = ~std::uint64_t{0};
+      return false;
+    }
+    send_batch();
+  }
+  flush();
+  return new_socket && sock >= 0;
+}
+
+void SlotMigrator::send_batch() {
+  cursor = store.scan(cursor, kScanBudget, [&](const db::Entry& e) {
+    const std::string_view key = e.key.view();
+    if (!moving[db::key_slot(key)]) {
+      return true;
+    }
+    // RESTORE key deadline payload REPLACE ABSTTL, the payload being the
+    // type and the value in its compact form; deadline 0 is none.
+    const std::string ttl = e.has_expiry() ? std::to_string(util::to_unix_millis(e.expire_at)) : "0";
+    payload.assign(1, static_cast<char>(e.type));
+    payload.append(e.compact_value(scratch));
+    static constexpr std::array<std::string_view, 1> kAsking{"ASKING"};
+    const std::array<std::string_view, 6> restore{"RESTORE", key, ttl, payload, "REPLACE", "ABSTTL"};
+    resp::append_command(out, kAsking);
+    resp::append_command(out, restore);
+    batch.emplace_back(key);
+    return batch.size() < kBatchKeys && out.size() < kBatchBytes;
+  });
+  if (!batch.empty()) {
+    for (const std::string& key : batch) {
+      sent.insert(key);
+    }
+    replies_left = 2 * batch.size();
+    state = State::Wait;
+    return;
+  }
+  if (cursor != 0) {
+    return;  // more of the store to scan
+  }
+  // A full pass is done. Slots without keys are handed over; keys a resize
+  // moved past the cursor are found by the next pass.
+  for (std::uint16_t slot : slots) {
+    if (store.keys_in_slot(slot) == 0) {
+      const std::string name = std::to_string(slot);
+      const std::string target_port = std::to_string(port);
+      const std::array<std::string_view, 6> setslot{"CLUSTER", "SETSLOT", name, "NODE", host, target_port};
+      resp::append_command(out, setslot);
+      handing.push_back(slot);
+    }
+  }
+  if (!handing.empty()) {
+    replies_left = handing.size();
+    state = State::Handover;
+  }
+}
+
+void SlotMigrator::flush() {
+  while (sock >= 0 && out_sent < out.size()) {
+    const ssize_t n = ::send(sock, out.data() + out_sent, out.size() - out_sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n > 0) {
+      out_sent += static_cast<std::size_t>(n);
+    } else if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return;  // retried by the next step
+    } else {
+      fail(std::strerror(errno));
+    }
+  }
+}
+
+void SlotMigrator::on_readable() {
+  char chunk[kReadChunk];
+  while (sock >= 0) {
+    const ssize_t n = ::recv(sock, chunk, sizeof(chunk), 0);
+    if (n > 0) {
+      std::string_view data(chunk, static_cast<std::size_t>(n));
+      while (sock >= 0 && !data.empty()) {
+        const std::size_t nl = data.find('\n');
+        line.append(data.substr(0, nl == std::string_view::npos ? data.size() : nl + 1));
+        if (line.size() > kMaxLine) {
+          fail("reply line too long");
+          return;
+        }
+        if (nl == std::string_view::npos) {
+          break;
+        }
+        data.remove_prefix(nl + 1);
+        std::string_view l(line);
+        l.remove_suffix(l.size() >= 2 && l[l.size() - 2] == '\r' ? 2 : 1);
+        const std::string reply(l);
+        line.clear();
+        on_reply(reply);
+      }
+      continue;
+    }
+    if (n == 0) {
+      fail("target closed the connection");
+    } else if (errno == EINTR) {
+      continue;
+    } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+      fail(std::strerror(errno));
+    }
+    return;
+  }
+}
+
+void SlotMigrator::on_reply(std::string_view l) {
+  if (replies_left == 0 || l.empty() || l[0] != '+') {
+    fail(l.empty() ? std::string_view("unexpected reply") : l);
+    return;
+  }
+  if (--replies_left > 0) {
+    return;
+  }
+  out.clear();
+  out_sent = 0;
+  if (state == State::Wait) {
+    sent.clear();
+    for (const std::string& key : batch) {
+      const std::array<std::string_view, 2> del{"DEL", key};
+      dispatcher.apply(del);
+    }
+    batch.clear();
+  } else if (state == State::Handover) {
+    std::string err;
+    for (std::uint16_t slot : handing) {
+      if (!cluster.set_slot(slot, Cluster::SlotState::Node, host, port, err)) {
+        std::fprintf(stderr, "cluster: keeping slot %u: %s\n", static_cast<unsigned>(slot), err.c_str());
+      }
+    }
+    std::fprintf(stderr, "cluster: shard %u handed %zu slots over to %s:%u\n", shard, handing.size(), host.c_str(),
+                 static_cast<unsigned>(port));
+    handing.clear();
+  }
+  state = State::Scan;
+}
+
+void SlotMigrator::fail(std::string_view reason) {
+  std::fprintf(stderr, "cluster: moving slots to %s:%u failed: %.*s; retrying\n", host.c_str(),
+               static_cast<unsigned>(port), static_cast<int>(reason.size()), reason.data());
+  close_socket();
+  // Unconfirmed keys stay here; RESTORE ... REPLACE makes resending them safe.
+  sent.clear();
+  batch.clear();
+  handing.clear();
+  out.clear();
+  out_sent = 0;
+  replies_left = 0;
+  line.clear();
+  state = State::Idle;
+  seen_version = ~std::uint64_t{0};
+  retry_at = util::now() + kRetryInterval;
+}
+
+void SlotMigrator::close_socket() {
+  if (sock >= 0) {
+    // Ends an io_uring poll that holds its own reference to the socket.
+    ::shutdown(sock, SHUT_RDWR);
+    ::close(sock);
+    sock = -1;
+  }
+}
+
+}  // namespace server
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+#include "../db/key_slot.hpp"
+#include "../db/store.hpp"
+#include "../util/time.hpp"
+
+namespace commands {
+class Dispatcher;
+}
+
+namespace server {
+
+// Cluster mode: which node serves each of the 16384 hash slots, shared by
+// every reactor. There is no cluster bus; nodes are named by address and
+// learn the slot map from CLUSTER ADDSLOTS / SETSLOT, which an operator (or
+// script) sends to every node, as redis-cli --cluster does on top of the
+// bus. Keyed commands for a slot served elsewhere get -MOVED, and -ASK
+// while the slot is being migrated (see SlotMigrator).
+//
+// The map is read on every keyed command, so slots are arrays of atomics
+// holding node indexes; changes are rare and serialized by a mutex.
+class Cluster {
+ public:
+  static constexpr std::uint16_t kNone = 0;
+  static constexpr std::uint16_t kSelf = 1;
+
+  // host and port are the address this node is known by to clients and the
+  // other nodes. wake interrupts a shard's wait when a slot it owns starts
+  // migrating.
+  Cluster(std::string host, std::uint16_t port, unsigned shards, std::function<void(unsigned)> wake);
+
+  Cluster(const Cluster&) = delete;
+  Cluster& operator=(const Cluster&) = delete;
+
+  const std::string& myid() const { return id; }
+  unsigned shard_count() const { return shards; }
+
+  // Node serving slot, or kNone.
+  std::uint16_t owner(std::uint16_t slot) const { return owners[slot].load(std::memory_order_acquire); }
+  // Node a slot of ours is migrating to / a slot is being imported from.
+  std::uint16_t migrating(std::uint16_t slot) const { return migrating_to[slot].load(std::memory_order_acquire); }
+  std::uint16_t importing(std::uint16_t slot) const { return importing_from[slot].load(std::memory_order_acquire); }
+  // "host:port" of a node, as -MOVED and -ASK give it.
+  std::string address(std::uint16_t node) const;
+  void address(std::uint16_t node, std::string& host, std::uint16_t& port) const;
+  // Bumped by every change, so shards notice slots that start migrating.
+  std::uint64_t version() const { return changes.load(std::memory_order_acquire); }
+
+  // Each shard's store, whose per-slot key counts COUNTKEYSINSLOT reports.
+  void attach_store(unsigned shard, const db::Store* store);
+  std::size_t keys_in_slot(std::uint16_t slot) const;
+
+  // CLUSTER ADDSLOTS / DELSLOTS: all or nothing; false with the reason in
+  // err if any slot is already assigned (unassigned).
+  bool add_slots(const std::vector<std::uint16_t>& slots, std::string& err);
+  bool del_slots(const std::vector<std::uint16_t>& slots, std::string& err);
+  // CLUSTER SETSLOT slot NODE | MIGRATING | IMPORTING host port, or STABLE.
+  enum class SlotState { Node, Migrating, Importing, Stable };
+  bool set_slot(std::uint16_t slot, SlotState state, std::string_view host, std::uint16_t port, std::string& err);
+
+  // CLUSTER SLOTS and CLUSTER INFO replies.
+  void slots_reply(std::string& out) const;
+  void info(std::string& out) const;
+
+ private:
+  struct Node {
+    std::string host;
+    std::uint16_t port;
+  };
+  // Index of the node at host:port, added if new. Requires mu.
+  std::uint16_t node_index(std::string_view host, std::uint16_t port);
+  void changed(std::uint16_t slot);
+
+  std::string id;
+  unsigned shards;
+  std::function<void(unsigned)> wake;
+  std::unique_ptr<std::atomic<std::uint16_t>[]> owners;
+  std::unique_ptr<std::atomic<std::uint16_t>[]> migrating_to;
+  std::unique_ptr<std::atomic<std::uint16_t>[]> importing_from;
+  std::atomic<std::uint64_t> changes{0};
+
+  mutable std::mutex mu;
+  std::vector<Node> nodes;  // index kNone is unused, kSelf is this node
+  std::vector<const db::Store*> stores;
+};
+
+// Moves the slots a shard owns that are marked migrating to their target,
+// driven from the shard's loop so it never blocks on the network. All the
+// slots going to one target move together: each step scans part of the
+// store for their keys and sends a batch of them as ASKING + RESTORE pairs,
+// and once the target has confirmed the batch its keys are deleted here
+// (through the dispatcher, so the aof and replicas see the DELs). Until
+// then commands on those keys get -TRYAGAIN. Slots left without keys after
+// a full pass are handed over: the target is told to take them with CLUSTER
+// SETSLOT NODE, and then this node's map points at the target too.
+class SlotMigrator {
+ public:
+  SlotMigrator(Cluster& cluster, db::Store& store, commands::Dispatcher& dispatcher, unsigned shard);
+  ~SlotMigrator();
+
+  SlotMigrator(const SlotMigrator&) = delete;
+  SlotMigrator& operator=(const SlotMigrator&) = delete;
+
+  // Called at the end of every loop iteration and cron tick. Returns true
+  // when fd() is a new socket for the reactor to watch for readability.
+  bool step();
+  void on_readable();
+  // Whether step() has work that does not wait on the network, so the loop
+  // should not sleep.
+  bool busy() const;
+  // Whether key is in a batch the target has not confirmed yet.
+  bool in_flight(std::string_view key) const { return !sent.empty() && sent.count(key) != 0; }
+
+  int fd() const { return sock; }
+  // Bumped for every socket, so completions for an old one can be told apart.
+  std::uint64_t generation() const { return gen; }
+
+ private:
+  enum class State { Idle, Connecting, Scan, Wait, Handover };
+
+  // Picks the target of this shard's first migrating slot and every slot
+  // going there. False if no slot is migrating.
+  bool pick_slots();
+  // Drops slots no longer migrating to target and adds new ones.
+  void refresh_slots();
+  void send_batch();
+  void flush();
+  void on_reply(std::string_view line);
+  void fail(std::string_view reason);
+  void close_socket();
+
+  Cluster& cluster;
+  db::Store& store;
+  commands::Dispatcher& dispatcher;
+  unsigned shard;
+
+  State state{State::Idle};
+  std::uint64_t seen_version{~std::uint64_t{0}};
+  util::TimePoint retry_at{};
+  std::uint16_t target{Cluster::kNone};
+  std::vector<std::uint16_t> slots;  // migrating to target
+  std::vector<bool> moving;          // the same, indexed by slot
+  std::vector<std::uint16_t> handing;  // sent CLUSTER SETSLOT NODE, not confirmed
+  std::string host;
+  std::uint16_t port{0};
+  int sock{-1};
+  std::uint64_t gen{0};
+
+  std::size_t cursor{0};
+  std::vector<std::string> batch;  // keys sent and not yet confirmed
+  std::unordered_set<std::string_view> sent;  // views of batch
+  std::string out;
+  std::size_t out_sent{0};
+  std::size_t replies_left{0};
+  std::string line;
+  std::string scratch;
+  std::string payload;
+};
+
+}  // namespace server
@@ -0,0 +1,210 @@
+#include "config.hpp"
+
+#include <charconv>
+#include <cstdio>
+#include <cstdlib>
+#include <string_view>
+
+namespace server {
+
+namespace {
+[[noreturn]] void usage(const char* prog) {
+  std::fprintf(stderr,
+               "usage: %s [--port N] [--threads N] [--cpu N] [--no-pin] [--io epoll|uring]\n"
+               "          [--uring-send] [--io-threads N] [--hz N]\n"
+               "          [--expire-keys N] [--expire-budget-us N]\n"
+               "          [--appendonly PATH] [--appendfsync always|everysec|no]\n"
+               "          [--dbfilename PATH] [--maxmemory BYTES]\n"
+               "          [--maxmemory-policy POLICY] [--maxmemory-samples N]\n"
+               "          [--metrics-file PATH] [--slowlog-log-slower-than US]\n"
+               "          [--slowlog-max-len N] [--loop-stall-us US] [--lockfree-reads]\n"
+               "          [--replicaof HOST PORT] [--repl-backlog-size BYTES]\n"
+               "          [--cluster] [--cluster-announce-ip HOST]\n"
+               "  --port N     listen port (default 9000)\n"
+               "  --threads N  reactor threads, keys are sharded across them (default 1)\n"
+               "  --cpu N      first cpu to pin reactors to (default 4)\n"
+               "  --no-pin     do not pin reactor threads\n"
+               "  --io BACKEND epoll (default) or uring\n"
+               "  --uring-send with epoll, submit each loop iteration's replies as one io_uring batch\n"
+               "  --io-threads N  threads that read, parse and send for the reactor, counting its own;\n"
+               "                  commands still run on the reactor (default 1; needs --threads 1, epoll)\n"
+               "  --hz N       active expiry ticks per second (default 10)\n"
+               "  --expire-keys N       max expired keys deleted per loop iteration (default 1000)\n"
+               "  --expire-budget-us N  max time spent expiring per loop iteration (default 1000)\n"
+               "  --appendonly PATH     log writes to PATH and replay it on startup\n"
+               "  --appendfsync POLICY  always, everysec (default) or no\n"
+               "  --dbfilename PATH     snapshot file for SAVE/BGSAVE (default dump.kvs)\n"
+               "  --maxmemory BYTES     memory limit for keys and values, with optional kb/mb/gb suffix\n"
+               "                        (default 0, unlimited)\n"
+               "  --maxmemory-policy P  noeviction (default), allkeys-lru, allkeys-lfu or volatile-ttl\n"
+               "  --maxmemory-samples N keys compared per eviction (default 5)\n"
+               "  --metrics-file PATH   rewrite PATH every second with metrics in Prometheus text format\n"
+               "  --slowlog-log-slower-than US  log commands slower than US to SLOWLOG (default 10000,\n"
+               "                        negative disables)\n"
+               "  --slowlog-max-len N   entries kept by SLOWLOG and STALLLOG (default 128)\n"
+               "  --loop-stall-us US    log loop iterations slower than US to STALLLOG (default 10000,\n"
+               "                        0 disables)\n"
+               "  --lockfree-reads      serve GET/EXISTS/TTL on other shards' keys from their stores, without\n"
+               "                        locks, instead of forwarding them\n"
+               "  --replicaof HOST PORT replicate HOST:PORT and serve reads (needs --threads 1, no aof)\n"
+               "  --repl-backlog-size B replication stream kept for partial resyncs (default 1mb)\n"
+               "  --cluster             serve assigned hash slots and redirect the rest (no --replicaof)\n"
+               "  --cluster-announce-ip HOST  address given to clients in redirects (default 127.0.0.1)\n",
+               prog);
+  std::exit(EXIT_FAILURE);
+}
+
+template <typename T>
+T parse_number(const char* prog, std::string_view s) {
+  T value{};
+  auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), value);
+  if (ec != std::errc() || ptr != s.data() + s.size()) {
+    usage(prog);
+  }
+  return value;
+}
+
+// Byte count with an optional kb/mb/gb suffix (powers of 1024).
+std::size_t parse_bytes(const char* prog, std::string_view s) {
+  std::size_t shift = 0;
+  if (s.size() > 2) {
+    const std::string_view suffix = s.substr(s.size() - 2);
+    if (suffix == "kb" || suffix == "KB") {
+      shift = 10;
+    } else if (suffix == "mb" || suffix == "MB") {
+      shift = 20;
+    } else if (suffix == "gb" || suffix == "GB") {
+      shift = 30;
+    }
+    if (shift != 0) {
+      s.remove_suffix(2);
+    }
+  }
+  return parse_number<std::size_t>(prog, s) << shift;
+}
+}  // namespace
+
+Config parse_args(int argc, char** argv) {
+  Config cfg;
+  const char* prog = argc > 0 ? argv[0] : "kvserv";
+
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    auto next = [&]() -> std::string_view {
+      if (i + 1 >= argc) {
+        usage(prog);
+      }
+      return argv[++i];
+    };
+
+    if (arg == "--port") {
+      cfg.port = parse_number<uint16_t>(prog, next());
+    } else if (arg == "--threads") {
+      cfg.threads = parse_number<unsigned>(prog, next());
+      if (cfg.threads == 0) {
+        usage(prog);
+      }
+    } else if (arg == "--cpu") {
+      cfg.cpu_base = parse_number<int>(prog, next());
+    } else if (arg == "--no-pin") {
+      cfg.pin = false;
+    } else if (arg == "--io") {
+      std::string_view backend = next();
+      if (backend == "epoll") {
+        cfg.io = IoBackend::Epoll;
+      } else if (backend == "uring") {
+        cfg.io = IoBackend::Uring;
+      } else {
+        usage(prog);
+      }
+    } else if (arg == "--uring-send") {
+      cfg.uring_send = true;
+    } else if (arg == "--io-threads") {
+      cfg.io_threads = parse_number<unsigned>(prog, next());
+      if (cfg.io_threads == 0) {
+        usage(prog);
+      }
+    } else if (arg == "--hz") {
+      cfg.hz = parse_number<unsigned>(prog, next());
+      if (cfg.hz == 0 || cfg.hz > 1000) {
+        usage(prog);
+      }
+    } else if (arg == "--expire-keys") {
+      cfg.expire_keys = parse_number<unsigned>(prog, next());
+    } else if (arg == "--expire-budget-us") {
+      cfg.expire_budget_us = parse_number<unsigned>(prog, next());
+    } else if (arg == "--appendonly") {
+      cfg.aof_path = std::string(next());
+    } else if (arg == "--appendfsync") {
+      std::string_view policy = next();
+      if (policy == "always") {
+        cfg.aof_fsync = persist::FsyncPolicy::Always;
+      } else if (policy == "everysec") {
+        cfg.aof_fsync = persist::FsyncPolicy::EverySec;
+      } else if (policy == "no") {
+        cfg.aof_fsync = persist::FsyncPolicy::No;
+      } else {
+        usage(prog);
+      }
+    } else if (arg == "--dbfilename") {
+      cfg.snapshot_path = std::string(next());
+    } else if (arg == "--maxmemory") {
+      cfg.maxmemory = parse_bytes(prog, next());
+    } else if (arg == "--maxmemory-policy") {
+      std::string_view policy = next();
+      if (policy == "noeviction") {
+        cfg.maxmemory_policy = db::EvictionPolicy::NoEviction;
+      } else if (policy == "allkeys-lru") {
+        cfg.maxmemory_policy = db::EvictionPolicy::AllKeysLru;
+      } else if (policy == "allkeys-lfu") {
+        cfg.maxmemory_policy = db::EvictionPolicy::AllKeysLfu;
+      } else if (policy == "volatile-ttl") {
+        cfg.maxmemory_policy = db::EvictionPolicy::VolatileTtl;
+      } else {
+        usage(prog);
+      }
+    } else if (arg == "--maxmemory-samples") {
+      cfg.maxmemory_samples = parse_number<unsigned>(prog, next());
+      if (cfg.maxmemory_samples == 0) {
+        usage(prog);
+      }
+    } else if (arg == "--metrics-file") {
+      cfg.metrics_path = std::string(next());
+    } else if (arg == "--slowlog-log-slower-than") {
+      cfg.slowlog_slower_than_us = parse_number<long long>(prog, next());
+    } else if (arg == "--slowlog-max-len") {
+      cfg.slowlog_max_len = parse_number<std::size_t>(prog, next());
+    } else if (arg == "--loop-stall-us") {
+      cfg.loop_stall_us = parse_number<unsigned>(prog, next());
+    } else if (arg == "--lockfree-reads") {
+      cfg.lockfree_reads = true;
+    } else if (arg == "--replicaof") {
+      cfg.replicaof_host = std::string(next());
+      cfg.replicaof_port = parse_number<uint16_t>(prog, next());
+    } else if (arg == "--repl-backlog-size") {
+      cfg.repl_backlog_size = parse_bytes(prog, next());
+      if (cfg.repl_backlog_size == 0) {
+        usage(prog);
+      }
+    } else if (arg == "--cluster") {
+      cfg.cluster_enabled = true;
+    } else if (arg == "--cluster-announce-ip") {
+      cfg.cluster_announce_ip = std::string(next());
+    } else {
+      usage(prog);
+    }
+  }
+  if (!cfg.replicaof_host.empty() && (cfg.threads != 1 || !cfg.aof_path.empty())) {
+    usage(prog);
+  }
+  if (cfg.cluster_enabled && !cfg.replicaof_host.empty()) {
+    usage(prog);
+  }
+  if (cfg.io_threads > 1 && (cfg.threads != 1 || cfg.io != IoBackend::Epoll || cfg.uring_send)) {
+    usage(prog);
+  }
+
+  return cfg;
+}
+
+}  // namespace server
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "../db/store.hpp"
+#include "../persist/aof.hpp"
+
+namespace server {
+
+// How reactors talk to the kernel: readiness via epoll plus recv/send calls,
+// or completions from an io_uring that accepts, receives and sends itself.
+enum class IoBackend { Epoll, Uring };
+
+struct Config {
+  uint16_t port{9000};
+  // Number of reactor threads; each owns a shard of the keyspace.
+  unsigned threads{1};
+  // Reactor i is pinned to cpu_base + i.
+  int cpu_base{4};
+  bool pin{true};
+  IoBackend io{IoBackend::Epoll};
+  // With epoll, send each iteration's replies with one io_uring submission
+  // instead of a send() per connection.
+  bool uring_send{false};
+  // Threads that receive, parse and send for a single epoll reactor, counting
+  // the reactor's own; commands still run on the reactor alone. Helper i is
+  // pinned to cpu_base + i.
+  unsigned io_threads{1};
+
+  // Active expiry runs hz times a second and, per event-loop iteration,
+  // deletes at most expire_keys keys or spends at most expire_budget_us.
+  unsigned hz{10};
+  unsigned expire_keys{1000};
+  unsigned expire_budget_us{1000};
+
+  // Memory ceiling across all shards, split evenly (0 = none), what to
+  // evict when a shard reaches its part, and keys sampled per eviction.
+  std::size_t maxmemory{0};
+  db::EvictionPolicy maxmemory_policy{db::EvictionPolicy::NoEviction};
+  unsigned maxmemory_samples{5};
+
+  // Append-only file; empty disables persistence.
+  std::string aof_path;
+  persist::FsyncPolicy aof_fsync{persist::FsyncPolicy::EverySec};
+  // Snapshot written by SAVE/BGSAVE, loaded on startup when aof is off.
+  std::string snapshot_path{"dump.kvs"};
+  // Prometheus text file rewritten every second; empty disables it.
+  std::string metrics_path;
+
+  // Commands slower than this go to SLOWLOG (negative disables, 0 logs
+  // every command), and event-loop iterations slower than loop_stall_us to
+  // STALLLOG (0 disables). Each log keeps its newest slowlog_max_len entries.
+  long long slowlog_slower_than_us{10000};
+  unsigned loop_stall_us{10000};
+  std::size_t slowlog_max_len{128};
+
+  // With several threads, GET/EXISTS/TTL on another shard's keys read its
+  // store directly instead of going through the mailbox.
+  bool lockfree_reads{false};
+
+  // Primary to replicate from; empty host means this node is a primary.
+  // Replicas run a single reactor and keep no aof.
+  std::string replicaof_host;
+  uint16_t replicaof_port{0};
+  // Bytes of the replication stream kept for replicas that reconnect.
+  std::size_t repl_backlog_size{1 << 20};
+
+  // Cluster mode: this node serves the hash slots assigned to it and
+  // redirects the rest. It is known to clients and other nodes by
+  // cluster_announce_ip and port.
+  bool cluster_enabled{false};
+  std::string cluster_announce_ip{"127.0.0.1"};
+};
+
+// Parses command line flags, dies with a usage message on bad input.
+Config parse_args(int argc, char** argv);
+
+}  // namespace server
@@ -0,0 +1,86 @@
+#include "io_threads.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "../util/affinity.hpp"
+
+namespace server {
+
+namespace {
+// Polls of the batch counter before a helper goes to sleep, and before the
+// reactor, waiting on the helpers, starts yielding its cpu to them.
+constexpr unsigned kHelperSpins = 1 << 12;
+constexpr unsigned kReactorSpins = 1 << 10;
+
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  _mm_pause();
+#endif
+}
+}  // namespace
+
+IoThreads::IoThreads(unsigned threads, int first_cpu, bool pin) : count(threads) {
+  for (unsigned i = 1; i < count; ++i) {
+    this->threads.emplace_back(&IoThreads::helper, this, i, first_cpu + static_cast<int>(i), pin);
+  }
+}
+
+IoThreads::~IoThreads() {
+  stopping = true;
+  generation.fetch_add(1, std::memory_order_release);
+  generation.notify_all();
+  for (std::thread& t : threads) {
+    t.join();
+  }
+}
+
+void IoThreads::start(std::size_t items, Fn fn, void* ctx) {
+  batch_fn = fn;
+  batch_ctx = ctx;
+  batch_items = items;
+  done.store(0, std::memory_order_relaxed);
+  generation.fetch_add(1, std::memory_order_release);
+  generation.notify_all();
+
+  for (std::size_t i = 0; i < items; i += count) {
+    fn(ctx, i);
+  }
+  // Acquire: what the helpers did to their connections is visible here.
+  for (unsigned spins = 0; done.load(std::memory_order_acquire) != count - 1; ++spins) {
+    if (spins < kReactorSpins) {
+      cpu_relax();
+    } else {
+      std::this_thread::yield();
+    }
+  }
+}
+
+void IoThreads::helper(unsigned index, int cpu, bool pin) {
+  if (pin) {
+    util::pin_cpu_or_die(cpu);
+  }
+  std::uint64_t seen = 0;
+  while (true) {
+    std::uint64_t gen = generation.load(std::memory_order_acquire);
+    for (unsigned spins = 0; gen == seen && spins < kHelperSpins; ++spins) {
+      cpu_relax();
+      gen = generation.load(std::memory_order_acquire);
+    }
+    while (gen == seen) {
+      generation.wait(seen, std::memory_order_acquire);
+      gen = generation.load(std::memory_order_acquire);
+    }
+    seen = gen;
+    if (stopping) {
+      return;
+    }
+    for (std::size_t i = index; i < batch_items; i += count) {
+      batch_fn(batch_ctx, i);
+    }
+    done.fetch_add(1, std::memory_order_release);
+  }
+}
+
+}  // namespace server
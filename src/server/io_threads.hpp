@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+namespace server {
+
+// Helper threads for --io-threads. The reactor hands them a batch of
+// connections to receive and parse from, or to send to, works through its
+// own share and waits for theirs, so a connection is only ever touched by one
+// thread at a time and the store only by the reactor. Between batches the
+// helpers spin for a while, since under load the next one is microseconds
+// away, then sleep on the batch counter.
+class IoThreads {
+ public:
+  // threads counts the reactor's own; helper i (from 1) is pinned to
+  // first_cpu + i when pin is set.
+  IoThreads(unsigned threads, int first_cpu, bool pin);
+  ~IoThreads();
+
+  IoThreads(const IoThreads&) = delete;
+  IoThreads& operator=(const IoThreads&) = delete;
+
+  // Calls work(i) for every i < items, item i on thread i % threads, and
+  // returns once all are done. Batches too small to be worth waking the
+  // helpers for run on the calling thread.
+  template <typename Work>
+  void run(std::size_t items, Work& work) {
+    if (items < kMinItemsPerThread * count) {
+      for (std::size_t i = 0; i < items; ++i) {
+        work(i);
+      }
+      return;
+    }
+    start(items, [](void* ctx, std::size_t i) { (*static_cast<Work*>(ctx))(i); }, &work);
+  }
+
+ private:
+  using Fn = void (*)(void* ctx, std::size_t item);
+  static constexpr std::size_t kMinItemsPerThread = 2;
+
+  void start(std::size_t items, Fn fn, void* ctx);
+  void helper(unsigned index, int cpu, bool pin);
+
+  unsigned count;
+  std::vector<std::thread> threads;
+
+  // The current batch, published by bumping generation; each helper bumps
+  // done when through its share.
+  Fn batch_fn{nullptr};
+  void* batch_ctx{nullptr};
+  std::size_t batch_items{0};
+  bool stopping{false};
+  alignas(64) std::atomic<std::uint64_t> generation{0};
+  alignas(64) std::atomic<unsigned> done{0};
+};
+
+}  // namespace server
@@ -0,0 +1,39 @@
+#include "mailbox.hpp"
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "../util/error.hpp"
+
+namespace server {
+
+Mailbox::Mailbox(unsigned shards, std::size_t capacity) : n(shards) {
+  queues.reserve(static_cast<std::size_t>(n) * n);
+  for (std::size_t i = 0; i < static_cast<std::size_t>(n) * n; ++i) {
+    queues.push_back(std::make_unique<util::SpscQueue<Message>>(capacity));
+  }
+  for (unsigned i = 0; i < n; ++i) {
+    int fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    util::syscall_or_die(fd, "eventfd");
+    wake_fds.push_back(fd);
+  }
+}
+
+Mailbox::~Mailbox() {
+  for (int fd : wake_fds) {
+    ::close(fd);
+  }
+}
+
+void Mailbox::notify(unsigned shard) {
+  std::uint64_t one = 1;
+  // A full counter still leaves the fd readable, so a failed write is harmless.
+  (void)!::write(wake_fds[shard], &one, sizeof(one));
+}
+
+void Mailbox::drain_wakeups(unsigned shard) {
+  std::uint64_t count = 0;
+  (void)!::read(wake_fds[shard], &count, sizeof(count));
+}
+
+}  // namespace server
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../db/key_slot.hpp"
+#include "../util/spsc_queue.hpp"
+
+namespace server {
+
+// Cross-shard message. A request carries a command for the owning shard to
+// execute, a reply carries the encoded RESP answer back to the origin shard.
+struct Message {
+  enum class Kind : uint8_t { Request, Reply };
+
+  Kind kind{Kind::Request};
+  int fd{-1};
+  std::uint64_t conn_id{0};
+  std::uint64_t seq{0};
+  std::string payload;              // concatenated args, or the reply
+  std::vector<std::uint32_t> lens;  // arg lengths, requests only
+};
+
+// Shard owning a key: the one its hash slot maps to, so keys sharing a hash
+// tag share a shard, and a slot moving to another node is moved by one shard.
+inline unsigned shard_of(std::string_view key, unsigned shards) {
+  return db::key_slot(key) % shards;
+}
+
+// Full mesh of lock-free SPSC queues between shards, one per ordered pair, plus
+// an eventfd per shard to wake its reactor out of epoll_wait.
+class Mailbox {
+ public:
+  Mailbox(unsigned shards, std::size_t capacity);
+  ~Mailbox();
+
+  Mailbox(const Mailbox&) = delete;
+  Mailbox& operator=(const Mailbox&) = delete;
+
+  unsigned shards() const { return n; }
+  util::SpscQueue<Message>& queue(unsigned from, unsigned to) { return *queues[from * n + to]; }
+
+  int wake_fd(unsigned shard) const { return wake_fds[shard]; }
+  void notify(unsigned shard);
+  // Clears a shard's pending wakeup; called by its reactor.
+  void drain_wakeups(unsigned shard);
+
+ private:
+  unsigned n;
+  std::vector<std::unique_ptr<util::SpscQueue<Message>>> queues;
+  std::vector<int> wake_fds;
+};
+
+}  // namespace server
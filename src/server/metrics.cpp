@@ -0,0 +1,309 @@
+#include "metrics.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+
+#include "../util/tsc.hpp"
+#include "config.hpp"
+#include "replication.hpp"
+
+namespace server {
+
+namespace {
+// Percentiles INFO latencystats reports, as Redis does by default.
+constexpr double kPercentiles[] = {50, 99, 99.9};
+
+void appendf(std::string& out, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+void appendf(std::string& out, const char* fmt, ...) {
+  char buf[256];
+  va_list ap;
+  va_start(ap, fmt);
+  const int n = std::vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  if (n > 0) {
+    out.append(buf, std::min(static_cast<std::size_t>(n), sizeof(buf) - 1));
+  }
+}
+
+const char* policy_name(db::EvictionPolicy p) {
+  switch (p) {
+    case db::EvictionPolicy::AllKeysLru:
+      return "allkeys-lru";
+    case db::EvictionPolicy::AllKeysLfu:
+      return "allkeys-lfu";
+    case db::EvictionPolicy::VolatileTtl:
+      return "volatile-ttl";
+    case db::EvictionPolicy::NoEviction:
+      break;
+  }
+  return "noeviction";
+}
+
+// Sum of one counter over every thread.
+template <typename F>
+std::uint64_t sum(const ThreadMetrics* threads, unsigned n, F&& field) {
+  std::uint64_t total = 0;
+  for (unsigned i = 0; i < n; ++i) {
+    total += ThreadMetrics::get(field(threads[i]));
+  }
+  return total;
+}
+
+bool wants(std::string_view section, std::string_view name, bool in_default) {
+  if (section.empty() || section == "default") {
+    return in_default;
+  }
+  return section == "all" || section == "everything" || section == name;
+}
+}  // namespace
+
+std::uint64_t ThreadMetrics::total_commands() const {
+  std::uint64_t total = 0;
+  for (const util::Histogram& h : commands) {
+    total += h.count();
+  }
+  return total;
+}
+
+void ThreadMetrics::publish(const db::Store& store) {
+  set(keys, store.size());
+  set(expires, store.volatile_size());
+  set(used_memory, store.used_memory());
+  set(evicted_keys, store.evicted_keys());
+  set(allocator_resident, store.allocator().resident_bytes());
+}
+
+std::uint64_t RateSampler::update(std::uint64_t total, util::TimePoint now) {
+  if (last_time != util::TimePoint{}) {
+    const double secs = std::chrono::duration<double>(now - last_time).count();
+    if (secs > 0) {
+      rates[next] = static_cast<double>(total - last_total) / secs;
+      next = (next + 1) % kSamples;
+    }
+  }
+  last_total = total;
+  last_time = now;
+  double mean = 0;
+  for (double r : rates) {
+    mean += r;
+  }
+  return static_cast<std::uint64_t>(mean / kSamples);
+}
+
+Metrics::Metrics(const Config& cfg, std::vector<std::string_view> command_names)
+    : cfg(cfg),
+      names(std::move(command_names)),
+      threads(new ThreadMetrics[cfg.threads]),
+      slow(cfg.slowlog_max_len),
+      stall(cfg.slowlog_max_len) {}
+
+void Metrics::info(std::string_view section, std::string& out) const {
+  const unsigned n = cfg.threads;
+  const ThreadMetrics* t = threads.get();
+  const double ticks_per_us = util::tsc_ticks_per_ns() * 1000.0;
+  auto usec = [&](std::uint64_t ticks) { return static_cast<double>(ticks) / ticks_per_us; };
+
+  if (wants(section, "server", true)) {
+    out.append("# Server\r\n");
+    appendf(out, "io_backend:%s\r\n", cfg.io == IoBackend::Uring ? "uring" : "epoll");
+    appendf(out, "process_id:%d\r\n", static_cast<int>(::getpid()));
+    appendf(out, "tcp_port:%u\r\n", static_cast<unsigned>(cfg.port));
+    appendf(out, "uptime_in_seconds:%lld\r\n",
+            static_cast<long long>(std::chrono::duration_cast<std::chrono::seconds>(util::now() - started).count()));
+    appendf(out, "reactor_threads:%u\r\n", n);
+    out.append("\r\n");
+  }
+  if (wants(section, "clients", true)) {
+    out.append("# Clients\r\n");
+    appendf(out, "connected_clients:%llu\r\n",
+            static_cast<unsigned long long>(sum(t, n, [](auto& m) -> auto& { return m.connected_clients; })));
+    out.append("\r\n");
+  }
+  if (wants(section, "memory", true)) {
+    out.append("# Memory\r\n");
+    appendf(out, "used_memory:%llu\r\n",
+            static_cast<unsigned long long>(sum(t, n, [](auto& m) -> auto& { return m.used_memory; })));
+    appendf(out, "allocator_resident:%llu\r\n",
+            static_cast<unsigned long long>(sum(t, n, [](auto& m) -> auto& { return m.allocator_resident; })));
+    appendf(out, "mem_clients_normal:%llu\r\n",
+            static_cast<unsigned long long>(sum(t, n, [](auto& m) -> auto& { return m.client_buffers; })));
+    appendf(out, "maxmemory:%zu\r\n", cfg.maxmemory);
+    appendf(out, "maxmemory_policy:%s\r\n", policy_name(cfg.maxmemory_policy));
+    out.append("\r\n");
+  }
+  if (wants(section, "stats", true)) {
+    util::Histogram::Totals loop;
+    std::uint64_t commands = 0;
+    for (unsigned i = 0; i < n; ++i) {
+      t[i].loop.add_to(loop);
+      commands += t[i].total_commands();
+    }
+    out.append("# Stats\r\n");
+    appendf(out, "total_connections_received:%llu\r\n",
+            static_cast<unsigned long long>(sum(t, n, [](auto& m) -> auto& { return m.connections_received; })));
+    appendf(out, "total_commands_processed:%llu\r\n", static_cast<unsigned long long>(commands));
+    appendf(out, "instantaneous_ops_per_sec:%llu\r\n",
+            static_cast<unsigned long long>(sum(t, n, [](auto& m) -> auto& { return m.ops_per_sec; })));
+    appendf(out, "evicted_keys:%llu\r\n",
+            static_cast<unsigned long long>(sum(t, n, [](auto& m) -> auto& { return m.evicted_keys; })));
+    appendf(out, "eventloop_cycles:%llu\r\n", static_cast<unsigned long long>(loop.count));
+    appendf(out, "eventloop_duration_sum:%.0f\r\n", usec(loop.sum));
+    appendf(out, "eventloop_duration_p99_usec:%.3f\r\n", usec(loop.percentile(99)));
+    appendf(out, "eventloop_duration_max_usec:%.3f\r\n", usec(loop.max));
+    out.append("\r\n");
+  }
+  if (replication != nullptr && wants(section, "replication", true)) {
+    replication->info(out);
+  }
+  if (wants(section, "threads", true)) {
+    out.append("# Threads\r\n");
+    for (unsigned i = 0; i < n; ++i) {
+      const ThreadMetrics& m = t[i];
+      appendf(out, "thread%u:clients=%llu,commands=%llu,ops_per_sec=%llu,keys=%llu,eventloop_cycles=%llu\r\n", i,
+              static_cast<unsigned long long>(ThreadMetrics::get(m.connected_clients)),
+              static_cast<unsigned long long>(m.total_commands()),
+              static_cast<unsigned long long>(ThreadMetrics::get(m.ops_per_sec)),
+              static_cast<unsigned long long>(ThreadMetrics::get(m.keys)),
+              static_cast<unsigned long long>(m.loop.count()));
+    }
+    out.append("\r\n");
+  }
+  const bool commandstats = wants(section, "commandstats", false);
+  const bool latencystats = wants(section, "latencystats", false);
+  if (commandstats || latencystats) {
+    std::vector<util::Histogram::Totals> per_command(names.size());
+    for (std::size_t c = 0; c < names.size(); ++c) {
+      for (unsigned i = 0; i < n; ++i) {
+        t[i].commands[c].add_to(per_command[c]);
+      }
+    }
+    if (commandstats) {
+      out.append("# Commandstats\r\n");
+      for (std::size_t c = 0; c < names.size(); ++c) {
+        const util::Histogram::Totals& h = per_command[c];
+        if (h.count == 0) {
+          continue;
+        }
+        appendf(out, "cmdstat_%.*s:calls=%llu,usec=%.0f,usec_per_call=%.2f\r\n", static_cast<int>(names[c].size()),
+                names[c].data(), static_cast<unsigned long long>(h.count), usec(h.sum),
+                usec(h.sum) / static_cast<double>(h.count));
+      }
+      out.append("\r\n");
+    }
+    if (latencystats) {
+      out.append("# Latencystats\r\n");
+      for (std::size_t c = 0; c < names.size(); ++c) {
+        const util::Histogram::Totals& h = per_command[c];
+        if (h.count == 0) {
+          continue;
+        }
+        appendf(out, "latency_percentiles_usec_%.*s:", static_cast<int>(names[c].size()), names[c].data());
+        const char* sep = "";
+        for (double p : kPercentiles) {
+          appendf(out, "%sp%g=%.3f", sep, p, usec(h.percentile(p)));
+          sep = ",";
+        }
+        out.append("\r\n");
+      }
+      out.append("\r\n");
+    }
+  }
+  if (wants(section, "keyspace", true)) {
+    out.append("# Keyspace\r\n");
+    const std::uint64_t keys = sum(t, n, [](auto& m) -> auto& { return m.keys; });
+    if (keys > 0) {
+      appendf(out, "db0:keys=%llu,expires=%llu\r\n", static_cast<unsigned long long>(keys),
+              static_cast<unsigned long long>(sum(t, n, [](auto& m) -> auto& { return m.expires; })));
+    }
+    out.append("\r\n");
+  }
+  // Like Redis, no blank line after the last section.
+  if (out.size() >= 2) {
+    out.resize(out.size() - 2);
+  }
+}
+
+void Metrics::prometheus(std::string& out) const {
+  const unsigned n = cfg.threads;
+  const ThreadMetrics* t = threads.get();
+  const double ticks_per_s = util::tsc_ticks_per_ns() * 1e9;
+
+  struct Gauge {
+    const char* name;
+    const char* type;
+    const ThreadMetrics::Counter ThreadMetrics::*field;
+  };
+  static constexpr Gauge kPerThread[] = {
+      {"kvserv_connected_clients", "gauge", &ThreadMetrics::connected_clients},
+      {"kvserv_connections_received_total", "counter", &ThreadMetrics::connections_received},
+      {"kvserv_ops_per_second", "gauge", &ThreadMetrics::ops_per_sec},
+      {"kvserv_client_buffer_bytes", "gauge", &ThreadMetrics::client_buffers},
+      {"kvserv_keys", "gauge", &ThreadMetrics::keys},
+      {"kvserv_expires", "gauge", &ThreadMetrics::expires},
+      {"kvserv_used_memory_bytes", "gauge", &ThreadMetrics::used_memory},
+      {"kvserv_allocator_resident_bytes", "gauge", &ThreadMetrics::allocator_resident},
+      {"kvserv_evicted_keys_total", "counter", &ThreadMetrics::evicted_keys},
+  };
+  for (const Gauge& g : kPerThread) {
+    appendf(out, "# TYPE %s %s\n", g.name, g.type);
+    for (unsigned i = 0; i < n; ++i) {
+      appendf(out, "%s{thread=\"%u\"} %llu\n", g.name, i,
+              static_cast<unsigned long long>(ThreadMetrics::get(t[i].*g.field)));
+    }
+  }
+
+  // labels is empty or a list like cmd="get".
+  auto summary = [&](const util::Histogram::Totals& h, const char* name, std::string_view labels) {
+    std::string braced;
+    if (!labels.empty()) {
+      braced.append("{").append(labels).append("}");
+    }
+    const char* sep = labels.empty() ? "" : ",";
+    for (double p : kPercentiles) {
+      appendf(out, "%s{%.*s%squantile=\"%g\"} %.9f\n", name, static_cast<int>(labels.size()), labels.data(), sep,
+              p / 100, static_cast<double>(h.percentile(p)) / ticks_per_s);
+    }
+    appendf(out, "%s_sum%s %.9f\n", name, braced.c_str(), static_cast<double>(h.sum) / ticks_per_s);
+    appendf(out, "%s_count%s %llu\n", name, braced.c_str(), static_cast<unsigned long long>(h.count));
+  };
+
+  out.append("# TYPE kvserv_eventloop_duration_seconds summary\n");
+  util::Histogram::Totals loop;
+  for (unsigned i = 0; i < n; ++i) {
+    t[i].loop.add_to(loop);
+  }
+  summary(loop, "kvserv_eventloop_duration_seconds", "");
+
+  out.append("# TYPE kvserv_command_duration_seconds summary\n");
+  for (std::size_t c = 0; c < names.size(); ++c) {
+    util::Histogram::Totals h;
+    for (unsigned i = 0; i < n; ++i) {
+      t[i].commands[c].add_to(h);
+    }
+    if (h.count == 0) {
+      continue;
+    }
+    char labels[64];
+    std::snprintf(labels, sizeof(labels), "cmd=\"%.*s\"", static_cast<int>(names[c].size()), names[c].data());
+    summary(h, "kvserv_command_duration_seconds", labels);
+  }
+}
+
+bool Metrics::write_file(const std::string& path) const {
+  std::string text;
+  prometheus(text);
+  const std::string tmp = path + ".tmp";
+  int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  const bool ok = ::write(fd, text.data(), text.size()) == static_cast<ssize_t>(text.size());
+  ::close(fd);
+  return ok && ::rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+}  // namespace server
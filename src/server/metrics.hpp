@@ -0,0 +1,107 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../db/store.hpp"
+#include "../util/histogram.hpp"
+#include "../util/time.hpp"
+#include "slowlog.hpp"
+
+namespace server {
+
+class Replication;
+
+struct Config;
+
+// Room for the dispatcher's command table in the per-command stats.
+inline constexpr std::size_t kMaxCommands = 48;
+
+// What one reactor thread reports. Only that thread writes its block, and
+// blocks are cache-line aligned, so recording never contends with another
+// core; INFO and the metrics file sum the blocks of every thread.
+struct alignas(64) ThreadMetrics {
+  using Counter = std::atomic<std::uint64_t>;
+
+  // Plain load and store: exact with the single writer, and no locked
+  // instruction on the hot path.
+  static void add(Counter& c, std::uint64_t n) {
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+  static void set(Counter& c, std::uint64_t v) { c.store(v, std::memory_order_relaxed); }
+  static std::uint64_t get(const Counter& c) { return c.load(std::memory_order_relaxed); }
+
+  // TSC ticks per command; a histogram's count is the command's calls.
+  std::array<util::Histogram, kMaxCommands> commands;
+  // TSC ticks from an event-loop wakeup to the end of that iteration.
+  util::Histogram loop;
+
+  Counter connections_received{0};
+  Counter connected_clients{0};
+
+  // Refreshed from the owning thread's cron (and before its own INFO).
+  Counter ops_per_sec{0};
+  Counter client_buffers{0};  // read and write buffer capacity of its clients
+  Counter keys{0};
+  Counter expires{0};
+  Counter used_memory{0};
+  Counter evicted_keys{0};
+  Counter allocator_resident{0};
+
+  std::uint64_t total_commands() const;
+  void publish(const db::Store& store);
+};
+
+// Instantaneous ops/sec as Redis computes it: the mean rate over the last
+// kSamples cron intervals. Owned by one thread.
+class RateSampler {
+ public:
+  std::uint64_t update(std::uint64_t total, util::TimePoint now);
+
+ private:
+  static constexpr std::size_t kSamples = 16;
+  std::array<double, kSamples> rates{};
+  std::size_t next{0};
+  std::uint64_t last_total{0};
+  util::TimePoint last_time{};
+};
+
+// Process-wide registry of per-thread metrics, rendered as INFO text or in
+// the Prometheus text format.
+class Metrics {
+ public:
+  Metrics(const Config& cfg, std::vector<std::string_view> command_names);
+
+  ThreadMetrics& thread(unsigned i) { return threads[i]; }
+  SlowLog& slowlog() { return slow; }
+  StallLog& stalls() { return stall; }
+  // Enables the replication section of INFO.
+  void set_replication(const Replication* r) { replication = r; }
+
+  // INFO text for section (lower case): empty or "default" for the usual
+  // sections, "all"/"everything" for all of them, or one section by name;
+  // nothing for an unknown name.
+  void info(std::string_view section, std::string& out) const;
+  void prometheus(std::string& out) const;
+  // Writes prometheus() to path through a temporary file and a rename, so
+  // scrapers (e.g. node_exporter's textfile collector) never see half a file.
+  bool write_file(const std::string& path) const;
+
+ private:
+  const Config& cfg;
+  std::vector<std::string_view> names;
+  std::unique_ptr<ThreadMetrics[]> threads;
+  SlowLog slow;
+  StallLog stall;
+  const Replication* replication{nullptr};
+  util::TimePoint started{util::now()};
+};
+
+}  // namespace server
@@ -0,0 +1,942 @@
+#include "reactor.hpp"
+
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+
+#include "../net/socket.hpp"
+#include "../protocol/resp.hpp"
+#include "../util/error.hpp"
+#include "../util/tsc.hpp"
+
+namespace server {
+
+namespace {
+// Time spent per loop iteration moving entries into a resized table.
+constexpr std::chrono::microseconds kRehashBudget{200};
+constexpr unsigned kUringEntries = 256;
+// Stream bytes queued to a replica at a time; more follow once it is sent.
+constexpr std::size_t kReplicaWindow = 256 * 1024;
+}  // namespace
+
+Reactor::Reactor(const Config& cfg, unsigned shard, const Shared& shared)
+    : cfg(cfg),
+      shard(shard),
+      mailbox(shared.mailbox),
+      aof(shared.aof),
+      snapshots(shared.snapshots),
+      metrics(shared.metrics),
+      replication(shared.replication),
+      cluster(shared.cluster),
+      stores(shared.stores),
+      stats(&shared.metrics->thread(shard)),
+      cron(std::chrono::microseconds(1000000 / cfg.hz)),
+      dispatcher(store) {
+  dispatcher.set_metrics(metrics, stats);
+  store.set_maxmemory(cfg.maxmemory / cfg.threads, cfg.maxmemory_policy, cfg.maxmemory_samples);
+  if (cluster != nullptr) {
+    store.count_slots();
+  }
+  if (shared.epochs != nullptr) {
+    store.share_reads(*shared.epochs, shard);
+  }
+  // The aof holds the full history, so it wins over a snapshot.
+  if (aof != nullptr) {
+    load_aof();
+    dispatcher.set_log_buffer(&log_buf);
+    logging = true;
+  } else if (snapshots != nullptr) {
+    load_snapshot();
+  }
+  if (snapshots != nullptr) {
+    dispatcher.set_snapshotter(snapshots);
+    snapshots->attach(shard, &store);
+  }
+  if (stores != nullptr) {
+    store.publish();
+    stores[shard].store(&store, std::memory_order_release);
+  }
+  if (mailbox != nullptr) {
+    outbox.resize(mailbox->shards());
+    needs_notify.resize(mailbox->shards());
+  }
+  if (cluster != nullptr) {
+    cluster->attach_store(shard, &store);
+    dispatcher.set_cluster(cluster);
+    migrator = std::make_unique<SlotMigrator>(*cluster, store, dispatcher, shard);
+  }
+  if (cfg.threads == 1 && cfg.aof_path.empty()) {
+    link = std::make_unique<ReplicaLink>(cfg, store, dispatcher);
+    dispatcher.set_replica_link(link.get());
+    replication->attach_link(link.get());
+    if (!cfg.replicaof_host.empty()) {
+      link->follow(cfg.replicaof_host, cfg.replicaof_port);
+    }
+  }
+
+  listen_fd = net::create_listen_socket(cfg.port, 128, cfg.threads > 1);
+  if (cfg.io == IoBackend::Uring) {
+    start_uring();
+    return;
+  }
+  if (cfg.uring_send) {
+    uring = std::make_unique<net::Uring>(kUringEntries);
+  }
+  if (cfg.io_threads > 1) {
+    io_threads = std::make_unique<IoThreads>(cfg.io_threads, cfg.cpu_base, cfg.pin);
+  }
+  if (!epoll.add(listen_fd, EPOLLIN)) {
+    util::die_errno("epoll add listen_fd");
+  }
+  if (!epoll.add(cron.fd(), EPOLLIN)) {
+    util::die_errno("epoll add timerfd");
+  }
+  if (mailbox != nullptr && !epoll.add(mailbox->wake_fd(shard), EPOLLIN)) {
+    util::die_errno("epoll add wake_fd");
+  }
+}
+
+Reactor::~Reactor() {
+  if (listen_fd != -1) {
+    ::close(listen_fd);
+  }
+}
+
+void Reactor::run() {
+  if (cfg.io == IoBackend::Uring) {
+    run_uring();
+  }
+  run_epoll();
+}
+
+void Reactor::run_epoll() {
+  while (true) {
+    int n = epoll.wait(wait_timeout());
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      util::die_errno("epoll_wait");
+    }
+    const std::uint64_t woke = util::tsc();
+    begin_iteration();
+
+    epoll_event* events = epoll.events_data();
+    for (int i = 0; i < n; ++i) {
+      int fd = events[i].data.fd;
+      if (fd == listen_fd) {
+        accept_clients();
+      } else if (fd == cron.fd()) {
+        on_cron();
+      } else if (mailbox != nullptr && fd == mailbox->wake_fd(shard)) {
+        mailbox->drain_wakeups(shard);
+      } else if (link != nullptr && fd == link->fd()) {
+        link->on_readable();
+      } else if (migrator != nullptr && fd == migrator->fd()) {
+        migrator->on_readable();
+      } else if (io_threads != nullptr) {
+        queue_io(fd, events[i].events);
+      } else {
+        handle_io(fd, events[i].events);
+      }
+    }
+    if (!read_list.empty()) {
+      read_queued();
+    }
+
+    end_iteration();
+    finish_iteration(woke, static_cast<std::uint64_t>(n));
+  }
+}
+
+int Reactor::wait_timeout() const {
+  // Keep polling while a table resize or an expiry backlog is in progress,
+  // retry soon if a peer's queue was full, otherwise sleep until an event.
+  if (rehashing || expiring || replicas_behind || (migrator != nullptr && migrator->busy())) {
+    return 0;
+  }
+  for (const auto& q : outbox) {
+    if (!q.empty()) {
+      return 1;
+    }
+  }
+  return -1;
+}
+
+void Reactor::begin_iteration() {
+  // Another shard may be forking a snapshot and need every store idle.
+  if (snapshots != nullptr) {
+    snapshots->maybe_park();
+  }
+  // Checked after parking: writes made before a full resync's snapshot are
+  // in the snapshot, and every later one reaches the stream.
+  if (!logging && replication->active()) {
+    dispatcher.set_log_buffer(&log_buf);
+    logging = true;
+  }
+  // One clock read per wakeup stamps every key access in the batch.
+  store.update_clock();
+}
+
+void Reactor::on_cron() {
+  cron.drain();
+  expiring = true;
+  if (snapshots != nullptr && shard == 0) {
+    snapshots->poll();
+  }
+  check_transfer();
+  if (link != nullptr) {
+    if (link->cron()) {
+      watch_link();
+    }
+    // A replica serves no replicas of its own.
+    while (link->following() && !peers.empty()) {
+      close_connection(peers.begin()->first);
+    }
+  }
+  if (migrator != nullptr && migrator->step()) {
+    watch_migrator();
+  }
+  store.reclaim();
+  publish_metrics();
+  update_thresholds();
+}
+
+void Reactor::update_thresholds() {
+  dispatcher.set_slowlog_threshold(cfg.slowlog_slower_than_us < 0
+                                       ? UINT64_MAX
+                                       : util::tsc_from_us(static_cast<std::uint64_t>(cfg.slowlog_slower_than_us)));
+  stall_ticks = cfg.loop_stall_us == 0 ? UINT64_MAX : util::tsc_from_us(cfg.loop_stall_us);
+}
+
+void Reactor::publish_metrics() {
+  const util::TimePoint now = util::now();
+  stats->publish(store);
+  ThreadMetrics::set(stats->ops_per_sec, ops_rate.update(stats->total_commands(), now));
+  std::size_t buffers = 0;
+  for (const auto& [fd, conn] : conns) {
+    buffers += conn->buffer_bytes();
+  }
+  ThreadMetrics::set(stats->client_buffers, buffers);
+
+  if (shard == 0 && !cfg.metrics_path.empty() && now - metrics_written >= std::chrono::seconds(1)) {
+    metrics_written = now;
+    if (!metrics->write_file(cfg.metrics_path)) {
+      std::perror("metrics file");
+    }
+  }
+}
+
+void Reactor::end_iteration() {
+  if (mailbox != nullptr) {
+    drain_mailbox();
+  }
+  // Group commit: one write (and fsync under always) for the iteration.
+  // Replies only leave after this, below or via the outbox. Replicas get the
+  // same batch.
+  if (!log_buf.empty()) {
+    if (aof != nullptr) {
+      aof->write(log_buf);
+    }
+    if (replication->active()) {
+      replication->append(shard, log_buf);
+    }
+    log_buf.clear();
+  }
+  if (mailbox != nullptr) {
+    flush_outbox();
+  }
+  feed_replicas();
+  flush_replies();
+  start_syncs();
+  if (migrator != nullptr && migrator->step()) {
+    watch_migrator();
+  }
+
+  const std::uint64_t start = util::tsc();
+  rehashing = store.rehash_step(kRehashBudget);
+  if (expiring) {
+    expiring = store.expire_cycle(cfg.expire_keys, std::chrono::microseconds(cfg.expire_budget_us));
+  }
+  iter.maintenance_ticks = util::tsc() - start;
+}
+
+void Reactor::finish_iteration(std::uint64_t woke, std::uint64_t events) {
+  const std::uint64_t ticks = util::tsc() - woke;
+  stats->loop.record(ticks);
+  const commands::Dispatcher::Slowest slowest = dispatcher.take_slowest();
+  if (ticks > stall_ticks) {
+    StallEntry e;
+    e.unix_secs = util::unix_millis() / 1000;
+    e.usec = util::tsc_to_us(ticks);
+    e.shard = shard;
+    e.events = events;
+    e.commands = iter.commands;
+    e.client_id = iter.top_client;
+    e.client_commands = iter.top_commands;
+    e.slowest = slowest.name;
+    e.slowest_usec = util::tsc_to_us(slowest.ticks);
+    e.maintenance_usec = util::tsc_to_us(iter.maintenance_ticks);
+    metrics->stalls().add(std::move(e));
+  }
+  iter = Iteration{};
+}
+
+void Reactor::add_connection(int fd) {
+  net::set_tcp_nodelay(fd);
+  conns.emplace(fd, std::make_unique<net::Connection>(fd, next_conn_id++));
+  ThreadMetrics::add(stats->connections_received, 1);
+  ThreadMetrics::set(stats->connected_clients, conns.size());
+}
+
+void Reactor::accept_clients() {
+  // Accept as many clients as are queued.
+  while (true) {
+    int client_fd = ::accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (client_fd < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+
+    add_connection(client_fd);
+    epoll.add(client_fd, EPOLLIN);
+  }
+}
+
+void Reactor::handle_io(int fd, uint32_t ev) {
+  auto it = conns.find(fd);
+  if (it == conns.end()) {
+    return;
+  }
+  net::Connection& conn = *it->second;
+
+  bool alive = true;
+  if (ev & (EPOLLERR | EPOLLHUP)) {
+    alive = false;
+  }
+  if (alive && (ev & EPOLLIN)) {
+    alive = conn.on_read([&](resp::Args args, std::string& out, resp::Splices* splices) {
+      route(conn, args, out, splices);
+    });
+  }
+
+  if (!alive) {
+    close_connection(fd);
+    return;
+  }
+  // Replies (new ones, or the rest after EPOLLOUT) go out with the batch.
+  if (conn.wants_write()) {
+    queue_flush(conn);
+  }
+}
+
+void Reactor::queue_io(int fd, uint32_t ev) {
+  auto it = conns.find(fd);
+  if (it == conns.end()) {
+    return;
+  }
+  net::Connection& conn = *it->second;
+  if (ev & (EPOLLERR | EPOLLHUP)) {
+    close_connection(fd);
+    return;
+  }
+  if (ev & EPOLLIN) {
+    read_list.push_back(fd);
+  } else if (conn.wants_write()) {
+    queue_flush(conn);
+  }
+}
+
+void Reactor::read_queued() {
+  // By fd: a cron tick handled after the event may have closed one.
+  io_batch.clear();
+  for (int fd : read_list) {
+    auto it = conns.find(fd);
+    if (it != conns.end()) {
+      io_batch.push_back(it->second.get());
+    }
+  }
+  read_list.clear();
+  io_ok.assign(io_batch.size(), 1);
+  auto read = [&](std::size_t i) { io_ok[i] = io_batch[i]->read_commands(); };
+  io_threads->run(io_batch.size(), read);
+
+  // Commands run here, one connection after another as without threads.
+  for (std::size_t i = 0; i < io_batch.size(); ++i) {
+    net::Connection& conn = *io_batch[i];
+    const bool alive = io_ok[i] && conn.run_commands([&](resp::Args args, std::string& out, resp::Splices* splices) {
+      route(conn, args, out, splices);
+    });
+    if (!alive) {
+      close_connection(conn.fd());
+    } else if (conn.wants_write()) {
+      queue_flush(conn);
+    }
+  }
+}
+
+void Reactor::queue_flush(net::Connection& conn) {
+  if (!conn.flush_queued()) {
+    conn.set_flush_queued(true);
+    flush_list.push_back(conn.fd());
+  }
+}
+
+void Reactor::flush_replies() {
+  if (cfg.io == IoBackend::Uring) {
+    queue_sends();
+    return;
+  }
+  if (uring != nullptr) {
+    flush_replies_uring();
+    return;
+  }
+  if (io_threads != nullptr) {
+    flush_replies_threaded();
+    return;
+  }
+  // Write opportunistically; EPOLLOUT is only armed for sockets that filled up.
+  for (int fd : flush_list) {
+    auto it = conns.find(fd);
+    if (it == conns.end()) {
+      continue;
+    }
+    net::Connection& conn = *it->second;
+    conn.set_flush_queued(false);
+    if (!conn.on_write()) {
+      close_connection(fd);
+      continue;
+    }
+    update_interest(conn);
+  }
+  flush_list.clear();
+}
+
+void Reactor::flush_replies_uring() {
+  std::size_t next = 0;
+  while (next < flush_list.size()) {
+    // One submission covers as many connections as the ring holds.
+    send_batch.clear();
+    for (; next < flush_list.size(); ++next) {
+      auto it = conns.find(flush_list[next]);
+      if (it == conns.end()) {
+        continue;
+      }
+      net::Connection& conn = *it->second;
+      conn.set_flush_queued(false);
+      if (!conn.wants_write()) {
+        continue;
+      }
+      io_uring_sqe* sqe = uring->get_sqe();
+      if (sqe == nullptr) {
+        conn.set_flush_queued(true);
+        break;
+      }
+      sqe->opcode = IORING_OP_SENDMSG;
+      sqe->fd = conn.fd();
+      sqe->addr = reinterpret_cast<std::uint64_t>(conn.pending_output());
+      sqe->len = 1;
+      // Never park in the kernel: a full socket completes with -EAGAIN and
+      // falls back to EPOLLOUT.
+      sqe->msg_flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+      sqe->user_data = send_batch.size();
+      send_batch.push_back(&conn);
+    }
+    if (send_batch.empty()) {
+      continue;
+    }
+
+    const auto submitted = static_cast<unsigned>(send_batch.size());
+    if (uring->submit(submitted) < 0) {
+      util::die_errno("io_uring_enter");
+    }
+    std::vector<int> dead;
+    unsigned completed = 0;
+    while (completed < submitted) {
+      completed += uring->drain([&](const io_uring_cqe& cqe) {
+        net::Connection& conn = *send_batch[cqe.user_data];
+        if (cqe.res > 0) {
+          conn.advance_output(static_cast<std::size_t>(cqe.res));
+        } else if (cqe.res != -EAGAIN && cqe.res != -EINTR) {
+          dead.push_back(conn.fd());
+        }
+      });
+      if (completed < submitted && uring->submit(submitted - completed) < 0) {
+        util::die_errno("io_uring_enter");
+      }
+    }
+
+    for (net::Connection* conn : send_batch) {
+      update_interest(*conn);
+    }
+    for (int fd : dead) {
+      close_connection(fd);
+    }
+  }
+  flush_list.clear();
+}
+
+void Reactor::flush_replies_threaded() {
+  io_batch.clear();
+  for (int fd : flush_list) {
+    auto it = conns.find(fd);
+    if (it == conns.end()) {
+      continue;
+    }
+    it->second->set_flush_queued(false);
+    io_batch.push_back(it->second.get());
+  }
+  flush_list.clear();
+  io_ok.assign(io_batch.size(), 1);
+  auto send = [&](std::size_t i) { io_ok[i] = io_batch[i]->write_keeping_pins(); };
+  io_threads->run(io_batch.size(), send);
+
+  for (std::size_t i = 0; i < io_batch.size(); ++i) {
+    net::Connection& conn = *io_batch[i];
+    conn.release_sent();
+    if (!io_ok[i]) {
+      close_connection(conn.fd());
+      continue;
+    }
+    update_interest(conn);
+  }
+}
+
+void Reactor::update_interest(net::Connection& conn) {
+  const uint32_t wanted = conn.wants_write() ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+  if (wanted != conn.interest()) {
+    epoll.mod(conn.fd(), wanted);
+    conn.set_interest(wanted);
+  }
+}
+
+void Reactor::route(net::Connection& conn, resp::Args args, std::string& out,
+                    resp::Splices* splices) {
+  ++iter.commands;
+  if (conn.id() != iter.run_client) {
+    iter.run_client = conn.id();
+    iter.run_commands = 0;
+  }
+  if (++iter.run_commands > iter.top_commands) {
+    iter.top_client = conn.id();
+    iter.top_commands = iter.run_commands;
+  }
+  dispatcher.set_client(shard, conn.id());
+  const bool asking = cluster != nullptr && conn.take_asking();
+
+  std::size_t first = 0;
+  std::size_t last = 0;
+  std::size_t step = 1;
+  const bool keyed =
+      (mailbox != nullptr || cluster != nullptr) && commands::Dispatcher::key_range(args, first, last, step);
+  if (keyed && cluster != nullptr && !cluster_allows(asking, args, first, last, step, out)) {
+    return;
+  }
+  if (!keyed) {
+    dispatcher.dispatch(args, out, splices);
+    if (dispatcher.repl_requested()) {
+      on_repl_request(conn, out);
+    }
+    if (dispatcher.take_asking()) {
+      conn.set_asking();
+    }
+    return;
+  }
+
+  unsigned owner = shard;
+  if (mailbox != nullptr) {
+    const unsigned shards = mailbox->shards();
+    owner = shard_of(args[first], shards);
+    for (std::size_t i = first + step; i < last; i += step) {
+      if (shard_of(args[i], shards) != owner) {
+        resp::append_error_code(out, "CROSSSLOT", "Keys in request don't hash to the same shard");
+        return;
+      }
+    }
+  }
+
+  if (owner == shard) {
+    if (migration_allows(args, out)) {
+      dispatcher.dispatch(args, out, splices);
+    }
+  } else if (!peek_owner(conn, owner, args, first, out)) {
+    forward(conn, owner, args);
+  }
+}
+
+bool Reactor::peek_owner(net::Connection& conn, unsigned owner, resp::Args args, std::size_t first,
+                         std::string& out) {
+  // A forwarded command still in flight may be a write the read must see.
+  if (stores == nullptr || conn.awaiting_replies()) {
+    return false;
+  }
+  const db::Store* owner_store = stores[owner].load(std::memory_order_acquire);
+  if (owner_store == nullptr) {
+    return false;
+  }
+  if (cluster != nullptr && cluster->migrating(db::key_slot(args[first])) != Cluster::kNone) {
+    return false;
+  }
+  return dispatcher.peek(*owner_store, shard, args, out);
+}
+
+void Reactor::forward(net::Connection& conn, unsigned owner, resp::Args args) {
+  Message msg;
+  msg.kind = Message::Kind::Request;
+  msg.fd = conn.fd();
+  msg.conn_id = conn.id();
+  msg.seq = conn.defer_reply();
+  msg.lens.reserve(args.size());
+  for (std::string_view arg : args) {
+    msg.payload.append(arg);
+    msg.lens.push_back(static_cast<std::uint32_t>(arg.size()));
+  }
+  post(owner, msg);
+}
+
+void Reactor::post(unsigned to, Message& msg) {
+  needs_notify[to] = true;
+  // Replies wait in the outbox until this iteration's aof batch is written.
+  if (msg.kind == Message::Kind::Request && outbox[to].empty() && mailbox->queue(shard, to).try_push(msg)) {
+    return;
+  }
+  outbox[to].push_back(std::move(msg));
+}
+
+void Reactor::drain_mailbox() {
+  Message msg;
+  for (unsigned from = 0; from < mailbox->shards(); ++from) {
+    if (from == shard) {
+      continue;
+    }
+    auto& q = mailbox->queue(from, shard);
+    while (q.try_pop(msg)) {
+      if (msg.kind == Message::Kind::Reply) {
+        deliver_reply(msg);
+        continue;
+      }
+
+      forwarded_args.clear();
+      std::size_t offset = 0;
+      for (std::uint32_t len : msg.lens) {
+        forwarded_args.emplace_back(msg.payload.data() + offset, len);
+        offset += len;
+      }
+      std::string reply;
+      ++iter.commands;
+      dispatcher.set_client(from, msg.conn_id);
+      if (migration_allows(forwarded_args, reply)) {
+        dispatcher.dispatch(forwarded_args, reply);
+      }
+
+      msg.kind = Message::Kind::Reply;
+      msg.payload = std::move(reply);
+      msg.lens.clear();
+      post(from, msg);
+    }
+  }
+}
+
+void Reactor::flush_outbox() {
+  for (unsigned to = 0; to < outbox.size(); ++to) {
+    auto& pending = outbox[to];
+    auto& q = mailbox->queue(shard, to);
+    while (!pending.empty() && q.try_push(pending.front())) {
+      pending.pop_front();
+      needs_notify[to] = true;
+    }
+    if (needs_notify[to]) {
+      mailbox->notify(to);
+      needs_notify[to] = false;
+    }
+  }
+}
+
+void Reactor::deliver_reply(Message& msg) {
+  auto it = conns.find(msg.fd);
+  if (it == conns.end() || it->second->id() != msg.conn_id) {
+    return;  // client went away while the command was in flight
+  }
+  net::Connection& conn = *it->second;
+  conn.complete_reply(msg.seq, msg.payload);
+  // Sent with the iteration's batch, after the aof write, since the replies
+  // it released may include local writes logged this iteration.
+  if (conn.wants_write()) {
+    queue_flush(conn);
+  }
+}
+
+void Reactor::load_aof() {
+  std::size_t applied = 0;
+  std::string scratch;
+  const std::size_t seen = aof->replay([&](resp::Args args) {
+    // Every shard reads the whole log and keeps its own keys, so the log
+    // stays valid when the thread count changes between runs.
+    std::size_t first = 0;
+    std::size_t last = 0;
+    std::size_t step = 1;
+    if (commands::Dispatcher::key_range(args, first, last, step) && !owns(args[first])) {
+      return;
+    }
+    scratch.clear();
+    dispatcher.dispatch(args, scratch);
+    ++applied;
+  });
+  std::fprintf(stderr, "shard %u: replayed %zu of %zu aof commands\n", shard, applied, seen);
+}
+
+void Reactor::load_snapshot() {
+  const auto start = util::now();
+  const auto loaded = persist::Snapshotter::load(cfg.snapshot_path, store, cfg.threads,
+                                                 [this](std::string_view key) { return owns(key); });
+  if (loaded == persist::Snapshotter::LoadResult::Corrupt) {
+    util::die("refusing to start from a corrupt snapshot");
+  }
+  if (loaded == persist::Snapshotter::LoadResult::Missing) {
+    return;
+  }
+  const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(util::now() - start).count();
+  std::fprintf(stderr, "shard %u: loaded %zu keys from %s in %lld ms\n", shard, store.size(),
+               cfg.snapshot_path.c_str(), static_cast<long long>(ms));
+}
+
+bool Reactor::owns(std::string_view key) const {
+  return mailbox == nullptr || shard_of(key, mailbox->shards()) == shard;
+}
+
+void Reactor::on_repl_request(net::Connection& conn, std::string& out) {
+  using Kind = commands::Dispatcher::ReplRequest::Kind;
+  const commands::Dispatcher::ReplRequest req = dispatcher.take_repl_request();
+  Peer& peer = peers[conn.fd()];
+  if (peer.conn_id != conn.id()) {
+    peer = Peer{conn.id()};
+  }
+  switch (req.kind) {
+    case Kind::ListeningPort:
+      peer.port = static_cast<std::uint16_t>(req.value);
+      return;
+    case Kind::Ack:
+      replication->ack(shard, conn.id(), static_cast<std::uint64_t>(req.value));
+      return;
+    case Kind::Psync:
+      break;
+    case Kind::None:
+      return;
+  }
+  if (peer.syncing || peer.online) {
+    resp::append_error(out, "already syncing");
+    return;
+  }
+  if (req.value >= 0 && replication->can_continue(req.replid, static_cast<std::uint64_t>(req.value))) {
+    resp::append_status_string(out, "CONTINUE " + replication->replid());
+    peer.online = true;
+    peer.offset = static_cast<std::uint64_t>(req.value);
+    replication->set_replica(shard, conn.id(), peer.port, Replication::PeerState::Online);
+    return;
+  }
+  // Full resync: writes are logged from now on, and the snapshot is forked
+  // at the end of an iteration once the snapshotter is free.
+  replication->activate();
+  if (!logging) {
+    dispatcher.set_log_buffer(&log_buf);
+    logging = true;
+  }
+  peer.syncing = true;
+  replication->set_replica(shard, conn.id(), peer.port, Replication::PeerState::WaitSnapshot);
+  pending_syncs.push_back(conn.fd());
+}
+
+void Reactor::start_syncs() {
+  while (sending_fd == -1 && !pending_syncs.empty()) {
+    const int fd = pending_syncs.front();
+    auto it = conns.find(fd);
+    auto peer = peers.find(fd);
+    if (it == conns.end() || peer == peers.end() || !peer->second.syncing || peer->second.conn_id != it->second->id()) {
+      pending_syncs.pop_front();
+      continue;
+    }
+    net::Connection& conn = *it->second;
+    // The child writes to the socket, so the replies before PSYNC go first.
+    if (conn.wants_write() || conn.send_inflight()) {
+      return;
+    }
+    // Every other store is parked while preamble runs, and this iteration's
+    // batch is already in the stream, so the offset matches the snapshot.
+    std::uint64_t at = 0;
+    const auto status = snapshots->background_send(fd, [&] {
+      at = replication->offset();
+      return "+FULLRESYNC " + replication->replid() + " " + std::to_string(at) + "\r\n";
+    });
+    if (status == persist::Snapshotter::Status::Busy || status == persist::Snapshotter::Status::NotReady) {
+      return;  // retried at the end of later iterations
+    }
+    pending_syncs.pop_front();
+    if (status != persist::Snapshotter::Status::Ok) {
+      close_connection(fd);
+      continue;
+    }
+    peer->second.offset = at;
+    sending_fd = fd;
+    sending_id = conn.id();
+    replication->set_replica(shard, conn.id(), peer->second.port, Replication::PeerState::Sending);
+  }
+}
+
+void Reactor::check_transfer() {
+  if (sending_fd == -1) {
+    return;
+  }
+  const persist::Snapshotter::Transfer t = snapshots->transfer();
+  if (t == persist::Snapshotter::Transfer::Running) {
+    return;
+  }
+  snapshots->end_transfer();
+  const int fd = std::exchange(sending_fd, -1);
+  auto it = conns.find(fd);
+  auto peer = peers.find(fd);
+  if (it == conns.end() || it->second->id() != sending_id || peer == peers.end()) {
+    return;  // the replica went away during the transfer
+  }
+  if (t != persist::Snapshotter::Transfer::Done) {
+    std::fprintf(stderr, "shard %u: snapshot transfer to a replica failed\n", shard);
+    close_connection(fd);
+    return;
+  }
+  peer->second.syncing = false;
+  peer->second.online = true;
+  replication->set_replica(shard, sending_id, peer->second.port, Replication::PeerState::Online);
+}
+
+void Reactor::feed_replicas() {
+  replicas_behind = false;
+  if (peers.empty()) {
+    return;
+  }
+  const std::uint64_t end = replication->offset();
+  std::vector<int> lost;
+  for (auto& [fd, peer] : peers) {
+    if (!peer.online || peer.offset == end) {
+      continue;
+    }
+    auto it = conns.find(fd);
+    if (it == conns.end()) {
+      continue;
+    }
+    net::Connection& conn = *it->second;
+    // A window at a time; the next is read once the socket has taken it.
+    if (conn.wants_write() || conn.send_inflight()) {
+      continue;
+    }
+    std::string& out = conn.reply_buffer();
+    const std::size_t before = out.size();
+    if (!replication->read(peer.offset, kReplicaWindow, out)) {
+      lost.push_back(fd);
+      continue;
+    }
+    peer.offset += out.size() - before;
+    replicas_behind = replicas_behind || peer.offset != end;
+    queue_flush(conn);
+  }
+  for (int fd : lost) {
+    std::fprintf(stderr, "shard %u: replica fell out of the backlog, disconnecting\n", shard);
+    close_connection(fd);
+  }
+}
+
+void Reactor::watch_link() {
+  if (cfg.io == IoBackend::Uring) {
+    arm_link();
+  } else if (!epoll.add(link->fd(), EPOLLIN)) {
+    util::die_errno("epoll add replica link");
+  }
+}
+
+bool Reactor::cluster_allows(bool asking, resp::Args args, std::size_t first, std::size_t last, std::size_t step,
+                             std::string& out) {
+  const std::uint16_t slot = db::key_slot(args[first]);
+  for (std::size_t i = first + step; i < last; i += step) {
+    if (db::key_slot(args[i]) != slot) {
+      resp::append_error_code(out, "CROSSSLOT", "Keys in request don't hash to the same slot");
+      return false;
+    }
+  }
+  const std::uint16_t node = cluster->owner(slot);
+  if (node == Cluster::kSelf || (asking && cluster->importing(slot) != Cluster::kNone)) {
+    return true;
+  }
+  if (node == Cluster::kNone) {
+    resp::append_error_code(out, "CLUSTERDOWN", "Hash slot not served");
+    return false;
+  }
+  resp::append_error_code(out, "MOVED", std::to_string(slot) + " " + cluster->address(node));
+  return false;
+}
+
+bool Reactor::migration_allows(resp::Args args, std::string& out) {
+  std::size_t first = 0;
+  std::size_t last = 0;
+  std::size_t step = 1;
+  if (cluster == nullptr || !commands::Dispatcher::key_range(args, first, last, step)) {
+    return true;
+  }
+  const std::uint16_t slot = db::key_slot(args[first]);
+  const std::uint16_t target = cluster->migrating(slot);
+  if (target == Cluster::kNone) {
+    return true;
+  }
+  // Keys still here are served here; new keys belong to the target already.
+  std::size_t present = 0;
+  std::size_t keys = 0;
+  for (std::size_t i = first; i < last; i += step, ++keys) {
+    if (migrator->in_flight(args[i])) {
+      resp::append_error_code(out, "TRYAGAIN", "Key is being migrated, try again");
+      return false;
+    }
+    present += store.exists(args[i]);
+  }
+  if (present == keys) {
+    return true;
+  }
+  if (present != 0) {
+    resp::append_error_code(out, "TRYAGAIN", "Multiple keys request during rehashing of slot");
+    return false;
+  }
+  resp::append_error_code(out, "ASK", std::to_string(slot) + " " + cluster->address(target));
+  return false;
+}
+
+void Reactor::watch_migrator() {
+  if (cfg.io == IoBackend::Uring) {
+    arm_migrator();
+  } else if (!epoll.add(migrator->fd(), EPOLLIN)) {
+    util::die_errno("epoll add migration socket");
+  }
+}
+
+void Reactor::close_connection(int fd) {
+  auto it = conns.find(fd);
+  if (it != conns.end() && peers.erase(fd) > 0) {
+    replication->remove_replica(shard, it->second->id());
+  }
+  if (cfg.io == IoBackend::Uring) {
+    // The ring holds its own reference to the socket while a multishot recv
+    // is armed; shutdown ends that recv so the socket is really released.
+    ::shutdown(fd, SHUT_RDWR);
+  } else {
+    epoll.del(fd);
+  }
+  conns.erase(fd);
+  ThreadMetrics::set(stats->connected_clients, conns.size());
+}
+
+}  // namespace server
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "../commands/dispatcher.hpp"
+#include "../db/store.hpp"
+#include "../net/connection.hpp"
+#include "../net/epoll.hpp"
+#include "../net/timer.hpp"
+#include "../net/uring.hpp"
+#include "../persist/aof.hpp"
+#include "../persist/snapshot.hpp"
+#include "../util/epoch.hpp"
+#include "cluster.hpp"
+#include "config.hpp"
+#include "io_threads.hpp"
+#include "mailbox.hpp"
+#include "metrics.hpp"
+#include "replication.hpp"
+
+namespace server {
+
+// Process-wide objects every reactor uses; null when the feature is off.
+struct Shared {
+  Mailbox* mailbox{nullptr};
+  persist::Aof* aof{nullptr};
+  persist::Snapshotter* snapshots{nullptr};
+  Metrics* metrics{nullptr};
+  Replication* replication{nullptr};
+  Cluster* cluster{nullptr};
+  // --lockfree-reads: each shard's store once loaded, for the others to
+  // peek at, and the epoch domain that keeps retired tables alive.
+  std::atomic<const db::Store*>* stores{nullptr};
+  util::EpochDomain* epochs{nullptr};
+};
+
+// One event loop with its own listener, connections and store shard. With a
+// mailbox, commands for keys owned by another shard are forwarded to it and
+// the reply is spliced back into the client's stream in order. With I/O
+// threads, the readable connections of an iteration are received from and
+// parsed in parallel, their commands then run here in order, and the
+// iteration's replies are sent in parallel again.
+class Reactor {
+ public:
+  // The shard's keys are loaded from the aof (or, without one, the snapshot)
+  // before clients are accepted.
+  Reactor(const Config& cfg, unsigned shard, const Shared& shared);
+  ~Reactor();
+
+  Reactor(const Reactor&) = delete;
+  Reactor& operator=(const Reactor&) = delete;
+
+  [[noreturn]] void run();
+
+ private:
+  [[noreturn]] void run_epoll();
+  int wait_timeout() const;
+  // Parks for a snapshot if asked to, starts logging writes once replicas
+  // need them and refreshes the store's clock.
+  void begin_iteration();
+  void on_cron();
+  // Refreshes this thread's gauges; shard 0 also rewrites the metrics file.
+  void publish_metrics();
+  // Converts the SLOWLOG and STALLLOG thresholds to TSC ticks.
+  void update_thresholds();
+  void end_iteration();
+  // Records the iteration that began at woke (a TSC reading) and logs it to
+  // STALLLOG if it ran over --loop-stall-us.
+  void finish_iteration(std::uint64_t woke, std::uint64_t events);
+  void add_connection(int fd);
+  void accept_clients();
+  void handle_io(int fd, uint32_t ev);
+  // I/O threads: handle_io without the read, which is queued for
+  // read_queued() once the iteration's events are handled.
+  void queue_io(int fd, uint32_t ev);
+  void read_queued();
+  void route(net::Connection& conn, resp::Args args, std::string& out, resp::Splices* splices);
+  void forward(net::Connection& conn, unsigned owner, resp::Args args);
+  void post(unsigned to, Message& msg);
+  void drain_mailbox();
+  void flush_outbox();
+  void deliver_reply(Message& msg);
+  void close_connection(int fd);
+  void queue_flush(net::Connection& conn);
+  void flush_replies();
+  void flush_replies_uring();
+  void flush_replies_threaded();
+  void update_interest(net::Connection& conn);
+
+  // Primary side of replication: handles a replica's PSYNC or REPLCONF,
+  // starts queued full resyncs once the snapshotter is free, moves replicas
+  // online when their snapshot is sent, and feeds online ones the stream.
+  void on_repl_request(net::Connection& conn, std::string& out);
+  void start_syncs();
+  void check_transfer();
+  void feed_replicas();
+  // Replica side: watches a new socket to the primary for readability.
+  void watch_link();
+
+  // Cluster mode. cluster_allows answers a keyed command for a slot this
+  // node does not serve with -MOVED (-ASK after ASKING is honoured by
+  // serving it) or -CROSSSLOT; migration_allows, run by the shard owning
+  // the keys, answers -ASK for keys already moved out of a migrating slot
+  // and -TRYAGAIN for keys on their way. Both return false once answered.
+  bool cluster_allows(bool asking, resp::Args args, std::size_t first, std::size_t last, std::size_t step,
+                      std::string& out);
+  bool migration_allows(resp::Args args, std::string& out);
+  // Answers a read of another shard's keys from its store directly, when
+  // nothing conn sent earlier is still waiting on a shard.
+  bool peek_owner(net::Connection& conn, unsigned owner, resp::Args args, std::size_t first, std::string& out);
+  // Watches a new socket to a migration target for readability.
+  void watch_migrator();
+
+  // io_uring backend (reactor_uring.cpp).
+  void start_uring();
+  [[noreturn]] void run_uring();
+  io_uring_sqe* next_sqe();
+  void arm_accept();
+  void arm_poll(int fd, std::uint64_t tag);
+  void arm_recv(const net::Connection& conn);
+  void arm_link();
+  void arm_migrator();
+  void handle_completion(const io_uring_cqe& cqe);
+  void on_recv(const io_uring_cqe& cqe);
+  void on_send(const io_uring_cqe& cqe, bool poll);
+  void queue_sends();
+  void load_aof();
+  void load_snapshot();
+  bool owns(std::string_view key) const;
+
+  const Config& cfg;
+  unsigned shard;
+  Mailbox* mailbox;
+  persist::Aof* aof;
+  persist::Snapshotter* snapshots;
+  Metrics* metrics;
+  Replication* replication;
+  Cluster* cluster;
+  std::atomic<const db::Store*>* stores;
+  ThreadMetrics* stats;  // this thread's block of metrics
+  RateSampler ops_rate;
+  util::TimePoint metrics_written{};
+  // STALLLOG threshold in TSC ticks. Like the SLOWLOG one it is set from
+  // cron, once the TSC rate has been measured over a tick or more.
+  std::uint64_t stall_ticks{UINT64_MAX};
+
+  // What the current iteration has done, for STALLLOG.
+  struct Iteration {
+    std::uint64_t commands{0};
+    // Consecutive commands from one connection (one read's pipeline), and
+    // the largest such run so far.
+    std::uint64_t run_client{0};
+    std::uint64_t run_commands{0};
+    std::uint64_t top_client{0};
+    std::uint64_t top_commands{0};
+    std::uint64_t maintenance_ticks{0};
+  };
+  Iteration iter;
+
+  int listen_fd{-1};
+  net::Epoll epoll;
+  net::Timer cron;
+  db::Store store;
+  commands::Dispatcher dispatcher;
+  std::unordered_map<int, std::unique_ptr<net::Connection>> conns;
+  std::uint64_t next_conn_id{1};
+  std::string log_buf;  // this iteration's writes, committed as one batch
+  bool logging{false};  // whether the dispatcher appends to log_buf
+  bool rehashing{false};
+  bool expiring{false};
+  bool replicas_behind{false};  // a replica was fed a window with more to come
+
+  // Connections with replies to send once the iteration's events are handled.
+  std::vector<int> flush_list;
+  std::unique_ptr<net::Uring> uring;
+  std::unique_ptr<net::BufferRing> recv_bufs;  // io_uring backend only
+  std::vector<net::Connection*> send_batch;
+  // Connections handed to the I/O threads and whether each stays open.
+  std::unique_ptr<IoThreads> io_threads;
+  std::vector<int> read_list;
+  std::vector<net::Connection*> io_batch;
+  std::vector<char> io_ok;
+
+  // Messages that did not fit a peer's queue, kept per destination in order.
+  std::vector<std::deque<Message>> outbox;
+  std::vector<bool> needs_notify;
+  std::vector<std::string_view> forwarded_args;
+
+  // Replicas connected to this reactor, by fd.
+  struct Peer {
+    std::uint64_t conn_id{0};
+    std::uint16_t port{0};
+    bool syncing{false};  // PSYNC seen, not online yet
+    bool online{false};
+    std::uint64_t offset{0};  // next stream byte to send
+  };
+  std::unordered_map<int, Peer> peers;
+  // Replicas waiting for a full resync, oldest first; one is sent at a time.
+  std::deque<int> pending_syncs;
+  int sending_fd{-1};
+  std::uint64_t sending_id{0};
+  // Link to a primary; only a node with a single reactor and no aof has one.
+  std::unique_ptr<ReplicaLink> link;
+  // Moves this shard's migrating slots out; cluster mode only.
+  std::unique_ptr<SlotMigrator> migrator;
+};
+
+}  // namespace server
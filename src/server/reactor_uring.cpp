@@ -0,0 +1,269 @@
+#include "reactor.hpp"
+
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <climits>
+
+#include "../util/error.hpp"
+#include "../util/tsc.hpp"
+
+// io_uring backend: the kernel accepts (multishot), receives into a
+// provided buffer ring (multishot) and sends, so a busy iteration costs one
+// io_uring_enter that both submits its sends and waits for the next batch.
+
+namespace server {
+
+namespace {
+constexpr unsigned kRingEntries = 1024;
+constexpr std::uint16_t kRecvGroup = 0;
+constexpr unsigned kRecvBuffers = 512;
+constexpr unsigned kRecvBufferSize = 8192;
+
+// user_data layout: op in the low byte, then the fd, then the low 32 bits of
+// the connection id so completions for a closed (and reused) fd are dropped.
+// kLink and kMigrate carry their socket's generation above the op instead.
+enum Op : std::uint64_t { kAccept, kCron, kWake, kRecv, kSend, kPollOut, kLink, kMigrate };
+
+std::uint64_t conn_tag(Op op, const net::Connection& conn) {
+  return (conn.id() << 32) | (static_cast<std::uint64_t>(conn.fd()) << 8) | op;
+}
+
+net::Connection* lookup(std::unordered_map<int, std::unique_ptr<net::Connection>>& conns, std::uint64_t tag) {
+  auto it = conns.find(static_cast<int>((tag >> 8) & 0xFFFFFF));
+  if (it == conns.end() || (it->second->id() & 0xFFFFFFFF) != tag >> 32) {
+    return nullptr;
+  }
+  return it->second.get();
+}
+}  // namespace
+
+void Reactor::start_uring() {
+  uring = std::make_unique<net::Uring>(kRingEntries);
+  recv_bufs = std::make_unique<net::BufferRing>(*uring, kRecvGroup, kRecvBuffers, kRecvBufferSize);
+  arm_accept();
+  arm_poll(cron.fd(), kCron);
+  if (mailbox != nullptr) {
+    arm_poll(mailbox->wake_fd(shard), kWake);
+  }
+}
+
+void Reactor::run_uring() {
+  while (true) {
+    // Submits the previous iteration's sends and re-arms in the same call.
+    const int timeout = wait_timeout();
+    const int ret = uring->submit(timeout == 0 ? 0 : 1, timeout);
+    if (ret < 0 && ret != -ETIME && ret != -EBUSY) {
+      errno = -ret;
+      util::die_errno("io_uring_enter");
+    }
+    const std::uint64_t woke = util::tsc();
+    begin_iteration();
+
+    const unsigned events = uring->drain([this](const io_uring_cqe& cqe) { handle_completion(cqe); });
+
+    end_iteration();
+    finish_iteration(woke, events);
+  }
+}
+
+io_uring_sqe* Reactor::next_sqe() {
+  io_uring_sqe* sqe = uring->get_sqe();
+  if (sqe == nullptr) {
+    // Full: hand what is queued to the kernel to make room.
+    const int ret = uring->submit();
+    if (ret < 0) {
+      errno = -ret;
+      util::die_errno("io_uring_enter");
+    }
+    sqe = uring->get_sqe();
+  }
+  return sqe;
+}
+
+void Reactor::arm_accept() {
+  io_uring_sqe* sqe = next_sqe();
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = listen_fd;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_CLOEXEC;
+  sqe->user_data = kAccept;
+}
+
+void Reactor::arm_poll(int fd, std::uint64_t tag) {
+  io_uring_sqe* sqe = next_sqe();
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+  sqe->len = IORING_POLL_ADD_MULTI;
+  sqe->poll32_events = POLLIN;
+  sqe->user_data = tag;
+}
+
+void Reactor::arm_link() {
+  io_uring_sqe* sqe = next_sqe();
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = link->fd();
+  sqe->poll32_events = POLLIN;
+  sqe->user_data = (link->generation() << 8) | kLink;
+}
+
+void Reactor::arm_migrator() {
+  io_uring_sqe* sqe = next_sqe();
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = migrator->fd();
+  sqe->poll32_events = POLLIN;
+  sqe->user_data = (migrator->generation() << 8) | kMigrate;
+}
+
+void Reactor::arm_recv(const net::Connection& conn) {
+  io_uring_sqe* sqe = next_sqe();
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = conn.fd();
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = recv_bufs->group();
+  sqe->user_data = conn_tag(kRecv, conn);
+}
+
+void Reactor::handle_completion(const io_uring_cqe& cqe) {
+  const bool more = (cqe.flags & IORING_CQE_F_MORE) != 0;
+  switch (cqe.user_data & 0xFF) {
+    case kAccept:
+      if (cqe.res >= 0) {
+        add_connection(cqe.res);
+        arm_recv(*conns[cqe.res]);
+      }
+      if (!more) {
+        arm_accept();
+      }
+      break;
+    case kCron:
+      on_cron();
+      if (!more) {
+        arm_poll(cron.fd(), kCron);
+      }
+      break;
+    case kWake:
+      mailbox->drain_wakeups(shard);
+      if (!more) {
+        arm_poll(mailbox->wake_fd(shard), kWake);
+      }
+      break;
+    case kRecv:
+      on_recv(cqe);
+      break;
+    case kSend:
+      on_send(cqe, false);
+      break;
+    case kPollOut:
+      on_send(cqe, true);
+      break;
+    case kLink:
+      // Single shot, re-armed for as long as the same socket is up.
+      if (cqe.user_data >> 8 == link->generation() && link->fd() >= 0) {
+        link->on_readable();
+        if (cqe.user_data >> 8 == link->generation() && link->fd() >= 0) {
+          arm_link();
+        }
+      }
+      break;
+    case kMigrate:
+      if (cqe.user_data >> 8 == migrator->generation() && migrator->fd() >= 0) {
+        migrator->on_readable();
+        if (cqe.user_data >> 8 == migrator->generation() && migrator->fd() >= 0) {
+          arm_migrator();
+        }
+      }
+      break;
+  }
+}
+
+void Reactor::on_recv(const io_uring_cqe& cqe) {
+  net::Connection* conn = lookup(conns, cqe.user_data);
+  bool alive = conn != nullptr && (cqe.res > 0 || cqe.res == -ENOBUFS);
+  if (cqe.flags & IORING_CQE_F_BUFFER) {
+    const auto bid = static_cast<std::uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+    if (alive && cqe.res > 0) {
+      std::string_view data(recv_bufs->data(bid), static_cast<std::size_t>(cqe.res));
+      alive = conn->on_data(data, [&](resp::Args args, std::string& out, resp::Splices* splices) {
+        route(*conn, args, out, splices);
+      });
+    }
+    // Commands were parsed in place and any partial one copied out.
+    recv_bufs->recycle(bid);
+  }
+
+  if (conn == nullptr) {
+    return;  // completion for a connection that is already gone
+  }
+  if (!alive) {
+    close_connection(conn->fd());
+    return;
+  }
+  // Out of buffers (or the kernel stopped the multishot): arm a new one.
+  if (!(cqe.flags & IORING_CQE_F_MORE)) {
+    arm_recv(*conn);
+  }
+  if (conn->wants_write()) {
+    queue_flush(*conn);
+  }
+}
+
+void Reactor::on_send(const io_uring_cqe& cqe, bool poll) {
+  net::Connection* conn = lookup(conns, cqe.user_data);
+  if (conn == nullptr) {
+    return;
+  }
+  conn->set_send_inflight(false);
+  if (!poll) {
+    if (cqe.res == -EAGAIN) {
+      // Socket buffer full: wait for room, then send the rest.
+      io_uring_sqe* sqe = next_sqe();
+      sqe->opcode = IORING_OP_POLL_ADD;
+      sqe->fd = conn->fd();
+      sqe->poll32_events = POLLOUT;
+      sqe->user_data = conn_tag(kPollOut, *conn);
+      conn->set_send_inflight(true);
+      return;
+    }
+    if (cqe.res < 0) {
+      close_connection(conn->fd());
+      return;
+    }
+    conn->advance_output(static_cast<std::size_t>(cqe.res));
+  }
+  if (conn->wants_write()) {
+    queue_flush(*conn);
+  }
+}
+
+void Reactor::queue_sends() {
+  // Prepared here, after the aof batch, and submitted by the next wait. Each
+  // connection has at most one send outstanding, which keeps its replies in
+  // order; MSG_DONTWAIT makes the kernel copy the bytes during submission,
+  // so the write buffer may grow again before the completion is seen.
+  for (int fd : flush_list) {
+    auto it = conns.find(fd);
+    if (it == conns.end()) {
+      continue;
+    }
+    net::Connection& conn = *it->second;
+    conn.set_flush_queued(false);
+    if (conn.send_inflight() || !conn.wants_write()) {
+      continue;  // an outstanding send re-queues the connection when it completes
+    }
+    io_uring_sqe* sqe = next_sqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<std::uint64_t>(conn.pending_output());
+    sqe->len = 1;
+    sqe->msg_flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+    sqe->user_data = conn_tag(kSend, conn);
+    conn.set_send_inflight(true);
+  }
+  flush_list.clear();
+}
+
+}  // namespace server
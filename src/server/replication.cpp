@@ -0,0 +1,500 @@
+#include "replication.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+
+#include "../commands/dispatcher.hpp"
+#include "../net/socket.hpp"
+#include "../persist/snapshot.hpp"
+#include "../protocol/resp.hpp"
+#include "../util/random_id.hpp"
+
+namespace server {
+
+namespace {
+constexpr std::chrono::seconds kRetryInterval{1};
+constexpr std::chrono::seconds kAckInterval{1};
+// A link that is connecting, in the handshake or receiving a snapshot and
+// has read nothing for this long is dropped and retried.
+constexpr std::chrono::seconds kSyncTimeout{60};
+constexpr std::size_t kReadChunk = 64 * 1024;
+constexpr std::size_t kMaxLine = 1024;
+
+std::size_t digits(std::size_t n) {
+  std::size_t d = 1;
+  while (n >= 10) {
+    n /= 10;
+    ++d;
+  }
+  return d;
+}
+
+// Bytes args take on the wire as resp::append_command writes them, which is
+// how the primary encodes the stream.
+std::size_t encoded_size(resp::Args args) {
+  std::size_t n = 3 + digits(args.size());
+  for (std::string_view arg : args) {
+    n += 5 + digits(arg.size()) + arg.size();
+  }
+  return n;
+}
+
+bool parse_u64(std::string_view s, std::uint64_t& out) {
+  auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), out);
+  return ec == std::errc() && ptr == s.data() + s.size();
+}
+
+const char* state_name(Replication::PeerState s) {
+  switch (s) {
+    case Replication::PeerState::WaitSnapshot:
+      return "wait_bgsave";
+    case Replication::PeerState::Sending:
+      return "send_bulk";
+    case Replication::PeerState::Online:
+      break;
+  }
+  return "online";
+}
+
+void append_field(std::string& out, std::string_view name, std::string_view value) {
+  out.append(name).push_back(':');
+  out.append(value).append("\r\n");
+}
+
+void append_field(std::string& out, std::string_view name, std::uint64_t value) {
+  append_field(out, name, std::to_string(value));
+}
+}  // namespace
+
+Replication::Replication(std::size_t backlog_size, unsigned shards, std::function<void(unsigned)> wake)
+    : id(util::random_hex_id()), wake(std::move(wake)), backlog(backlog_size, '\0'), online(shards, 0) {}
+
+void Replication::append(unsigned shard, std::string_view batch) {
+  std::vector<unsigned> to_wake;
+  {
+    std::lock_guard<std::mutex> lock(mu);
+    const std::uint64_t at = end.load(std::memory_order_relaxed);
+    const std::size_t size = backlog.size();
+    // Only the last size bytes of a huge batch can stay.
+    std::string_view tail = batch.size() > size ? batch.substr(batch.size() - size) : batch;
+    std::size_t pos = static_cast<std::size_t>((at + batch.size() - tail.size()) % size);
+    while (!tail.empty()) {
+      const std::size_t n = std::min(tail.size(), size - pos);
+      std::memcpy(backlog.data() + pos, tail.data(), n);
+      tail.remove_prefix(n);
+      pos = 0;
+    }
+    end.store(at + batch.size(), std::memory_order_release);
+    for (unsigned s = 0; s < online.size(); ++s) {
+      if (s != shard && online[s] > 0) {
+        to_wake.push_back(s);
+      }
+    }
+  }
+  for (unsigned s : to_wake) {
+    wake(s);
+  }
+}
+
+bool Replication::can_continue(std::string_view replid, std::uint64_t from) const {
+  const std::uint64_t at = offset();
+  return active() && replid == id && from <= at && at - from <= backlog.size();
+}
+
+bool Replication::read(std::uint64_t from, std::size_t max, std::string& out) const {
+  std::lock_guard<std::mutex> lock(mu);
+  const std::uint64_t at = end.load(std::memory_order_relaxed);
+  const std::size_t size = backlog.size();
+  if (from > at || at - from > size) {
+    return false;
+  }
+  std::size_t left = static_cast<std::size_t>(std::min<std::uint64_t>(at - from, max));
+  std::size_t pos = static_cast<std::size_t>(from % size);
+  while (left > 0) {
+    const std::size_t n = std::min(left, size - pos);
+    out.append(backlog.data() + pos, n);
+    left -= n;
+    pos = 0;
+  }
+  return true;
+}
+
+Replication::Peer* Replication::find(unsigned shard, std::uint64_t conn_id) {
+  for (Peer& p : peers) {
+    if (p.shard == shard && p.conn_id == conn_id) {
+      return &p;
+    }
+  }
+  return nullptr;
+}
+
+void Replication::set_replica(unsigned shard, std::uint64_t conn_id, std::uint16_t port, PeerState state) {
+  std::lock_guard<std::mutex> lock(mu);
+  Peer* p = find(shard, conn_id);
+  if (p == nullptr) {
+    p = &peers.emplace_back(Peer{shard, conn_id, port, state, 0, util::now()});
+  } else if (p->state == PeerState::Online) {
+    --online[shard];
+  }
+  p->port = port;
+  p->state = state;
+  if (state == PeerState::Online) {
+    ++online[shard];
+  }
+}
+
+void Replication::ack(unsigned shard, std::uint64_t conn_id, std::uint64_t offset) {
+  std::lock_guard<std::mutex> lock(mu);
+  if (Peer* p = find(shard, conn_id)) {
+    p->ack = offset;
+    p->ack_time = util::now();
+  }
+}
+
+void Replication::remove_replica(unsigned shard, std::uint64_t conn_id) {
+  std::lock_guard<std::mutex> lock(mu);
+  Peer* p = find(shard, conn_id);
+  if (p == nullptr) {
+    return;
+  }
+  if (p->state == PeerState::Online) {
+    --online[shard];
+  }
+  *p = peers.back();
+  peers.pop_back();
+}
+
+void Replication::info(std::string& out) const {
+  out.append("# Replication\r\n");
+  const util::TimePoint now = util::now();
+  if (link != nullptr && link->following()) {
+    append_field(out, "role", "slave");
+    append_field(out, "master_host", link->primary_host());
+    append_field(out, "master_port", link->primary_port());
+    append_field(out, "master_link_status", link->up() ? "up" : "down");
+    append_field(out, "master_last_io_seconds_ago",
+                 static_cast<std::uint64_t>(
+                     std::chrono::duration_cast<std::chrono::seconds>(now - link->last_io()).count()));
+    append_field(out, "master_sync_in_progress", std::uint64_t{link->syncing()});
+    append_field(out, "slave_repl_offset", link->applied_offset());
+    append_field(out, "master_replid", link->primary_replid());
+    out.append("\r\n");
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mu);
+  const std::uint64_t at = end.load(std::memory_order_relaxed);
+  const std::uint64_t histlen = std::min<std::uint64_t>(at, backlog.size());
+  append_field(out, "role", "master");
+  append_field(out, "connected_slaves", peers.size());
+  for (std::size_t i = 0; i < peers.size(); ++i) {
+    const Peer& p = peers[i];
+    const auto lag = std::chrono::duration_cast<std::chrono::seconds>(now - p.ack_time).count();
+    append_field(out, "slave" + std::to_string(i),
+                 "shard=" + std::to_string(p.shard) + ",port=" + std::to_string(p.port) +
+                     ",state=" + state_name(p.state) + ",offset=" + std::to_string(p.ack) +
+                     ",lag=" + std::to_string(lag));
+  }
+  append_field(out, "master_replid", id);
+  append_field(out, "master_repl_offset", at);
+  append_field(out, "repl_backlog_active", std::uint64_t{active()});
+  append_field(out, "repl_backlog_size", backlog.size());
+  append_field(out, "repl_backlog_first_byte_offset", at - histlen);
+  append_field(out, "repl_backlog_histlen", histlen);
+  out.append("\r\n");
+}
+
+ReplicaLink::ReplicaLink(const Config& cfg, db::Store& store, commands::Dispatcher& dispatcher)
+    : cfg(cfg), store(store), dispatcher(dispatcher) {}
+
+ReplicaLink::~ReplicaLink() {
+  drop({});
+}
+
+void ReplicaLink::follow(std::string_view new_host, std::uint16_t new_port) {
+  drop({});
+  host.assign(new_host);
+  port = new_port;
+  // Another primary's history has nothing to continue from.
+  primary_id.clear();
+  applied = 0;
+  last_attempt = {};
+}
+
+void ReplicaLink::stop() {
+  drop({});
+  host.clear();
+  port = 0;
+}
+
+bool ReplicaLink::cron() {
+  if (!following()) {
+    return false;
+  }
+  const util::TimePoint now = util::now();
+  switch (state) {
+    case State::Idle:
+      if (now - last_attempt < kRetryInterval) {
+        return false;
+      }
+      last_attempt = now;
+      return connect();
+    case State::Connecting:
+      finish_connect();
+      break;
+    case State::Online:
+      if (now - last_ack >= kAckInterval) {
+        last_ack = now;
+        std::string ack;
+        const std::string offset = std::to_string(applied);
+        const std::array<std::string_view, 3> args{"REPLCONF", "ACK", offset};
+        resp::append_command(ack, args);
+        // Best effort: a full socket just skips this acknowledgement.
+        ::send(sock, ack.data(), ack.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+      }
+      break;
+    case State::Handshake:
+    case State::Transfer:
+      break;
+  }
+  if (state != State::Idle && state != State::Online && now - last_read > kSyncTimeout) {
+    drop("timed out waiting for the primary");
+  }
+  return false;
+}
+
+bool ReplicaLink::connect() {
+  sock = net::connect_nonblocking(host, port);
+  if (sock < 0) {
+    drop(std::strerror(errno));
+    return false;
+  }
+  ++gen;
+  state = State::Connecting;
+  last_read = util::now();
+  finish_connect();
+  return sock >= 0;
+}
+
+void ReplicaLink::finish_connect() {
+  const int rc = net::connect_result(sock);
+  if (rc == 0) {
+    return;  // still connecting
+  }
+  if (rc < 0) {
+    drop(std::strerror(errno));
+    return;
+  }
+  if (!send_handshake()) {
+    drop("handshake failed");
+    return;
+  }
+  state = State::Handshake;
+}
+
+bool ReplicaLink::send_handshake() {
+  std::string out;
+  const std::string listening = std::to_string(cfg.port);
+  const std::array<std::string_view, 3> replconf{"REPLCONF", "listening-port", listening};
+  resp::append_command(out, replconf);
+  const std::string offset = primary_id.empty() ? "-1" : std::to_string(applied);
+  const std::string_view id = primary_id.empty() ? std::string_view("?") : std::string_view(primary_id);
+  const std::array<std::string_view, 3> psync{"PSYNC", id, offset};
+  resp::append_command(out, psync);
+  // A fresh socket has room for a few dozen bytes.
+  return ::send(sock, out.data(), out.size(), MSG_NOSIGNAL | MSG_DONTWAIT) == static_cast<ssize_t>(out.size());
+}
+
+void ReplicaLink::on_readable() {
+  if (state == State::Connecting) {
+    finish_connect();
+  }
+  char chunk[kReadChunk];
+  while (sock >= 0 && state != State::Connecting) {
+    const ssize_t n = ::recv(sock, chunk, sizeof(chunk), 0);
+    if (n > 0) {
+      last_read = util::now();
+      if (!consume(std::string_view(chunk, static_cast<std::size_t>(n)))) {
+        drop("bad data from the primary");
+      }
+      continue;
+    }
+    if (n == 0) {
+      drop("primary closed the connection");
+    } else if (errno == EINTR) {
+      continue;
+    } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+      drop(std::strerror(errno));
+    }
+    return;
+  }
+}
+
+bool ReplicaLink::consume(std::string_view data) {
+  while (!data.empty()) {
+    if (state == State::Online) {
+      return stream(data);
+    }
+    if (file >= 0) {
+      const std::size_t n = std::min(data.size(), bulk_left);
+      if (::write(file, data.data(), n) != static_cast<ssize_t>(n)) {
+        return false;
+      }
+      data.remove_prefix(n);
+      bulk_left -= n;
+      if (bulk_left == 0 && !load_snapshot()) {
+        return false;
+      }
+      continue;
+    }
+    // Handshake replies and the snapshot's bulk header are single lines.
+    const std::size_t nl = data.find('\n');
+    line.append(data.substr(0, nl == std::string_view::npos ? data.size() : nl + 1));
+    if (line.size() > kMaxLine) {
+      return false;
+    }
+    if (nl == std::string_view::npos) {
+      return true;
+    }
+    data.remove_prefix(nl + 1);
+    std::string_view l(line);
+    l.remove_suffix(l.size() >= 2 && l[l.size() - 2] == '\r' ? 2 : 1);
+    const bool ok = on_line(l);
+    line.clear();
+    if (!ok) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ReplicaLink::on_line(std::string_view l) {
+  if (l.empty()) {
+    return true;  // keepalive
+  }
+  if (l[0] == '-') {
+    std::fprintf(stderr, "replication: primary replied %.*s\n", static_cast<int>(l.size()), l.data());
+    return false;
+  }
+  if (state == State::Transfer) {
+    std::uint64_t len = 0;
+    if (l[0] != '$' || !parse_u64(l.substr(1), len)) {
+      return false;
+    }
+    const std::string tmp = cfg.snapshot_path + ".sync";
+    file = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (file < 0) {
+      return false;
+    }
+    bulk_left = static_cast<std::size_t>(len);
+    return bulk_left > 0 || load_snapshot();
+  }
+  if (l == "+OK") {
+    return true;  // REPLCONF
+  }
+  if (l.starts_with("+FULLRESYNC ")) {
+    l.remove_prefix(12);
+    const std::size_t space = l.find(' ');
+    if (space == std::string_view::npos || !parse_u64(l.substr(space + 1), sync_offset)) {
+      return false;
+    }
+    sync_id.assign(l.substr(0, space));
+    state = State::Transfer;
+    return true;
+  }
+  if (l.starts_with("+CONTINUE")) {
+    std::fprintf(stderr, "replication: continuing from offset %llu\n", static_cast<unsigned long long>(applied));
+    state = State::Online;
+    return true;
+  }
+  return false;
+}
+
+bool ReplicaLink::load_snapshot() {
+  const bool written = ::close(file) == 0;
+  file = -1;
+  const std::string tmp = cfg.snapshot_path + ".sync";
+  if (!written) {
+    return false;
+  }
+  const util::TimePoint start = util::now();
+  store.clear();
+  // Load before the rename so a bad transfer never replaces the last good
+  // snapshot on disk. What was loaded up to the damage is thrown away, and
+  // forgetting the primary's history makes the next handshake a full resync.
+  if (persist::Snapshotter::load(tmp, store, 1, [](std::string_view) { return true; }) !=
+          persist::Snapshotter::LoadResult::Loaded ||
+      ::rename(tmp.c_str(), cfg.snapshot_path.c_str()) != 0) {
+    ::unlink(tmp.c_str());
+    store.clear();
+    primary_id.clear();
+    applied = 0;
+    return false;
+  }
+  primary_id = sync_id;
+  applied = sync_offset;
+  state = State::Online;
+  const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(util::now() - start).count();
+  std::fprintf(stderr, "replication: full resync, loaded %zu keys in %lld ms at offset %llu\n", store.size(),
+               static_cast<long long>(ms), static_cast<unsigned long long>(applied));
+  return true;
+}
+
+bool ReplicaLink::stream(std::string_view data) {
+  // Big bulks are received into the parser as on client connections.
+  if (parser.big_arg_pending()) {
+    data.remove_prefix(parser.feed_big_arg(data));
+    if (parser.big_arg_pending()) {
+      return true;
+    }
+  }
+  in.append(data);
+  std::size_t used = 0;
+  while (parser.parse(std::string_view(in).substr(used))) {
+    const resp::Args args(parser.argv().data(), parser.argv().size());
+    dispatcher.apply(args);
+    applied += encoded_size(args);
+    used += parser.consumed_bytes();
+  }
+  if (parser.error()) {
+    return false;
+  }
+  in.erase(0, used);
+  if (parser.big_arg_pending()) {
+    in.resize(parser.frame_bytes());  // the rest is in the bulk
+  }
+  return true;
+}
+
+void ReplicaLink::drop(std::string_view reason) {
+  if (!reason.empty()) {
+    std::fprintf(stderr, "replication: link to %s:%u down: %.*s\n", host.c_str(), static_cast<unsigned>(port),
+                 static_cast<int>(reason.size()), reason.data());
+  }
+  if (sock >= 0) {
+    // Ends an io_uring poll that holds its own reference to the socket.
+    ::shutdown(sock, SHUT_RDWR);
+    ::close(sock);
+    sock = -1;
+  }
+  if (file >= 0) {
+    ::close(file);
+    file = -1;
+  }
+  state = State::Idle;
+  bulk_left = 0;
+  line.clear();
+  in.clear();
+  parser.reset();
+  last_attempt = util::now();
+}
+
+}  // namespace server
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../db/store.hpp"
+#include "../protocol/resp_parser.hpp"
+#include "../util/time.hpp"
+#include "config.hpp"
+
+namespace commands {
+class Dispatcher;
+}
+
+namespace server {
+
+class ReplicaLink;
+
+// Primary side of replication, shared by every reactor. The mutations a
+// reactor logs in one loop iteration are appended as a batch (the same one
+// that goes to the aof) to the replication stream, whose offset counts every
+// byte ever appended; the last backlog_size bytes stay in a circular backlog.
+// A key is owned by one reactor, so interleaved batches keep every key's
+// history in order.
+//
+// A replica asks for the stream with PSYNC <replid> <offset>, offset being
+// how much of it the replica has applied. If replid is ours and the offset
+// is still in the backlog it gets +CONTINUE and the stream from there;
+// otherwise +FULLRESYNC <replid> <offset> and a snapshot taken at that
+// offset, then the stream from it.
+class Replication {
+ public:
+  // wake interrupts another shard's wait so it feeds the replicas it serves.
+  Replication(std::size_t backlog_size, unsigned shards, std::function<void(unsigned)> wake);
+
+  Replication(const Replication&) = delete;
+  Replication& operator=(const Replication&) = delete;
+
+  const std::string& replid() const { return id; }
+
+  // Reactors log writes for replicas only once the first replica has asked
+  // to sync; each checks at the top of its loop iterations.
+  bool active() const { return logging.load(std::memory_order_acquire); }
+  void activate() { logging.store(true, std::memory_order_release); }
+
+  // Appends a reactor's batch and wakes the other shards serving replicas.
+  void append(unsigned shard, std::string_view batch);
+  // End of the stream: every byte appended so far.
+  std::uint64_t offset() const { return end.load(std::memory_order_acquire); }
+  // Whether a replica of history replid that has applied the stream up to
+  // from can resume from the backlog.
+  bool can_continue(std::string_view replid, std::uint64_t from) const;
+  // Appends up to max bytes of the stream starting at from to out. Returns
+  // false if from is no longer in the backlog.
+  bool read(std::uint64_t from, std::size_t max, std::string& out) const;
+
+  // Replicas as INFO lists them, kept current by the reactor serving each.
+  enum class PeerState { WaitSnapshot, Sending, Online };
+  void set_replica(unsigned shard, std::uint64_t conn_id, std::uint16_t port, PeerState state);
+  void ack(unsigned shard, std::uint64_t conn_id, std::uint64_t offset);
+  void remove_replica(unsigned shard, std::uint64_t conn_id);
+
+  // This node's own link to a primary, owned by its only reactor.
+  void attach_link(const ReplicaLink* l) { link = l; }
+  // The INFO replication section.
+  void info(std::string& out) const;
+
+ private:
+  struct Peer {
+    unsigned shard;
+    std::uint64_t conn_id;
+    std::uint16_t port;
+    PeerState state;
+    std::uint64_t ack;
+    util::TimePoint ack_time;
+  };
+  Peer* find(unsigned shard, std::uint64_t conn_id);
+
+  std::string id;
+  std::function<void(unsigned)> wake;
+  std::atomic<bool> logging{false};
+
+  mutable std::mutex mu;
+  std::string backlog;  // circular; stream byte i lives at i % size
+  std::atomic<std::uint64_t> end{0};
+  std::vector<Peer> peers;
+  std::vector<unsigned> online;  // online replicas per shard
+  const ReplicaLink* link{nullptr};
+};
+
+// Replica side: the connection to the primary, driven by the node's only
+// reactor. Handshake replies and the snapshot of a full resync are read as
+// they arrive; the stream's commands are applied through the dispatcher
+// and counted towards the offset that is acknowledged to the primary and
+// asked for on reconnect.
+class ReplicaLink {
+ public:
+  ReplicaLink(const Config& cfg, db::Store& store, commands::Dispatcher& dispatcher);
+  ~ReplicaLink();
+
+  ReplicaLink(const ReplicaLink&) = delete;
+  ReplicaLink& operator=(const ReplicaLink&) = delete;
+
+  // REPLICAOF host port: drops any current link and full-resyncs from the
+  // new primary. The connection is made from cron().
+  void follow(std::string_view host, std::uint16_t port);
+  // REPLICAOF NO ONE: drops the link and keeps the data, writable again.
+  void stop();
+  bool following() const { return !host.empty(); }
+
+  // Called every cron tick: connects (at most once a second while down),
+  // sends the handshake once connected, and acknowledges the applied offset
+  // every second. Returns true when fd() is a new socket for the reactor to
+  // watch for readability.
+  bool cron();
+  void on_readable();
+
+  int fd() const { return sock; }
+  // Bumped for every socket, so completions for an old one can be told apart.
+  std::uint64_t generation() const { return gen; }
+
+  // For INFO.
+  std::string_view primary_host() const { return host; }
+  std::uint16_t primary_port() const { return port; }
+  const std::string& primary_replid() const { return primary_id; }
+  std::uint64_t applied_offset() const { return applied; }
+  bool up() const { return state == State::Online; }
+  bool syncing() const { return state == State::Transfer; }
+  util::TimePoint last_io() const { return last_read; }
+
+ private:
+  enum class State { Idle, Connecting, Handshake, Transfer, Online };
+
+  bool connect();
+  void finish_connect();
+  bool send_handshake();
+  // Handles received bytes according to state; false drops the link.
+  bool consume(std::string_view data);
+  bool on_line(std::string_view line);
+  bool load_snapshot();
+  bool stream(std::string_view data);
+  void drop(std::string_view reason);
+
+  const Config& cfg;
+  db::Store& store;
+  commands::Dispatcher& dispatcher;
+
+  std::string host;
+  std::uint16_t port{0};
+  State state{State::Idle};
+  int sock{-1};
+  std::uint64_t gen{0};
+  util::TimePoint last_attempt{};
+  util::TimePoint last_read{};
+  util::TimePoint last_ack{};
+
+  // History and offset applied so far; what PSYNC asks to continue.
+  std::string primary_id;
+  std::uint64_t applied{0};
+  // A full resync in progress: where its snapshot goes and what it is worth.
+  std::string sync_id;
+  std::uint64_t sync_offset{0};
+  int file{-1};
+  std::size_t bulk_left{0};
+
+  std::string line;  // partial handshake or bulk header line
+  std::string in;    // partial command of the stream
+  resp::RespParser parser;
+};
+
+}  // namespace server
@@ -0,0 +1,25 @@
+#include "slowlog.hpp"
+
+namespace server {
+
+std::vector<std::string> SlowEntry::truncate(resp::Args args) {
+  std::vector<std::string> out;
+  const std::size_t kept = args.size() > kMaxArgs ? kMaxArgs - 1 : args.size();
+  out.reserve(kept + 1);
+  for (std::size_t i = 0; i < kept; ++i) {
+    const std::string_view arg = args[i];
+    if (arg.size() <= kMaxArgBytes) {
+      out.emplace_back(arg);
+      continue;
+    }
+    std::string s(arg.substr(0, kMaxArgBytes));
+    s.append("... (").append(std::to_string(arg.size() - kMaxArgBytes)).append(" more bytes)");
+    out.push_back(std::move(s));
+  }
+  if (kept < args.size()) {
+    out.push_back("... (" + std::to_string(args.size() - kept) + " more arguments)");
+  }
+  return out;
+}
+
+}  // namespace server
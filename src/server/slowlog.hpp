@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "../protocol/resp.hpp"
+
+namespace server {
+
+// A command that ran longer than --slowlog-log-slower-than.
+struct SlowEntry {
+  std::uint64_t id{0};
+  std::int64_t unix_secs{0};
+  std::uint64_t usec{0};
+  // Truncated as Redis does: at most kMaxArgs arguments of kMaxArgBytes.
+  std::vector<std::string> args;
+  // The client that sent it: the reactor that owns its connection and the
+  // connection's id there (forwarded commands run on another shard).
+  unsigned client_shard{0};
+  std::uint64_t client_id{0};
+
+  static constexpr std::size_t kMaxArgs = 32;
+  static constexpr std::size_t kMaxArgBytes = 128;
+  static std::vector<std::string> truncate(resp::Args args);
+};
+
+// An event-loop iteration that ran longer than --loop-stall-us, with what
+// it spent the time on.
+struct StallEntry {
+  std::uint64_t id{0};
+  std::int64_t unix_secs{0};
+  std::uint64_t usec{0};
+  unsigned shard{0};
+  std::uint64_t events{0};    // readiness events or completions handled
+  std::uint64_t commands{0};  // commands run, including forwarded ones
+  // The connection that sent the most of them, and how many.
+  std::uint64_t client_id{0};
+  std::uint64_t client_commands{0};
+  // The longest single command.
+  std::string_view slowest;  // command name, from the dispatcher's table
+  std::uint64_t slowest_usec{0};
+  // Incremental rehashing and active expiry at the end of the iteration.
+  std::uint64_t maintenance_usec{0};
+};
+
+// Bounded, newest-first log shared by every reactor. Entries are rare by
+// construction, so adding one takes a mutex rather than per-thread rings.
+template <typename Entry>
+class EventLog {
+ public:
+  explicit EventLog(std::size_t max_len) : max_len(max_len) {}
+
+  // Assigns e the next id and drops the oldest entry past max_len.
+  void add(Entry e) {
+    std::lock_guard<std::mutex> lock(mu);
+    e.id = next_id++;
+    if (max_len == 0) {
+      return;
+    }
+    entries.push_front(std::move(e));
+    if (entries.size() > max_len) {
+      entries.pop_back();
+    }
+  }
+  // Up to n of the newest entries, newest first.
+  std::vector<Entry> latest(std::size_t n) const {
+    std::lock_guard<std::mutex> lock(mu);
+    const std::size_t count = n < entries.size() ? n : entries.size();
+    return std::vector<Entry>(entries.begin(), entries.begin() + static_cast<std::ptrdiff_t>(count));
+  }
+  std::size_t size() const {
+    std::lock_guard<std::mutex> lock(mu);
+    return entries.size();
+  }
+  void reset() {
+    std::lock_guard<std::mutex> lock(mu);
+    entries.clear();
+  }
+
+ private:
+  mutable std::mutex mu;
+  std::deque<Entry> entries;
+  std::size_t max_len;
+  std::uint64_t next_id{0};
+};
+
+using SlowLog = EventLog<SlowEntry>;
+using StallLog = EventLog<StallEntry>;
+
+}  // namespace server
@@ -0,0 +1,26 @@
+#pragma once
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+#include "error.hpp"
+
+namespace util {
+
+// Pins the calling thread to a single cpu.
+inline void pin_cpu_or_die(int cpu) {
+#if defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(static_cast<std::size_t>(cpu), &set);
+  if (::sched_setaffinity(0, sizeof(set), &set) != 0) {
+    die_errno("sched_setaffinity");
+  }
+#else
+  (void)cpu;
+  die("CPU pinning is only supported on Linux");
+#endif
+}
+
+}  // namespace util
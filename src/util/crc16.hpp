@@ -0,0 +1,36 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+
+namespace util {
+
+namespace detail {
+constexpr std::array<std::uint16_t, 256> make_crc16_table() {
+  std::array<std::uint16_t, 256> table{};
+  for (unsigned i = 0; i < 256; ++i) {
+    auto crc = static_cast<std::uint16_t>(i << 8);
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = static_cast<std::uint16_t>((crc & 0x8000) != 0 ? (crc << 1) ^ 0x1021 : crc << 1);
+    }
+    table[i] = crc;
+  }
+  return table;
+}
+inline constexpr std::array<std::uint16_t, 256> kCrc16Table = make_crc16_table();
+}  // namespace detail
+
+// CRC-16/XMODEM (polynomial 0x1021, no reflection, zero initial value), the
+// checksum Redis Cluster derives key slots from. A byte per table lookup.
+constexpr std::uint16_t crc16(std::string_view data) {
+  std::uint16_t crc = 0;
+  for (char c : data) {
+    crc = static_cast<std::uint16_t>((crc << 8) ^ detail::kCrc16Table[((crc >> 8) ^ static_cast<unsigned char>(c)) & 0xFF]);
+  }
+  return crc;
+}
+
+static_assert(crc16("123456789") == 0x31C3);
+
+}  // namespace util
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace util {
+
+// Epoch-based reclamation for memory that threads read without locks while
+// its owner may replace it. A reader pins the global epoch for the length of
+// one read; the owner unlinks memory, retires it at the epoch of the unlink
+// and frees it in collect() once every thread is unpinned or pinned at a
+// later epoch, so no reader can still be looking at it. Each thread owns one
+// cache-line aligned slot: its pin and its own retired list.
+class EpochDomain {
+ public:
+  explicit EpochDomain(unsigned threads) : slots(std::make_unique<Slot[]>(threads)), count(threads) {}
+  ~EpochDomain() {
+    for (unsigned t = 0; t < count; ++t) {
+      for (const Retired& r : slots[t].retired) {
+        r.free(r.ptr);
+      }
+    }
+  }
+
+  EpochDomain(const EpochDomain&) = delete;
+  EpochDomain& operator=(const EpochDomain&) = delete;
+
+  // Pins thread's slot until destroyed; pointers loaded meanwhile stay valid.
+  class Guard {
+   public:
+    explicit Guard(std::atomic<std::uint64_t>& pin) : pin(pin) {}
+    ~Guard() { pin.store(kIdle, std::memory_order_release); }
+    Guard(const Guard&) = delete;
+    Guard& operator=(const Guard&) = delete;
+
+   private:
+    std::atomic<std::uint64_t>& pin;
+  };
+  // Sequentially consistent, so an owner that still sees the slot unpinned
+  // has unlinked before anything this read loads.
+  Guard pin(unsigned thread) {
+    slots[thread].pin.store(epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+    return Guard(slots[thread].pin);
+  }
+
+  // Hands ptr, already unlinked by thread, to free(ptr) once no reader can
+  // hold it. Only thread may retire into or collect its slot.
+  void retire(unsigned thread, void* ptr, void (*free)(void*)) {
+    const std::uint64_t at = epoch.fetch_add(1, std::memory_order_seq_cst);
+    slots[thread].retired.push_back(Retired{ptr, free, at});
+  }
+  // Frees what thread retired that every reader has moved past. Returns
+  // whether anything is still waiting.
+  bool collect(unsigned thread) {
+    std::vector<Retired>& retired = slots[thread].retired;
+    if (retired.empty()) {
+      return false;
+    }
+    std::uint64_t oldest = kIdle;
+    for (unsigned t = 0; t < count; ++t) {
+      oldest = std::min(oldest, slots[t].pin.load(std::memory_order_seq_cst));
+    }
+    auto keep = std::partition(retired.begin(), retired.end(), [&](const Retired& r) { return r.at >= oldest; });
+    for (auto it = keep; it != retired.end(); ++it) {
+      it->free(it->ptr);
+    }
+    retired.erase(keep, retired.end());
+    return !retired.empty();
+  }
+
+ private:
+  static constexpr std::uint64_t kIdle = std::numeric_limits<std::uint64_t>::max();
+
+  struct Retired {
+    void* ptr;
+    void (*free)(void*);
+    std::uint64_t at;
+  };
+  struct alignas(64) Slot {
+    std::atomic<std::uint64_t> pin{kIdle};
+    std::vector<Retired> retired;
+  };
+
+  std::atomic<std::uint64_t> epoch{0};
+  std::unique_ptr<Slot[]> slots;
+  unsigned count;
+};
+
+}  // namespace util
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+namespace util {
+
+// Log-linear histogram with one writer thread and any number of readers:
+// each power of two is split into kSub linear buckets, so a bucket's bounds
+// are within 1/kSub of each other, in fixed memory and O(1) per record.
+// Counters are relaxed atomics that the writer bumps with a plain load and
+// store (no locked instruction), which is exact with a single writer.
+class Histogram {
+ public:
+  static constexpr unsigned kSubBits = 3;
+  static constexpr std::uint64_t kSub = 1u << kSubBits;
+  // Values from 2^kMaxBits up land in the last bucket.
+  static constexpr unsigned kMaxBits = 40;
+  static constexpr std::size_t kBuckets = (kMaxBits - kSubBits + 1) * kSub;
+
+  // Summed counts of one or more histograms, for reporting.
+  struct Totals {
+    std::array<std::uint64_t, kBuckets> counts{};
+    std::uint64_t count{0};
+    std::uint64_t sum{0};
+    std::uint64_t max{0};
+
+    // Upper bound of the bucket holding the p-th percentile (0-100).
+    std::uint64_t percentile(double p) const {
+      if (count == 0) {
+        return 0;
+      }
+      const auto rank = static_cast<std::uint64_t>(p / 100.0 * static_cast<double>(count - 1)) + 1;
+      std::uint64_t seen = 0;
+      for (std::size_t i = 0; i < kBuckets; ++i) {
+        seen += counts[i];
+        if (seen >= rank) {
+          return std::min(upper_bound(i), max);
+        }
+      }
+      return max;
+    }
+  };
+
+  void record(std::uint64_t value) {
+    bump(counts[index_of(value)], 1);
+    bump(total, 1);
+    bump(sum, value);
+    if (value > max.load(std::memory_order_relaxed)) {
+      max.store(value, std::memory_order_relaxed);
+    }
+  }
+
+  std::uint64_t count() const { return total.load(std::memory_order_relaxed); }
+
+  void add_to(Totals& t) const {
+    for (std::size_t i = 0; i < kBuckets; ++i) {
+      t.counts[i] += counts[i].load(std::memory_order_relaxed);
+    }
+    t.count += total.load(std::memory_order_relaxed);
+    t.sum += sum.load(std::memory_order_relaxed);
+    t.max = std::max(t.max, max.load(std::memory_order_relaxed));
+  }
+
+  static std::size_t index_of(std::uint64_t value) {
+    if (value < kSub) {
+      return static_cast<std::size_t>(value);
+    }
+    const unsigned bits = static_cast<unsigned>(std::bit_width(value));  // > kSubBits
+    if (bits > kMaxBits) {
+      return kBuckets - 1;
+    }
+    const std::uint64_t sub = (value >> (bits - 1 - kSubBits)) & (kSub - 1);
+    return static_cast<std::size_t>((bits - kSubBits) * kSub + sub);
+  }
+  // Largest value that lands in bucket i.
+  static std::uint64_t upper_bound(std::size_t i) {
+    if (i < kSub) {
+      return i;
+    }
+    const auto shift = static_cast<unsigned>(i / kSub) - 1;
+    const std::uint64_t sub = i % kSub;
+    return ((kSub + sub + 1) << shift) - 1;
+  }
+
+ private:
+  static void bump(std::atomic<std::uint64_t>& c, std::uint64_t n) {
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  std::array<std::atomic<std::uint64_t>, kBuckets> counts{};
+  std::atomic<std::uint64_t> total{0};
+  std::atomic<std::uint64_t> sum{0};
+  std::atomic<std::uint64_t> max{0};
+};
+
+}  // namespace util
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <string>
+
+namespace util {
+
+// Random lower-case hex string, for the 40-character ids Redis gives a
+// replication history or a cluster node.
+inline std::string random_hex_id(std::size_t length = 40) {
+  static constexpr char kHex[] = "0123456789abcdef";
+  std::random_device rd;
+  std::mt19937_64 rng((static_cast<std::uint64_t>(rd()) << 32) ^ rd());
+  std::string id(length, '0');
+  for (char& c : id) {
+    c = kHex[rng() & 15];
+  }
+  return id;
+}
+
+}  // namespace util
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace util {
+
+// Vector of trivially copyable T that keeps its first N elements inline and
+// moves to the heap only past that. clear() keeps the heap capacity, so a
+// reused instance allocates at most once per new high-water mark.
+template <typename T, std::size_t N>
+class SmallVector {
+  static_assert(std::is_trivially_copyable_v<T>);
+
+ public:
+  std::size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+
+  const T* data() const { return count > N ? spilled.data() : local.data(); }
+  T* data() { return count > N ? spilled.data() : local.data(); }
+  const T* begin() const { return data(); }
+  const T* end() const { return data() + count; }
+  const T& operator[](std::size_t i) const { return data()[i]; }
+  T& operator[](std::size_t i) { return data()[i]; }
+  const T& back() const { return data()[count - 1]; }
+
+  void clear() {
+    count = 0;
+    spilled.clear();
+  }
+
+  template <typename... A>
+  void emplace_back(A&&... a) {
+    if (count < N) {
+      local[count++] = T{std::forward<A>(a)...};
+      return;
+    }
+    if (count == N) {
+      spilled.assign(local.begin(), local.end());
+    }
+    spilled.emplace_back(std::forward<A>(a)...);
+    ++count;
+  }
+  void push_back(const T& value) { emplace_back(value); }
+
+ private:
+  std::array<T, N> local{};
+  std::vector<T> spilled;
+  std::size_t count{0};
+};
+
+}  // namespace util
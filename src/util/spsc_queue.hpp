@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace util {
+
+// Bounded single-producer/single-consumer ring. Capacity is rounded up to a
+// power of two. Each side caches the other's index so the common case touches
+// only its own cache line.
+template <typename T>
+class SpscQueue {
+ public:
+  explicit SpscQueue(std::size_t capacity) {
+    std::size_t cap = 2;
+    while (cap < capacity) {
+      cap <<= 1;
+    }
+    slots.resize(cap);
+    mask = cap - 1;
+  }
+
+  SpscQueue(const SpscQueue&) = delete;
+  SpscQueue& operator=(const SpscQueue&) = delete;
+
+  // Producer side. Returns false (leaving value untouched) when full.
+  bool try_push(T& value) {
+    const std::size_t t = tail.load(std::memory_order_relaxed);
+    if (t - cached_head > mask) {
+      cached_head = head.load(std::memory_order_acquire);
+      if (t - cached_head > mask) {
+        return false;
+      }
+    }
+    slots[t & mask] = std::move(value);
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side. Returns false when empty.
+  bool try_pop(T& out) {
+    const std::size_t h = head.load(std::memory_order_relaxed);
+    if (h == cached_tail) {
+      cached_tail = tail.load(std::memory_order_acquire);
+      if (h == cached_tail) {
+        return false;
+      }
+    }
+    out = std::move(slots[h & mask]);
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+ private:
+  std::vector<T> slots;
+  std::size_t mask{0};
+
+  alignas(64) std::atomic<std::size_t> head{0};  // written by consumer
+  std::size_t cached_tail{0};                    // consumer's view of tail
+
+  alignas(64) std::atomic<std::size_t> tail{0};  // written by producer
+  std::size_t cached_head{0};                    // producer's view of head
+};
+
+}  // namespace util
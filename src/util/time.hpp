@@ -1,5 +1,6 @@
 #pragma once
 #include <chrono>
+#include <cstdint>
 
 namespace util {
 
@@ -10,4 +11,33 @@ inline TimePoint now() {
   return Clock::now();
 }
 
+// Whole milliseconds on the steady clock, rounded down.
+inline int64_t to_millis(TimePoint tp) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(tp.time_since_epoch()).count();
+}
+
+// Whole milliseconds on the steady clock, rounded up, so a timer for the
+// returned tick never fires before tp.
+inline int64_t to_millis_ceil(TimePoint tp) {
+  return std::chrono::ceil<std::chrono::milliseconds>(tp.time_since_epoch()).count();
+}
+
+// Wall-clock milliseconds since the unix epoch, for deadlines that must
+// survive a restart.
+inline int64_t unix_millis() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+// Wall-clock unix time in milliseconds for a steady-clock deadline.
+inline int64_t to_unix_millis(TimePoint tp) {
+  return unix_millis() + std::chrono::duration_cast<std::chrono::milliseconds>(tp - now()).count();
+}
+
+// Steady-clock deadline for a wall-clock unix time in milliseconds.
+inline TimePoint from_unix_millis(int64_t ms) {
+  return now() + std::chrono::milliseconds(ms - unix_millis());
+}
+
 }
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "time.hpp"
+
+namespace util {
+
+// Cycle counter for timing hot paths: one rdtsc on x86 (the TSC runs at a
+// constant rate on any recent CPU), steady-clock nanoseconds elsewhere.
+// Ticks are only turned into time when reported, via tsc_ticks_per_ns().
+inline std::uint64_t tsc() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(now().time_since_epoch()).count());
+#endif
+}
+
+namespace detail {
+struct TscOrigin {
+  std::uint64_t ticks;
+  TimePoint time;
+};
+inline const TscOrigin tsc_origin{tsc(), now()};
+}  // namespace detail
+
+// TSC rate measured against the steady clock since startup, so it gets
+// more exact the longer the process runs.
+inline double tsc_ticks_per_ns() {
+  const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(now() - detail::tsc_origin.time).count();
+  if (elapsed <= 0) {
+    return 1.0;
+  }
+  return static_cast<double>(tsc() - detail::tsc_origin.ticks) / static_cast<double>(elapsed);
+}
+
+// Conversions at the current estimate of the rate, for thresholds and
+// reports rather than hot paths.
+inline std::uint64_t tsc_from_us(std::uint64_t us) {
+  return static_cast<std::uint64_t>(static_cast<double>(us) * 1000.0 * tsc_ticks_per_ns());
+}
+inline std::uint64_t tsc_to_us(std::uint64_t ticks) {
+  return static_cast<std::uint64_t>(static_cast<double>(ticks) / (1000.0 * tsc_ticks_per_ns()));
+}
+
+}  // namespace util
@@ -1,8 +1,9 @@
 #!/usr/bin/env bash
 set -euo pipefail
 
-# Run the Python client load generator.
+# Build and run the load generator from repo root; flags go to kvbench.
 ROOT="$(cd "$(dirname "${BASH_SOURCE[0]}")/.." && pwd)"
 cd "$ROOT"
 
-python3 client/runner.py "$@"
+make -j"${JOBS:-4}" kvbench
+exec ./kvbench "$@"